@@ -24,6 +24,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
@@ -32,9 +34,12 @@
 #include <poll.h>
 #include <fcntl.h>
 #include <time.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>  /* for gettimeofday() */
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
@@ -57,12 +62,25 @@ int verbose = 1;           /* h2cli verbose */
 int verbose_h2 = 1;        /* h2sim verbose */
 int long_tr_thr_msec = 0;  /* long transaction detection; 0:disabled */
 int retry_on_rst_stream = 0;
+char *accept_encoding = NULL;  /* added to requests without one */
+int rsp_decode = 0;            /* inflate encoded response bodies */
+
+h2_ctx *ctx = NULL;
+
+int coord_fd = -1;  /* agent connection to the controller; see -K option */
+h2_rlog *result_log = NULL;  /* see -l option */
+int control_fd = -1;  /* runtime load control listen socket; see -U option */
+long long result_log_start_usec = 0;
 
 #define CLIENT_JOB_REPL_SYM_MAX  16    /* replace symbol max */
                                        /* MUST be < 32 for repl_sym_idx_mask */
 #define CLIENT_JOB_SBUF_SIZE     (128 * 1024)
 #define REQ_STEP_MAX             32
 #define MSG_HDR_MAX              32
+#define REQ_TASK_CHUNK           4096  /* req_task_t per task pool chunk */
+#define REQ_MAX_UNBOUNDED        (LLONG_MAX / REQ_STEP_MAX)  /* for -d */
+#define CAPTURE_MAX              16    /* response json capture max */
+#define BULK_BODY_MIN            (64 * 1024)  /* larger -e bodies by reference */
 
 
 /* symbol replace is applied on uri, header value and request body */
@@ -86,16 +104,37 @@ typedef struct {
   int value_len;
 } repl_sym_val_t;
 
+/* response json value captured as symbol for the next steps of the task */
+typedef struct {
+  char *sym;
+  int sym_len;
+  int req_step;      /* captured from response of this step */
+  h2_json_ptr *ptr;
+  long long found_num;
+  long long missing_num;
+} capture_t;
+
+/* multipart/related request body parts of a req step by -y */
+typedef struct {
+  h2_mpart part[H2_MPART_MAX];  /* content_type, content_id and body */
+  int part_num;                 /* are dynamic alloced */
+  char *hdr_buf;                /* delimiters and part headers */
+} mpart_body_t;
+
+/* NOTE: kept small for large req_par; 32 bytes on 64bit */
 typedef struct {
   /* job/req/step status fields */
   int par_idx;   /* 0 ~ req_par-1 */
-  int req_id;    /* 0 ~ req_max-1 */
-  int req_step;  /* 0 ~ req_step_num-1 */
+  int req_id;    /* 0 ~ req_max-1; wraps in positive int on unbounded */
+  short req_step;  /* 0 ~ req_step_num-1 */
   /* push promise status */
-  int prm_num;   /* push promize per this request */
+  short prm_num;   /* push promize per this request */
+  /* 3gpp-sbi-message-priority of the request and its class for stat */
+  short prio;
+  short prio_class;
   /* for long transaction detection */
-  h2_msg *req;   /* request message backuped for long transaction report */
-  struct timeval req_tv;
+  h2_msg *req;   /* request message backuped only for long transaction report */
+  long long req_usec;  /* request send time for latency and long transaction */
 } req_task_t;
 
 /* server connections per <scheme, authority> */
@@ -107,11 +146,40 @@ typedef struct {
 } svr_peer_t;
 
 /* client job to be handled by run(); set by runtime parameters */
+/* soak metrics sampled per interval and checked for drift */
+enum {
+  SOAK_RSS_KB,
+  SOAK_TASK_CHUNKS,
+  SOAK_STRMS,
+  SOAK_SEND_REMAIN,
+  SOAK_TPS,
+  SOAK_P99_USEC,
+  SOAK_METRIC_NUM
+};
+
+static const struct {
+  const char *name;
+  int drift_dir;  /* +1: growth is drift; -1: decay is drift */
+} soak_metric[SOAK_METRIC_NUM] = {
+  { "rss_kb", +1 },
+  { "task_chunks", +1 },
+  { "strms", +1 },
+  { "send_remain", +1 },
+  { "tps", -1 },
+  { "p99_usec", +1 },
+};
+
+#define SOAK_TREND_MIN   4     /* samples to check drift */
+#define SOAK_TAU_THR     0.6   /* monotonicity to be drift */
+#define SOAK_CHANGE_THR  0.05  /* relative change to be drift; 5% */
+
 typedef struct client_job {
   /* request job configuration */
   int req_par;
-  int req_max; 
+  long long req_max;  /* REQ_MAX_UNBOUNDED on duration mode */
   int req_tps;  /* 0:unlimited */
+  long long duration_usec;  /* duration mode on > 0; req_max is ignored */
+  int is_duration_end;
 
   /* replace symbol format */
   repl_sym_fmt_t repl_sym[CLIENT_JOB_REPL_SYM_MAX];
@@ -120,20 +188,117 @@ typedef struct client_job {
   int hdr_repl_sym_idx_mask[REQ_STEP_MAX][MSG_HDR_MAX];
                             /* bit-OR of (1 << repl_sym_idx) matched in value */
   int repl_modular;  /* modular to be applied on req_id for repl_sym value */
+
+  /* response json capture */
+  capture_t capt[CAPTURE_MAX];
+  int capt_num;
+  int capt_repl_mask[REQ_STEP_MAX];  /* ORs of REPL_SYM_MASK_* per req_step */
+  char **capt_val;  /* [req_par * capt_num]; captured value per task */
+  long long capt_scan_bytes;
+  long long capt_scan_usec;
   /* request context; 1 request message per request step  */
-  int req_cnt;  /* current request status; req_psr_tasks per each req_cnt */
-  req_task_t *req_par_task;  /* alloced as req_task_t[req_par] */
+  long long req_cnt;  /* current request status; req_psr_tasks per req_cnt */
+  req_task_t **req_task_pool;  /* chunks of req_task_t[REQ_TASK_CHUNK] */
+                               /* chunk is alloced on first use */
   h2_msg *req_step_msg[REQ_STEP_MAX];
   h2_peer *req_step_peer[REQ_STEP_MAX];
+  mpart_body_t req_step_mpart[REQ_STEP_MAX];
+  void *req_step_bulk[REQ_STEP_MAX];  /* -e body referenced as iov */
   int req_step_num;
 
   /* request send and response recv status */
-  int req_msg_max;  /* req_max * req_step_num */
-  int req_msg_num;  /* request send count */
-  int rsp_msg_num;  /* response callback count */
+  long long req_msg_max;  /* req_max * req_step_num */
+  long long req_msg_num;  /* request send count */
+  long long rsp_msg_num;  /* response callback count */
 
   /* request tps control; managed by sleep_for_req_tps() */
   struct timeval start_tv;
+  long long tps_base_cnt;   /* req_cnt at start_tv; rebased on tps change */
+
+  /* request tasks; req_par and is_paused can be changed at runtime by -U */
+  int task_par_max;         /* tasks alloced in req_task_pool and capt_val */
+  int task_num;             /* tasks started; par_idx 0 ~ task_num-1 */
+  int is_paused;
+  int *park_idx;            /* dynamic int[task_par_max] */
+  int park_num;             /* tasks holding next request on pause */
+  int *idle_idx;            /* dynamic int[task_par_max] */
+  int idle_num;             /* tasks over req_par at a new req_id */
+
+  /* warm-up phase; responses are excluded from tps and latency stat */
+  int warmup_req;           /* warm-up request count; 0:not used */
+  long long warmup_usec;    /* warm-up duration; 0:not used */
+  int is_warmup;            /* in warm-up phase */
+  long long warmup_req_cnt; /* requests started in warm-up phase */
+  long long start_usec;     /* start_request() time */
+  int is_started;           /* start_request() called on sessions ready */
+
+  /* measurement after warm-up */
+  long long measure_usec;   /* measure start time; 0 for not started */
+  long long last_rsp_usec;  /* last measured response time */
+  long long measure_rsp_num; /* responses measured */
+  long long measure_err_num; /* stream closed without response */
+  long long measure_tx_bytes; /* request body bytes of measured responses */
+  long long measure_rx_bytes; /* response body bytes */
+  long long measure_cpu_usec; /* process cpu time at measure start */
+  h2_hist lat_hist;         /* response latency in usec */
+
+  /* request priority mix by weight; see -O option */
+  int prio_mix[H2_PRIO_MAX + 1];         /* priority */
+  int prio_mix_weight[H2_PRIO_MAX + 1];
+  int prio_mix_wrr[H2_PRIO_MAX + 1];     /* smooth weighted round robin */
+  int prio_mix_num;
+  /* per priority class measurement; 503 rsps are not in latency */
+  h2_hist prio_hist[H2_PRIO_CLASS_NUM];
+  long long prio_rsp_num[H2_PRIO_CLASS_NUM];
+  long long prio_err_num[H2_PRIO_CLASS_NUM];
+  long long prio_503_num[H2_PRIO_CLASS_NUM];
+
+  /* response content coding */
+  long long rsp_coding_num[H2_CODING_NUM];
+  long long rsp_body_bytes;      /* received body bytes */
+  long long rsp_decoded_bytes;   /* body bytes as decoded */
+  long long rsp_decode_err_num;  /* unknown or corrupted coding */
+  long long rsp_decode_cpu_usec;
+
+  /* multipart/related responses */
+  long long rsp_mpart_num;
+  long long rsp_mpart_part_num;
+  long long rsp_mpart_err_num;   /* malformed */
+
+  /* soak sampling per interval; samples after warm-up are kept for drift */
+  long long soak_intv_usec;   /* 0:not used */
+  long long soak_last_usec;   /* last sample time */
+  long long soak_last_rsp;    /* measure_rsp_num at last sample */
+  int soak_sample_cnt;        /* samples taken including warm-up */
+  h2_hist soak_hist;          /* response latency in the interval */
+  double *soak_val[SOAK_METRIC_NUM];  /* dynamic double[soak_alloced] */
+  int soak_num;
+  int soak_alloced;
+
+  /* capture replay; request steps are not used but the first's peer */
+  h2_cap *replay;
+  double replay_speed;          /* time scale; 2.0 for twice faster */
+  const h2_cap_rec *replay_rec; /* next record to send */
+  long long replay_first_usec;  /* capture time of the first record */
+  long long *replay_req_usec;   /* send time per record for latency */
+  long long replay_lag_sum;     /* send time behind due time */
+  long long replay_lag_max;
+  long long replay_send_err_num;
+
+  /* coordinated run as an agent; see -K option */
+  long long req_id_base;     /* disjoint req_id range assigned */
+  long long coord_intv_usec; /* interval report period */
+  long long coord_last_rsp;  /* measure_rsp_num at last report */
+  long long coord_last_err;
+  long long coord_last_usec; /* last report time */
+  h2_hist coord_hist;        /* response latency in the interval */
+  int is_coord_ready;        /* READY sent */
+
+  /* runtime load control interim report; see -U option */
+  long long ctl_last_usec;   /* last report time */
+  long long ctl_last_rsp;    /* measure_rsp_num at last report */
+  long long ctl_last_err;
+  h2_hist ctl_hist;          /* response latency since last report */
 } client_job_t;
 
 #define SVR_PEER_MAX  100
@@ -148,14 +313,18 @@ int svr_peer_num = 0;
 static int req_counting_line_printed = 0;
 
 static void req_counting_print(client_job_t *job) {
-  int pc = job->req_msg_num * 100 / job->req_msg_max;
+  int pc;
+  if (job->duration_usec > 0) {  /* progress on time */
+    pc = (h2_time_usec() - job->start_usec) * 100 / job->duration_usec;
+  } else {
+    pc = job->req_msg_num * 100 / job->req_msg_max;
+  }
   int dots = (pc < 100)? pc / 2 + 1 : 50;
   char buf[52];
 
   memset(buf, '#', dots);
   buf[dots] = '\0';
-  printf("\r> req msgs: %-9d |%-50s|%3d%%",
-         job->req_msg_num, buf, job->req_msg_num * 100 / job->req_msg_max);
+  printf("\r> req msgs: %-9lld |%-50s|%3d%%", job->req_msg_num, buf, pc);
   fflush(stdout);
   req_counting_line_printed = 1;
 }
@@ -178,6 +347,141 @@ static void req_counting_line_clear() {
 }
 
 
+/*
+ * Soak Sampling and Drift Check --------------------------------------------
+ */
+
+static long long soak_rss_kb(void) {
+  long long size, rss = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    if (fscanf(fp, "%lld %lld", &size, &rss) != 2) {
+      rss = 0;
+    }
+    fclose(fp);
+  }
+  return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int soak_task_chunks(client_job_t *job) {
+  int i, n = 0;
+  for (i = 0; i < (job->task_par_max + REQ_TASK_CHUNK - 1) / REQ_TASK_CHUNK;
+       i++) {
+    n += (job->req_task_pool[i] != NULL);
+  }
+  return n;
+}
+
+/* returns drift direction of the metric: +1 growth, -1 decay, 0 none */
+static int soak_drift(client_job_t *job, int m, h2_trend *trend) {
+  h2_trend_calc(job->soak_val[m], job->soak_num, trend);
+  if (job->soak_num < SOAK_TREND_MIN) {
+    return 0;
+  }
+  int dir = soak_metric[m].drift_dir;
+  if (dir * trend->tau >= SOAK_TAU_THR &&
+      dir * trend->change >= SOAK_CHANGE_THR) {
+    return dir;
+  }
+  return 0;
+}
+
+static void soak_sample_cb(h2_ctx *ctx, void *user_data) {
+  client_job_t *job = user_data;
+  long long cur_usec = h2_time_usec();
+  double intv_sec = (cur_usec - job->soak_last_usec) / 1000000.0;
+  double val[SOAK_METRIC_NUM];
+  h2_ctx_stat stat;
+  int m;
+
+  if (job->is_duration_end) {
+    return;  /* no sample on draining requests in progress */
+  }
+
+  /* interval partly in warm-up is not measured */
+  int is_measured = (job->measure_usec > 0 &&
+                     job->soak_last_usec >= job->measure_usec);
+
+  h2_ctx_get_stat(ctx, &stat);
+  val[SOAK_RSS_KB] = soak_rss_kb();
+  val[SOAK_TASK_CHUNKS] = soak_task_chunks(job);
+  val[SOAK_STRMS] = stat.strm_num;
+  val[SOAK_SEND_REMAIN] = stat.send_data_remain;
+  val[SOAK_TPS] = (intv_sec > 0)?
+                  (job->measure_rsp_num - job->soak_last_rsp) / intv_sec : 0;
+  val[SOAK_P99_USEC] = h2_hist_percentile(&job->soak_hist, 99.0);
+
+  /* keep samples after warm-up for drift check */
+  if (is_measured) {
+    if (job->soak_num >= job->soak_alloced) {
+      job->soak_alloced = (job->soak_alloced)? job->soak_alloced * 2 : 64;
+      for (m = 0; m < SOAK_METRIC_NUM; m++) {
+        job->soak_val[m] = realloc(job->soak_val[m],
+                                   sizeof(double) * job->soak_alloced);
+      }
+    }
+    for (m = 0; m < SOAK_METRIC_NUM; m++) {
+      job->soak_val[m][job->soak_num] = val[m];
+    }
+    job->soak_num++;
+  }
+
+  /* sample line with metrics drifting so far */
+  char drift_str[128] = "";
+  int n = 0;
+  for (m = 0; m < SOAK_METRIC_NUM; m++) {
+    h2_trend trend;
+    if (job->soak_num > 0 && soak_drift(job, m, &trend)) {
+      n += snprintf(drift_str + n, sizeof(drift_str) - n, "%s%s",
+                    (n == 0)? " DRIFT:" : ",", soak_metric[m].name);
+    }
+  }
+  req_counting_line_clear();
+  fprintf(stdout, "SOAK[%d] %.0fs%s: %.1f tps p50=%lld p99=%lld usec "
+          "rss=%.0fKB task_chunks=%.0f strms=%.0f send_remain=%.0f "
+          "sess=%d%s\n",
+          job->soak_sample_cnt, (cur_usec - job->start_usec) / 1000000.0,
+          (is_measured)? "" : "(warm-up)", val[SOAK_TPS],
+          h2_hist_percentile(&job->soak_hist, 50.0),
+          (long long)val[SOAK_P99_USEC],
+          val[SOAK_RSS_KB], val[SOAK_TASK_CHUNKS], val[SOAK_STRMS],
+          val[SOAK_SEND_REMAIN], stat.sess_num, drift_str);
+  fflush(stdout);
+
+  job->soak_sample_cnt++;
+  job->soak_last_usec = cur_usec;
+  job->soak_last_rsp = job->measure_rsp_num;
+  h2_hist_init(&job->soak_hist);
+  h2_timer_add(ctx, job->soak_intv_usec, soak_sample_cb, job);
+}
+
+static void print_soak_result(client_job_t *job) {
+  double per_hour = 3600000000.0 / job->soak_intv_usec;
+  int m, drift_num = 0;
+
+  if (job->soak_intv_usec <= 0) {
+    return;
+  }
+  for (m = 0; m < SOAK_METRIC_NUM; m++) {
+    h2_trend trend;
+    int dir = soak_drift(job, m, &trend);
+    if (job->soak_num <= 0) {
+      break;
+    }
+    fprintf(stdout, "DRIFT CHECK %s: first=%.0f last=%.0f slope=%+.1f/h "
+            "change=%+.1f%% tau=%+.2f%s\n",
+            soak_metric[m].name, job->soak_val[m][0],
+            job->soak_val[m][job->soak_num - 1], trend.slope * per_hour,
+            trend.change * 100, trend.tau,
+            (dir > 0)? " DRIFT(growth)" : (dir < 0)? " DRIFT(decay)" : "");
+    drift_num += (dir != 0);
+  }
+  fprintf(stdout, "SOAK RESULT: %d samples; %s\n", job->soak_num,
+          (job->soak_num < SOAK_TREND_MIN)? "too few samples for drift check" :
+          (drift_num > 0)? "DRIFT DETECTED" : "no drift detected");
+}
+
+
 /*
  * Replace Symbold Utilities ------------------------------------------------
  */
@@ -207,56 +511,104 @@ static void update_replace_symbol_mask(client_job_t *job) {
       }
       /* NOTE: all body buffer has '\0' at body_len+1 */
       /* NOTE: might be faulty on non-text body */
-      if (h2_body_len(req) > 0 && strstr(h2_body(req), sym)) {
+      if (h2_body(req) && strstr(h2_body(req), sym)) {
         mask |= REPL_SYM_MASK_BODY;
       }
 
       job->repl_sym[i].mask |= mask;  /* TODO: to be alloced per req step */
       job->repl_sym_mask[s] |= mask;
     }
+
+    /* captured symbols from previous steps */
+    job->capt_repl_mask[s] = 0;
+    for (i = 0; i < job->capt_num; i++) {
+      char *sym = job->capt[i].sym;
+      if (job->capt[i].req_step >= s) {
+        continue;
+      }
+      if (strstr(h2_path(req), sym)) {
+        job->capt_repl_mask[s] |= REPL_SYM_MASK_PATH;
+      }
+      for (j = 0; j < req_hdr_num; j++) {
+        if (strstr(h2_hdr_idx_value(req, j), sym)) {
+          job->capt_repl_mask[s] |= REPL_SYM_MASK_HDR;
+        }
+      }
+      if (h2_body(req) && strstr(h2_body(req), sym)) {
+        job->capt_repl_mask[s] |= REPL_SYM_MASK_BODY;
+      }
+    }
   }
 }
 
-static void replace_symbol(repl_sym_fmt_t *rs, char **str_pp, int *len_p,
-                           int req_id, int modular)
+static void replace_str(const char *sym, int sym_len,
+                        const char *val, int n, char **str_pp, int *len_p)
 {
   /* ASSUME: str is dynamic alloced and null terminated (even with body case) */
-  char *str, *p, buf[REPL_SYM_BUF_MAX];
-  int len, skip, offset, r, n;
-
-  if (modular) {
-    req_id %= modular;
-  }
+  char *str, *p;
+  int len, skip, offset, r;
 
   str = *str_pp;
   len = *len_p;
   skip = 0;
-  while ((p = strstr(str + skip, rs->sym))) {
+  while ((p = strstr(str + skip, sym))) {
     offset = p - str;  /* p should not be used any more */
-    r = len - offset - rs->sym_len;
-    n = sprintf(buf, rs->fmt, req_id);
-    if (n > rs->sym_len) {
-      str = realloc(str, len + n - rs->sym_len + 1); 
+    r = len - offset - sym_len;
+    if (n > sym_len) {
+      str = realloc(str, len + n - sym_len + 1); 
       *str_pp = str;  /* update str return value */
     }
-    if (r > 0 && n != rs->sym_len)
-      memmove(str + offset + n, str + offset + rs->sym_len, r);
+    if (r > 0 && n != sym_len)
+      memmove(str + offset + n, str + offset + sym_len, r);
     if (n > 0)
-      memcpy(str + offset, buf, n);
-    len += n - rs->sym_len;
+      memcpy(str + offset, val, n);
+    len += n - sym_len;
     *len_p = len;  /* update len return value */
     str[len] = '\0';
     skip = offset + n;
    }
 }
 
+static void replace_symbol(repl_sym_fmt_t *rs, char **str_pp, int *len_p,
+                           int req_id, int modular)
+{
+  char buf[REPL_SYM_BUF_MAX];
+  int n;
+
+  if (modular) {
+    req_id %= modular;
+  }
+  if (strstr(*str_pp, rs->sym)) {
+    n = sprintf(buf, rs->fmt, req_id);
+    replace_str(rs->sym, rs->sym_len, buf, n, str_pp, len_p);
+  }
+}
+
+/* replace captured symbols of the previous steps in the task */
+static void replace_capture(client_job_t *job, req_task_t *req_task,
+                            char **str_pp, int *len_p)
+{
+  char **val = &job->capt_val[req_task->par_idx * job->capt_num];
+  int i;
+
+  for (i = 0; i < job->capt_num; i++) {
+    if (job->capt[i].req_step < req_task->req_step) {
+      replace_str(job->capt[i].sym, job->capt[i].sym_len,
+                  (val[i])? val[i] : "", (val[i])? strlen(val[i]) : 0,
+                  str_pp, len_p);
+    }
+  }
+}
+
 static h2_msg *gen_request(h2_msg *src, client_job_t *job,
                            int repl_sym_mask, req_task_t *req_task) {
 
   /* NOTE: special version of h2_msg_cpy() to copy with symbol replace */
   h2_msg *msg = h2_msg_init();
+  int capt_mask = job->capt_repl_mask[req_task->req_step];
 
-  if (job->repl_sym_num <= 0 || job->repl_sym_mask[req_task->req_step] == 0) {
+  if ((job->repl_sym_num <= 0 || job->repl_sym_mask[req_task->req_step] == 0)
+      && capt_mask == 0) {
     h2_cpy_msg(msg, src);
     return msg;
   }
@@ -266,7 +618,7 @@ static h2_msg *gen_request(h2_msg *src, client_job_t *job,
   h2_set_scheme(msg, h2_scheme(src));
   h2_set_authority(msg, h2_authority(src));
 
-  if ((repl_sym_mask & REPL_SYM_MASK_PATH)) {
+  if (((repl_sym_mask | capt_mask) & REPL_SYM_MASK_PATH)) {
     char *path = strdup(h2_path(src));
     int i, path_len = strlen(path);
     for (i = 0; i < job->repl_sym_num; i++) {
@@ -275,6 +627,9 @@ static h2_msg *gen_request(h2_msg *src, client_job_t *job,
                        req_task->req_id, job->repl_modular);
       }
     }
+    if ((capt_mask & REPL_SYM_MASK_PATH)) {
+      replace_capture(job, req_task, &path, &path_len);
+    }
     h2_set_path(msg, path);
     free(path);
   } else {
@@ -283,7 +638,7 @@ static h2_msg *gen_request(h2_msg *src, client_job_t *job,
 
   h2_set_status(msg, h2_status(src));
 
-  if ((repl_sym_mask & REPL_SYM_MASK_HDR)) {
+  if (((repl_sym_mask | capt_mask) & REPL_SYM_MASK_HDR)) {
     int i, m, s;
     int hdr_num = h2_hdr_num(src);
     for (i = 0; i < hdr_num; i++) {
@@ -296,12 +651,25 @@ static h2_msg *gen_request(h2_msg *src, client_job_t *job,
                          req_task->req_id, job->repl_modular);
         }
       }
+      if ((capt_mask & REPL_SYM_MASK_HDR)) {
+        replace_capture(job, req_task, &value, &value_len);
+      }
       h2_add_hdr(msg, h2_hdr_idx_name(src, i), value);
       free(value);
     }
+  } else {
+    int i;
+    for (i = 0; i < h2_hdr_num(src); i++) {
+      h2_add_hdr(msg, h2_hdr_idx_name(src, i), h2_hdr_idx_value(src, i));
+    }
   }
 
-  if (h2_body_len(src) > 0) {
+  if (h2_body_iov(src, NULL)) {
+    /* multipart body without symbol; keep referencing parts */
+    int iov_num;
+    const struct iovec *iov = h2_body_iov(src, &iov_num);
+    h2_set_body_iov(msg, iov, iov_num);
+  } else if (h2_body_len(src) > 0) {
     int i, body_len = h2_body_len(src);
     char *body = malloc(body_len + 1);
     memcpy(body, h2_body(src), body_len + 1/* '\0' */);
@@ -313,6 +681,9 @@ static h2_msg *gen_request(h2_msg *src, client_job_t *job,
                          req_task->req_id, job->repl_modular);
       }
     }
+    if ((capt_mask & REPL_SYM_MASK_BODY)) {
+      replace_capture(job, req_task, &body, &body_len);
+    }
     h2_set_body(msg, body, body_len);
   }
 
@@ -320,6 +691,104 @@ static h2_msg *gen_request(h2_msg *src, client_job_t *job,
 }
 
 
+/*
+ * Request Priority Mix -----------------------------------------------------
+ * 3gpp-sbi-message-priority is assigned per req_id by weight of -O option
+ * and kept over the req steps; responses are measured per priority class
+ */
+
+static int get_prio_mix(char *mix_str, client_job_t *job) {
+  char *s = mix_str;
+  int prio, weight, n;
+
+  while (*s) {
+    weight = 1;
+    if (sscanf(s, "%d%n:%d%n", &prio, &n, &weight, &n) < 1 ||
+        prio < 0 || prio > H2_PRIO_MAX || weight <= 0 ||
+        job->prio_mix_num > H2_PRIO_MAX) {
+      fprintf(stderr, "invalid -O prio[:weight],... option value: %s\n",
+              mix_str);
+      return -1;
+    }
+    job->prio_mix[job->prio_mix_num] = prio;
+    job->prio_mix_weight[job->prio_mix_num] = weight;
+    job->prio_mix_num++;
+    s += n;
+    if (*s == ',') {
+      s++;
+    } else if (*s) {
+      fprintf(stderr, "invalid -O prio[:weight],... option value: %s\n",
+              mix_str);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* priority for new req_id; -1 to keep one of the request message */
+static int new_req_prio(client_job_t *job) {
+  int i, pick = 0, total = 0;
+
+  if (job->prio_mix_num == 0) {
+    return -1;
+  }
+  for (i = 0; i < job->prio_mix_num; i++) {
+    job->prio_mix_wrr[i] += job->prio_mix_weight[i];
+    total += job->prio_mix_weight[i];
+    if (job->prio_mix_wrr[i] > job->prio_mix_wrr[pick]) {
+      pick = i;
+    }
+  }
+  job->prio_mix_wrr[pick] -= total;
+  return job->prio_mix[pick];
+}
+
+static void set_req_prio(req_task_t *req_task, h2_msg *req) {
+  if (req_task->prio >= 0) {
+    h2_set_msg_priority(req, req_task->prio);
+  }
+  req_task->prio_class = h2_prio_class(h2_msg_priority(req));
+}
+
+static void count_rsp_prio(client_job_t *job, req_task_t *req_task,
+                           h2_msg *rsp, long long latency_usec) {
+  int c = req_task->prio_class;
+  job->prio_rsp_num[c]++;
+  if (rsp == NULL) {
+    job->prio_err_num[c]++;
+  } else if (h2_status(rsp) == 503) {
+    job->prio_503_num[c]++;
+  } else {
+    h2_hist_add(&job->prio_hist[c], latency_usec);
+  }
+}
+
+static void print_prio_result(client_job_t *job) {
+  char title[64];
+  int c, class_num = 0;
+
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    class_num += (job->prio_rsp_num[c] > 0);
+  }
+  if (job->prio_mix_num == 0 && class_num <= 1) {
+    return;
+  }
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    if (job->prio_rsp_num[c] == 0) {
+      continue;
+    }
+    fprintf(stdout, "PRIORITY[%d] prio %d~%d: %lld rsps (%lld errors); "
+            "%lld rejected by 503\n", c,
+            c * (H2_PRIO_MAX + 1) / H2_PRIO_CLASS_NUM,
+            (c + 1) * (H2_PRIO_MAX + 1) / H2_PRIO_CLASS_NUM - 1,
+            job->prio_rsp_num[c], job->prio_err_num[c],
+            job->prio_503_num[c]);
+    snprintf(title, sizeof(title), "PRIORITY[%d] LATENCY(usec)", c);
+    h2_hist_print(stdout, &job->prio_hist[c], title);
+  }
+}
+
+
 /*
  * H2 Application Callbacks ------------------------------------------------
  */
@@ -329,6 +798,7 @@ static int response_cb(h2_peer *peer, h2_msg *rsp, void *peer_user_data,
                        void *strm_user_data);
 static int push_response_cb(h2_peer *peer, h2_msg *prm_rsp,
                             void *peer_user_data, void *push_stream_user_data);
+void sighdlr_mark_stop(int signo);
 
 static void sleep_for_req_tps(client_job_t *job) { 
   if (job->start_tv.tv_sec == 0) {
@@ -339,7 +809,7 @@ static void sleep_for_req_tps(client_job_t *job) {
 gettimeofday(&cur_tv, NULL);
     elapsed_usec = ((cur_tv.tv_sec - job->start_tv.tv_sec) * 1000000 +
                     (cur_tv.tv_usec - job->start_tv.tv_usec));
-    sleep_usec = ((long long)(job->req_cnt) * 1000000 / job->req_tps
+    sleep_usec = ((job->req_cnt - job->tps_base_cnt) * 1000000 / job->req_tps
                   - elapsed_usec);
     if (sleep_usec >= 1) {
       sleep_tv.tv_sec = sleep_usec / 1000000;
@@ -349,54 +819,508 @@ gettimeofday(&cur_tv, NULL);
   }
 }
 
+/* returns new req_id; warm-up requests are added on top of req_max */
+static int new_req_id(client_job_t *job) {
+  if (job->is_warmup) {
+    long long cur_usec = h2_time_usec();
+    if ((job->warmup_req > 0 && job->warmup_req_cnt >= job->warmup_req) ||
+        (job->warmup_usec > 0 &&
+         cur_usec - job->start_usec >= job->warmup_usec)) {
+      job->is_warmup = 0;
+      job->measure_usec = cur_usec;
+      job->measure_cpu_usec = h2_proc_cpu_usec();
+      if (verbose) {
+        req_counting_line_clear();
+        fprintf(stdout, "WARM-UP DONE: %lld reqs in %.3f secs\n",
+                job->warmup_req_cnt,
+                (cur_usec - job->start_usec) / 1000000.0);
+      }
+    } else {
+      job->warmup_req_cnt++;
+      job->req_max++;
+      job->req_msg_max += job->req_step_num;
+    }
+  }
+  return (int)((job->req_id_base + job->req_cnt++) & INT_MAX);
+}
+
+static void rebase_req_tps(client_job_t *job) {
+  gettimeofday(&job->start_tv, NULL);
+  job->tps_base_cnt = job->req_cnt;
+}
+
+static req_task_t *get_req_task(client_job_t *job, int par_idx) {
+  req_task_t **chunk = &job->req_task_pool[par_idx / REQ_TASK_CHUNK];
+  if (*chunk == NULL) {
+    *chunk = calloc(REQ_TASK_CHUNK, sizeof(req_task_t));
+  }
+  return &(*chunk)[par_idx % REQ_TASK_CHUNK];
+}
+
+/* grows task pool, parked list and captured values for par tasks */
+static int grow_req_task_pool(client_job_t *job, int par) {
+  int chunk_num = (job->task_par_max + REQ_TASK_CHUNK - 1) / REQ_TASK_CHUNK;
+  int new_chunk_num = (par + REQ_TASK_CHUNK - 1) / REQ_TASK_CHUNK;
+  void *p;
+
+  if (par <= job->task_par_max) {
+    return 0;
+  }
+  if ((p = realloc(job->req_task_pool,
+                   new_chunk_num * sizeof(req_task_t *))) == NULL) {
+    return -1;
+  }
+  job->req_task_pool = p;
+  memset(job->req_task_pool + chunk_num, 0,
+         (new_chunk_num - chunk_num) * sizeof(req_task_t *));
+  if ((p = realloc(job->park_idx, par * sizeof(int))) == NULL) {
+    return -1;
+  }
+  job->park_idx = p;
+  if ((p = realloc(job->idle_idx, par * sizeof(int))) == NULL) {
+    return -1;
+  }
+  job->idle_idx = p;
+  if (job->capt_num > 0) {
+    if ((p = realloc(job->capt_val,
+                     (size_t)par * job->capt_num * sizeof(char *))) == NULL) {
+      return -1;
+    }
+    job->capt_val = p;
+    memset(job->capt_val + (size_t)job->task_par_max * job->capt_num, 0,
+           (size_t)(par - job->task_par_max) * job->capt_num *
+           sizeof(char *));
+  }
+  job->task_par_max = par;
+  return 0;
+}
+
+/* returns 1 if the task is to hold its next request on pause; */
+/* resumed by resume_req_tasks() */
+static int park_req_task(client_job_t *job, req_task_t *req_task) {
+  if (!job->is_paused) {
+    return 0;
+  }
+  job->park_idx[job->park_num++] = req_task->par_idx;
+  return 1;
+}
+
+/* returns 1 if the task is to stop before a new req_id on req_par lowered; */
+/* steps in progress are completed not to hold requests counted */
+static int idle_req_task(client_job_t *job, req_task_t *req_task) {
+  if (req_task->par_idx < job->req_par) {
+    return 0;
+  }
+  job->idle_idx[job->idle_num++] = req_task->par_idx;
+  return 1;
+}
+
+/* returns h2_send_request() result */
+static int send_req_task(client_job_t *job, h2_peer *peer,
+                         req_task_t *req_task) {
+  int r;
+
+  sleep_for_req_tps(job);
+  h2_msg *req = gen_request(job->req_step_msg[req_task->req_step], job,
+                            job->repl_sym_mask[req_task->req_step], req_task);
+  set_req_prio(req_task, req);
+  if (verbose) {
+    h2_dump_msg(stdout, req, "", "REQUEST[%d/%d,%d]",
+                req_task->req_id, req_task->req_step, req_task->par_idx);
+  }
+  req_task->req_usec = h2_time_usec();
+  req_task->req = (long_tr_thr_msec)? req : NULL;  /* freed in response_cb */
+  r = h2_send_request(peer, req, response_cb, req_task);
+  if (!long_tr_thr_msec) {
+    h2_msg_free(req);  /* already copied by h2_send_request() */
+  } else if (r < 0) {
+    h2_msg_free(req_task->req);
+    req_task->req = NULL;
+  }
+  return r;
+}
+
+/* starts a new task with a new req_id; returns h2_send_request() result */
+static int start_req_task(client_job_t *job, int par_idx) {
+  req_task_t *req_task = get_req_task(job, par_idx);
+  int r = 0;
+
+  req_task->par_idx = par_idx;
+  req_task->req_id = new_req_id(job);
+  req_task->req_step = 0;
+  req_task->prm_num = 0;
+  req_task->prio = new_req_prio(job);
+  if (par_idx >= job->task_num) {
+    job->task_num = par_idx + 1;
+  }
+
+  if (!park_req_task(job, req_task)) {
+    r = send_req_task(job, job->req_step_peer[0], req_task);
+  }
+  job->req_msg_num++;
+  req_counting_update(job);
+  return r;
+}
+
+/* check for all request sent, then terminate marking no more request */
+static void check_all_req_sent(client_job_t *job) {
+  int i;
+  if (job->req_msg_num >= job->req_msg_max && job->park_num == 0 &&
+      job->req_msg_max != 0/* to allow -C 0 test case */) {
+    for (i = 0; i < svr_peer_num; i++) {
+      h2_terminate(svr_peers[i].peer, 1);
+    }
+    req_counting_line_clear();
+  }
+}
+
+static void duration_end_cb(h2_ctx *ctx, void *user_data) {
+  client_job_t *job = user_data;
+  (void)ctx;
+
+  /* no more new request; request steps in progress are completed */
+  job->is_duration_end = 1;
+  job->req_max = job->req_cnt;
+  job->req_msg_max = job->req_cnt * job->req_step_num;
+  /* but not the ones parked; the held and remaining steps are dropped */
+  while (job->park_num > 0) {
+    req_task_t *req_task = get_req_task(job, job->park_idx[--job->park_num]);
+    job->req_msg_max -= job->req_step_num - 1 - req_task->req_step;
+  }
+  if (verbose) {
+    req_counting_line_clear();
+    fprintf(stdout, "DURATION END: %lld reqs in %.3f secs\n", job->req_cnt,
+            (h2_time_usec() - job->start_usec) / 1000000.0);
+  }
+  check_all_req_sent(job);
+}
+
+
+/*
+ * Per Request Result Log ---------------------------------------------------
+ * one fixed size record per response or stream close without response for
+ * offline analysis by h2rlog; written by h2sim background writer
+ */
+
+#define RESULT_LOG_FLUSH_USEC  1000000  /* hand over records on idle */
+
+static int result_log_open(const char *file, int is_agent) {
+  char agent_file[PATH_MAX];
+
+  if (is_agent) {
+    /* not to be shared with the other agents of the same args */
+    snprintf(agent_file, sizeof(agent_file), "%s.%d", file, (int)getpid());
+    file = agent_file;
+  }
+  if ((result_log = h2_rlog_open(file)) == NULL) {
+    return -1;
+  }
+  result_log_start_usec = h2_rlog_start_usec(result_log);
+  return 0;
+}
+
+static void result_log_timer_cb(h2_ctx *ctx, void *user_data) {
+  h2_rlog_flush(result_log);
+  h2_timer_add(ctx, RESULT_LOG_FLUSH_USEC, result_log_timer_cb, user_data);
+}
+
+static void result_log_write(h2_peer *peer, h2_msg *rsp, long long req_usec,
+                             long long cur_usec, long long req_id, int step,
+                             int prio, long long req_bytes, int flags) {
+  h2_rlog_rec rec;
+  long long latency_usec = cur_usec - req_usec;
+  int sess_idx = h2_peer_rsp_sess_idx(peer);
+
+  rec.send_usec = req_usec - result_log_start_usec;
+  rec.latency_usec = (latency_usec < UINT32_MAX)? latency_usec : UINT32_MAX;
+  rec.req_id = req_id;
+  rec.req_bytes = req_bytes;
+  rec.rsp_bytes = (rsp)? h2_body_len(rsp) : 0;
+  rec.status = (rsp)? h2_status(rsp) : 0;
+  rec.sess_idx = (sess_idx >= 0)? sess_idx : 0xffff;
+  rec.step = step;
+  rec.prio = prio;
+  rec.flags = flags | ((rsp)? 0 : H2_RLOG_F_NO_RSP);
+  h2_rlog_write(result_log, &rec);
+}
+
+
+/*
+ * Capture Replay -----------------------------------------------------------
+ * requests captured by h2svr -C are sent at the captured time offsets
+ * scaled by speed; open loop regardless of responses
+ */
+
+#define REPLAY_BURST_MAX  1000  /* sends per timer call to let io run */
+
+static int replay_response_cb(h2_peer *peer, h2_msg *rsp,
+                              void *peer_user_data, void *strm_user_data) {
+  client_job_t *job = peer_user_data;
+  long long *req_usec = strm_user_data;
+  long long cur_usec = h2_time_usec();
+
+  if (!service_flag) {
+    return 0;
+  }
+  if (result_log) {
+    /* request body length is not kept; 0 for req_bytes */
+    result_log_write(peer, rsp, *req_usec, cur_usec,
+                     req_usec - job->replay_req_usec, 0, -1, 0,
+                     H2_RLOG_F_REPLAY);
+  }
+  if (rsp) {
+    h2_hist_add(&job->lat_hist, cur_usec - *req_usec);
+    if (job->soak_intv_usec > 0) {
+      h2_hist_add(&job->soak_hist, cur_usec - *req_usec);
+    }
+    if (verbose) {
+      h2_dump_msg(stdout, rsp, "", "RESPONSE[%ld]",
+                  (long)(req_usec - job->replay_req_usec));
+    }
+  } else {
+    job->measure_err_num++;
+  }
+  job->measure_rsp_num++;
+  job->last_rsp_usec = cur_usec;
+  job->rsp_msg_num++;
+  return 0;
+}
+
+static void replay_timer_cb(h2_ctx *ctx, void *user_data) {
+  client_job_t *job = user_data;
+  h2_peer *peer = job->req_step_peer[0];
+  long long cur_usec, due_usec, *req_usec;
+  int n;
+
+  for (n = 0; job->replay_rec && service_flag; n++) {
+    cur_usec = h2_time_usec();
+    due_usec = job->start_usec +
+               (long long)((h2_cap_rec_usec(job->replay_rec) -
+                            job->replay_first_usec) / job->replay_speed);
+    if (due_usec > cur_usec || n >= REPLAY_BURST_MAX) {
+      h2_timer_add(ctx, (due_usec > cur_usec)? due_usec - cur_usec : 0,
+                   replay_timer_cb, job);
+      return;
+    }
+
+    h2_msg *req = h2_msg_init();
+    h2_set_scheme(req, h2_scheme(job->req_step_msg[0]));
+    h2_set_authority(req, h2_authority(job->req_step_msg[0]));
+    h2_cap_rec_msg(job->replay, job->replay_rec, req);
+    if (verbose) {
+      h2_dump_msg(stdout, req, "", "REQUEST[%lld]", job->req_msg_num);
+    }
+    req_usec = &job->replay_req_usec[job->req_msg_num];
+    *req_usec = cur_usec;
+    if (h2_send_request(peer, req, replay_response_cb, req_usec) < 0) {
+      job->replay_send_err_num++;
+      job->measure_err_num++;
+      job->measure_rsp_num++;
+      job->rsp_msg_num++;
+    }
+    h2_msg_free(req);  /* already copied by h2_send_request() */
+
+    job->replay_lag_sum += cur_usec - due_usec;
+    if (cur_usec - due_usec > job->replay_lag_max) {
+      job->replay_lag_max = cur_usec - due_usec;
+    }
+    job->req_msg_num++;
+    job->req_cnt++;
+    job->replay_rec = h2_cap_next(job->replay, job->replay_rec);
+    req_counting_update(job);
+  }
+  check_all_req_sent(job);
+}
+
+static int start_replay(client_job_t *job) {
+  job->req_max = h2_cap_rec_num(job->replay);
+  job->req_msg_max = job->req_max;
+  job->replay_req_usec = calloc(job->req_max + 1, sizeof(long long));
+  job->replay_rec = h2_cap_next(job->replay, NULL);
+  if (job->replay_rec) {
+    job->replay_first_usec = h2_cap_rec_usec(job->replay_rec);
+  }
+  h2_timer_add(ctx, 0, replay_timer_cb, job);
+  return 0;
+}
+
+static void print_replay_result(client_job_t *job) {
+  if (job->replay == NULL || job->req_msg_num == 0) {
+    return;
+  }
+  fprintf(stdout, "REPLAY: %lld of %d reqs at speed %.2f; send lag avg=%lld "
+          "max=%lld usec; %lld send failed\n",
+          job->req_msg_num, h2_cap_rec_num(job->replay), job->replay_speed,
+          job->replay_lag_sum / job->req_msg_num, job->replay_lag_max,
+          job->replay_send_err_num);
+}
+
 static int start_request(client_job_t *job) {
-  int i, r;
+  int i;
 
+  job->is_started = 1;
   job->req_cnt = 0;
+  if (job->duration_usec > 0) {
+    job->req_max = REQ_MAX_UNBOUNDED;
+  }
   job->req_msg_max = job->req_max * job->req_step_num;
   job->req_msg_num = 0;
   job->rsp_msg_num = 0;
+  job->start_usec = h2_time_usec();
+  if (job->req_max > 0 && (job->warmup_req > 0 || job->warmup_usec > 0)) {
+    job->is_warmup = 1;
+  } else {
+    job->measure_usec = job->start_usec;
+    job->measure_cpu_usec = h2_proc_cpu_usec();
+  }
+  if (job->duration_usec > 0) {
+    h2_timer_add(ctx, job->duration_usec, duration_end_cb, job);
+  }
+  if (job->soak_intv_usec > 0) {
+    job->soak_last_usec = job->start_usec;
+    h2_timer_add(ctx, job->soak_intv_usec, soak_sample_cb, job);
+  }
+  if (job->replay) {
+    return start_replay(job);
+  }
   req_counting_update(job);
 
   /* send initial requests as req_par */
   for (i = 0; i < job->req_par && job->req_cnt < job->req_max; i++) {
-    req_task_t *req_task = &job->req_par_task[i]; 
-    req_task->par_idx = i;
-    req_task->req_id = job->req_cnt++;
-    req_task->req_step = 0;
-    req_task->prm_num = 0;
-
-    sleep_for_req_tps(job);
-    h2_msg *req = gen_request(job->req_step_msg[0],
-                              job, job->repl_sym_mask[0], req_task);
-    if (verbose) {
-      h2_dump_msg(stdout, req, "", "REQUEST[%d/%d,%d]",
-                  req_task->req_id, req_task->req_step, req_task->par_idx);
-    }
-    if (long_tr_thr_msec) {
-      gettimeofday(&req_task->req_tv, NULL);
-    }
-    req_task->req = req;  /* to be freed in response_cb */
-    r = h2_send_request(job->req_step_peer[req_task->req_step], req,
-                        response_cb, req_task);
-    job->req_msg_num++;
-    req_counting_update(job);
-    if (r < 0) {
-      h2_msg_free(req_task->req);
-      req_task->req = NULL;
+    if (start_req_task(job, i) < 0) {
       break;
     }
   }
 
-  /* check for all request sent, then terminate marking no more request */
-  if (job->req_msg_num >= job->req_msg_max &&
-      job->req_msg_max != 0/* to allow -C 0 test case */) {
-    for (i = 0; i < svr_peer_num; i++) {
-      h2_terminate(svr_peers[i].peer, 1);
+  check_all_req_sent(job);
+  return 0;
+}
+
+static void count_rsp_coding(client_job_t *job, h2_msg *rsp) {
+  int coding = h2_coding_from_name(h2_hdr_value(rsp, "content-encoding"));
+  long long decoded_len = h2_body_len(rsp);
+
+  job->rsp_body_bytes += h2_body_len(rsp);
+  if (coding < 0) {
+    job->rsp_decode_err_num++;
+    return;
+  }
+  job->rsp_coding_num[coding]++;
+  if (rsp_decode && coding != H2_CODING_IDENTITY) {
+    long long cpu_usec = h2_cpu_usec();
+    decoded_len = h2_body_decode_len(coding, h2_body(rsp), h2_body_len(rsp));
+    job->rsp_decode_cpu_usec += h2_cpu_usec() - cpu_usec;
+    if (decoded_len < 0) {
+      job->rsp_decode_err_num++;
+      decoded_len = 0;
     }
-    req_counting_line_clear();
   }
-  return 0;
+  job->rsp_decoded_bytes += decoded_len;
+}
+
+/* json body or application/json part of multipart/related body */
+static const void *rsp_json_body(h2_msg *rsp, int *len_ret) {
+  h2_mpart parts[H2_MPART_MAX];
+  const char *boundary;
+  int i, n, boundary_len;
+
+  boundary_len = h2_mpart_boundary(h2_hdr_value(rsp, "content-type"),
+                                   &boundary);
+  if (boundary_len <= 0) {
+    *len_ret = h2_body_len(rsp);
+    return h2_body(rsp);
+  }
+  n = h2_mpart_parse(h2_body(rsp), h2_body_len(rsp), boundary, boundary_len,
+                     parts, H2_MPART_MAX);
+  if ((i = h2_mpart_find(parts, n, "application/json")) < 0) {
+    *len_ret = 0;
+    return NULL;
+  }
+  *len_ret = parts[i].body_len;
+  return parts[i].body;
+}
+
+static void count_rsp_mpart(client_job_t *job, h2_msg *rsp) {
+  h2_mpart parts[H2_MPART_MAX];
+  const char *boundary;
+  int n, boundary_len;
+
+  boundary_len = h2_mpart_boundary(h2_hdr_value(rsp, "content-type"),
+                                   &boundary);
+  if (boundary_len <= 0) {
+    return;  /* not multipart */
+  }
+  n = h2_mpart_parse(h2_body(rsp), h2_body_len(rsp), boundary, boundary_len,
+                     parts, H2_MPART_MAX);
+  job->rsp_mpart_num++;
+  if (n < 0) {
+    job->rsp_mpart_err_num++;
+  } else {
+    job->rsp_mpart_part_num += n;
+  }
+}
+
+/* capture json values of the step's response for the next steps */
+static void capture_rsp(client_job_t *job, req_task_t *req_task,
+                        h2_msg *rsp) {
+  char **val = &job->capt_val[req_task->par_idx * job->capt_num];
+  h2_json_ptr *ptrs[CAPTURE_MAX];
+  h2_json_val vals[CAPTURE_MAX];
+  int idx[CAPTURE_MAX];
+  int i, n = 0;
+
+  for (i = 0; i < job->capt_num; i++) {
+    if (job->capt[i].req_step == req_task->req_step) {
+      idx[n] = i;
+      ptrs[n++] = job->capt[i].ptr;
+    }
+  }
+  if (n == 0) {
+    return;
+  }
+  long long start_usec = h2_time_usec();
+  const void *json = NULL;
+  int json_len = 0;
+  if (rsp) {
+    json = rsp_json_body(rsp, &json_len);
+  }
+  if (json_len <= 0 ||
+      h2_json_extract(json, json_len, ptrs, n, vals) < 0) {
+    for (i = 0; i < n; i++) {
+      vals[i].type = H2_JSON_NONE;
+    }
+  }
+  job->capt_scan_usec += h2_time_usec() - start_usec;
+  job->capt_scan_bytes += json_len;
+
+  for (i = 0; i < n; i++) {
+    capture_t *capt = &job->capt[idx[i]];
+    free(val[idx[i]]);
+    val[idx[i]] = NULL;
+    if (vals[i].type == H2_JSON_NONE) {
+      capt->missing_num++;
+    } else {
+      val[idx[i]] = strndup(vals[i].str, vals[i].len);
+      capt->found_num++;
+    }
+  }
+}
+
+static void print_capture_result(client_job_t *job) {
+  int i;
+  if (job->capt_num <= 0) {
+    return;
+  }
+  for (i = 0; i < job->capt_num; i++) {
+    fprintf(stdout, "CAPTURE %s=%s on step %d: found=%lld missing=%lld\n",
+            job->capt[i].sym, h2_json_ptr_str(job->capt[i].ptr),
+            job->capt[i].req_step, job->capt[i].found_num,
+            job->capt[i].missing_num);
+  }
+  fprintf(stdout, "CAPTURE SCAN: %lld bytes in %lld usec (%.1f MB/s)\n",
+          job->capt_scan_bytes, job->capt_scan_usec,
+          (job->capt_scan_usec > 0)?
+          (double)job->capt_scan_bytes / job->capt_scan_usec : 0);
 }
 
 static int response_cb(h2_peer *peer, h2_msg *rsp, void *peer_user_data,
@@ -409,19 +1333,45 @@ static int response_cb(h2_peer *peer, h2_msg *rsp, void *peer_user_data,
     return 0;  /* just ignore on service stop */
   }
 
-  /* check for long traction report case */
-  if (long_tr_thr_msec) {
-    struct timeval cur_tv, req_tv = req_task->req_tv;
-    int elapsed_msec;
+  long long cur_usec = h2_time_usec();
+  int is_measured = (job->measure_usec > 0 &&
+                     req_task->req_usec >= job->measure_usec);
+
+  if (result_log) {
+    result_log_write(peer, rsp, req_task->req_usec, cur_usec,
+                     req_task->req_id, req_task->req_step, req_task->prio,
+                     h2_body_len(job->req_step_msg[req_task->req_step]),
+                     (is_measured)? 0 : H2_RLOG_F_WARMUP);
+  }
 
-    gettimeofday(&cur_tv, NULL);
-    if (cur_tv.tv_usec >= req_tv.tv_usec) {
-      elapsed_msec = (cur_tv.tv_sec - req_tv.tv_sec) * 1000 +
-                     (cur_tv.tv_usec - req_tv.tv_usec) / 1000;
+  /* measure only requests sent after warm-up */
+  if (is_measured) {
+    if (rsp) {
+      h2_hist_add(&job->lat_hist, cur_usec - req_task->req_usec);
+      if (job->soak_intv_usec > 0) {
+        h2_hist_add(&job->soak_hist, cur_usec - req_task->req_usec);
+      }
+      if (coord_fd >= 0) {
+        h2_hist_add(&job->coord_hist, cur_usec - req_task->req_usec);
+      }
+      if (control_fd >= 0) {
+        h2_hist_add(&job->ctl_hist, cur_usec - req_task->req_usec);
+      }
+      job->measure_rx_bytes += h2_body_len(rsp);
+      job->measure_tx_bytes +=
+          h2_body_len(job->req_step_msg[req_task->req_step]);
     } else {
-      elapsed_msec = (cur_tv.tv_sec - req_tv.tv_sec - 1) * 1000 +
-                     (1000000 + cur_tv.tv_usec - req_tv.tv_usec) / 1000;
+      job->measure_err_num++;
     }
+    count_rsp_prio(job, req_task, rsp, cur_usec - req_task->req_usec);
+    job->measure_rsp_num++;
+    job->last_rsp_usec = cur_usec;
+  }
+
+  /* check for long traction report case */
+  if (long_tr_thr_msec) {
+    int elapsed_msec = (cur_usec - req_task->req_usec) / 1000;
+
     if (elapsed_msec >= long_tr_thr_msec) {
       static int ltc = 0; 
 
@@ -459,49 +1409,742 @@ static int response_cb(h2_peer *peer, h2_msg *rsp, void *peer_user_data,
       h2_dump_msg(stdout, rsp, "", "RESPONSE[%d/%d,%d]",
                   req_task->req_id, req_task->req_step, req_task->par_idx);
     }
+    if (accept_encoding || rsp_decode) {
+      count_rsp_coding(job, rsp);
+    }
+    count_rsp_mpart(job, rsp);
+  }
+  if (job->capt_num > 0 && (rsp || !retry_on_rst_stream)) {
+    capture_rsp(job, req_task, rsp);
+  }
+
+  if (rsp || !retry_on_rst_stream) {
+    job->rsp_msg_num++;
+    /* prepare new request */
+    if (req_task->req_step + 1 < job->req_step_num) {
+      req_task->req_step += 1;
+    } else if (job->req_cnt < job->req_max) {
+      if (idle_req_task(job, req_task)) {
+        return 0;
+      }
+      req_task->req_id = new_req_id(job);
+      req_task->req_step = 0;
+      req_task->prm_num = 0;
+      req_task->prio = new_req_prio(job);
+    } else {
+      return 0;  /* no more request stream */
+    }
+    job->req_msg_num++;
+  }
+
+  /* send new request unless held by runtime load control */
+  if (park_req_task(job, req_task)) {
+    req_counting_update(job);
+    return 0;
+  }
+  send_req_task(job, peer, req_task);
+  req_counting_update(job);
+  /* may need to handle h2_send_request() error case */
+
+  check_all_req_sent(job);
+  return 0;
+}
+
+/*
+ * Coordinated Multi-Process Run --------------------------------------------
+ * controller (-Z) assigns disjoint req_id ranges, req_par and req_tps to
+ * agents (-K) attached over unix or tcp control socket, starts them at once
+ * on all agents ready, and merges interval and final latency histograms;
+ * messages are text lines to be independent of agent host arch:
+ *   agent -> controller: HELLO <host> <pid>
+ *                        READY
+ *                        INTV <rsps> <errors> <hist>
+ *                        DONE <rsps> <errors> <elapsed_usec> <hist>
+ *   controller -> agent: ASSIGN <idx> <num> <req_id_base> <req_max>
+ *                               <req_par> <req_tps> <intv_usec>
+ *                        START
+ *                        STOP
+ * <hist> is "<cnt> <sum> <min> <max>" followed by "<bucket>:<count>" of
+ * non-zero buckets; percentiles are taken from the merged buckets
+ */
+
+#define COORD_AGENT_MAX   256
+#define COORD_LINE_MAX    (64 * 1024)  /* enough for all buckets of hist */
+#define COORD_POLL_USEC   10000        /* agent control message check */
+#define COORD_WAIT_SEC    30           /* agent attach and ready timeout */
+#define COORD_INTV_USEC   1000000      /* default report interval */
+
+typedef struct {
+  int fd;
+  int len;
+  int line_len;  /* line returned; consumed on the next coord_recv_line() */
+  char buf[COORD_LINE_MAX];
+} coord_conn_t;
+
+typedef struct {
+  coord_conn_t conn;
+  char host[64];
+  int pid;
+  int is_ready;
+  int is_done;
+  int is_lost;      /* closed without DONE */
+  long long rsp_num;
+  long long err_num;
+  long long elapsed_usec;
+} coord_agent_t;
+
+/* interval reports merged on the controller */
+typedef struct {
+  int seq;
+  int rpt_num;  /* agent reports merged */
+  long long rsp_num;
+  long long err_num;
+  h2_hist hist;
+} coord_intv_t;
+
+static coord_conn_t coord_agent_conn;  /* agent side connection */
+
+/* addr is <host>:<port> for tcp or else unix socket path */
+static int coord_sock(const char *addr, int is_listen) {
+  const char *port = strrchr(addr, ':');
+  int fd, r, on = 1;
+
+  if (port == NULL) {
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(addr) >= sizeof(sa.sun_path)) {
+      fprintf(stderr, "control socket path too long: %s\n", addr);
+      return -1;
+    }
+    strcpy(sa.sun_path, addr);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+      fprintf(stderr, "control socket() failed: %s\n", strerror(errno));
+      return -1;
+    }
+    if (is_listen) {
+      unlink(addr);
+      r = bind(fd, (struct sockaddr *)&sa, sizeof(sa));
+      if (r == 0) {
+        r = listen(fd, COORD_AGENT_MAX);
+      }
+    } else {
+      r = connect(fd, (struct sockaddr *)&sa, sizeof(sa));
+    }
+  } else {
+    struct addrinfo hints, *res;
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(port - addr), addr);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = (is_listen)? AI_PASSIVE : 0;
+    if ((r = getaddrinfo((host[0])? host : NULL, port + 1, &hints, &res))) {
+      fprintf(stderr, "control address failed: %s: %s\n", addr,
+              gai_strerror(r));
+      return -1;
+    }
+    fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      fprintf(stderr, "control socket() failed: %s\n", strerror(errno));
+      freeaddrinfo(res);
+      return -1;
+    }
+    if (is_listen) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      r = bind(fd, res->ai_addr, res->ai_addrlen);
+      if (r == 0) {
+        r = listen(fd, COORD_AGENT_MAX);
+      }
+    } else {
+      r = connect(fd, res->ai_addr, res->ai_addrlen);
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    freeaddrinfo(res);
+  }
+  if (r < 0) {
+    fprintf(stderr, "control socket %s failed: %s: %s\n",
+            (is_listen)? "listen" : "connect", addr, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int coord_send(int fd, const char *fmt, ...) {
+  char buf[COORD_LINE_MAX];
+  va_list ap;
+  int len, off, r;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len >= (int)sizeof(buf)) {
+    return -1;
+  }
+  for (off = 0; off < len; off += r) {
+    if ((r = send(fd, buf + off, len - off, MSG_NOSIGNAL)) < 0) {
+      if (errno == EINTR) {
+        r = 0;
+        continue;
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* returns a line without newline, or NULL if none yet; *eof on close */
+static char *coord_recv_line(coord_conn_t *cc, int *eof) {
+  char *nl;
+  int r;
+
+  if (cc->line_len > 0) {
+    cc->len -= cc->line_len;
+    memmove(cc->buf, cc->buf + cc->line_len, cc->len);
+    cc->line_len = 0;
+  }
+  while (1) {
+    if ((nl = memchr(cc->buf, '\n', cc->len))) {
+      *nl = '\0';
+      cc->line_len = nl - cc->buf + 1;
+      return cc->buf;
+    }
+    if (cc->len >= (int)sizeof(cc->buf)) {
+      *eof = 1;  /* too long line; protocol error */
+      return NULL;
+    }
+    r = recv(cc->fd, cc->buf + cc->len, sizeof(cc->buf) - cc->len,
+             MSG_DONTWAIT);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return NULL;
+    }
+    if (r <= 0) {
+      *eof = 1;
+      return NULL;
+    }
+    cc->len += r;
+  }
+}
+
+static void coord_hist_fmt(char *buf, int size, const h2_hist *hist) {
+  int i, n;
+
+  n = snprintf(buf, size, "%lld %lld %lld %lld",
+               hist->cnt, hist->sum, hist->min, hist->max);
+  for (i = 0; i < H2_HIST_BUCKET_NUM && n < size; i++) {
+    if (hist->bucket[i]) {
+      n += snprintf(buf + n, size - n, " %d:%lld", i, hist->bucket[i]);
+    }
+  }
+}
+
+static int coord_hist_parse(const char *str, h2_hist *hist) {
+  long long cnt;
+  int i, n;
+
+  h2_hist_init(hist);
+  if (sscanf(str, "%lld %lld %lld %lld%n",
+             &hist->cnt, &hist->sum, &hist->min, &hist->max, &n) != 4) {
+    return -1;
+  }
+  for (str += n; sscanf(str, " %d:%lld%n", &i, &cnt, &n) == 2; str += n) {
+    if (i < 0 || i >= H2_HIST_BUCKET_NUM) {
+      return -1;
+    }
+    hist->bucket[i] = cnt;
+  }
+  return 0;
+}
+
+/* agent: attach to the controller and take the assignment */
+static int coord_agent_attach(client_job_t *job, const char *addr) {
+  struct pollfd pfd;
+  char host[64], *line;
+  int eof = 0, idx, num, req_par, req_tps;
+  long long req_id_base, req_max, intv_usec;
+
+  if ((coord_fd = coord_sock(addr, 0)) < 0) {
+    return -1;
+  }
+  coord_agent_conn.fd = coord_fd;
+  if (gethostname(host, sizeof(host)) < 0) {
+    strcpy(host, "-");
+  }
+  host[sizeof(host) - 1] = '\0';
+  coord_send(coord_fd, "HELLO %s %d\n", host, (int)getpid());
+
+  pfd.fd = coord_fd;
+  pfd.events = POLLIN;
+  while ((line = coord_recv_line(&coord_agent_conn, &eof)) == NULL) {
+    if (eof || poll(&pfd, 1, COORD_WAIT_SEC * 1000) <= 0) {
+      fprintf(stderr, "no assignment from controller: %s\n", addr);
+      return -1;
+    }
+  }
+  if (sscanf(line, "ASSIGN %d %d %lld %lld %d %d %lld", &idx, &num,
+             &req_id_base, &req_max, &req_par, &req_tps, &intv_usec) != 7) {
+    fprintf(stderr, "invalid assignment from controller: %s\n", line);
+    return -1;
+  }
+  job->req_id_base = req_id_base;
+  if (job->duration_usec == 0) {
+    job->req_max = req_max;
+  }
+  job->req_par = req_par;
+  job->req_tps = req_tps;
+  job->coord_intv_usec = intv_usec;
+  fprintf(stderr, "COORD AGENT[%d/%d]: req_id_base=%lld req_max=%lld "
+          "req_par=%d req_tps=%d\n", idx, num, req_id_base,
+          (job->duration_usec > 0)? 0 : req_max, req_par, req_tps);
+  return 0;
+}
+
+static void coord_agent_ready(client_job_t *job) {
+  if (!job->is_coord_ready) {
+    job->is_coord_ready = 1;
+    coord_send(coord_fd, "READY\n");
+  }
+}
+
+static void coord_agent_report(client_job_t *job) {
+  char hist_str[COORD_LINE_MAX - 64];
+
+  coord_hist_fmt(hist_str, sizeof(hist_str), &job->coord_hist);
+  coord_send(coord_fd, "INTV %lld %lld %s\n",
+             job->measure_rsp_num - job->coord_last_rsp,
+             job->measure_err_num - job->coord_last_err, hist_str);
+  job->coord_last_rsp = job->measure_rsp_num;
+  job->coord_last_err = job->measure_err_num;
+  h2_hist_init(&job->coord_hist);
+}
+
+static void coord_agent_cb(h2_ctx *ctx, void *user_data) {
+  client_job_t *job = user_data;
+  long long cur_usec = h2_time_usec();
+  char *line;
+  int eof = 0;
+
+  while ((line = coord_recv_line(&coord_agent_conn, &eof))) {
+    if (!strcmp(line, "START") && !job->is_started) {
+      job->coord_last_usec = h2_time_usec();
+      start_request(job);
+    } else if (!strcmp(line, "STOP")) {
+      eof = 1;
+    }
+  }
+  if (eof) {  /* stop on STOP or controller lost */
+    service_flag = 0;
+    h2_ctx_stop(ctx);
+    return;
+  }
+  if (job->is_started &&
+      cur_usec - job->coord_last_usec >= job->coord_intv_usec) {
+    job->coord_last_usec = cur_usec;
+    coord_agent_report(job);
+  }
+  h2_timer_add(ctx, COORD_POLL_USEC, coord_agent_cb, job);
+}
+
+static void coord_agent_done(client_job_t *job) {
+  char hist_str[COORD_LINE_MAX - 64];
+  long long elapsed_usec = (job->last_rsp_usec > job->measure_usec)?
+                           job->last_rsp_usec - job->measure_usec : 0;
+
+  coord_hist_fmt(hist_str, sizeof(hist_str), &job->lat_hist);
+  coord_send(coord_fd, "DONE %lld %lld %lld %s\n", job->measure_rsp_num,
+             job->measure_err_num, elapsed_usec, hist_str);
+  close(coord_fd);
+  coord_fd = -1;
+}
+
+/* controller: split the job into the agent's share */
+static void coord_assign(client_job_t *job, coord_agent_t *ag,
+                         int idx, int num) {
+  long long req_max = 0, req_id_base;
+  int req_par, req_tps;
+
+  if (job->duration_usec > 0) {
+    req_id_base = idx * (INT_MAX / num + 1LL);
+  } else {
+    req_max = job->req_max / num + (idx < job->req_max % num);
+    /* warm-up requests are on top of req_max; see new_req_id() */
+    req_id_base = idx * (job->req_max / num + job->warmup_req) +
+                  ((idx < job->req_max % num)? idx : job->req_max % num);
+  }
+  req_par = job->req_par / num + (idx < job->req_par % num);
+  if (req_par < 1) {
+    req_par = 1;
+  }
+  req_tps = job->req_tps / num + (idx < job->req_tps % num);
+  if (job->req_tps > 0 && req_tps < 1) {
+    req_tps = 1;
+  }
+  coord_send(ag->conn.fd, "ASSIGN %d %d %lld %lld %d %d %lld\n", idx, num,
+             req_id_base, req_max, req_par, req_tps,
+             (long long)COORD_INTV_USEC);
+}
+
+/* returns agent processes launched as "<prog> -K <addr> <args>" */
+static int coord_launch(int num, const char *addr, int argc, char **argv,
+                        pid_t *pids) {
+  char **args = calloc(argc + 3, sizeof(char *));
+  int i, n, fd;
+
+  args[0] = argv[0];
+  args[1] = "-K";
+  args[2] = (char *)addr;
+  memcpy(args + 3, argv + 1, (argc - 1) * sizeof(char *));
+  fflush(stdout);
+  fflush(stderr);
+  for (n = 0; n < num; n++) {
+    if ((pids[n] = fork()) < 0) {
+      fprintf(stderr, "agent fork() failed: %s\n", strerror(errno));
+      break;
+    }
+    if (pids[n] == 0) {
+      /* agent results are merged by the controller */
+      if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+      }
+      execv("/proc/self/exe", args);
+      fprintf(stderr, "agent exec failed: %s\n", strerror(errno));
+      _exit(127);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    fprintf(stderr, "COORD AGENT[%d] LAUNCHED: pid=%d\n", i, (int)pids[i]);
+  }
+  free(args);
+  return n;
+}
+
+static void coord_print_intv(coord_intv_t *intv, int agent_num) {
+  intv->seq++;
+  req_counting_line_clear();
+  fprintf(stdout, "COORD[%d] %.0fs: %lld rsps %.1f tps p50=%lld p99=%lld "
+          "usec %lld errors; %d of %d agents\n", intv->seq,
+          intv->seq * (COORD_INTV_USEC / 1000000.0), intv->rsp_num,
+          intv->rsp_num * 1000000.0 / COORD_INTV_USEC,
+          h2_hist_percentile(&intv->hist, 50),
+          h2_hist_percentile(&intv->hist, 99), intv->err_num,
+          intv->rpt_num, agent_num);
+  intv->rpt_num = 0;
+  intv->rsp_num = 0;
+  intv->err_num = 0;
+  h2_hist_init(&intv->hist);
+}
+
+/* handles agent messages; returns -1 on agent lost or protocol error */
+static int coord_agent_recv(client_job_t *job, coord_agent_t *ag, int idx,
+                            int num, coord_intv_t *intv, h2_hist *total_hist) {
+  h2_hist hist;
+  long long rsp, err, elapsed;
+  char *line;
+  int eof = 0, n;
+
+  while ((line = coord_recv_line(&ag->conn, &eof))) {
+    if (!strncmp(line, "HELLO ", 6)) {
+      if (sscanf(line + 6, "%63s %d", ag->host, &ag->pid) != 2) {
+        break;
+      }
+      coord_assign(job, ag, idx, num);
+    } else if (!strcmp(line, "READY")) {
+      ag->is_ready = 1;
+    } else if (sscanf(line, "INTV %lld %lld %n", &rsp, &err, &n) == 2) {
+      if (coord_hist_parse(line + n, &hist) < 0) {
+        break;
+      }
+      intv->rpt_num++;
+      intv->rsp_num += rsp;
+      intv->err_num += err;
+      h2_hist_merge(&intv->hist, &hist);
+    } else if (sscanf(line, "DONE %lld %lld %lld %n",
+                      &rsp, &err, &elapsed, &n) == 3) {
+      if (coord_hist_parse(line + n, &hist) < 0) {
+        break;
+      }
+      ag->rsp_num = rsp;
+      ag->err_num = err;
+      ag->elapsed_usec = elapsed;
+      ag->is_done = 1;
+      h2_hist_merge(total_hist, &hist);
+    } else {
+      break;
+    }
+  }
+  if (line || (eof && !ag->is_done)) {
+    fprintf(stderr, "COORD AGENT[%d] %s:%d LOST%s%s\n", idx, ag->host,
+            ag->pid, (line)? "; invalid message: " : "", (line)? line : "");
+    ag->is_lost = 1;
+    return -1;
+  }
+  return 0;
+}
+
+/* controller main; spec is <agent_num>[@<addr>] */
+static int coord_run(client_job_t *job, const char *spec,
+                     int argc, char **argv) {
+  const char *at = strchr(spec, '@');
+  char addr[256];
+  int num = atoi(spec), listen_fd, agent_num = 0, ready_num = 0, done_num;
+  int is_started = 0, is_stop_sent = 0, rc = 0, i;
+  coord_agent_t *agents;
+  pid_t *pids;
+  int pid_num = 0;
+  struct pollfd *pfds;
+  long long start_usec, intv_usec;
+  long long rsp_num = 0, err_num = 0, elapsed_usec = 0, cur_usec;
+  coord_intv_t *intv = calloc(1, sizeof(coord_intv_t));
+  h2_hist *hist = malloc(sizeof(h2_hist));  /* total */
+
+  if (num <= 0 || num > COORD_AGENT_MAX) {
+    fprintf(stderr, "invalid -Z agent_num; should be 1 ~ %d: %s\n",
+            COORD_AGENT_MAX, spec);
+    free(hist);
+    free(intv);
+    return EXIT_FAILURE;
+  }
+  if (job->duration_usec == 0 && job->req_max < num) {
+    fprintf(stderr, "-C req_max_count should be >= -Z agent_num\n");
+    free(hist);
+    free(intv);
+    return EXIT_FAILURE;
+  }
+  if (at) {
+    snprintf(addr, sizeof(addr), "%s", at + 1);
+  } else {
+    snprintf(addr, sizeof(addr), "/tmp/h2cli-coord.%d.sock", (int)getpid());
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, sighdlr_mark_stop);
+  if ((listen_fd = coord_sock(addr, 1)) < 0) {
+    free(hist);
+    free(intv);
+    return EXIT_FAILURE;
+  }
+  h2_hist_init(&intv->hist);
+  h2_hist_init(hist);
+  agents = calloc(num, sizeof(coord_agent_t));
+  pfds = calloc(num + 1, sizeof(struct pollfd));
+  pids = calloc(num, sizeof(pid_t));
+
+  if (at == NULL) {
+    pid_num = coord_launch(num, addr, argc, argv, pids);
+    if (pid_num < num) {
+      rc = EXIT_FAILURE;
+    }
+  } else {
+    fprintf(stderr, "COORD: waiting %d agents on %s\n", num, addr);
+  }
+
+  /* run until all agents done or lost */
+  start_usec = intv_usec = h2_time_usec();
+  for (done_num = 0; rc == 0 && done_num < num; ) {
+    int pfd_num = 0;
+
+    pfds[pfd_num].fd = listen_fd;
+    pfds[pfd_num++].events = POLLIN;
+    for (i = 0; i < agent_num; i++) {
+      pfds[pfd_num].fd = (agents[i].is_done || agents[i].is_lost)?
+                         -1 : agents[i].conn.fd;
+      pfds[pfd_num++].events = POLLIN;
+    }
+    poll(pfds, pfd_num, 100);
+    cur_usec = h2_time_usec();
+
+    if (pfds[0].revents & POLLIN) {
+      int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (fd >= 0 && (agent_num >= num || is_started)) {
+        close(fd);  /* no more agent */
+      } else if (fd >= 0) {
+        agents[agent_num++].conn.fd = fd;
+      }
+    }
+    for (i = 0; i < agent_num; i++) {
+      coord_agent_t *ag = &agents[i];
+      int was_done = ag->is_done;
+      if (pfds[i + 1].fd < 0 || pfds[i + 1].revents == 0) {
+        continue;
+      }
+      if (coord_agent_recv(job, ag, i, num, intv, hist) < 0 &&
+          !is_started) {
+        rc = EXIT_FAILURE;  /* all agents are required to start */
+      }
+      if ((ag->is_done && !was_done) || ag->is_lost) {
+        done_num++;
+      }
+    }
+
+    if (!is_started) {
+      for (ready_num = 0, i = 0; i < agent_num; i++) {
+        ready_num += agents[i].is_ready;
+      }
+      if (done_num > 0 || (pid_num > 0 && waitpid(-1, NULL, WNOHANG) > 0)) {
+        fprintf(stderr, "COORD: agent exited before start\n");
+        rc = EXIT_FAILURE;
+      } else if (ready_num == num) {
+        for (i = 0; i < num; i++) {
+          coord_send(agents[i].conn.fd, "START\n");
+        }
+        is_started = 1;
+        start_usec = intv_usec = cur_usec;
+        fprintf(stderr, "COORD: %d agents started\n", num);
+      } else if (!service_flag ||
+                 cur_usec - start_usec >= COORD_WAIT_SEC * 1000000LL) {
+        fprintf(stderr, "COORD: %d of %d agents ready; not started\n",
+                ready_num, num);
+        rc = EXIT_FAILURE;
+      }
+      continue;
+    }
+    if (!service_flag && !is_stop_sent) {
+      for (i = 0; i < agent_num; i++) {
+        if (!agents[i].is_done && !agents[i].is_lost) {
+          coord_send(agents[i].conn.fd, "STOP\n");
+        }
+      }
+      is_stop_sent = 1;
+    }
+    /* printed on reports of all running agents, or late ones are missed */
+    if (intv->rpt_num > 0 && (intv->rpt_num >= num - done_num ||
+                              cur_usec - intv_usec >= COORD_INTV_USEC * 3 / 2)) {
+      intv_usec = cur_usec;
+      coord_print_intv(intv, num - done_num);
+    }
+  }
+
+  if (rc != 0) {  /* stop agents not started */
+    for (i = 0; i < agent_num; i++) {
+      coord_send(agents[i].conn.fd, "STOP\n");
+    }
+  } else {
+    /* merged result; percentiles are of the merged histogram */
+    for (i = 0; i < num; i++) {
+      coord_agent_t *ag = &agents[i];
+      double sec = ag->elapsed_usec / 1000000.0;
+      fprintf(stdout, "AGENT[%d] %s:%d: %lld rsps (%lld errors) in %.3f "
+              "secs: %.1f tps%s\n", i, ag->host, ag->pid, ag->rsp_num,
+              ag->err_num, sec, (sec > 0)? ag->rsp_num / sec : 0,
+              (ag->is_lost)? "; LOST" : "");
+      rsp_num += ag->rsp_num;
+      err_num += ag->err_num;
+      if (ag->elapsed_usec > elapsed_usec) {
+        elapsed_usec = ag->elapsed_usec;
+      }
+    }
+    fprintf(stdout, "RESULT: %lld rsps (%lld errors) in %.3f secs: %.1f tps; "
+            "%d agents\n", rsp_num, err_num, elapsed_usec / 1000000.0,
+            (elapsed_usec > 0)? rsp_num * 1000000.0 / elapsed_usec : 0, num);
+    h2_hist_print(stdout, hist, "LATENCY(usec)");
+  }
+
+  for (i = 0; i < agent_num; i++) {
+    close(agents[i].conn.fd);
+  }
+  close(listen_fd);
+  for (i = 0; i < pid_num; i++) {
+    waitpid(pids[i], NULL, 0);
+  }
+  if (strchr(addr, ':') == NULL) {
+    unlink(addr);
+  }
+  free(pids);
+  free(pfds);
+  free(agents);
+  free(intv);
+  free(hist);
+  return rc;
+}
+
+/* requests are started after all sessions are ready to exclude handshakes */
+static int svr_peers_ready(void) {
+  int i;
+  for (i = 0; i < svr_peer_num; i++) {
+    h2_peer *peer = svr_peers[i].peer;
+    if (h2_peer_ready_sess_num(peer) <= 0 ||
+        h2_peer_ready_sess_num(peer) < h2_peer_sess_num(peer)) {
+      return 0;
+    }
   }
+  return 1;
+}
 
-  if (rsp || !retry_on_rst_stream) {
-    job->rsp_msg_num++;
-    /* prepare new request */
-    if (req_task->req_step + 1 < job->req_step_num) {
-      req_task->req_step += 1;
-    } else if (job->req_cnt < job->req_max) {
-      req_task->req_id = job->req_cnt++; 
-      req_task->req_step = 0;
-      req_task->prm_num = 0;
+static void peer_ready_cb(h2_peer *peer, void *peer_user_data,
+                          int ready_sess_num) {
+  client_job_t *job = peer_user_data;
+  (void)peer;
+  (void)ready_sess_num;
+
+  if (service_flag && !job->is_started && svr_peers_ready()) {
+    if (coord_fd >= 0) {
+      coord_agent_ready(job);  /* started on START of the controller */
     } else {
-      return 0;  /* no more request stream */
+      start_request(job);
     }
-    job->req_msg_num++;
   }
+}
 
-  /* send new request */
-  sleep_for_req_tps(job);
-  h2_msg *req = gen_request(job->req_step_msg[req_task->req_step], job,
-                            job->repl_sym_mask[req_task->req_step], req_task);
-  if (verbose) {
-    h2_dump_msg(stdout, req, "", "REQUEST[%d/%d,%d]",
-                req_task->req_id, req_task->req_step, req_task->par_idx);
+/* body bytes over the measure time; for bulk transfer benchmarks */
+static void print_throughput(client_job_t *job, double elapsed_sec) {
+  long long bytes = job->measure_tx_bytes + job->measure_rx_bytes;
+  long long cpu_usec = h2_proc_cpu_usec() - job->measure_cpu_usec;
+  double mhz = h2_cpu_mhz();
+
+  fprintf(stdout, "THROUGHPUT: tx=%lld rx=%lld body bytes: %.3f Gbps; "
+          "cpu=%lld usec %.2f cycles/byte at %.0f MHz; peak rss=%lld kB\n",
+          job->measure_tx_bytes, job->measure_rx_bytes,
+          (elapsed_sec > 0)? bytes * 8 / elapsed_sec / 1e9 : 0, cpu_usec,
+          (bytes > 0)? cpu_usec * mhz / bytes : 0, mhz, h2_peak_rss_kb());
+}
+
+static void print_result(client_job_t *job) {
+  double elapsed_sec;
+  long long retry_num = 0;
+  int i;
+
+  if (job->measure_usec <= 0) {
+    return;  /* not started */
   }
-  if (long_tr_thr_msec) {
-    gettimeofday(&req_task->req_tv, NULL);
+  elapsed_sec = (job->last_rsp_usec > job->measure_usec)?
+                (job->last_rsp_usec - job->measure_usec) / 1000000.0 : 0;
+  req_counting_line_clear();
+  if (job->warmup_req_cnt > 0) {
+    fprintf(stdout, "WARM-UP: %lld reqs excluded\n", job->warmup_req_cnt);
   }
-  req_task->req = req;  /* to be freed in response_cb */
-  h2_send_request(peer, req, response_cb, req_task);
-  req_counting_update(job);
-  /* may need to handle h2_send_request() error case */
-
-  /* check for all request sent, then terminate marking no more request */
-  if (job->req_msg_num >= job->req_msg_max) {
-    int i;
-    for (i = 0; i < svr_peer_num; i++) {
-      h2_terminate(svr_peers[i].peer, 1);
+  fprintf(stdout, "RESULT: %lld rsps (%lld errors) in %.3f secs: %.1f tps\n",
+          job->measure_rsp_num, job->measure_err_num, elapsed_sec,
+          (elapsed_sec > 0)? job->measure_rsp_num / elapsed_sec : 0);
+  for (i = 0; i < svr_peer_num; i++) {
+    retry_num += h2_peer_retry_cnt(svr_peers[i].peer);
+  }
+  if (retry_num > 0) {
+    fprintf(stdout, "RETRY: %lld reqs not processed by server sent again\n",
+            retry_num);
+  }
+  h2_hist_print(stdout, &job->lat_hist, "LATENCY(usec)");
+  print_prio_result(job);
+  print_throughput(job, elapsed_sec);
+  if (accept_encoding || rsp_decode) {
+    fprintf(stdout, "CONTENT CODING: identity=%lld gzip=%lld deflate=%lld "
+            "rsps; %lld body bytes received",
+            job->rsp_coding_num[H2_CODING_IDENTITY],
+            job->rsp_coding_num[H2_CODING_GZIP],
+            job->rsp_coding_num[H2_CODING_DEFLATE], job->rsp_body_bytes);
+    if (rsp_decode) {
+      fprintf(stdout, ", %lld decoded (%lld saved) in %lld cpu usec; "
+              "%lld errors", job->rsp_decoded_bytes,
+              job->rsp_decoded_bytes - job->rsp_body_bytes,
+              job->rsp_decode_cpu_usec, job->rsp_decode_err_num);
     }
-    req_counting_line_clear();
+    fprintf(stdout, "\n");
+  }
+  if (job->rsp_mpart_num > 0) {
+    fprintf(stdout, "MULTIPART: %lld rsps with %lld parts; %lld malformed\n",
+            job->rsp_mpart_num, job->rsp_mpart_part_num,
+            job->rsp_mpart_err_num);
   }
-
-  return 0;
 }
 
 static int push_promise_cb(h2_peer *peer, h2_msg *prm_req,
@@ -540,6 +2183,241 @@ static int push_response_cb(h2_peer *peer, h2_msg *prm_rsp,
 }
 
 
+/*
+ * Runtime Load Control -----------------------------------------------------
+ * commands on a local unix socket applied in the event loop by timer to
+ * drive a run through load levels without restart; a line per command,
+ * replied by a line of "OK ..." or "ERR ...":
+ *   tps <req_tps>           request tps; 0 for unlimited
+ *   par <req_par>           concurrent tasks; tasks over it stop at their
+ *                           next new req_id until raised again
+ *   pause | resume          all tasks hold the next request on pause
+ *   prio <prio[:weight],...>|off  priority mix of new req_ids as -O
+ *   report                  interim result since the last report
+ */
+
+#define CONTROL_CONN_MAX   4
+#define CONTROL_POLL_USEC  50000  /* command check */
+
+static coord_conn_t control_conn[CONTROL_CONN_MAX];  /* fd -1 if not used */
+static char control_path[PATH_MAX];
+
+/* listens on path.<pid> for -Z agents not to take over the others' */
+static int control_open(const char *path, int is_agent) {
+  int i;
+
+  if (strchr(path, ':')) {
+    fprintf(stderr, "-U needs a unix socket path: %s\n", path);
+    return -1;
+  }
+  if (is_agent) {
+    snprintf(control_path, sizeof(control_path), "%s.%d", path,
+             (int)getpid());
+  } else {
+    snprintf(control_path, sizeof(control_path), "%s", path);
+  }
+  if ((control_fd = coord_sock(control_path, 1)) < 0) {
+    return -1;
+  }
+  fcntl(control_fd, F_SETFL, fcntl(control_fd, F_GETFL) | O_NONBLOCK);
+  for (i = 0; i < CONTROL_CONN_MAX; i++) {
+    control_conn[i].fd = -1;
+  }
+  return 0;
+}
+
+static void control_close(void) {
+  int i;
+
+  if (control_fd < 0) {
+    return;
+  }
+  for (i = 0; i < CONTROL_CONN_MAX; i++) {
+    if (control_conn[i].fd >= 0) {
+      close(control_conn[i].fd);
+      control_conn[i].fd = -1;
+    }
+  }
+  close(control_fd);
+  control_fd = -1;
+  unlink(control_path);
+}
+
+/* sends held requests on resume, and starts idle and new tasks up to */
+/* req_par; lists are detached first for the tasks parked again */
+static void resume_req_tasks(client_job_t *job) {
+  int i, n, *idx;
+
+  if (!job->is_started || job->is_paused || job->replay) {
+    return;
+  }
+  if ((n = job->park_num) > 0 && (idx = malloc(n * sizeof(int)))) {
+    memcpy(idx, job->park_idx, n * sizeof(int));
+    job->park_num = 0;
+    for (i = 0; i < n; i++) {
+      req_task_t *req_task = get_req_task(job, idx[i]);
+      send_req_task(job, job->req_step_peer[req_task->req_step], req_task);
+    }
+    free(idx);
+  }
+  if ((n = job->idle_num) > 0 && (idx = malloc(n * sizeof(int)))) {
+    memcpy(idx, job->idle_idx, n * sizeof(int));
+    job->idle_num = 0;
+    for (i = 0; i < n; i++) {
+      if (idx[i] >= job->req_par || job->req_cnt >= job->req_max ||
+          !service_flag) {
+        job->idle_idx[job->idle_num++] = idx[i];
+      } else {
+        start_req_task(job, idx[i]);
+      }
+    }
+    free(idx);
+  }
+  while (service_flag && job->task_num < job->req_par &&
+         job->req_cnt < job->req_max) {
+    if (start_req_task(job, job->task_num) < 0) {
+      break;
+    }
+  }
+  check_all_req_sent(job);
+}
+
+/* interim result since the last report */
+static void control_report(client_job_t *job, char *buf, int size) {
+  long long cur_usec = h2_time_usec();
+  long long rsp_num = job->measure_rsp_num - job->ctl_last_rsp;
+  double intv_sec;
+
+  if (job->ctl_last_usec == 0) {
+    job->ctl_last_usec = (job->measure_usec > 0)? job->measure_usec :
+                                                  job->start_usec;
+  }
+  intv_sec = (cur_usec - job->ctl_last_usec) / 1000000.0;
+  snprintf(buf, size, "%.3fs: %lld rsps %.1f tps p50=%lld p90=%lld "
+           "p99=%lld max=%lld usec %lld errors; total %lld rsps %lld errors; "
+           "tps=%d par=%d tasks=%d parked=%d idle=%d%s%s",
+           intv_sec, rsp_num, (intv_sec > 0)? rsp_num / intv_sec : 0,
+           h2_hist_percentile(&job->ctl_hist, 50.0),
+           h2_hist_percentile(&job->ctl_hist, 90.0),
+           h2_hist_percentile(&job->ctl_hist, 99.0),
+           (job->ctl_hist.cnt)? job->ctl_hist.max : 0,
+           job->measure_err_num - job->ctl_last_err, job->measure_rsp_num,
+           job->measure_err_num, job->req_tps, job->req_par, job->task_num,
+           job->park_num, job->idle_num, (job->is_paused)? " paused" : "",
+           (job->is_warmup)? " warm-up" : "");
+  job->ctl_last_usec = cur_usec;
+  job->ctl_last_rsp = job->measure_rsp_num;
+  job->ctl_last_err = job->measure_err_num;
+  h2_hist_init(&job->ctl_hist);
+}
+
+/* returns 0(ok) or -1(error) with reply text in buf */
+static int control_cmd(client_job_t *job, char *line, char *buf, int size) {
+  char arg[256];
+  int n;
+
+  if (sscanf(line, "tps %d", &n) == 1) {
+    if (n < 0) {
+      snprintf(buf, size, "invalid tps: %d", n);
+      return -1;
+    }
+    job->req_tps = n;
+    rebase_req_tps(job);
+    snprintf(buf, size, "tps=%d", n);
+  } else if (sscanf(line, "par %d", &n) == 1) {
+    if (n < 1) {
+      snprintf(buf, size, "invalid par: %d", n);
+      return -1;
+    }
+    if (grow_req_task_pool(job, n) < 0) {
+      snprintf(buf, size, "cannot allocate tasks: par=%d", n);
+      return -1;
+    }
+    job->req_par = n;
+    resume_req_tasks(job);
+    snprintf(buf, size, "par=%d", n);
+  } else if (!strcmp(line, "pause")) {
+    job->is_paused = 1;
+    snprintf(buf, size, "paused");
+  } else if (!strcmp(line, "resume")) {
+    job->is_paused = 0;
+    rebase_req_tps(job);  /* not to catch up the paused time */
+    resume_req_tasks(job);
+    snprintf(buf, size, "resumed");
+  } else if (sscanf(line, "prio %255s", arg) == 1) {
+    int mix[H2_PRIO_MAX + 1], weight[H2_PRIO_MAX + 1];
+    int num = job->prio_mix_num;
+
+    memcpy(mix, job->prio_mix, sizeof(mix));
+    memcpy(weight, job->prio_mix_weight, sizeof(weight));
+    job->prio_mix_num = 0;
+    if (strcmp(arg, "off") && get_prio_mix(arg, job) < 0) {
+      memcpy(job->prio_mix, mix, sizeof(mix));
+      memcpy(job->prio_mix_weight, weight, sizeof(weight));
+      job->prio_mix_num = num;
+      snprintf(buf, size, "invalid prio mix: %s", arg);
+      return -1;
+    }
+    memset(job->prio_mix_wrr, 0, sizeof(job->prio_mix_wrr));
+    snprintf(buf, size, "prio=%s", arg);
+  } else if (!strcmp(line, "report")) {
+    control_report(job, buf, size);
+  } else {
+    snprintf(buf, size, "unknown command: %s; tps <n> | par <n> | pause | "
+             "resume | prio <prio[:weight],...>|off | report", line);
+    return -1;
+  }
+  return 0;
+}
+
+static void control_cb(h2_ctx *ctx, void *user_data) {
+  client_job_t *job = user_data;
+  char buf[1024], *line;
+  int i, fd, eof;
+
+  while ((fd = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+    for (i = 0; i < CONTROL_CONN_MAX && control_conn[i].fd >= 0; i++);
+    if (i == CONTROL_CONN_MAX) {
+      coord_send(fd, "ERR too many control connections\n");
+      close(fd);
+      continue;
+    }
+    control_conn[i].fd = fd;
+    control_conn[i].len = 0;
+    control_conn[i].line_len = 0;
+  }
+
+  for (i = 0; i < CONTROL_CONN_MAX; i++) {
+    coord_conn_t *cc = &control_conn[i];
+    if (cc->fd < 0) {
+      continue;
+    }
+    eof = 0;
+    while (service_flag && (line = coord_recv_line(cc, &eof))) {
+      int len = strlen(line);
+      if (len > 0 && line[len - 1] == '\r') {
+        line[len - 1] = '\0';
+      }
+      if (line[0] == '\0') {
+        continue;
+      }
+      int r = control_cmd(job, line, buf, sizeof(buf));
+      coord_send(cc->fd, "%s %s\n", (r < 0)? "ERR" : "OK", buf);
+      if (r == 0) {
+        req_counting_line_clear();
+        fprintf(stdout, "CONTROL %s: %s\n", line, buf);
+        fflush(stdout);
+      }
+    }
+    if (eof) {
+      close(cc->fd);
+      cc->fd = -1;
+    }
+  }
+  h2_timer_add(ctx, CONTROL_POLL_USEC, control_cb, job);
+}
+
+
 /*
  * Application main and runtime argument parsers ----------------------------
  */
@@ -550,8 +2428,12 @@ static void help(char *prog) {
   fprintf(stderr, "client_run_options:\n");
   fprintf(stderr, "  -P req_parallel       # default:1\n");
   fprintf(stderr, "  -C req_max_count      # default:1; 0 for idle conn\n");
+  fprintf(stderr, "  -d duration           # unbounded requests for secs or as Nm, Nh; -C ignored\n");
+  fprintf(stderr, "  -I interval_secs      # soak sample and drift check interval;\n");
+  fprintf(stderr, "                        # default:0(off), duration/20 (1~60) on -d\n");
   fprintf(stderr, "  -T req_tps            # request tps; 0 for unlimited; default:0\n");
   fprintf(stderr, "  -S sess_per_peer      # sessions per server: default:1\n");
+  fprintf(stderr, "  -W warmup             # warm-up req count or secs as Ns; excluded from stat\n");
   fprintf(stderr, "  -R symbol=format      # replace symbol by format on req_id / modular M\n");
   fprintf(stderr, "  -M modular_base       # modular to be applied on req_id for -R; 0: unlimited\n");
 #ifdef TLS_MODE
@@ -565,17 +2447,51 @@ static void help(char *prog) {
   fprintf(stderr, "     # <settings_id> := \n");
   fprintf(stderr, "     # Peer Session Management:\n");
   fprintf(stderr, "     #   sess_num, reconn_max, req_max_per_sess\n");
+  fprintf(stderr, "     #   retry_unprocessed: resend count of request not processed\n");
+  fprintf(stderr, "     #     by server (GOAWAY, REFUSED_STREAM); default:2, 0:off\n");
   fprintf(stderr, "     # HTTP/2 Settings:\n");
   fprintf(stderr, "     #   header_table_size | enable_push |\n");
   fprintf(stderr, "     #   max_concurrent_streams, initial_window_size | max_frame_size\n");
   fprintf(stderr, "     #   max_header_list_size, enable_connect_protocol\n");
+  fprintf(stderr, "     #   conn_window_size: connection receive window\n");
   fprintf(stderr, "     # HTTP/1.1 Settings:\n");
   fprintf(stderr, "     #   single_req\n");
+  fprintf(stderr, "     # HTTP/2 Request DATA Scheduling:\n");
+  fprintf(stderr, "     #   data_sched=rr|fifo|srpt\n");
+  fprintf(stderr, "     # Request Priority Lanes by 3gpp-sbi-message-priority class:\n");
+  fprintf(stderr, "     #   prio_sched=off|strict|wrr; requests over the stream room\n");
+  fprintf(stderr, "     #   of sessions wait in lanes; wrr weights 8:4:2:1 by class\n");
+  fprintf(stderr, "     # Network Emulation on sent bytes; 0 for off:\n");
+  fprintf(stderr, "     #   emu_delay(msec), emu_jitter(msec), emu_rate(kbit/s),\n");
+  fprintf(stderr, "     #   emu_loss(per mille), emu_read_stall(msec after each read),\n");
+  fprintf(stderr, "     #   emu_read_rate(kbit/s), emu_sess_pct(percent of sessions)\n");
   fprintf(stderr, "  -1                    # use HTTP/1.1 instead of HTTP/2\n");
   fprintf(stderr, "  -Q                    # h2sim io quiet mode\n");
   fprintf(stderr, "  -q                    # all quiet mode\n");
   fprintf(stderr, "  -D threshold_msec     # show long transactions\n");
   fprintf(stderr, "  -r # retry request on rst stream; default:handle-as-error-response\n");
+  fprintf(stderr, "  -G folded_file        # cpu profile as folded stacks at exit\n");
+  fprintf(stderr, "  -z accept_encoding    # e.g. \"gzip, deflate\"; unless set by -x\n");
+  fprintf(stderr, "  -i                    # inflate encoded responses to validate\n");
+  fprintf(stderr, "  -L capture_file       # replay requests captured by h2svr -C at the\n");
+  fprintf(stderr, "                        # captured timing to the first req step's server;\n");
+  fprintf(stderr, "                        # -P, -C and -T are ignored; no -d and -W\n");
+  fprintf(stderr, "  -X replay_speed       # time scale of -L; 2 for twice faster; default:1\n");
+  fprintf(stderr, "  -Z agent_num[@addr]   # coordinated run by agents with merged result;\n");
+  fprintf(stderr, "                        # -C, -P and -T are split over agents;\n");
+  fprintf(stderr, "                        # local agents are launched without @addr, or\n");
+  fprintf(stderr, "                        # agents attached by -K addr are waited for;\n");
+  fprintf(stderr, "                        # addr is host:port or unix socket path\n");
+  fprintf(stderr, "  -K controller_addr    # run as an agent of -Z at the addr\n");
+  fprintf(stderr, "  -O prio[:weight],...  # 3gpp-sbi-message-priority mix of requests\n");
+  fprintf(stderr, "                        # by weight; latency is shown per class\n");
+  fprintf(stderr, "  -l result_log_file    # binary record per request of send time, latency,\n");
+  fprintf(stderr, "                        # status, step, session and bytes; see h2rlog;\n");
+  fprintf(stderr, "                        # .<pid> is appended for -Z agents\n");
+  fprintf(stderr, "  -U control_sock_path  # runtime load control by unix socket commands:\n");
+  fprintf(stderr, "                        # tps <n>, par <n>, pause, resume,\n");
+  fprintf(stderr, "                        # prio <prio[:weight],...>|off, report;\n");
+  fprintf(stderr, "                        # .<pid> is appended for -Z agents; no -L\n");
   fprintf(stderr, "request_options:\n");
   fprintf(stderr, "  # -m starts each request step\n");
   fprintf(stderr, "  # previous step's -s and -a are used if not specifiied\n");
@@ -592,7 +2508,12 @@ static void help(char *prog) {
   fprintf(stderr, "  -t req_body_text\n");
   fprintf(stderr, "  -b req_body_hex_binary\n");
   fprintf(stderr, "  -f req_body_file\n");
-  fprintf(stderr, "  -e req_body_size      # dummy zero value body of given size\n");
+  fprintf(stderr, "  -e req_body_size      # dummy zero value body of given size;\n");
+  fprintf(stderr, "                        # k, m or g suffix for 1024 based units\n");
+  fprintf(stderr, "  -y content_type[:content_id]=file|0xhex\n");
+  fprintf(stderr, "                        # multipart/related req body part\n");
+  fprintf(stderr, "  -J symbol=json_pointer  # capture response json value as symbol\n");
+  fprintf(stderr, "                        # to be replaced in the next steps; ex) -J __ID__=/nfInstanceId\n");
   fprintf(stderr, "NOTE: now, only the first req step's scheme and authority is used\n");
 }
 
@@ -624,7 +2545,154 @@ static int get_replace_symbol(char *symbol_format_str, client_job_t *job) {
   return 0;
 }
 
-h2_ctx *ctx = NULL;
+static int get_capture_symbol(char *symbol_pointer_str, client_job_t *job) {
+  char *ptr_str;
+  capture_t *capt;
+
+  if ((ptr_str = strchr(symbol_pointer_str, '=')) == NULL) {
+    fprintf(stderr, "capture option should be symbol=json_pointer format: "
+            "%s\n", symbol_pointer_str);
+    return -1;
+  }
+  if (job->req_step_num <= 0) {
+    fprintf(stderr, "capture option should follow -m of the step: %s\n",
+            symbol_pointer_str);
+    return -2;
+  }
+  if (job->capt_num >= CAPTURE_MAX) {
+    fprintf(stderr, "too many capture symbols; max=%d: %s\n",
+            CAPTURE_MAX, symbol_pointer_str);
+    return -3;
+  }
+  capt = &job->capt[job->capt_num];
+  if ((capt->ptr = h2_json_ptr_compile(ptr_str + 1)) == NULL) {
+    return -4;
+  }
+  capt->sym_len = ptr_str - symbol_pointer_str;
+  capt->sym = strndup(symbol_pointer_str, capt->sym_len);
+  capt->req_step = job->req_step_num - 1;
+  job->capt_num++;
+  return 0;
+}
+
+/* add -y content_type[:content_id]=file|0xhex part to the req step */
+static int add_req_mpart(mpart_body_t *mb, char *part_str) {
+  if (mb->part_num >= H2_MPART_MAX) {
+    fprintf(stderr, "too many multipart parts per req step; max=%d: %s\n",
+            H2_MPART_MAX, part_str);
+    return -1;
+  }
+  if (h2_mpart_load(&mb->part[mb->part_num], part_str) < 0) {
+    return -2;
+  }
+  mb->part_num++;
+  return 0;
+}
+
+/* returns 1 if any replace or capture symbol is in the parts */
+static int mpart_has_symbol(client_job_t *job, mpart_body_t *mb) {
+  int i, j;
+  for (i = 0; i < mb->part_num; i++) {
+    for (j = 0; j < job->repl_sym_num; j++) {
+      if (memmem(mb->part[i].body, mb->part[i].body_len,
+                 job->repl_sym[j].sym, job->repl_sym[j].sym_len)) {
+        return 1;
+      }
+    }
+    for (j = 0; j < job->capt_num; j++) {
+      if (memmem(mb->part[i].body, mb->part[i].body_len,
+                 job->capt[j].sym, job->capt[j].sym_len)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* set req step body as iov of the parts */
+/* NOTE: parts with symbols are flattened once to be replaced per request */
+static int build_req_mpart(client_job_t *job, int req_step) {
+  h2_msg *req = job->req_step_msg[req_step];
+  mpart_body_t *mb = &job->req_step_mpart[req_step];
+  const struct iovec *iov;
+  int i, n, len;
+
+  if (mb->part_num == 0) {
+    return 0;
+  }
+  if (h2_body_len(req) > 0) {
+    fprintf(stderr, "multipart parts cannot be used with req body; "
+            "in %dth req step\n", req_step + 1);
+    return -1;
+  }
+  if (h2_mpart_set_body(req, mb->part, mb->part_num, &mb->hdr_buf) < 0) {
+    return -2;
+  }
+  if (mpart_has_symbol(job, mb)) {
+    char *body, *p;
+    iov = h2_body_iov(req, &n);
+    for (i = 0, len = 0; i < n; i++) {
+      len += iov[i].iov_len;
+    }
+    p = body = malloc(len + 1);
+    for (i = 0; i < n; i++) {
+      memcpy(p, iov[i].iov_base, iov[i].iov_len);
+      p += iov[i].iov_len;
+    }
+    *p = '\0';
+    h2_set_body(req, body, len);
+  }
+  return 0;
+}
+
+static void free_req_mpart(mpart_body_t *mb) {
+  h2_mpart_free(mb->part, mb->part_num);
+  mb->part_num = 0;
+  free(mb->hdr_buf);
+  mb->hdr_buf = NULL;
+}
+
+static void free_client_job(client_job_t *job) {
+  int i;
+
+  /* free parallel task pool */
+  for (i = 0; job->req_task_pool &&
+              i < (job->task_par_max + REQ_TASK_CHUNK - 1) / REQ_TASK_CHUNK;
+       i++) {
+    free(job->req_task_pool[i]);
+  }
+  free(job->req_task_pool);
+  free(job->park_idx);
+  free(job->idle_idx);
+  for (i = 0; i < SOAK_METRIC_NUM; i++) {
+    free(job->soak_val[i]);
+  }
+
+  /* free client job */
+  for (i = 0; i <= job->req_step_num && i < REQ_STEP_MAX; i++) {
+    h2_msg_free(job->req_step_msg[i]);
+    free_req_mpart(&job->req_step_mpart[i]);
+    free(job->req_step_bulk[i]);
+  }
+  for (i = 0; i < job->repl_sym_num; i++) {
+    free(job->repl_sym[i].sym);
+    job->repl_sym[i].sym = NULL;
+    free(job->repl_sym[i].fmt);
+    job->repl_sym[i].fmt = NULL;
+  }
+  if (job->capt_val) {
+    for (i = 0; i < job->task_par_max * job->capt_num; i++) {
+      free(job->capt_val[i]);
+    }
+    free(job->capt_val);
+  }
+  for (i = 0; i < job->capt_num; i++) {
+    free(job->capt[i].sym);
+    h2_json_ptr_free(job->capt[i].ptr);
+  }
+  free(job->replay_req_usec);
+  h2_cap_close(job->replay, NULL);
+}
 
 void sighdlr_mark_stop(int signo) {
   (void)signo;
@@ -646,6 +2714,11 @@ int main(int argc, char **argv) {
   void *body;
   int body_len;
   int http_ver = H2_HTTP_V2;
+  char *prof_file = NULL;
+  char *coord_spec = NULL;  /* controller of -Z */
+  char *result_log_file = NULL;  /* -l */
+  char *control_spec = NULL;     /* -U */
+  char *coord_addr = NULL;  /* agent of -K */
 
   h2_settings settings;
   h2_settings_init(&settings);
@@ -659,9 +2732,10 @@ int main(int argc, char **argv) {
 #endif
   job.req_step_msg[0] = req;
 
-  int c;
+  int c, n;
   char scale;
-  while ((c = getopt(argc, argv, "P:C:T:S:R:M:k:c:V:H:1QqD:rm:u:s:a:p:x:t:b:f:e:h")) >= 0) {
+  long long body_size;
+  while ((c = getopt(argc, argv, "P:C:d:I:T:S:W:R:M:k:c:V:H:1QqD:rG:z:iL:X:Z:K:O:l:U:m:u:s:a:p:x:t:b:f:e:y:J:h")) >= 0) {
     switch (c) {
     /* client run options */
     case 'P':  /* concurrent requests (ie. streams) */
@@ -670,18 +2744,45 @@ int main(int argc, char **argv) {
         job.req_par = 1;
       break;
     case 'C':  /* total request counts; 0 for no request and idle conn only */
-      job.req_max = atoi(optarg);
+      job.req_max = atoll(optarg);
       if (job.req_max < 0) {
         fprintf(stderr, "invalid req_max; should be >= 0: %s\n", optarg);
         return EXIT_FAILURE;
       }
       break;
+    case 'd':  /* duration mode; request until duration */
+      n = sscanf(optarg, "%lld%c", &job.duration_usec, &scale);
+      if (n == 2 && (scale == 's' || scale == 'm' || scale == 'h')) {
+        job.duration_usec *= (scale == 'h')? 3600 : (scale == 'm')? 60 : 1;
+      } else if (n != 1) {
+        job.duration_usec = 0;
+      }
+      if (job.duration_usec <= 0) {
+        fprintf(stderr, "invalid -d duration option value: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      job.duration_usec *= 1000000;
+      break;
+    case 'I':
+      job.soak_intv_usec = (long long)atoi(optarg) * 1000000;
+      break;
     case 'T':
       job.req_tps = atoi(optarg);
       break;
     case 'S':
       settings.sess_num = atoi(optarg);
       break;
+    case 'W':
+      if (sscanf(optarg, "%d%c", &job.warmup_req, &scale) == 2 &&
+          scale == 's') {
+        job.warmup_usec = (long long)job.warmup_req * 1000000;
+        job.warmup_req = 0;
+      } else if (sscanf(optarg, "%d%c", &job.warmup_req, &scale) != 1 ||
+                 job.warmup_req < 0) {
+        fprintf(stderr, "invalid -W warmup option value: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
     case 'R':
       if (get_replace_symbol(optarg, &job) < 0) {
         return EXIT_FAILURE;
@@ -724,6 +2825,48 @@ int main(int argc, char **argv) {
     case 'r':
       retry_on_rst_stream = 1;
       break;
+    case 'G':
+      prof_file = optarg;
+      break;
+    case 'z':
+      accept_encoding = optarg;
+      break;
+    case 'i':
+      rsp_decode = 1;
+      break;
+    case 'L':
+      if (job.replay) {
+        fprintf(stderr, "-L capture file is already given: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      if ((job.replay = h2_cap_map(optarg)) == NULL) {
+        return EXIT_FAILURE;
+      }
+      if (h2_cap_rec_num(job.replay) == 0) {
+        fprintf(stderr, "no request in capture file: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'X':
+      job.replay_speed = atof(optarg);
+      if (job.replay_speed <= 0) {
+        fprintf(stderr, "invalid -X replay_speed; should be > 0: %s\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'Z':
+      coord_spec = optarg;
+      break;
+    case 'K':
+      coord_addr = optarg;
+      break;
+    case 'l':
+      result_log_file = optarg;
+      break;
+    case 'U':
+      control_spec = optarg;
+      break;
 
     /* request step options */
     case 'm':  /* http request method */
@@ -780,14 +2923,52 @@ int main(int argc, char **argv) {
       h2_set_body(req, body, body_len);
       break;
     case 'e':
-      if (sscanf(optarg, "%d%c", &body_len, &scale) == 2 &&
-          (scale == 'k' || scale == 'K')) {
-        body_len *= 1024; 
-      } else if (sscanf(optarg, "%d%c", &body_len, &scale) != 1) {
+      n = sscanf(optarg, "%lld%c", &body_size, &scale);
+      if (n == 2 && strchr("kKmMgG", scale) && scale) {
+        body_size <<= (tolower(scale) == 'g')? 30 :
+                      (tolower(scale) == 'm')? 20 : 10;
+      } else if (n != 1) {
         fprintf(stderr, "invalid -e req_body_size option value: %s\n", optarg);
         return EXIT_FAILURE;
       }
-      h2_set_body(req, calloc(1, body_len + 1), body_len);
+      if (body_size < 0 || body_size >= INT_MAX) {
+        fprintf(stderr, "-e req_body_size should be less than 2g: %s\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      body_len = (int)body_size;
+      n = (job.req_step_num > 0)? job.req_step_num - 1 : 0;
+      free(job.req_step_bulk[n]);
+      job.req_step_bulk[n] = NULL;
+      if (body_len >= BULK_BODY_MIN) {
+        /* not copied per request; sent from the one buffer */
+        struct iovec iov;
+        job.req_step_bulk[n] = iov.iov_base = calloc(1, body_len);
+        iov.iov_len = body_len;
+        h2_set_body_iov(req, &iov, 1);
+      } else {
+        h2_set_body(req, calloc(1, body_len + 1), body_len);
+      }
+      break;
+    case 'y':  /* http request multipart body part */
+      if (job.req_step_num == 0) {
+        fprintf(stderr, "-y should follow -m of the req step: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      if (add_req_mpart(&job.req_step_mpart[job.req_step_num - 1],
+                        optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'J':  /* capture response json value */
+      if (get_capture_symbol(optarg, &job) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'O':  /* request priority mix */
+      if (get_prio_mix(optarg, &job) < 0) {
+        return EXIT_FAILURE;
+      }
       break;
 
     case 'h':
@@ -828,8 +3009,71 @@ int main(int argc, char **argv) {
     }
   } 
 
-  /* init parallel task table */
-  job.req_par_task = calloc(job.req_par, sizeof(req_task_t));
+  if (job.replay) {
+    if (job.duration_usec > 0 || job.warmup_req > 0 || job.warmup_usec > 0) {
+      fprintf(stderr, "-d and -W are not for -L replay\n");
+      return EXIT_FAILURE;
+    }
+    if (control_spec) {
+      fprintf(stderr, "-U is not for -L replay\n");
+      return EXIT_FAILURE;
+    }
+    if (job.replay_speed <= 0) {
+      job.replay_speed = 1.0;
+    }
+  }
+
+  /* coordinated run; agents are launched with -K to override -Z */
+  if (coord_addr) {
+    if (job.replay) {
+      fprintf(stderr, "-L is not for -K agent\n");
+      return EXIT_FAILURE;
+    }
+    if (coord_agent_attach(&job, coord_addr) < 0) {
+      return EXIT_FAILURE;
+    }
+  } else if (coord_spec) {
+    if (job.replay) {
+      fprintf(stderr, "-L is not for -Z coordinated run\n");
+      return EXIT_FAILURE;
+    }
+    n = coord_run(&job, coord_spec, argc, argv);
+    free_client_job(&job);
+    return n;
+  }
+
+  /* soak sampling interval default on duration mode */
+  if (job.duration_usec > 0 && job.soak_intv_usec == 0) {
+    job.soak_intv_usec = job.duration_usec / 20;
+    if (job.soak_intv_usec < 1000000) {
+      job.soak_intv_usec = 1000000;
+    } else if (job.soak_intv_usec > 60000000) {
+      job.soak_intv_usec = 60000000;
+    }
+  }
+  if (job.soak_intv_usec < 0) {
+    job.soak_intv_usec = 0;
+  }
+
+  /* init parallel task pool; chunks are alloced on use */
+  if (grow_req_task_pool(&job, job.req_par) < 0) {
+    fprintf(stderr, "cannot allocate task pool: req_par=%d\n", job.req_par);
+    return EXIT_FAILURE;
+  }
+
+  if (accept_encoding) {
+    for (i = 0; i < job.req_step_num; i++) {
+      if (!h2_hdr_value(job.req_step_msg[i], "accept-encoding")) {
+        h2_add_hdr(job.req_step_msg[i], "accept-encoding", accept_encoding);
+      }
+    }
+  }
+
+  for (i = 0; i < job.req_step_num; i++) {
+    if (build_req_mpart(&job, i) < 0) {
+      return EXIT_FAILURE;
+    }
+  }
 
   /* job's all fields are ready */
   update_replace_symbol_mask(&job);
@@ -837,6 +3081,11 @@ int main(int argc, char **argv) {
   signal(SIGPIPE, SIG_IGN);
   signal(SIGINT, sighdlr_mark_stop);
 
+  /* start before connect to profile tls handshakes also */
+  if (prof_file && h2_prof_start(0) < 0) {
+    return EXIT_FAILURE;
+  }
+
   SSL_CTX *ssl_ctx = NULL;
 #ifdef TLS_MODE
   SSL_load_error_strings();
@@ -850,6 +3099,19 @@ int main(int argc, char **argv) {
 #endif
   ctx = h2_ctx_init(http_ver, verbose_h2);
 
+  if (result_log_file) {
+    if (result_log_open(result_log_file, coord_addr != NULL) < 0) {
+      return EXIT_FAILURE;
+    }
+    h2_timer_add(ctx, RESULT_LOG_FLUSH_USEC, result_log_timer_cb, NULL);
+  }
+  if (control_spec) {
+    if (control_open(control_spec, coord_addr != NULL) < 0) {
+      return EXIT_FAILURE;
+    }
+    h2_timer_add(ctx, CONTROL_POLL_USEC, control_cb, &job);
+  }
+
   /* create sessions for all <scheme, authority> */
   for (i = 0; i < job.req_step_num; i++) {
     const char *scheme = h2_scheme(job.req_step_msg[i]);
@@ -884,32 +3146,49 @@ int main(int argc, char **argv) {
     }
   }
 
-  /* initial requests logic per parallel streams */
-  start_request(&job);
+  /* initial requests logic per parallel streams on all sessions ready */
+  for (i = 0; i < svr_peer_num; i++) {
+    h2_peer_set_ready_cb(svr_peers[i].peer, peer_ready_cb);
+  }
+  if (svr_peers_ready()) {
+    if (coord_fd >= 0) {
+      coord_agent_ready(&job);
+    } else {
+      start_request(&job);
+    }
+  }
+  if (coord_fd >= 0) {
+    h2_timer_add(ctx, COORD_POLL_USEC, coord_agent_cb, &job);
+  }
 
   h2_ctx_run(ctx);
 
+  control_close();
+  if (coord_fd >= 0) {
+    coord_agent_done(&job);
+  }
+
+  print_result(&job);
+  print_replay_result(&job);
+  print_capture_result(&job);
+  print_soak_result(&job);
+  if (result_log) {
+    h2_rlog_close(result_log, stdout);
+  }
+
   h2_ctx_free(ctx); 
+  if (prof_file) {
+    h2_prof_stop(prof_file, stdout);
+  }
 #ifdef TLS_MODE
   if (ssl_ctx) {
+    h2_ssl_ctx_print_stat(stdout, ssl_ctx, "CLIENT");
     SSL_CTX_free(ssl_ctx);
     ERR_free_strings();
   }
 #endif
 
-  /* free parallel task table */
-  free(job.req_par_task);
-
-  /* free client job */
-  for (i = 0; i <= job.req_step_num && i < REQ_STEP_MAX; i++) {
-    h2_msg_free(job.req_step_msg[i]);
-  }
-  for (i = 0; i < job.repl_sym_num; i++) {
-    free(job.repl_sym[i].sym);
-    job.repl_sym[i].sym = NULL;
-    free(job.repl_sym[i].fmt);
-    job.repl_sym[i].fmt = NULL;
-  }
+  free_client_job(&job);
 
   return 0;
 }
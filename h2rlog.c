@@ -0,0 +1,286 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * h2rlog - converts h2cli -l result log to csv or aggregates
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "h2sim/h2.h"
+
+
+/* aggregation keys */
+enum {
+  KEY_STATUS,
+  KEY_STEP,
+  KEY_SESS,
+  KEY_PRIO,
+  KEY_TIME,
+  KEY_NUM
+};
+
+static const char *key_name[KEY_NUM] = {
+  "status", "step", "sess", "prio", "time"
+};
+
+typedef struct {
+  long long key;
+  long long no_rsp_num;
+  long long req_bytes;
+  long long rsp_bytes;
+  h2_hist lat_hist;  /* latency in usec of records with response */
+} group_t;
+
+/* groups sorted by key; records are nearly in key order for time key */
+typedef struct {
+  group_t **group;
+  int group_num;
+  int group_alloced;
+} group_set_t;
+
+static long long rec_key(const h2_rlog_rec *rec, int key,
+                         long long intv_usec) {
+  switch (key) {
+  case KEY_STATUS:
+    return rec->status;
+  case KEY_STEP:
+    return rec->step;
+  case KEY_SESS:
+    return (rec->sess_idx == 0xffff)? -1 : rec->sess_idx;
+  case KEY_PRIO:
+    return rec->prio;
+  default:
+    return rec->send_usec / intv_usec;
+  }
+}
+
+static group_t *get_group(group_set_t *gs, long long key) {
+  group_t *g;
+  int lo = 0, hi = gs->group_num;
+
+  if (hi > 0 && gs->group[hi - 1]->key == key) {
+    return gs->group[hi - 1];  /* most likely on time key */
+  }
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (gs->group[mid]->key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < gs->group_num && gs->group[lo]->key == key) {
+    return gs->group[lo];
+  }
+
+  if (gs->group_num == gs->group_alloced) {
+    int n = (gs->group_alloced)? gs->group_alloced * 2 : 64;
+    void *p;
+    if ((p = realloc(gs->group, sizeof(group_t *) * n)) == NULL) {
+      return NULL;
+    }
+    gs->group = p;
+    gs->group_alloced = n;
+  }
+  if ((g = calloc(1, sizeof(*g))) == NULL) {
+    return NULL;
+  }
+  g->key = key;
+  h2_hist_init(&g->lat_hist);
+  memmove(&gs->group[lo + 1], &gs->group[lo],
+          sizeof(group_t *) * (gs->group_num - lo));
+  gs->group[lo] = g;
+  gs->group_num++;
+  return g;
+}
+
+static void print_csv(h2_rlog *rlog, int is_abs_time) {
+  const h2_rlog_rec *rec = h2_rlog_recs(rlog);
+  long long i, n = h2_rlog_rec_num(rlog);
+  long long base = (is_abs_time)? h2_rlog_start_time_usec(rlog) : 0;
+
+  printf("send_usec,latency_usec,status,step,sess,req_id,prio,"
+         "req_bytes,rsp_bytes,no_rsp,warmup,replay\n");
+  for (i = 0; i < n; i++, rec++) {
+    printf("%lld,%" PRIu32 ",%d,%d,%d,%" PRIu32 ",%d,%" PRIu32 ",%" PRIu32
+           ",%d,%d,%d\n",
+           base + (long long)rec->send_usec, rec->latency_usec, rec->status,
+           rec->step, (rec->sess_idx == 0xffff)? -1 : rec->sess_idx,
+           rec->req_id, rec->prio, rec->req_bytes, rec->rsp_bytes,
+           !!(rec->flags & H2_RLOG_F_NO_RSP),
+           !!(rec->flags & H2_RLOG_F_WARMUP),
+           !!(rec->flags & H2_RLOG_F_REPLAY));
+  }
+}
+
+static int print_aggr(h2_rlog *rlog, int key, long long intv_usec,
+                      int with_warmup) {
+  const h2_rlog_rec *rec = h2_rlog_recs(rlog);
+  long long i, n = h2_rlog_rec_num(rlog);
+  group_set_t gs = { NULL, 0, 0 };
+  group_t *g;
+  h2_hist *hist;
+
+  for (i = 0; i < n; i++, rec++) {
+    if ((rec->flags & H2_RLOG_F_WARMUP) && !with_warmup) {
+      continue;
+    }
+    if ((g = get_group(&gs, rec_key(rec, key, intv_usec))) == NULL) {
+      fprintf(stderr, "cannot allocate group: %d groups\n", gs.group_num);
+      return -1;
+    }
+    if (rec->flags & H2_RLOG_F_NO_RSP) {
+      g->no_rsp_num++;
+    } else {
+      h2_hist_add(&g->lat_hist, rec->latency_usec);
+    }
+    g->req_bytes += rec->req_bytes;
+    g->rsp_bytes += rec->rsp_bytes;
+  }
+
+  printf("%s%s,reqs,rsps,no_rsp,%savg_usec,p50_usec,p90_usec,p99_usec,"
+         "max_usec,req_bytes,rsp_bytes\n",
+         key_name[key], (key == KEY_TIME)? "_sec" : "",
+         (key == KEY_TIME)? "rsp_tps," : "");
+  for (i = 0; i < gs.group_num; i++) {
+    g = gs.group[i];
+    hist = &g->lat_hist;
+    if (key == KEY_TIME) {
+      printf("%.3f,", g->key * intv_usec / 1000000.0);
+    } else {
+      printf("%lld,", g->key);
+    }
+    printf("%lld,%lld,%lld,", hist->cnt + g->no_rsp_num, hist->cnt,
+           g->no_rsp_num);
+    if (key == KEY_TIME) {
+      printf("%.1f,", hist->cnt * 1000000.0 / intv_usec);
+    }
+    printf("%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+           (hist->cnt)? hist->sum / hist->cnt : 0,
+           h2_hist_percentile(hist, 50.0), h2_hist_percentile(hist, 90.0),
+           h2_hist_percentile(hist, 99.0), (hist->cnt)? hist->max : 0,
+           g->req_bytes, g->rsp_bytes);
+    free(g);
+  }
+  free(gs.group);
+  return 0;
+}
+
+static void print_summary(h2_rlog *rlog) {
+  const h2_rlog_rec *rec = h2_rlog_recs(rlog);
+  long long i, n = h2_rlog_rec_num(rlog);
+  long long no_rsp_num = 0, warmup_num = 0, last_usec = 0;
+
+  for (i = 0; i < n; i++, rec++) {
+    no_rsp_num += !!(rec->flags & H2_RLOG_F_NO_RSP);
+    warmup_num += !!(rec->flags & H2_RLOG_F_WARMUP);
+    if (rec->send_usec > last_usec) {
+      last_usec = rec->send_usec;
+    }
+  }
+  fprintf(stderr, "RESULT LOG: %lld records; no_rsp=%lld warmup=%lld; "
+          "start_time_usec=%lld send span=%.3f sec\n",
+          n, no_rsp_num, warmup_num, h2_rlog_start_time_usec(rlog),
+          last_usec / 1000000.0);
+}
+
+static void help(char *prog) {
+  fprintf(stderr, "%s [options] result_log_file\n", prog);
+  fprintf(stderr, "  # converts h2cli -l result log; csv of all records "
+                  "by default\n");
+  fprintf(stderr, "  -g status|step|sess|prio|time  # aggregate by key as csv "
+                  "of rsps, no_rsp,\n");
+  fprintf(stderr, "                        # latency percentiles and bytes; "
+                  "time is by send time\n");
+  fprintf(stderr, "  -i interval_msec      # time key interval; default:1000\n");
+  fprintf(stderr, "  -w                    # include warm-up records in "
+                  "aggregates\n");
+  fprintf(stderr, "  -t                    # wall clock send_usec since epoch "
+                  "in csv\n");
+  fprintf(stderr, "  -s                    # print summary of the log to "
+                  "stderr\n");
+}
+
+int main(int argc, char **argv) {
+  h2_rlog *rlog;
+  int c, i, key = -1, with_warmup = 0, is_abs_time = 0, is_summary = 0, r = 0;
+  long long intv_usec = 1000000;
+
+  while ((c = getopt(argc, argv, "g:i:wtsh")) >= 0) {
+    switch (c) {
+    case 'g':
+      for (i = 0; i < KEY_NUM && strcmp(optarg, key_name[i]); i++);
+      if (i == KEY_NUM) {
+        fprintf(stderr, "unknown -g key: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      key = i;
+      break;
+    case 'i':
+      intv_usec = atoll(optarg) * 1000;
+      if (intv_usec <= 0) {
+        fprintf(stderr, "invalid -i interval_msec: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'w':
+      with_warmup = 1;
+      break;
+    case 't':
+      is_abs_time = 1;
+      break;
+    case 's':
+      is_summary = 1;
+      break;
+    case 'h':
+    default:
+      help(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 1 != argc) {
+    help(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if ((rlog = h2_rlog_map(argv[optind])) == NULL) {
+    return EXIT_FAILURE;
+  }
+  if (is_summary) {
+    print_summary(rlog);
+  }
+  if (key < 0) {
+    print_csv(rlog, is_abs_time);
+  } else {
+    r = print_aggr(rlog, key, intv_usec, with_warmup);
+  }
+  h2_rlog_close(rlog, NULL);
+  return (r < 0)? EXIT_FAILURE : 0;
+}
@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/uio.h>  /* for struct iovec */
 
 
 /* opaque type defintions */
@@ -65,8 +66,22 @@ int h2_ssl_ctx_set_verify(SSL_CTX *ssl_ctx, int is_server, int ssl_verify_flag,
   /* trust_dir is trusted CA cerfificates PEM dir, prepared by 'c_rehash' */
   /* to be used as CAfile and CApath args of SSL_CTX_loca_verify_locations() */ 
 
+  /* CA certificates and CRLs are preloaded to the store, and reloaded */
+  /* in background on file changes; see h2_ssl_ctx_set_verify_reload() */
+
+int h2_ssl_ctx_set_verify_cache(SSL_CTX *ssl_ctx, int cache_size,
+                                int cache_ttl_sec);
+  /* cache peer certificate verify results keyed by sha256 of the presented */
+  /* chain and verify params (store, role, purpose, flags, depth, hosts, */
+  /* email, ip) for ttl; cache_size 0 to disable (default) */
+  /* NOTE: purpose set per SSL by SSL_set_purpose() is not in the key */
+  /* NOTE: cache and verify stat are not locked; use an SSL_CTX with cache */
+  /*       in one thread only, ie. one SSL_CTX per h2_ctx thread */
+int h2_ssl_ctx_set_verify_reload(SSL_CTX *ssl_ctx, int reload_sec);
+  /* trust file and dir change check interval; 0 to disable; default 5 secs */
+
 #define H2_SSL_VERIFY_STR_FORMAT  \
-    "none|pass|verify[,certs_file=<ca_certs_file>][,certs_dir=<ca_certs_dir>][,crl][,crl_all][,purpose]"
+    "none|pass|verify[,trust_file=<ca_certs_file>][,trust_dir=<ca_certs_dir>][,crl][,crl_all][,purpose][,cache][,cache_size=<n>][,cache_ttl=<secs>][,reload=<secs>]"
 
 int h2_ssl_ctx_set_verify_from_str(SSL_CTX *ssl_ctx, int is_server,
                                    char *verify_str);
@@ -75,6 +90,9 @@ int h2_ssl_ctx_set_verify_from_str(SSL_CTX *ssl_ctx, int is_server,
 int h2_ssl_set_verify_param_host(SSL *ssl, const char *host_name);
 int h2_ssl_add_verify_param_host(SSL *ssl, const char *host_name);
 
+/* print handshake time and verify cache stat of the ssl_ctx */
+void h2_ssl_ctx_print_stat(FILE *fp, SSL_CTX *ssl_ctx, const char *title);
+
 #else
 
 typedef void SSL_CTX;
@@ -160,6 +178,27 @@ int h2_set_body(h2_msg *msg, void *body, int body_len);
 int h2_cpy_body(h2_msg *msg, void *body, int body_len);
   /* assign msg body by copied from given body */
   /* returns 1(valid body), 0(null body) or <0(error) */
+int h2_set_body_iov(h2_msg *msg, const struct iovec *iov, int iov_num);
+  /* body as reference to iov data; iov array is copied but data are not */
+  /* data SHOULD be kept until the streams sending this msg are closed; */
+  /* h2_body() returns NULL and h2_body_len() returns the total length */
+  /* returns 1(valid body), 0(null body) or <0(error) */
+const struct iovec *h2_body_iov(h2_msg *msg, int *iov_num_ret);
+  /* returns NULL if not a reference body */
+
+/* message priority by 3gpp-sbi-message-priority header (3GPP TS 29.500) */
+#define H2_PRIO_HDR        "3gpp-sbi-message-priority"
+#define H2_PRIO_MAX        31  /* 0 is the highest */
+#define H2_PRIO_DEFAULT    24  /* for no or invalid header */
+#define H2_PRIO_CLASS_NUM  4   /* 8 priorities per class; 0 is the highest */
+
+int h2_msg_priority(h2_msg *msg);
+  /* returns 0~H2_PRIO_MAX by the header, else H2_PRIO_DEFAULT */
+int h2_set_msg_priority(h2_msg *msg, int priority);
+  /* sets the header; deletes it if priority < 0 */
+  /* returns 0(ok) or <0(invalid priority) */
+int h2_prio_class(int priority);
+  /* returns 0(0~7), 1(8~15), 2(16~23) or 3(24~31) */
 
 /* message dump utility */
 void h2_dump_msg(FILE *fp, h2_msg *msg, const char *line_prefix,
@@ -176,6 +215,10 @@ typedef struct h2_settings {
   int sess_num;          /* default: 1 */
   int reconn_max;        /* defualt: 0(no reconn); except req_max_reconn case */
   int req_max_per_sess;  /* default: 0(no max check) */
+  int retry_unprocessed; /* default: 2; resend count per request provably */
+                         /* not processed by server; 0 to disable: */
+                         /* over GOAWAY last_stream_id, REFUSED_STREAM */
+                         /* or not sent at all on session loss */
 
   /* HTTP/2 Settings */
   /* use value -1 for no set; ie. use default value */
@@ -186,11 +229,49 @@ typedef struct h2_settings {
   int max_frame_size;
   int max_header_list_size;
   int enable_connect_protocol;
+  int conn_window_size;   /* connection recv window by WINDOW_UPDATE on 0 */
 
   /* HTTP/1.1 Settings */
   int single_req;        /* default: 0(persistent) */
+
+  /* HTTP/2 Data Send Scheduling among streams of a session */
+  int data_sched;        /* H2_DATA_SCHED_*; default: H2_DATA_SCHED_RR */
+
+  /* Request Priority Lanes by h2_msg_priority() class */
+  /* client: requests over the stream room of sessions wait in the peer */
+  /*   lanes, HTTP/2 streams are weighted by class for DATA interleaving */
+  /* both: data_sched=fifo|srpt picks higher class streams first */
+  int prio_sched;        /* H2_PRIO_SCHED_*; default: H2_PRIO_SCHED_OFF */
+
+  /* HTTP/2 Abuse Rate Limits; frames received per sec, 0 for off (default) */
+  /* server only; exceeding one sends GOAWAY(ENHANCE_YOUR_CALM) and closes */
+  /* the session */
+  int rst_stream_rate;   /* RST_STREAM; suggested: 1000 */
+  int ping_rate;         /* PING without ACK; suggested: 100 */
+  int settings_rate;     /* SETTINGS without ACK; suggested: 100 */
+  int empty_frame_rate;  /* DATA without payload nor END_STREAM; suggested: 1000 */
+
+  /* Network Emulation on session send and recv; 0 for off (default) */
+  /* NOTE: applied to sent bytes only; set both sides for round trip */
+  int emu_delay;         /* one-way delay msec */
+  int emu_jitter;        /* random delay 0~msec added; order is kept */
+  int emu_rate;          /* send bandwidth kbit/sec */
+  int emu_loss;          /* segment loss per mille; delayed by rto 200 msec */
+  int emu_read_stall;    /* reads stalled msec after each recv */
+  int emu_read_rate;     /* recv bandwidth kbit/sec; reads stalled over it */
+  int emu_sess_pct;      /* percent of sessions emulated; 0 or 100 for all */
 } h2_settings;
 
+/* data_sched values; set as data_sched=rr|fifo|srpt */
+#define H2_DATA_SCHED_RR    0  /* nghttp2 default; interleaved by weight */
+#define H2_DATA_SCHED_FIFO  1  /* earliest submitted stream first */
+#define H2_DATA_SCHED_SRPT  2  /* shortest remaining body first */
+
+/* prio_sched values; set as prio_sched=off|strict|wrr */
+#define H2_PRIO_SCHED_OFF     0  /* sent at once in call order */
+#define H2_PRIO_SCHED_STRICT  1  /* higher class lane first */
+#define H2_PRIO_SCHED_WRR     2  /* class lanes weighted 8:4:2:1 */
+
 void h2_settings_init(h2_settings *settings);  /* must be call before set */
 
 
@@ -204,12 +285,21 @@ typedef void (*h2_svr_free_cb)(h2_svr *svr, void *svr_user_data);
 
 h2_ctx *h2_sess_ctx(h2_sess *sess);
 
+int h2_sess_is_ready(h2_sess *sess);
+  /* returns 1 if ready to send messages without handshake delay, else 0 */
+  /* HTTP/2: remote SETTINGS received and local SETTINGS ACKed */
+  /* HTTP/1.1: connected */
+
 int h2_sess_terminate(h2_sess *sess, int wait_rsp);
   /* trigger to terminate session; session is destroyed later */
   /* returns: 0(terminated), 1(already terminated), <(error) */
   /* wait_rsp=1 for client session to terminate after all remaining responses */
   /* NOTE: there might be more message receives after this call */
 
+int h2_sess_abort(h2_sess *sess);
+  /* close connection at once without GOAWAY nor TLS close_notify */
+  /* peer sees tcp RST; session is destroyed later as terminated one */
+
 
 /* Client Side API Calls and Callbacks on Peer --------------------------- */
 /* NOTE: h2 peer is set of sessions to a server for client API */
@@ -240,9 +330,26 @@ h2_peer *h2_connect(h2_ctx *ctx, SSL_CTX *cli_ssl_ctx,
   /* cli_ssl_ctx, settings might be null */
   /* req_max_per_sess 0 for unlimited */
 
+/* client side peer session ready callback */
+typedef void (*h2_peer_ready_cb)(h2_peer *peer, void *peer_user_data,
+                                 int ready_sess_num);
+  /* called when a session of the peer gets ready or is closed; */
+  /* see h2_sess_is_ready(); ready_sess_num is ready sessions of the peer */
+
+void h2_peer_set_ready_cb(h2_peer *peer, h2_peer_ready_cb ready_cb);
+  /* NOTE: sessions might be ready already at set; check ready_sess_num */
+int h2_peer_sess_num(h2_peer *peer);        /* number of connected sessions */
+int h2_peer_ready_sess_num(h2_peer *peer);  /* number of ready sessions */
+long long h2_peer_retry_cnt(h2_peer *peer);  /* requests sent again */
+int h2_peer_rsp_sess_idx(h2_peer *peer);
+  /* session index of the response in h2_response_cb; -1 if not on session */
+
 /* h2 client application api for request on peer with sess load balancing */
 int h2_send_request(h2_peer *peer, h2_msg *req,
                     h2_response_cb response_cb, void *strm_user_data);
+  /* req is copied; unprocessed one is sent again on the other session */
+  /* transparently (see retry_unprocessed), so body iov data referenced */
+  /* should be kept till response_cb */
 
 /* terminate all sessions on the peer */
 int h2_terminate(h2_peer *peer, int wait_rsp);
@@ -265,6 +372,60 @@ int h2_send_push_promise(h2_sess *sess, h2_strm *strm,
                     h2_msg *prm_req, h2_msg *prm_rsp);
   /* strm is of request callback's */
 
+/* server stream result; for per request metrics */
+typedef struct h2_strm_result {
+  int status;               /* response status sent; 0 if none */
+  int is_done;              /* response fully written; else reset or closed */
+  int is_rejected;          /* shed by 503 or dropped in admission lane */
+  long long req_body_len;
+  long long rsp_body_len;   /* of response sent */
+  long long latency_usec;   /* request received to stream end */
+} h2_strm_result;
+
+typedef void (*h2_strm_done_cb)(h2_sess *sess, h2_strm *strm,
+                    void *sess_user_data, void *strm_user_data,
+                    const h2_strm_result *result);
+  /* called at server stream end of request received; nothing to send */
+
+void h2_ctx_set_strm_done_cb(h2_ctx *ctx, h2_strm_done_cb strm_done_cb);
+  /* for requests received after set; NULL for off (default) */
+void h2_strm_set_user_data(h2_strm *strm, void *strm_user_data);
+  /* server: strm_user_data for strm_done_cb; eg. set in request_cb */
+
+/* HTTP/2 error codes for RST_STREAM and GOAWAY (RFC 7540 7) */
+#define H2_ERR_NO_ERROR             0x0
+#define H2_ERR_PROTOCOL_ERROR       0x1
+#define H2_ERR_INTERNAL_ERROR       0x2
+#define H2_ERR_FLOW_CONTROL_ERROR   0x3
+#define H2_ERR_SETTINGS_TIMEOUT     0x4
+#define H2_ERR_STREAM_CLOSED        0x5
+#define H2_ERR_FRAME_SIZE_ERROR     0x6
+#define H2_ERR_REFUSED_STREAM       0x7
+#define H2_ERR_CANCEL               0x8
+#define H2_ERR_COMPRESSION_ERROR    0x9
+#define H2_ERR_CONNECT_ERROR        0xa
+#define H2_ERR_ENHANCE_YOUR_CALM    0xb
+#define H2_ERR_INADEQUATE_SECURITY  0xc
+#define H2_ERR_HTTP_1_1_REQUIRED    0xd
+
+int h2_err_code_from_name(const char *name);
+  /* name is as "REFUSED_STREAM" case insensitive or number */
+  /* returns error code or <0(unknown) */
+
+/* Server Fault Injection; for client retry and reconnect tests ---------- */
+
+int h2_reset_stream(h2_sess *sess, h2_strm *strm, int error_code);
+  /* HTTP/2: RST_STREAM with error_code instead of response */
+  /* HTTP/1.1: no stream reset in protocol; the session is aborted */
+int h2_send_response_delayed(h2_sess *sess, h2_strm *strm, h2_msg *rsp,
+                    long long delay_usec);
+  /* rsp is copied and sent after delay; dropped if strm is closed before */
+  /* HTTP/1.1: later responses on the session wait for this in order */
+int h2_send_response_trunc(h2_sess *sess, h2_strm *strm, h2_msg *rsp,
+                    int body_len_sent);
+  /* content-length of full body but the body sent is cut at body_len_sent */
+  /* then RST_STREAM(INTERNAL_ERROR) on HTTP/2, session abort on HTTP/1.1 */
+
 
 /* Server Accept Session API Calls and Callbacks ------------------------- */
 
@@ -288,8 +449,16 @@ h2_svr *h2_listen(h2_ctx *ctx, const char *authority, SSL_CTX *svr_ssl_ctx,
 void h2_svr_free(h2_svr *svr);
   /* removes listen socket only; connected session are not affected */
 
+/* adopt listen socket already bound; eg. handed off on hot restart */
+h2_svr *h2_listen_fd(h2_ctx *ctx, const char *authority, int fd,
+                     SSL_CTX *svr_ssl_ctx, h2_accept_cb accept_cb,
+                     h2_svr_free_cb svr_free_cb, void *svr_user_data);
+  /* fd is owned by svr on success and closed on failure */
+  /* NOTE: listen sockets are set nonblocking to be shared with others */
+
 const char *h2_svr_authority(h2_svr *svr);
 SSL_CTX *h2_svr_ssl_ctx(h2_svr *svr);
+int h2_svr_fd(h2_svr *svr);  /* listen socket fd; eg. to hand off */
 
 
 /* H2 Service Context ---------------------------------------------------- */
@@ -304,9 +473,81 @@ void h2_ctx_free(h2_ctx *ctx);
 void h2_ctx_run(h2_ctx *ctx);
 void h2_ctx_stop(h2_ctx *ctx);  /* mark ctx run look stop */
 
+/* graceful drain; close listen sockets and GOAWAY to server sessions */
+/* notices are spread over spread_usec then final GOAWAY after grace time */
+/* h2_ctx_run() returns when all sessions are closed */
+void h2_ctx_drain(h2_ctx *ctx, long long spread_usec);
+int h2_ctx_is_draining(h2_ctx *ctx);
+
 void h2_ctx_set_http_ver(h2_ctx *ctx, int http_ver);
 void h2_ctx_set_verbose(h2_ctx *ctx, int verbose);
 
+/* run time resource usage of ctx; for soak test monitoring */
+typedef struct h2_ctx_stat {
+  int sess_num;               /* sessions alive (client and server) */
+  int peer_num;
+  int svr_num;
+  int timer_num;              /* timers pending */
+  long long strm_num;         /* open streams over all sessions */
+  long long send_data_remain; /* bytes queued but not yet sent */
+  int send_blocked_sess_num;  /* sessions waiting for socket writable */
+  int emu_sess_num;           /* sessions with network emulation */
+} h2_ctx_stat;
+
+void h2_ctx_get_stat(h2_ctx *ctx, h2_ctx_stat *stat);
+
+/* server request admission by h2_msg_priority() class; off by default */
+/* emulates capacity of rate requests/sec over all server sessions; */
+/* requests over it wait in class lanes served higher class first, */
+/* and on queue_max waiting, the newest of the lowest class is shed by 503 */
+void h2_ctx_set_admission(h2_ctx *ctx, int rate, int queue_max);
+  /* rate 0 to turn off; queue_max <= 0 for rate / 10 */
+
+typedef struct h2_admit_stat {
+  long long admit_cnt;      /* requests passed to request_cb */
+  long long queue_cnt;      /* of them, waited in the lane */
+  long long shed_cnt;       /* rejected by 503 */
+  long long drop_cnt;       /* stream closed while waiting */
+  long long wait_usec_sum;  /* lane wait of queue_cnt */
+  long long wait_usec_max;
+} h2_admit_stat;
+
+int h2_ctx_get_admit_stat(h2_ctx *ctx, h2_admit_stat *stat_ret);
+  /* stat_ret is array of [H2_PRIO_CLASS_NUM] */
+  /* returns 1(admission set), 0(not set; stat_ret is zeroed) */
+
+/* server session rebalancing over ctxs each run by its own thread; */
+/* when thread cpu busy of a ctx is over the least busy one by */
+/* imbalance_pct points for 3 intervals in a row, one of its sessions is */
+/* moved to the least busy ctx at a run loop turn, ie. between frames, */
+/* with its fd, nghttp2 session, SSL and streams; sessions with pending */
+/* delayed response, admission queue or network emulation are not moved */
+int h2_ctx_set_balance(h2_ctx **ctx_arr, int ctx_num,
+                       int imbalance_pct, int interval_msec);
+  /* call before h2_ctx_run() of the ctxs; interval_msec <= 0 for 1000 */
+  /* returns 0(ok), <0(error) */
+
+typedef struct h2_bal_stat {
+  int idx;                  /* index of ctx in ctx_arr */
+  int busy_pct;             /* thread cpu busy of the last interval */
+  long long move_out_cnt;   /* sessions moved to the other ctx */
+  long long move_in_cnt;    /* sessions moved from the other ctx */
+} h2_bal_stat;
+
+int h2_ctx_get_bal_stat(h2_ctx *ctx, h2_bal_stat *stat_ret);
+  /* returns 1(balance set), 0(not set; stat_ret is zeroed) */
+
+/* one-shot timer run in h2_ctx_run() loop */
+/* NOTE: timers do not keep h2_ctx_run() running without sessions or servers */
+typedef struct h2_timer h2_timer;
+typedef void (*h2_timer_cb)(h2_ctx *ctx, void *user_data);
+
+h2_timer *h2_timer_add(h2_ctx *ctx, long long delay_usec,
+                       h2_timer_cb timer_cb, void *user_data);
+  /* returns timer freed after timer_cb called; re-add in timer_cb to repeat */
+void h2_timer_del(h2_ctx *ctx, h2_timer *timer);
+  /* cancel pending timer; do not call for the timer already fired */
+
 
 /* Message Body Utilities ------------------------------------------------ */
 /* NOTE: this is just for utility; pron to be changed */
@@ -315,6 +556,282 @@ int h2_body_from_hex_str(char *hex_str, void **body_ret, int *body_len_ret);
 int h2_body_from_file(char *file, void **body_ret, int *body_len_ret);
   /* returns dynamic alloced data via *body_ret */
 
+/* content coding for content-encoding and accept-encoding headers */
+#define H2_CODING_IDENTITY  0
+#define H2_CODING_GZIP      1
+#define H2_CODING_DEFLATE   2
+#define H2_CODING_NUM       3
+
+const char *h2_coding_name(int coding);
+  /* returns content-encoding value or NULL for identity */
+int h2_coding_from_name(const char *name);
+  /* returns H2_CODING_* or <0(unknown); identity for NULL name */
+int h2_coding_select(const char *accept_encoding, int coding_mask);
+  /* coding_mask is bit-OR of (1 << H2_CODING_*) of available variants */
+  /* returns the best H2_CODING_* by q values; identity if none matched */
+int h2_body_encode(int coding, const void *body, int body_len,
+                   void **enc_ret, int *enc_len_ret);
+  /* compress at the best level; for load time use, not per message */
+  /* returns 0(ok) or <0(error) with dynamic alloced data via *enc_ret */
+long long h2_body_decode_len(int coding, const void *body, int body_len);
+  /* streaming inflate without keeping the decoded data; for validation */
+  /* returns decoded length or <0(unsupported or corrupted) */
+
+
+/* Multipart Body Utilities -------------------------------------------- */
+/* multipart/related (RFC 2387) as used by 5G SBI N1/N2 messages */
+
+#define H2_MPART_MAX  16  /* parts per body */
+#define H2_MPART_BOUNDARY  "h2sim-mpart-boundary"  /* default on build */
+
+typedef struct h2_mpart {
+  const char *content_type;  /* NULL if not given; not null terminated */
+  int content_type_len;
+  const char *content_id;    /* NULL if not given; not null terminated */
+  int content_id_len;
+  const void *body;
+  int body_len;
+} h2_mpart;
+
+int h2_mpart_boundary(const char *content_type, const char **boundary_ret);
+  /* content_type is multipart content-type header value */
+  /* returns boundary length with *boundary_ret on content_type, */
+  /* or <0(not multipart or no boundary) */
+int h2_mpart_parse(const void *body, int body_len,
+                   const char *boundary, int boundary_len,
+                   h2_mpart *parts, int part_max);
+  /* parts point into body; nothing is copied */
+  /* returns number of parts or <0(malformed or too many parts) */
+int h2_mpart_find(const h2_mpart *parts, int part_num,
+                  const char *content_type);
+  /* returns the first part index of content_type (ignoring parameters) */
+  /* or <0(not found) */
+int h2_mpart_build(const char *boundary, const h2_mpart *parts, int part_num,
+                   char *hdr_buf, int hdr_buf_size,
+                   struct iovec *iov, int iov_max);
+  /* part bodies are referenced in iov without copy; delimiters and part */
+  /* headers are written to hdr_buf; iov needs (2 * part_num + 1) entries */
+  /* returns number of iov or <0(buffer too small) */
+int h2_mpart_load(h2_mpart *part, char *part_str);
+  /* part_str is content_type[:content_id]=file|0xhex; modified on parse */
+  /* part fields are dynamic alloced; free by h2_mpart_free() */
+  /* returns 0(ok) or <0(invalid part_str or body load error) */
+void h2_mpart_free(h2_mpart *parts, int part_num);
+int h2_mpart_set_body(h2_msg *msg, const h2_mpart *parts, int part_num,
+                      char **hdr_buf_ret);
+  /* set msg body as iov of the parts by h2_mpart_build(); if msg has no */
+  /* multipart content-type, it is set with the first part's type and */
+  /* H2_MPART_BOUNDARY; parts and *hdr_buf_ret (dynamic alloced delimiters */
+  /* and part headers) SHOULD be kept while msg body is in use */
+  /* returns 0(ok) or <0(error) */
+
+
+/* Regular Expression Matching ------------------------------------------ */
+/* compiled into DFA at load time; matching is a table walk per byte */
+/* supports: literal . [] [^] \d\w\s\D\W\S * + ? {m} {m,} {m,n} | (), (?:) */
+/* ^ and $ are only at pattern start and end, and apply to the whole pattern */
+/* unanchored pattern matches anywhere in the string */
+
+typedef struct h2_re h2_re;
+
+h2_re *h2_re_compile(const char *pattern);
+  /* returns NULL on syntax error or too complex pattern */
+void h2_re_free(h2_re *re);
+const char *h2_re_str(h2_re *re);
+int h2_re_state_num(h2_re *re);
+  /* returns number of DFA states */
+int h2_re_match(const h2_re *re, const char *str, int len);
+  /* len < 0 for null terminated str; returns 1(matched) or 0 */
+
+
+/* JSON Field Extraction ------------------------------------------------- */
+/* NOTE: not a validator; structural errors are detected only on the way */
+
+#define H2_JSON_PTR_MAX    64  /* pointers per h2_json_extract() call */
+#define H2_JSON_DEPTH_MAX  64
+
+typedef struct h2_json_ptr h2_json_ptr;
+
+h2_json_ptr *h2_json_ptr_compile(const char *pointer);
+  /* pointer is RFC 6901 JSON pointer; ex) "/nfProfiles/0/nfType" */
+  /* returns NULL on error */
+void h2_json_ptr_free(h2_json_ptr *ptr);
+const char *h2_json_ptr_str(h2_json_ptr *ptr);
+
+#define H2_JSON_NONE     0  /* not found */
+#define H2_JSON_STRING   1  /* str is the content without quotes */
+#define H2_JSON_LITERAL  2  /* number, true, false or null */
+#define H2_JSON_OBJECT   3  /* str is the whole text from '{' to '}' */
+#define H2_JSON_ARRAY    4  /* str is the whole text from '[' to ']' */
+
+typedef struct h2_json_val {
+  int type;         /* H2_JSON_* */
+  const char *str;  /* points into the json text; escapes are kept */
+  int len;
+} h2_json_val;
+
+int h2_json_extract(const void *json, int json_len,
+                    h2_json_ptr **ptrs, int ptr_num, h2_json_val *vals);
+  /* finds values of all ptrs in single pass without building DOM */
+  /* returns number of pointers found or <0(malformed json) */
+int h2_json_val_eq(const h2_json_val *val, const char *str);
+  /* returns 1 if val is found and same as str */
+
+
+/* Statistics Utilities -------------------------------------------------- */
+
+long long h2_time_usec(void);
+  /* returns monotonic clock time in usec; for elapsed time measurement */
+long long h2_cpu_usec(void);
+  /* returns cpu time of the calling thread in usec */
+long long h2_proc_cpu_usec(void);
+  /* returns user and system cpu time of the process in usec */
+long long h2_peak_rss_kb(void);
+  /* returns peak resident set size of the process in kbytes */
+double h2_cpu_mhz(void);
+  /* returns cpu clock mhz from /proc/cpuinfo; 0 if unknown */
+
+/* log-linear histogram; values are kept within 1/16 relative error */
+#define H2_HIST_SUB_BITS    4
+#define H2_HIST_BUCKET_NUM  (64 << H2_HIST_SUB_BITS)
+
+typedef struct h2_hist {
+  long long cnt;
+  long long sum;
+  long long min;
+  long long max;
+  long long bucket[H2_HIST_BUCKET_NUM];
+} h2_hist;
+
+void h2_hist_init(h2_hist *hist);
+void h2_hist_add(h2_hist *hist, long long value);
+void h2_hist_merge(h2_hist *dst, const h2_hist *src);
+long long h2_hist_percentile(const h2_hist *hist, double percent);
+  /* percent is 0.0 ~ 100.0; returns 0 for empty hist */
+void h2_hist_print(FILE *fp, const h2_hist *hist, const char *title);
+  /* prints "<title>: cnt= avg= min= p50= p90= p99= p99.9= max=" line */
+
+/* trend of series sampled at even interval; for resource drift detection */
+typedef struct h2_trend {
+  double slope;   /* least squares slope per sample */
+  double change;  /* fitted last - first, relative to fitted first */
+  double tau;     /* Kendall rank correlation: +1 monotonic increase, */
+                  /*                           -1 monotonic decrease */
+} h2_trend;
+
+void h2_trend_calc(const double *v, int n, h2_trend *trend);
+  /* trend is all zero for n < 2 */
+
+
+/* Sampling Profiler ----------------------------------------------------- */
+
+#define H2_PROF_HZ_DEFAULT  199  /* not to be in lockstep with timers */
+
+int h2_prof_start(int hz);
+  /* starts SIGPROF sampling of process cpu time at hz; default if hz <= 0 */
+  /* returns 0(ok) or <0(failed) */
+int h2_prof_stop(const char *folded_file, FILE *stat_fp);
+  /* stops sampling and writes folded stacks as "phase;root;...;leaf count"
+   * lines into folded_file if not NULL, for flamegraph.pl;
+   * prints per phase sample ratios to stat_fp if not NULL */
+  /* returns number of folded stacks written or <0(failed) */
+
+
+/* Buffered Background File Writer --------------------------------------- */
+/* for record logging from the event loop; write(2) is on a writer thread */
+
+typedef struct h2_bwr h2_bwr;
+
+h2_bwr *h2_bwr_open(const char *file, int buf_size, int buf_num);
+  /* file is truncated; buf_num buffers of buf_size are used in turn */
+  /* returns NULL on error */
+void *h2_bwr_alloc(h2_bwr *bwr, int size);
+  /* returns space of size to be filled before the next call, or NULL */
+  /* if dropped for size over buf_size or all buffers not yet written */
+int h2_bwr_write(h2_bwr *bwr, const void *data, int size);
+  /* returns 0(ok) or <0(dropped) */
+void h2_bwr_flush(h2_bwr *bwr);
+  /* hands over partially filled buffer; call by timer for idle periods */
+void h2_bwr_stat(h2_bwr *bwr, long long *rec_num_ret,
+                 long long *drop_rec_num_ret, long long *written_bytes_ret);
+long long h2_bwr_close(h2_bwr *bwr);
+  /* writes all the remaining and returns total bytes written */
+
+
+/* Traffic Capture and Replay -------------------------------------------- */
+/* capture file is in host byte order; not for exchange between archs */
+
+typedef struct h2_cap h2_cap;
+typedef struct h2_cap_rec h2_cap_rec;
+
+#define H2_CAP_BODY       0  /* capture whole body */
+#define H2_CAP_BODY_HASH  1  /* capture body length and hash only */
+
+h2_cap *h2_cap_open(const char *file, int body_mode);
+  /* body_mode is H2_CAP_BODY*; returns NULL on error */
+int h2_cap_write(h2_cap *cap, h2_msg *req);
+  /* records request with time; returns 0(ok) or <0(dropped) */
+void h2_cap_flush(h2_cap *cap);
+
+h2_cap *h2_cap_map(const char *file);
+  /* mmap capture file for replay; records are validated here once */
+  /* returns NULL on error */
+int h2_cap_rec_num(h2_cap *cap);
+const h2_cap_rec *h2_cap_next(h2_cap *cap, const h2_cap_rec *rec);
+  /* returns the first record for NULL rec, or NULL at the end */
+long long h2_cap_rec_usec(const h2_cap_rec *rec);
+  /* returns time since capture start */
+int h2_cap_rec_msg(h2_cap *cap, const h2_cap_rec *rec, h2_msg *req);
+  /* sets method, path, headers and body; body references the map or */
+  /* zero filled data for body hash only record, valid until h2_cap_close */
+  /* returns 0(ok) or <0(error) */
+
+void h2_cap_close(h2_cap *cap, FILE *stat_fp);
+  /* prints capture stat to stat_fp if not NULL */
+
+
+/* Per Request Result Log ------------------------------------------------ */
+/* fixed size records in host byte order; not for exchange between archs */
+
+typedef struct h2_rlog h2_rlog;
+
+/* NOTE: kept 32 bytes for 100M requests runs */
+typedef struct h2_rlog_rec {
+  int64_t send_usec;      /* request send time since log open */
+  uint32_t latency_usec;  /* response time since send; saturated */
+  uint32_t req_id;
+  uint32_t req_bytes;     /* request body bytes */
+  uint32_t rsp_bytes;     /* response body bytes; 0 for no response */
+  int16_t status;         /* response status; 0 for no response */
+  uint16_t sess_idx;      /* session index in peer; 0xffff for unknown */
+  uint8_t step;           /* request step */
+  int8_t prio;            /* 3gpp-sbi-message-priority; -1 for none */
+  uint16_t flags;         /* H2_RLOG_F_* */
+} h2_rlog_rec;
+
+#define H2_RLOG_F_NO_RSP   0x0001  /* closed without response */
+#define H2_RLOG_F_WARMUP   0x0002  /* not measured for warm-up */
+#define H2_RLOG_F_REPLAY   0x0004  /* capture replay; req_id is record index */
+
+h2_rlog *h2_rlog_open(const char *file);
+  /* file is truncated; returns NULL on error */
+long long h2_rlog_start_usec(h2_rlog *rlog);
+  /* h2_time_usec() at open to be subtracted for send_usec */
+int h2_rlog_write(h2_rlog *rlog, const h2_rlog_rec *rec);
+  /* returns 0(ok) or <0(dropped) */
+void h2_rlog_flush(h2_rlog *rlog);
+
+h2_rlog *h2_rlog_map(const char *file);
+  /* mmap result log to read; returns NULL on error */
+long long h2_rlog_rec_num(h2_rlog *rlog);
+const h2_rlog_rec *h2_rlog_recs(h2_rlog *rlog);
+  /* returns h2_rlog_rec[h2_rlog_rec_num()] on the map */
+long long h2_rlog_start_time_usec(h2_rlog *rlog);
+  /* wall clock time of send_usec 0 */
+
+void h2_rlog_close(h2_rlog *rlog, FILE *stat_fp);
+  /* prints written stat to stat_fp if not NULL */
+
 
 /* Settings Parameter Utilties ------------------------------------------- */
 
@@ -0,0 +1,408 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef EPOLL_MODE
+#include <sys/epoll.h>
+#endif
+
+#ifdef TLS_MODE
+#include <openssl/ssl.h>
+#endif
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Session Rebalancing over Thread Contexts ---------------------------------
+ * each ctx measures its thread cpu busy on its own interval timer and
+ * publishes it; the busiest one moves the session of the nearest half of
+ * the busy gap to the least busy one; the session is detached at the timer,
+ * ie. out of any frame handling, and linked to the inbox of the target,
+ * which adopts it on the wake up pipe at its own loop turn
+ */
+
+#define H2_BAL_INTERVAL_USEC  1000000  /* default balance interval */
+#define H2_BAL_SUSTAIN        3        /* intervals over imbalance to move */
+
+typedef struct h2_bal_group {
+  int ctx_num;
+  int ref_num;              /* ctxs not freed yet; atomic */
+  int imbalance_pm;         /* busy permille over the least busy one */
+  long long interval_usec;
+  h2_bal *bal[];            /* [ctx_num] */
+} h2_bal_group;
+
+struct h2_bal {
+  h2_obj obj;               /* h2_cls_bal for run loop event */
+  h2_bal_group *grp;
+  h2_ctx *ctx;
+  int idx;                  /* in grp->bal */
+
+  /* sessions moved in; adopted by the thread of ctx */
+  pthread_mutex_t lock;
+  int wake_fd[2];           /* pipe written on move in; locked */
+  h2_sess *in_head;         /* linked by sess->next; locked */
+  int is_closed;            /* run loop ended; locked */
+
+  /* published to other threads; atomic */
+  int busy_pm;              /* thread cpu busy permille of last interval */
+  int is_open;              /* not closed and not draining */
+
+  /* for the thread of ctx only */
+  long long tick_usec;
+  long long cpu_usec;
+  int over_cnt;             /* intervals over imbalance in a row */
+  long long move_out_cnt;
+  long long move_in_cnt;
+};
+
+static void h2_bal_timer_cb(h2_ctx *ctx, void *user_data);
+
+/* link sessions moved in to ctx; sess->next is the inbox link */
+static void h2_bal_link(h2_ctx *ctx, h2_sess *sess) {
+  h2_sess *next;
+
+  for ( ; sess; sess = next) {
+    next = sess->next;
+
+    sess->ctx = ctx;
+    sess->next = ctx->sess_list_head.next;
+    ctx->sess_list_head.next = sess;
+    sess->prev = &ctx->sess_list_head;
+    if (sess->next) {
+      sess->next->prev = sess;
+    }
+    ctx->sess_num++;
+    ctx->bal->move_in_cnt++;
+
+#ifdef EPOLL_MODE
+    struct epoll_event e;
+    e.events = EPOLLIN | ((sess->send_pending)? EPOLLOUT : 0);
+    e.data.ptr = &sess->obj;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, sess->fd, &e) < 0) {
+      warnx("%ssession moved in failed for epoll_ctl() error: %s",
+            sess->log_prefix, strerror(errno));
+      sess->close_reason = CLOSE_BY_SOCK_ERR;
+      h2_sess_free(sess);
+    }
+#endif
+  }
+}
+
+/* session of no state bound to ctx; ie. timers and admission queue */
+static int h2_bal_is_movable(h2_sess *sess) {
+  h2_strm *strm;
+
+  if (!sess->is_server || !sess->is_ready || sess->is_terminated ||
+      sess->is_no_more_req || sess->drain_usec > 0 || sess->emu ||
+      sess->fd < 0) {
+    return 0;
+  }
+  for (strm = sess->strm_list_head.next; strm; strm = strm->next) {
+    if (strm->delayed_timer || strm->is_admit_queued) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void h2_bal_move(h2_bal *bal, h2_bal *to, int busy_pm, int to_busy_pm,
+                        long long elapsed) {
+  h2_ctx *ctx = bal->ctx;
+  h2_sess *sess, *pick = NULL;
+  long long gap, diff, pick_diff = 0;
+  char c = 0;
+
+  /* moving over the gap just turns over the imbalance */
+  gap = (long long)(busy_pm - to_busy_pm) * elapsed / 1000;
+  for (sess = ctx->sess_list_head.next; sess; sess = sess->next) {
+    if (sess->bal_usec <= 0 || sess->bal_usec >= gap ||
+        !h2_bal_is_movable(sess)) {
+      continue;
+    }
+    diff = sess->bal_usec - gap / 2;
+    diff = (diff < 0)? -diff : diff;
+    if (pick == NULL || diff < pick_diff) {
+      pick = sess;
+      pick_diff = diff;
+    }
+  }
+  if (pick == NULL) {
+    if (ctx->verbose) {
+      warnx("ctx[%d] busy %d%% over ctx[%d] %d%%; no session to move",
+            bal->idx, busy_pm / 10, to->idx, to_busy_pm / 10);
+    }
+    return;
+  }
+  sess = pick;
+
+  pthread_mutex_lock(&to->lock);
+  if (to->is_closed) {
+    pthread_mutex_unlock(&to->lock);
+    return;
+  }
+
+  /* detach from ctx; nothing of ctx refers the session from now */
+#ifdef EPOLL_MODE
+  epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, sess->fd, NULL);
+#endif
+  sess->prev->next = sess->next;
+  if (sess->next) {
+    sess->next->prev = sess->prev;
+  }
+  ctx->sess_num--;
+
+  /* reported before wake up; the session is of the target from then */
+  bal->move_out_cnt++;
+  fprintf(stderr, "%sSESSION MOVED ctx[%d] -> ctx[%d]: busy %d%% vs %d%%, "
+          "session %lld%%\n", sess->log_prefix, bal->idx, to->idx,
+          busy_pm / 10, to_busy_pm / 10,
+          (elapsed > 0)? sess->bal_usec * 100 / elapsed : 0);
+
+  sess->next = to->in_head;
+  to->in_head = sess;
+  if (write(to->wake_fd[1], &c, 1) < 0 && errno != EAGAIN) {
+    warnx("ctx[%d] wake up write failed: %s", to->idx, strerror(errno));
+  }
+  pthread_mutex_unlock(&to->lock);
+}
+
+static void h2_bal_timer_cb(h2_ctx *ctx, void *user_data) {
+  h2_bal *bal = user_data, *o, *to = NULL;
+  h2_bal_group *grp = bal->grp;
+  h2_sess *sess;
+  long long now = h2_time_usec();
+  long long cpu = h2_cpu_usec();
+  long long elapsed = now - bal->tick_usec;
+  int i, b, busy, to_busy = 0, is_max = 1;
+
+  if (bal->cpu_usec < 0) {
+    elapsed = 0;  /* first interval; thread cpu base is taken now */
+  }
+  busy = (elapsed > 0)? (int)((cpu - bal->cpu_usec) * 1000 / elapsed) : 0;
+  bal->tick_usec = now;
+  bal->cpu_usec = cpu;
+  __atomic_store_n(&bal->busy_pm, busy, __ATOMIC_RELAXED);
+  if (h2_ctx_is_draining(ctx)) {
+    __atomic_store_n(&bal->is_open, 0, __ATOMIC_RELAXED);
+  }
+
+  for (i = 0; i < grp->ctx_num; i++) {
+    if ((o = grp->bal[i]) == bal) {
+      continue;
+    }
+    b = __atomic_load_n(&o->busy_pm, __ATOMIC_RELAXED);
+    if (b > busy) {
+      is_max = 0;
+    }
+    if (__atomic_load_n(&o->is_open, __ATOMIC_RELAXED) &&
+        (to == NULL || b < to_busy)) {
+      to = o;
+      to_busy = b;
+    }
+  }
+
+  if (elapsed > 0 && to && is_max &&
+      __atomic_load_n(&bal->is_open, __ATOMIC_RELAXED) &&
+      busy - to_busy >= grp->imbalance_pm) {
+    if (++bal->over_cnt >= H2_BAL_SUSTAIN) {
+      bal->over_cnt = 0;  /* new loads to be measured after move */
+      h2_bal_move(bal, to, busy, to_busy, elapsed);
+    }
+  } else {
+    bal->over_cnt = 0;
+  }
+
+  for (sess = ctx->sess_list_head.next; sess; sess = sess->next) {
+    sess->bal_usec = 0;
+  }
+  h2_timer_add(ctx, grp->interval_usec, h2_bal_timer_cb, bal);
+}
+
+int h2_ctx_set_balance(h2_ctx **ctx_arr, int ctx_num,
+                       int imbalance_pct, int interval_msec) {
+  h2_bal_group *grp;
+  h2_bal *bal;
+  int i;
+
+  if (ctx_arr == NULL || ctx_num < 2 || imbalance_pct <= 0) {
+    warnx("invalid argument: ctx_num=%d imbalance_pct=%d",
+          ctx_num, imbalance_pct);
+    return -1;
+  }
+  for (i = 0; i < ctx_num; i++) {
+    if (ctx_arr[i]->bal) {
+      warnx("ctx balance is already set");
+      return -1;
+    }
+  }
+
+  grp = calloc(1, sizeof(*grp) + sizeof(h2_bal *) * ctx_num);
+  grp->ctx_num = ctx_num;
+  grp->ref_num = ctx_num;
+  grp->imbalance_pm = imbalance_pct * 10;
+  grp->interval_usec = (interval_msec > 0)? interval_msec * 1000LL :
+                                            H2_BAL_INTERVAL_USEC;
+  for (i = 0; i < ctx_num; i++) {
+    bal = calloc(1, sizeof(*bal));
+    bal->obj.cls = &h2_cls_bal;
+    bal->grp = grp;
+    bal->ctx = ctx_arr[i];
+    bal->idx = i;
+    pthread_mutex_init(&bal->lock, NULL);
+    bal->wake_fd[0] = bal->wake_fd[1] = -1;
+    grp->bal[i] = bal;
+  }
+  for (i = 0; i < ctx_num; i++) {
+    bal = grp->bal[i];
+    if (pipe2(bal->wake_fd, O_NONBLOCK | O_CLOEXEC) < 0) {
+      warnx("balance wake up pipe failed: %s", strerror(errno));
+      break;
+    }
+#ifdef EPOLL_MODE
+    struct epoll_event e;
+    e.events = EPOLLIN;
+    e.data.ptr = &bal->obj;
+    if (epoll_ctl(bal->ctx->epoll_fd, EPOLL_CTL_ADD, bal->wake_fd[0], &e) < 0) {
+      warnx("balance init failed for epoll_ctl() error: %s", strerror(errno));
+      break;
+    }
+#endif
+  }
+  if (i < ctx_num) {
+    for (i = 0; i < ctx_num; i++) {
+      bal = grp->bal[i];
+      if (bal->wake_fd[0] >= 0) {
+#ifdef EPOLL_MODE
+        epoll_ctl(bal->ctx->epoll_fd, EPOLL_CTL_DEL, bal->wake_fd[0], NULL);
+#endif
+        close(bal->wake_fd[0]);
+        close(bal->wake_fd[1]);
+      }
+      pthread_mutex_destroy(&bal->lock);
+      free(bal);
+    }
+    free(grp);
+    return -1;
+  }
+
+  for (i = 0; i < ctx_num; i++) {
+    bal = grp->bal[i];
+    bal->is_open = 1;
+    bal->tick_usec = h2_time_usec();
+    bal->cpu_usec = -1;  /* set at the first interval in its thread */
+    bal->ctx->bal = bal;
+    h2_timer_add(bal->ctx, grp->interval_usec, h2_bal_timer_cb, bal);
+  }
+  return 0;
+}
+
+int h2_ctx_get_bal_stat(h2_ctx *ctx, h2_bal_stat *stat_ret) {
+  h2_bal *bal = ctx->bal;
+
+  memset(stat_ret, 0, sizeof(*stat_ret));
+  if (bal == NULL) {
+    return 0;
+  }
+  stat_ret->idx = bal->idx;
+  stat_ret->busy_pct = __atomic_load_n(&bal->busy_pm, __ATOMIC_RELAXED) / 10;
+  stat_ret->move_out_cnt = bal->move_out_cnt;
+  stat_ret->move_in_cnt = bal->move_in_cnt;
+  return 1;
+}
+
+int h2_bal_fd(h2_ctx *ctx) {
+  return (ctx->bal)? ctx->bal->wake_fd[0] : -1;
+}
+
+void h2_bal_adopt(h2_ctx *ctx) {
+  h2_bal *bal = ctx->bal;
+  h2_sess *sess;
+  char buf[64];
+
+  while (read(bal->wake_fd[0], buf, sizeof(buf)) > 0);
+  pthread_mutex_lock(&bal->lock);
+  sess = bal->in_head;
+  bal->in_head = NULL;
+  pthread_mutex_unlock(&bal->lock);
+  h2_bal_link(ctx, sess);
+}
+
+int h2_bal_close(h2_ctx *ctx, int force) {
+  h2_bal *bal = ctx->bal;
+  h2_sess *sess;
+
+  pthread_mutex_lock(&bal->lock);
+  if (bal->in_head && !force) {
+    pthread_mutex_unlock(&bal->lock);
+    return 0;  /* to be adopted on wake up */
+  }
+  bal->is_closed = 1;
+  sess = bal->in_head;
+  bal->in_head = NULL;
+  pthread_mutex_unlock(&bal->lock);
+  __atomic_store_n(&bal->is_open, 0, __ATOMIC_RELAXED);
+
+  h2_bal_link(ctx, sess);  /* to be freed with ctx */
+  return 1;
+}
+
+void h2_bal_free(h2_ctx *ctx) {
+  h2_bal *bal = ctx->bal;
+  h2_bal_group *grp;
+  int i;
+
+  if (bal == NULL) {
+    return;
+  }
+  h2_bal_close(ctx, 1);
+
+  /* no more write on closed; other threads may still read the loads */
+#ifdef EPOLL_MODE
+  epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, bal->wake_fd[0], NULL);
+#endif
+  close(bal->wake_fd[0]);
+  close(bal->wake_fd[1]);
+  ctx->bal = NULL;
+
+  grp = bal->grp;
+  if (__atomic_sub_fetch(&grp->ref_num, 1, __ATOMIC_ACQ_REL) == 0) {
+    for (i = 0; i < grp->ctx_num; i++) {
+      pthread_mutex_destroy(&grp->bal[i]->lock);
+      free(grp->bal[i]);
+    }
+    free(grp);
+  }
+}
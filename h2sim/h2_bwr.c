@@ -0,0 +1,274 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <err.h>
+
+#include "h2.h"
+
+
+/*
+ * Buffered Background File Writer -----------------------------------------
+ * the caller fills the current buffer without lock and hands it over to the
+ * writer thread when full; lock is taken only per buffer handover;
+ * records are dropped instead of blocking the caller if all buffers are busy
+ */
+
+#define H2_BWR_BUF_SIZE_MIN  (64 * 1024)
+#define H2_BWR_BUF_NUM_MIN   2
+
+struct h2_bwr {
+  int fd;
+  int buf_size;
+  int buf_num;
+  char **buf;       /* ring of buf_num buffers of buf_size */
+  int *buf_len;     /* filled length of handed over buffers */
+
+  /* owned by the caller */
+  int cur;          /* buffer index being filled */
+  int cur_len;
+
+  /* locked; buffers wr_idx ... cur-1 are handed over to the writer */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_cond_t done_cond;
+  int wr_idx;
+  int is_closing;
+
+  pthread_t thread;
+
+  /* stat */
+  long long rec_num;
+  long long drop_rec_num;
+  long long written_bytes;  /* updated by the writer thread */
+  int write_err;
+};
+
+
+static void *h2_bwr_thread(void *arg) {
+  h2_bwr *bwr = arg;
+  int idx, off, r;
+
+  pthread_mutex_lock(&bwr->lock);
+  while (1) {
+    while (bwr->wr_idx == bwr->cur && !bwr->is_closing) {
+      pthread_cond_wait(&bwr->cond, &bwr->lock);
+    }
+    if (bwr->wr_idx == bwr->cur) {  /* closing with nothing left */
+      break;
+    }
+    idx = bwr->wr_idx;
+    pthread_mutex_unlock(&bwr->lock);
+
+    for (off = 0; off < bwr->buf_len[idx]; off += r) {
+      r = write(bwr->fd, bwr->buf[idx] + off, bwr->buf_len[idx] - off);
+      if (r < 0) {
+        if (errno == EINTR) {
+          r = 0;
+          continue;
+        }
+        if (!bwr->write_err) {
+          warnx("buffered writer: write failed: %s", strerror(errno));
+        }
+        bwr->write_err = errno;
+        break;
+      }
+    }
+
+    pthread_mutex_lock(&bwr->lock);
+    bwr->written_bytes += off;
+    bwr->wr_idx = (idx + 1) % bwr->buf_num;
+    pthread_cond_signal(&bwr->done_cond);
+  }
+  pthread_mutex_unlock(&bwr->lock);
+  return NULL;
+}
+
+h2_bwr *h2_bwr_open(const char *file, int buf_size, int buf_num) {
+  h2_bwr *bwr;
+  int i;
+
+  if (buf_size < H2_BWR_BUF_SIZE_MIN) {
+    buf_size = H2_BWR_BUF_SIZE_MIN;
+  }
+  if (buf_num < H2_BWR_BUF_NUM_MIN) {
+    buf_num = H2_BWR_BUF_NUM_MIN;
+  }
+
+  if ((bwr = calloc(1, sizeof(*bwr))) == NULL) {
+    warnx("cannot allocate buffered writer");
+    return NULL;
+  }
+  bwr->fd = -1;
+  bwr->buf_size = buf_size;
+  bwr->buf_num = buf_num;
+  bwr->buf = calloc(buf_num, sizeof(char *));
+  bwr->buf_len = calloc(buf_num, sizeof(int));
+  if (bwr->buf == NULL || bwr->buf_len == NULL) {
+    warnx("cannot allocate buffered writer buffers");
+    h2_bwr_close(bwr);
+    return NULL;
+  }
+  for (i = 0; i < buf_num; i++) {
+    if ((bwr->buf[i] = malloc(buf_size)) == NULL) {
+      warnx("cannot allocate buffered writer buffer: size=%d", buf_size);
+      h2_bwr_close(bwr);
+      return NULL;
+    }
+  }
+
+  bwr->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (bwr->fd < 0) {
+    warnx("cannot open file to write: %s: %s", file, strerror(errno));
+    h2_bwr_close(bwr);
+    return NULL;
+  }
+
+  pthread_mutex_init(&bwr->lock, NULL);
+  pthread_cond_init(&bwr->cond, NULL);
+  pthread_cond_init(&bwr->done_cond, NULL);
+  if (pthread_create(&bwr->thread, NULL, h2_bwr_thread, bwr) != 0) {
+    warnx("cannot create buffered writer thread");
+    pthread_cond_destroy(&bwr->done_cond);
+    pthread_cond_destroy(&bwr->cond);
+    pthread_mutex_destroy(&bwr->lock);
+    close(bwr->fd);
+    bwr->fd = -1;
+    h2_bwr_close(bwr);
+    return NULL;
+  }
+  return bwr;
+}
+
+/* hand over the current buffer; returns 0(ok) or <0(no free buffer) */
+static int h2_bwr_handover(h2_bwr *bwr, int wait_free) {
+  int next = (bwr->cur + 1) % bwr->buf_num;
+
+  pthread_mutex_lock(&bwr->lock);
+  while (next == bwr->wr_idx && wait_free) {
+    pthread_cond_wait(&bwr->done_cond, &bwr->lock);
+  }
+  if (next == bwr->wr_idx) {
+    pthread_mutex_unlock(&bwr->lock);
+    return -1;
+  }
+  bwr->buf_len[bwr->cur] = bwr->cur_len;
+  bwr->cur = next;
+  pthread_cond_signal(&bwr->cond);
+  pthread_mutex_unlock(&bwr->lock);
+
+  bwr->cur_len = 0;
+  return 0;
+}
+
+void *h2_bwr_alloc(h2_bwr *bwr, int size) {
+  void *p;
+
+  if (size <= 0 || size > bwr->buf_size) {
+    bwr->drop_rec_num++;
+    return NULL;
+  }
+  if (bwr->cur_len + size > bwr->buf_size &&
+      h2_bwr_handover(bwr, 0) < 0) {
+    bwr->drop_rec_num++;
+    return NULL;
+  }
+  p = bwr->buf[bwr->cur] + bwr->cur_len;
+  bwr->cur_len += size;
+  bwr->rec_num++;
+  return p;
+}
+
+int h2_bwr_write(h2_bwr *bwr, const void *data, int size) {
+  void *p;
+
+  if ((p = h2_bwr_alloc(bwr, size)) == NULL) {
+    return -1;
+  }
+  memcpy(p, data, size);
+  return 0;
+}
+
+void h2_bwr_flush(h2_bwr *bwr) {
+  if (bwr->cur_len > 0) {
+    h2_bwr_handover(bwr, 0);  /* retried on next flush if busy */
+  }
+}
+
+void h2_bwr_stat(h2_bwr *bwr, long long *rec_num_ret,
+                 long long *drop_rec_num_ret, long long *written_bytes_ret) {
+  if (rec_num_ret) {
+    *rec_num_ret = bwr->rec_num;
+  }
+  if (drop_rec_num_ret) {
+    *drop_rec_num_ret = bwr->drop_rec_num;
+  }
+  if (written_bytes_ret) {
+    pthread_mutex_lock(&bwr->lock);
+    *written_bytes_ret = bwr->written_bytes;
+    pthread_mutex_unlock(&bwr->lock);
+  }
+}
+
+long long h2_bwr_close(h2_bwr *bwr) {
+  long long written_bytes;
+  int i;
+
+  if (bwr == NULL) {
+    return 0;
+  }
+  if (bwr->fd >= 0) {
+    if (bwr->cur_len > 0) {
+      h2_bwr_handover(bwr, 1);
+    }
+    pthread_mutex_lock(&bwr->lock);
+    bwr->is_closing = 1;
+    pthread_cond_signal(&bwr->cond);
+    pthread_mutex_unlock(&bwr->lock);
+    pthread_join(bwr->thread, NULL);
+    pthread_cond_destroy(&bwr->done_cond);
+    pthread_cond_destroy(&bwr->cond);
+    pthread_mutex_destroy(&bwr->lock);
+    close(bwr->fd);
+  }
+  if (bwr->buf) {
+    for (i = 0; i < bwr->buf_num; i++) {
+      free(bwr->buf[i]);
+    }
+    free(bwr->buf);
+  }
+  free(bwr->buf_len);
+  written_bytes = bwr->written_bytes;
+  free(bwr);
+  return written_bytes;
+}
@@ -0,0 +1,407 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#ifdef TLS_MODE
+#include <openssl/ssl.h>
+#endif
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Traffic Capture and Replay ----------------------------------------------
+ * file is a header followed by 8 bytes aligned records in host byte order;
+ * a record has method, path, headers and body or its length and hash only
+ */
+
+#define H2_CAP_MAGIC      "H2CAP001"
+#define H2_CAP_BUF_SIZE   (4 * 1024 * 1024)
+#define H2_CAP_BUF_NUM    8
+
+#define H2_CAP_F_BODY_HASH  0x0001
+
+typedef struct h2_cap_hdr {
+  char magic[8];
+  int64_t start_time_usec;  /* wall clock time of capture start */
+} h2_cap_hdr;
+
+struct h2_cap_rec {
+  uint32_t rec_len;   /* including this header and padding */
+  uint32_t body_len;  /* original body length */
+  int64_t usec;       /* since capture start */
+  uint16_t method_len;
+  uint16_t path_len;
+  uint16_t hdr_num;
+  uint16_t flags;     /* H2_CAP_F_* */
+  /* method, path, { uint16_t name_len, value_len; name, value } * hdr_num,
+   * then body[body_len] or uint64_t body hash for H2_CAP_F_BODY_HASH */
+};
+
+struct h2_cap {
+  /* capture */
+  h2_bwr *bwr;
+  int body_mode;
+  long long start_usec;
+
+  /* replay */
+  char *map;
+  size_t map_size;
+  size_t map_end;     /* end of the last valid record */
+  int rec_num;
+  char *zero_body;    /* for body hash only records */
+};
+
+
+/* FNV-1a 64 on 8 bytes words; not byte-wise to keep up with body rate */
+static uint64_t h2_cap_hash(uint64_t h, const void *data, int len) {
+  const unsigned char *p = data;
+  uint64_t w;
+  int i;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+#define H2_CAP_HASH_INIT  0xcbf29ce484222325ULL
+
+static int h2_cap_align(int len) {
+  return (len + 7) & ~7;
+}
+
+/* content-length is regenerated from body_len on replay */
+static int h2_cap_hdr_skip(const char *name) {
+  return !strcasecmp(name, "content-length");
+}
+
+
+/*
+ * Capture ------------------------------------------------------------------
+ */
+
+h2_cap *h2_cap_open(const char *file, int body_mode) {
+  h2_cap *cap;
+  h2_cap_hdr hdr;
+  struct timespec ts;
+
+  if ((cap = calloc(1, sizeof(*cap))) == NULL) {
+    warnx("cannot allocate capture");
+    return NULL;
+  }
+  cap->body_mode = body_mode;
+  cap->bwr = h2_bwr_open(file, H2_CAP_BUF_SIZE, H2_CAP_BUF_NUM);
+  if (cap->bwr == NULL) {
+    free(cap);
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, H2_CAP_MAGIC, sizeof(hdr.magic));
+  hdr.start_time_usec = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  h2_bwr_write(cap->bwr, &hdr, sizeof(hdr));
+  cap->start_usec = h2_time_usec();
+  return cap;
+}
+
+int h2_cap_write(h2_cap *cap, h2_msg *req) {
+  struct h2_cap_rec *rec;
+  const char *method = h2_method(req);
+  const char *path = h2_path(req);
+  const char *name, *value;
+  const struct iovec *iov;
+  uint16_t lens[2];
+  uint64_t hash;
+  int method_len = (method)? strlen(method) : 0;
+  int path_len = (path)? strlen(path) : 0;
+  int hdr_num = h2_hdr_num(req);
+  int body_len = h2_body_len(req);
+  int len, i, iov_num;
+  char *p;
+
+  len = sizeof(*rec) + method_len + path_len;
+  for (i = 0; i < h2_hdr_num(req); i++) {
+    name = h2_hdr_idx_name(req, i);
+    if (h2_cap_hdr_skip(name)) {
+      hdr_num--;
+      continue;
+    }
+    len += 4 + strlen(name) + strlen(h2_hdr_idx_value(req, i));
+  }
+  len += (cap->body_mode == H2_CAP_BODY_HASH)? 8 : body_len;
+  len = h2_cap_align(len);
+
+  if ((rec = h2_bwr_alloc(cap->bwr, len)) == NULL) {
+    return -1;  /* dropped */
+  }
+  rec->rec_len = len;
+  rec->body_len = body_len;
+  rec->usec = h2_time_usec() - cap->start_usec;
+  rec->method_len = method_len;
+  rec->path_len = path_len;
+  rec->hdr_num = hdr_num;
+  rec->flags = (cap->body_mode == H2_CAP_BODY_HASH)? H2_CAP_F_BODY_HASH : 0;
+
+  p = (char *)(rec + 1);
+  memcpy(p, method, method_len);
+  p += method_len;
+  memcpy(p, path, path_len);
+  p += path_len;
+  for (i = 0; i < h2_hdr_num(req); i++) {
+    name = h2_hdr_idx_name(req, i);
+    if (h2_cap_hdr_skip(name)) {
+      continue;
+    }
+    value = h2_hdr_idx_value(req, i);
+    lens[0] = strlen(name);
+    lens[1] = strlen(value);
+    memcpy(p, lens, 4);
+    p += 4;
+    memcpy(p, name, lens[0]);
+    p += lens[0];
+    memcpy(p, value, lens[1]);
+    p += lens[1];
+  }
+  if (cap->body_mode == H2_CAP_BODY_HASH) {
+    hash = H2_CAP_HASH_INIT;
+    if ((iov = h2_body_iov(req, &iov_num))) {
+      for (i = 0; i < iov_num; i++) {
+        hash = h2_cap_hash(hash, iov[i].iov_base, iov[i].iov_len);
+      }
+    } else if (body_len > 0) {
+      hash = h2_cap_hash(hash, h2_body(req), body_len);
+    }
+    memcpy(p, &hash, 8);
+    p += 8;
+  } else if (body_len > 0) {
+    if ((iov = h2_body_iov(req, &iov_num))) {
+      for (i = 0; i < iov_num; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+      }
+    } else {
+      memcpy(p, h2_body(req), body_len);
+      p += body_len;
+    }
+  }
+  memset(p, 0, (char *)rec + len - p);  /* padding */
+  return 0;
+}
+
+void h2_cap_flush(h2_cap *cap) {
+  if (cap->bwr) {
+    h2_bwr_flush(cap->bwr);
+  }
+}
+
+
+/*
+ * Replay -------------------------------------------------------------------
+ */
+
+/* returns record length or 0 if not a valid record at off */
+static int h2_cap_rec_check(h2_cap *cap, size_t off) {
+  const struct h2_cap_rec *rec = (const struct h2_cap_rec *)(cap->map + off);
+  const char *p, *end;
+  uint16_t lens[2];
+  int i;
+
+  if (cap->map_size - off < sizeof(*rec) ||
+      rec->rec_len < sizeof(*rec) || (rec->rec_len & 7) ||
+      rec->rec_len > cap->map_size - off) {
+    return 0;
+  }
+  p = (const char *)(rec + 1) + rec->method_len + rec->path_len;
+  end = cap->map + off + rec->rec_len;
+  for (i = 0; i < rec->hdr_num && p + 4 <= end; i++) {
+    memcpy(lens, p, 4);
+    p += 4 + lens[0] + lens[1];
+  }
+  if (i < rec->hdr_num || rec->hdr_num > H2_MSG_HDR_MAX) {
+    return 0;
+  }
+  p += (rec->flags & H2_CAP_F_BODY_HASH)? 8 : rec->body_len;
+  if (p > end) {
+    return 0;
+  }
+  return rec->rec_len;
+}
+
+h2_cap *h2_cap_map(const char *file) {
+  h2_cap *cap;
+  struct stat st;
+  size_t off;
+  int fd, len, zero_len = 0;
+  const struct h2_cap_rec *rec;
+
+  if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+    warnx("cannot open capture file: %s: %s", file, strerror(errno));
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(h2_cap_hdr)) {
+    warnx("invalid capture file: %s", file);
+    close(fd);
+    return NULL;
+  }
+  if ((cap = calloc(1, sizeof(*cap))) == NULL) {
+    warnx("cannot allocate capture");
+    close(fd);
+    return NULL;
+  }
+  cap->map_size = st.st_size;
+  cap->map = mmap(NULL, cap->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (cap->map == MAP_FAILED) {
+    warnx("cannot mmap capture file: %s: %s", file, strerror(errno));
+    free(cap);
+    return NULL;
+  }
+  if (memcmp(cap->map, H2_CAP_MAGIC, 8)) {
+    warnx("not a capture file: %s", file);
+    h2_cap_close(cap, NULL);
+    return NULL;
+  }
+
+  /* validate records once not to check on replay */
+  for (off = sizeof(h2_cap_hdr); off < cap->map_size; off += len) {
+    if ((len = h2_cap_rec_check(cap, off)) == 0) {
+      warnx("capture file truncated or corrupted at offset %zu: %s; "
+            "%d records before are used", off, file, cap->rec_num);
+      break;
+    }
+    rec = (const struct h2_cap_rec *)(cap->map + off);
+    if ((rec->flags & H2_CAP_F_BODY_HASH) && (int)rec->body_len > zero_len) {
+      zero_len = rec->body_len;
+    }
+    cap->rec_num++;
+  }
+  cap->map_end = off;
+  if (zero_len > 0 && (cap->zero_body = calloc(1, zero_len)) == NULL) {
+    warnx("cannot allocate replay body: size=%d", zero_len);
+    h2_cap_close(cap, NULL);
+    return NULL;
+  }
+  madvise(cap->map, cap->map_size, MADV_SEQUENTIAL);
+  return cap;
+}
+
+int h2_cap_rec_num(h2_cap *cap) {
+  return cap->rec_num;
+}
+
+const h2_cap_rec *h2_cap_next(h2_cap *cap, const h2_cap_rec *rec) {
+  size_t off;
+
+  if (rec == NULL) {
+    off = sizeof(h2_cap_hdr);
+  } else {
+    off = (const char *)rec - cap->map + rec->rec_len;
+  }
+  if (off >= cap->map_end) {
+    return NULL;
+  }
+  return (const h2_cap_rec *)(cap->map + off);
+}
+
+long long h2_cap_rec_usec(const h2_cap_rec *rec) {
+  return rec->usec;
+}
+
+int h2_cap_rec_msg(h2_cap *cap, const h2_cap_rec *rec, h2_msg *req) {
+  const char *p = (const char *)(rec + 1);
+  struct iovec iov;
+  uint16_t lens[2];
+  int i;
+
+  if (rec->method_len > 0) {
+    h2_set_method_n(req, p, rec->method_len);
+  }
+  p += rec->method_len;
+  if (rec->path_len > 0) {
+    h2_set_path_n(req, p, rec->path_len);
+  }
+  p += rec->path_len;
+  for (i = 0; i < rec->hdr_num; i++) {
+    memcpy(lens, p, 4);
+    p += 4;
+    if (h2_add_hdr_n(req, p, lens[0], p + lens[0], lens[1]) < 0) {
+      return -1;
+    }
+    p += lens[0] + lens[1];
+  }
+  if (rec->body_len > 0) {
+    /* referenced on the map or the zero body kept until h2_cap_close() */
+    iov.iov_base = (rec->flags & H2_CAP_F_BODY_HASH)? cap->zero_body :
+                                                      (void *)p;
+    iov.iov_len = rec->body_len;
+    if (h2_set_body_iov(req, &iov, 1) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+void h2_cap_close(h2_cap *cap, FILE *stat_fp) {
+  long long rec_num, drop_rec_num, written_bytes;
+
+  if (cap == NULL) {
+    return;
+  }
+  if (cap->bwr) {
+    h2_bwr_stat(cap->bwr, &rec_num, &drop_rec_num, NULL);
+    written_bytes = h2_bwr_close(cap->bwr);
+    if (stat_fp) {
+      fprintf(stat_fp, "CAPTURE: records=%lld dropped=%lld bytes=%lld\n",
+              rec_num - 1/* file header */, drop_rec_num, written_bytes);
+    }
+  }
+  if (cap->map) {
+    munmap(cap->map, cap->map_size);
+  }
+  free(cap->zero_body);
+  free(cap);
+}
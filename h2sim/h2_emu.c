@@ -0,0 +1,409 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef TLS_MODE
+#include <openssl/ssl.h>
+#endif
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Network Emulation --------------------------------------------------------
+ * sent bytes are queued into per session delay line as chunks of each write
+ * and sent to the socket by timer on due time within token bucket rate;
+ * lost chunks are delayed by retransmit timeout holding the later ones as
+ * tcp in-order delivery; reads may be stalled after each recv or over the
+ * read rate to hold bytes in the socket for backpressure to the sender;
+ * emulation is applied to emu_sess_pct of sessions spread in order
+ */
+
+#define H2_EMU_RTO_USEC     200000       /* linux min rto for lost chunk */
+#define H2_EMU_MSS          1448         /* for chunk loss probability */
+#define H2_EMU_QUEUE_MIN    (256 * 1024) /* delay line bytes to block writer */
+#define H2_EMU_BURST_USEC   10000        /* token bucket depth in time */
+#define H2_EMU_BURST_MIN    (16 * 1024)
+#define H2_EMU_RETRY_USEC   1000         /* on socket would block */
+
+struct h2_emu_chunk {
+  h2_emu_chunk *next;
+  long long due_usec;     /* earliest time to be sent */
+  int size;
+  int off;                /* sent bytes of data */
+  unsigned char data[];   /* dynamic alloced [size] */
+};
+
+int h2_emu_is_set(const h2_settings *settings) {
+  return (settings->emu_delay > 0 || settings->emu_jitter > 0 ||
+          settings->emu_rate > 0 || settings->emu_loss > 0 ||
+          settings->emu_read_stall > 0 || settings->emu_read_rate > 0);
+}
+
+h2_emu *h2_emu_init(h2_sess *sess) {
+  h2_settings *settings = &sess->settings;
+  if (!h2_emu_is_set(settings)) {
+    return NULL;
+  }
+  if (settings->emu_sess_pct > 0 && settings->emu_sess_pct < 100) {
+    /* n-th session is emulated when n * pct / 100 steps up */
+    long long n = sess->ctx->emu_sess_seq++;
+    if ((n + 1) * settings->emu_sess_pct / 100 ==
+        n * settings->emu_sess_pct / 100) {
+      return NULL;
+    }
+  }
+
+  h2_emu *emu = calloc(1, sizeof(h2_emu));
+  emu->delay_usec = settings->emu_delay * 1000LL;
+  emu->jitter_usec = settings->emu_jitter * 1000LL;
+  emu->rate = settings->emu_rate * 1000LL / 8;  /* kbps to bytes/sec */
+  emu->loss = settings->emu_loss;
+  emu->stall_usec = settings->emu_read_stall * 1000LL;
+  emu->read_rate = settings->emu_read_rate * 1000LL / 8;
+
+  /* bandwidth delay product over the delay line plus socket buffer */
+  long long bdp = (emu->rate > 0)?
+      emu->rate * (emu->delay_usec + emu->jitter_usec) / 1000000 : 0;
+  emu->queue_max = H2_EMU_QUEUE_MIN + (int)((bdp < (1 << 30))? bdp : 1 << 30);
+  emu->burst = emu->rate * H2_EMU_BURST_USEC / 1000000;
+  if (emu->burst < H2_EMU_BURST_MIN) {
+    emu->burst = H2_EMU_BURST_MIN;
+  }
+  emu->tokens = emu->burst;
+  emu->token_usec = h2_time_usec();
+  emu->read_burst = emu->read_rate * H2_EMU_BURST_USEC / 1000000;
+  if (emu->read_burst < H2_EMU_MSS) {
+    emu->read_burst = H2_EMU_MSS;
+  }
+  emu->read_tokens = emu->read_burst;
+  emu->read_token_usec = emu->token_usec;
+  emu->seed = (unsigned int)(emu->token_usec ^ (long long)sess->fd);
+  return emu;
+}
+
+void h2_emu_free(h2_sess *sess) {
+  h2_emu *emu = sess->emu;
+  if (emu == NULL) {
+    return;
+  }
+  if (emu->timer) {
+    h2_timer_del(sess->ctx, emu->timer);
+  }
+  while (emu->head) {
+    h2_emu_chunk *c = emu->head;
+    emu->head = c->next;
+    free(c);
+  }
+  free(emu);
+  sess->emu = NULL;
+}
+
+/* real socket write; returns sent, 0 on would block or <0 on error */
+static int h2_emu_sock_write(h2_sess *sess, const void *data, int size) {
+  int sent;
+#ifdef TLS_MODE
+  if (sess->ssl) {
+    sent = SSL_write(sess->ssl, data, size);
+    if (sent > 0) {
+      return sent;
+    }
+    if (SSL_get_error(sess->ssl, sent) == SSL_ERROR_WANT_WRITE) {
+      return 0;  /* NOTE: should be repeated with same buf and size */
+    }
+    warnx("%sSSL_write(emu chunk) error: %d",
+          sess->log_prefix, SSL_get_error(sess->ssl, sent));
+    sess->close_reason = CLOSE_BY_SSL_ERR;
+    return -1;
+  }
+#endif
+  sent = send(sess->fd, data, size, 0);
+  if (sent > 0) {
+    return sent;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+    return 0;
+  }
+  if (sess->is_terminated && errno == EPIPE) {
+    sess->close_reason = CLOSE_BY_SOCK_EOF;
+  } else {
+    warnx("%ssend(emu chunk) error: %s", sess->log_prefix, strerror(errno));
+    sess->close_reason = CLOSE_BY_SOCK_ERR;
+  }
+  return -1;
+}
+
+static void h2_emu_timer_cb(h2_ctx *ctx, void *user_data);
+
+/* (re)arm timer for the next due chunk or read resume */
+static void h2_emu_schedule(h2_sess *sess, long long now) {
+  h2_emu *emu = sess->emu;
+  long long next = 0;
+
+  if (emu->head) {
+    h2_emu_chunk *c = emu->head;
+    next = c->due_usec;
+    if (emu->rate > 0) {
+      /* wait for tokens of the chunk remain or the bucket depth */
+      double need = c->size - c->off;
+      if (need > emu->burst) {
+        need = emu->burst;
+      }
+      if (emu->tokens < need) {
+        long long t = now + (long long)((need - emu->tokens) * 1000000 /
+                                        emu->rate) + 1;
+        if (t > next) {
+          next = t;
+        }
+      }
+    }
+    if (emu->is_sock_blocked && next < now + H2_EMU_RETRY_USEC) {
+      next = now + H2_EMU_RETRY_USEC;
+    }
+  }
+  if (emu->read_resume_usec > 0 &&
+      (next == 0 || emu->read_resume_usec < next)) {
+    next = emu->read_resume_usec;
+  }
+  if (next == 0) {
+    return;  /* nothing to wait */
+  }
+  if (emu->timer) {
+    if (emu->timer_usec <= next) {
+      return;  /* earlier one pending */
+    }
+    h2_timer_del(sess->ctx, emu->timer);
+  }
+  emu->timer_usec = next;
+  emu->timer = h2_timer_add(sess->ctx, next - now, h2_emu_timer_cb, sess);
+}
+
+int h2_emu_write(h2_sess *sess, const void *data, int size) {
+  h2_emu *emu = sess->emu;
+
+  int room = emu->queue_max - emu->queued;
+  if (room <= 0) {
+    if (!emu->is_blocked) {
+      emu->is_blocked = 1;
+      emu->blocked_cnt++;
+      h2_sess_set_events(sess);  /* no EPOLLOUT till delay line drained */
+    }
+    return 0;
+  }
+  if (size > room) {
+    size = room;
+  }
+
+  long long now = h2_time_usec();
+  h2_emu_chunk *c = malloc(sizeof(h2_emu_chunk) + size);
+  memcpy(c->data, data, size);
+  c->size = size;
+  c->off = 0;
+  c->next = NULL;
+  c->due_usec = now + emu->delay_usec;
+  if (emu->jitter_usec > 0) {
+    c->due_usec += rand_r(&emu->seed) % (emu->jitter_usec + 1);
+  }
+  if (emu->loss > 0) {
+    /* loss of any segment of the chunk; emu_loss is per mille */
+    int seg_num = (size + H2_EMU_MSS - 1) / H2_EMU_MSS;
+    if (rand_r(&emu->seed) % 1000 < emu->loss * seg_num) {
+      c->due_usec += H2_EMU_RTO_USEC;
+      emu->lost_cnt++;
+    }
+  }
+  if (c->due_usec < emu->last_due_usec) {
+    c->due_usec = emu->last_due_usec;  /* in-order delivery */
+  }
+  emu->last_due_usec = c->due_usec;
+
+  if (emu->tail) {
+    emu->tail->next = c;
+  } else {
+    emu->head = c;
+  }
+  emu->tail = c;
+  emu->queued += size;
+  emu->chunk_cnt++;
+  emu->byte_cnt += size;
+
+  h2_emu_schedule(sess, now);
+  return size;
+}
+
+/* send due chunks within tokens; returns sent bytes or <0 on error */
+static int h2_emu_flush(h2_sess *sess, long long now) {
+  h2_emu *emu = sess->emu;
+  int total_sent = 0;
+
+  if (emu->rate > 0) {
+    emu->tokens += (double)emu->rate * (now - emu->token_usec) / 1000000;
+    if (emu->tokens > emu->burst) {
+      emu->tokens = emu->burst;
+    }
+  }
+  emu->token_usec = now;
+  emu->is_sock_blocked = 0;
+
+  h2_emu_chunk *c;
+  while ((c = emu->head) && c->due_usec <= now) {
+    int size = c->size - c->off;
+    if (emu->rate > 0) {
+      if (emu->tokens < 1) {
+        break;
+      }
+      if (size > emu->tokens) {
+        size = (int)emu->tokens;
+      }
+    }
+    int sent = h2_emu_sock_write(sess, c->data + c->off, size);
+    if (sent < 0) {
+      return -1;
+    } else if (sent == 0) {
+      emu->is_sock_blocked = 1;
+      break;
+    }
+    if (emu->rate > 0) {
+      emu->tokens -= sent;
+    }
+    total_sent += sent;
+    emu->queued -= sent;
+    c->off += sent;
+    if (c->off >= c->size) {
+      emu->head = c->next;
+      if (emu->head == NULL) {
+        emu->tail = NULL;
+      }
+      free(c);
+    }
+  }
+  return total_sent;
+}
+
+static void h2_emu_timer_cb(h2_ctx *ctx, void *user_data) {
+  h2_sess *sess = user_data;
+  h2_emu *emu = sess->emu;
+  (void)ctx;
+
+  emu->timer = NULL;  /* freed by caller after return */
+  long long now = h2_time_usec();
+
+  if (emu->read_resume_usec > 0 && emu->read_resume_usec <= now) {
+    emu->read_resume_usec = 0;
+    h2_sess_set_events(sess);
+  }
+
+  if (h2_emu_flush(sess, now) < 0) {
+    h2_sess_free(sess);
+    return;
+  }
+
+  /* resume blocked writer, or let it close on all sent */
+  if ((emu->is_blocked && emu->queued < emu->queue_max) ||
+      emu->queued == 0) {
+    if (emu->is_blocked) {
+      emu->is_blocked = 0;
+      h2_sess_set_events(sess);
+    }
+    if (emu->queued == 0 && sess->is_terminated &&
+        sess->http_ver != H2_HTTP_V2) {
+      sess->close_reason = CLOSE_BY_HTTP_END;
+      h2_sess_free(sess);
+      return;
+    }
+    if (h2_sess_send(sess) < 0) {
+      h2_sess_free(sess);
+      return;
+    }
+  }
+
+  h2_emu_schedule(sess, now);
+}
+
+void h2_emu_stall_read(h2_sess *sess, int recv_len) {
+  h2_emu *emu = sess->emu;
+  if ((emu->stall_usec <= 0 && emu->read_rate <= 0) ||
+      emu->read_resume_usec > 0) {
+    return;
+  }
+  long long now = h2_time_usec();
+  long long resume = (emu->stall_usec > 0)? now + emu->stall_usec : 0;
+  if (emu->read_rate > 0) {
+    /* read is done at once; stalled until the tokens are paid back */
+    emu->read_tokens += (double)emu->read_rate *
+                        (now - emu->read_token_usec) / 1000000;
+    if (emu->read_tokens > emu->read_burst) {
+      emu->read_tokens = emu->read_burst;
+    }
+    emu->read_token_usec = now;
+    emu->read_tokens -= recv_len;
+    if (emu->read_tokens < 0) {
+      long long t = now + (long long)(-emu->read_tokens * 1000000 /
+                                      emu->read_rate) + 1;
+      if (t > resume) {
+        resume = t;
+      }
+    }
+  }
+  if (resume == 0) {
+    return;
+  }
+  emu->read_resume_usec = resume;
+  emu->stall_cnt++;
+  h2_sess_set_events(sess);
+  h2_emu_schedule(sess, now);
+}
+
+int h2_emu_is_read_stalled(h2_sess *sess) {
+  return (sess->emu && sess->emu->read_resume_usec > 0);
+}
+
+int h2_emu_is_send_blocked(h2_sess *sess) {
+  return (sess->emu && sess->emu->is_blocked);
+}
+
+int h2_emu_queued(h2_sess *sess) {
+  return (sess->emu)? sess->emu->queued : 0;
+}
+
+void h2_emu_print_stat(h2_sess *sess) {
+  h2_emu *emu = sess->emu;
+  if (emu == NULL) {
+    return;
+  }
+  warnx("%sNETWORK EMULATION: %lld bytes in %lld chunks delayed; "
+        "%lld lost, %lld writer blocked, %lld read stalled",
+        sess->log_prefix, emu->byte_cnt, emu->chunk_cnt,
+        emu->lost_cnt, emu->blocked_cnt, emu->stall_cnt);
+}
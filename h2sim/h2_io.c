@@ -88,33 +88,46 @@ static void h2_set_close_exec(int fd) {
  * - tcp MTU: 1360 or less; cf. some public CPs site has MTU 1360
  */
 
-void h2_sess_mark_send_pending(h2_sess *sess) {
-  if (!sess->send_pending) {
+void h2_sess_set_events(h2_sess *sess) {
 #ifdef EPOLL_MODE
-    struct epoll_event e;
-    e.events = EPOLLIN | EPOLLOUT;
-    e.data.ptr = &sess->obj;
-    epoll_ctl(sess->fd, EPOLL_CTL_MOD, sess->fd, &e);
+  struct epoll_event e;
+  e.events = 0;
+  if (!h2_emu_is_read_stalled(sess)) {
+    e.events |= EPOLLIN;
+  }
+  if (sess->send_pending && !h2_emu_is_send_blocked(sess)) {
+    e.events |= EPOLLOUT;  /* emulation timer resumes blocked send */
+  }
+  e.data.ptr = &sess->obj;
+  if (sess->fd >= 0) {
+    epoll_ctl(sess->ctx->epoll_fd, EPOLL_CTL_MOD, sess->fd, &e);
+  }
+#else
+  (void)sess;  /* poll events are built on each loop */
 #endif
+}
+
+void h2_sess_mark_send_pending(h2_sess *sess) {
+  if (!sess->send_pending) {
     sess->send_pending = 1;
+    h2_sess_set_events(sess);
   }
 }
 
 void h2_sess_clear_send_pending(h2_sess *sess) {
   if (sess->send_pending) {
-#ifdef EPOLL_MODE
-    struct epoll_event e;
-    e.events = EPOLLIN;
-    e.data.ptr = &sess->obj;
-    epoll_ctl(sess->fd, EPOLL_CTL_MOD, sess->fd, &e);
-#endif
     sess->send_pending = 0;
+    h2_sess_set_events(sess);
   }
 }
 
 int h2_sess_send(h2_sess *sess) {
   int r;
 
+  if (sess->is_aborted) {
+    return -1;  /* to be freed by caller */
+  }
+
   if (sess->http_ver == H2_HTTP_V2) {
     do {
       r = h2_sess_send_once_v2(sess);
@@ -162,6 +175,9 @@ static int h2_sess_recv(h2_sess *sess) {
     sess->close_reason = CLOSE_BY_SOCK_EOF;
     return -2;
   }
+  if (sess->emu) {
+    h2_emu_stall_read(sess, recv_len);  /* slow reader emulation if set */
+  }
 
   //warnx("### DEBUG: DATA RECEIVED: recv_len=%d", (int)recv_len);
 
@@ -178,8 +194,10 @@ static int h2_sess_recv(h2_sess *sess) {
     }
   }
 
+  /* NOTE: HTTP/2 server has no req/rsp count; closed by nghttp2 end */
   if (sess->is_no_more_req && sess->req_cnt == sess->rsp_cnt &&
-      !sess->is_terminated) {
+      !sess->is_terminated &&
+      !(sess->is_server && sess->http_ver == H2_HTTP_V2)) {
     /* shutdown send side */
     if (sess->ctx->verbose) {
       warnx("%sTERMINATE SESSION FOR ALL RESPONSE RECEIVED", sess->log_prefix);
@@ -204,7 +222,9 @@ int h2_sess_terminate(h2_sess *sess, int wait_rsp) {
     return 1;  /* already terminated */
   }
 
-  if (wait_rsp) {
+  /* idle client session has no response to wait; HTTP/1.1 has no */
+  /* other way to close as half shutdown is not used */
+  if (wait_rsp && (sess->is_server || sess->req_cnt > sess->rsp_cnt)) {
     if (sess->is_no_more_req) {
       return 1;  /* already no_more_req marked */
     }
@@ -226,6 +246,24 @@ int h2_sess_terminate(h2_sess *sess, int wait_rsp) {
 
   return 0;
 }
+
+int h2_sess_abort(h2_sess *sess) {
+  if (sess == NULL || sess->is_aborted) {
+    return 1;  /* already aborted */
+  }
+  if (sess->ctx->verbose) {
+    warnx("%sABORT SESSION", sess->log_prefix);
+  }
+  /* close() sends RST instead of FIN; queued data are dropped */
+  struct linger lg = { 1, 0 };
+  setsockopt(sess->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+  sess->is_aborted = 1;
+  sess->is_terminated = 1;
+  sess->is_no_more_req = 1;
+  /* mark close event to be handled; freed on next send */
+  h2_sess_mark_send_pending(sess);
+  return 0;
+}
   
 
 /*
@@ -259,6 +297,7 @@ static h2_sess *h2_sess_init_client(h2_ctx *ctx, h2_peer *peer, SSL *ssl,
 
   sess->ssl = ssl;
   sess->fd = fd;
+  sess->emu = h2_emu_init(sess);  /* after connect and tls handshake */
 
   /* use local binding address for session log prefix */
   struct sockaddr_in6 sa;  /* to allow ipv4 and ipv6 */
@@ -311,6 +350,7 @@ static h2_sess *h2_sess_client_start(int sock, h2_ctx *ctx, h2_peer *peer,
                     h2_settings *settings) {
   SSL *ssl = NULL;
   int http_ver = ctx->http_ver;
+  char hs_str[64] = "";  /* tls handshake time */
 #ifdef TLS_MODE
 #else
   (void)client_ssl_ctx;
@@ -329,6 +369,7 @@ static h2_sess *h2_sess_client_start(int sock, h2_ctx *ctx, h2_peer *peer,
     /* HERE: TODO: MAY NEED TO SET sock NOBLOCKING before  SSL_set_fd() */
     /* HERE: TO CHECK: is sock needs to be close()ed on error exit case? */
 
+    h2_ssl_ctx_check_update(client_ssl_ctx);
     ssl = SSL_new(client_ssl_ctx);
     if (!ssl) {
       warnx("%s connected but cannot create tls session: %s",
@@ -339,7 +380,10 @@ static h2_sess *h2_sess_client_start(int sock, h2_ctx *ctx, h2_peer *peer,
       SSL_set_alpn_protos(ssl, (const unsigned char *)"\x02h2", 3);
     }
     SSL_set_fd(ssl, sock);
-    r = SSL_connect(ssl);
+    long long hs_usec;
+    H2_PROF_PHASE(H2_PROF_TLS,
+                  r = h2_ssl_handshake(ssl, 0/*client*/, &hs_usec));
+    snprintf(hs_str, sizeof(hs_str), " (handshake %lld usec)", hs_usec);
     if (r == 0) {
       warnx("%s connected but shutdown by tls protocol: %d",
             authority, SSL_get_error(ssl, r));
@@ -378,8 +422,8 @@ static h2_sess *h2_sess_client_start(int sock, h2_ctx *ctx, h2_peer *peer,
       h2_sess_free(sess);
       return NULL;
     }
-    fprintf(stderr, "%sCONNECTED %s HTTP/2 TO %s\n",
-            sess->log_prefix, transport, authority);
+    fprintf(stderr, "%sCONNECTED %s HTTP/2 TO %s%s\n",
+            sess->log_prefix, transport, authority, hs_str);
   } else if (http_ver == H2_HTTP_V2_TRY) {
     /* try to upgrade to HTTP2; TCP only */
 #if 0  /* TODO: TO BE IMPLEMENTED */
@@ -392,8 +436,9 @@ static h2_sess *h2_sess_client_start(int sock, h2_ctx *ctx, h2_peer *peer,
             sess->log_prefix, transport, authority);
   } else {
     /* HTTP/1.1 */
-    fprintf(stderr, "%sCONNECTED %s HTTP/1.1 TO %s\n",
-            sess->log_prefix, transport, authority);
+    fprintf(stderr, "%sCONNECTED %s HTTP/1.1 TO %s%s\n",
+            sess->log_prefix, transport, authority, hs_str);
+    h2_sess_mark_ready(sess);
   }
 
   return sess;
@@ -481,6 +526,7 @@ static int h2_sess_server_tcp_start(h2_sess *sess) {
     fprintf(stderr, "%sCONNECTED TCP HTTP/2\n", sess->log_prefix);
   } else if (sess->http_ver == H2_HTTP_V1_1) {
     fprintf(stderr, "%sCONNECTED TCP HTTP/1.1\n", sess->log_prefix);
+    h2_sess_mark_ready(sess);
   } else {
     /* NOTE: on client's setting received, h2_sess_send_settings_v2() is called */
     h2_sess_init_v2(sess);
@@ -491,7 +537,7 @@ static int h2_sess_server_tcp_start(h2_sess *sess) {
 }
 
 #ifdef TLS_MODE
-static int h2_sess_server_tls_start(h2_sess *sess) {
+static int h2_sess_server_tls_start(h2_sess *sess, long long hs_usec) {
   const unsigned char *alpn = NULL;
   unsigned int alpnlen = 0;
   SSL *ssl = sess->ssl;
@@ -514,9 +560,12 @@ static int h2_sess_server_tls_start(h2_sess *sess) {
     if (h2_sess_send_settings_v2(sess) < 0) {
        return -1;
     }
-    fprintf(stderr, "%sCONNECTED TLS HTTP/2\n", sess->log_prefix);
+    fprintf(stderr, "%sCONNECTED TLS HTTP/2 (handshake %lld usec)\n",
+            sess->log_prefix, hs_usec);
   } else {
-    fprintf(stderr, "%sCONNECTED TLS HTTP/1.1\n", sess->log_prefix);
+    fprintf(stderr, "%sCONNECTED TLS HTTP/1.1 (handshake %lld usec)\n",
+            sess->log_prefix, hs_usec);
+    h2_sess_mark_ready(sess);
   }
   return 0;
 }
@@ -582,10 +631,12 @@ static h2_sess *h2_sess_init_server(h2_ctx *ctx, h2_svr *svr, int fd,
   /* call user accept callback */
   SSL_CTX *sess_ssl_ctx = NULL;
   if (svr->accept_cb) {
-    int r = svr->accept_cb(svr, svr->user_data, host, port,
-                           &sess_ssl_ctx, &sess->settings,
-                           &sess->request_cb,
-                           &sess->sess_free_cb, &sess->user_data);
+    int r;
+    H2_PROF_PHASE(H2_PROF_APP,
+                  r = svr->accept_cb(svr, svr->user_data, host, port,
+                                     &sess_ssl_ctx, &sess->settings,
+                                     &sess->request_cb,
+                                     &sess->sess_free_cb, &sess->user_data));
     if (r < 0) {
       warnx("%saccept_cb failed: %d", sess->log_prefix, r);
       sess->sess_free_cb = NULL;
@@ -594,10 +645,16 @@ static h2_sess *h2_sess_init_server(h2_ctx *ctx, h2_svr *svr, int fd,
       return NULL;
     }
   }
+  sess->emu = h2_emu_init(sess);  /* on settings by accept_cb */
 
 #ifdef TLS_MODE
   if (svr->ssl_ctx) {
-    sess->ssl = SSL_new((sess_ssl_ctx)? sess_ssl_ctx : svr->ssl_ctx);
+    long long hs_usec;
+    if (!sess_ssl_ctx) {
+      sess_ssl_ctx = svr->ssl_ctx;
+    }
+    h2_ssl_ctx_check_update(sess_ssl_ctx);
+    sess->ssl = SSL_new(sess_ssl_ctx);
     if (!sess->ssl) {
       warnx("%scannot create ssl session: %s",
             sess->log_prefix, ERR_error_string(ERR_get_error(), NULL));
@@ -605,13 +662,16 @@ static h2_sess *h2_sess_init_server(h2_ctx *ctx, h2_svr *svr, int fd,
       return NULL;
     }
     SSL_set_fd(sess->ssl, sess->fd);
-    if (SSL_accept(sess->ssl) < 0) {
+    int r;
+    H2_PROF_PHASE(H2_PROF_TLS,
+                  r = h2_ssl_handshake(sess->ssl, 1/*server*/, &hs_usec));
+    if (r < 0) {
       warnx("%scannot create ssl session: %s",
             sess->log_prefix, ERR_error_string(ERR_get_error(), NULL));
       h2_sess_free(sess);
       return NULL;
     }
-    if (h2_sess_server_tls_start(sess) < 0)  {
+    if (h2_sess_server_tls_start(sess, hs_usec) < 0)  {
       h2_sess_free(sess);
       return NULL;
     }
@@ -629,6 +689,50 @@ static h2_sess *h2_sess_init_server(h2_ctx *ctx, h2_svr *svr, int fd,
   return sess;
 }
 
+static h2_svr *h2_svr_init(h2_ctx *ctx, const char *authority, int sock,
+                           SSL_CTX *svr_ssl_ctx, h2_accept_cb accept_cb,
+                           h2_svr_free_cb svr_free_cb, void *svr_user_data) {
+  /* NOTE: listen socket may be shared with other process on hot restart; */
+  /*       nonblocking not to be stuck at accept() lost to the other */
+  h2_set_nonblock(sock);
+
+  h2_svr *svr = calloc(1, sizeof(h2_svr));
+  svr->obj.cls = &h2_cls_svr;
+
+  /* insert into ctx server list */
+  svr->next = ctx->svr_list_head.next;
+  ctx->svr_list_head.next = svr;
+  svr->prev = &ctx->svr_list_head;
+  if (svr->next) {
+    svr->next->prev = svr;
+  }
+  ctx->svr_num++;
+
+  svr->ctx = ctx;
+  svr->authority = strdup(authority);
+  svr->ssl_ctx = svr_ssl_ctx;
+  svr->accept_fd = sock;
+
+  svr->accept_cb = accept_cb;
+  svr->svr_free_cb = svr_free_cb;
+  svr->user_data = svr_user_data;
+
+#ifdef EPOLL_MODE
+  struct epoll_event e;
+  e.events = EPOLLIN;
+  e.data.ptr = &svr->obj;
+  if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, svr->accept_fd, &e) < 0) {
+    warnx("svr init failed for epoll_ctl() error: %s", strerror(errno));
+    h2_svr_free(svr);
+    return NULL;
+  }
+#endif
+
+  fprintf(stderr, "listen %s for http2/%s\n",
+          authority, (svr_ssl_ctx)? "tls" : "tcp");
+  return svr;
+}
+
 h2_svr *h2_listen(h2_ctx *ctx, const char *authority, SSL_CTX *svr_ssl_ctx,
                   h2_accept_cb accept_cb,
                   h2_svr_free_cb svr_free_cb, void *svr_user_data) { /* get host and port from req[0].authority */
@@ -693,47 +797,29 @@ h2_svr *h2_listen(h2_ctx *ctx, const char *authority, SSL_CTX *svr_ssl_ctx,
   /* now, sock is valid listen socket */
   /* ASSUME: authority is not conflicting for bind() already checked */
 
-  h2_svr *svr = calloc(1, sizeof(h2_svr));
-  svr->obj.cls = &h2_cls_svr;
-
-  /* insert into ctx server list */
-  svr->next = ctx->svr_list_head.next;
-  ctx->svr_list_head.next = svr;
-  svr->prev = &ctx->svr_list_head;
-  if (svr->next) {
-    svr->next->prev = svr;
-  }
-  ctx->svr_num++;
-
-  svr->ctx = ctx;
-  svr->authority = strdup(authority);
-  svr->ssl_ctx = svr_ssl_ctx;
-  svr->accept_fd = sock;
-
-  svr->accept_cb = accept_cb;
-  svr->svr_free_cb = svr_free_cb;
-  svr->user_data = svr_user_data;
+  return h2_svr_init(ctx, authority, sock, svr_ssl_ctx,
+                     accept_cb, svr_free_cb, svr_user_data);
+}
 
-#ifdef EPOLL_MODE
-  struct epoll_event e;
-  e.events = EPOLLIN;
-  e.data.ptr = &svr->obj;
-  if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, svr->accept_fd, &e) < 0) {
-    warnx("svr init failed for epoll_ctl() error: %s", strerror(errno));
-    h2_svr_free(svr);
+h2_svr *h2_listen_fd(h2_ctx *ctx, const char *authority, int fd,
+                     SSL_CTX *svr_ssl_ctx, h2_accept_cb accept_cb,
+                     h2_svr_free_cb svr_free_cb, void *svr_user_data) {
+  int v = 0;
+  socklen_t v_len = sizeof(v);
+  if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &v, &v_len) < 0 || !v) {
+    warnx("not a listening socket: %s fd=%d", authority, fd);
+    close(fd);
     return NULL;
   }
-#endif
-
-  fprintf(stderr, "listen %s for http2/%s\n",
-          authority, (svr_ssl_ctx)? "tls" : "tcp");
-  return svr;
+  h2_set_close_exec(fd);
+  return h2_svr_init(ctx, authority, fd, svr_ssl_ctx,
+                     accept_cb, svr_free_cb, svr_user_data);
 }
 
 void h2_svr_free(h2_svr *svr) {
   /* call server user data free callback */
   if (svr->svr_free_cb) {
-    svr->svr_free_cb(svr, svr->user_data);
+    H2_PROF_PHASE(H2_PROF_APP, svr->svr_free_cb(svr, svr->user_data));
     svr->svr_free_cb = NULL;
     svr->user_data = NULL;
   }
@@ -759,6 +845,10 @@ void h2_svr_free(h2_svr *svr) {
   free(svr);
 }
 
+int h2_svr_fd(h2_svr *svr) {
+  return (svr)? svr->accept_fd : -1;
+}
+
 const char *h2_svr_authority(h2_svr *svr) {
   return (svr)? svr->authority : NULL;
 }
@@ -768,6 +858,110 @@ SSL_CTX *h2_svr_ssl_ctx(h2_svr *svr) {
 }
 
 
+/*
+ * Server Graceful Drain ---------------------------------------------------
+ * listen sockets are closed at once; server sessions are given GOAWAY
+ * notice one by one over the spread time not to make reconnect storm,
+ * then final GOAWAY after grace time for the requests in flight
+ */
+
+#define H2_DRAIN_TICK_USEC   10000    /* 10 msec */
+#define H2_DRAIN_GRACE_USEC  1000000  /* notice to final GOAWAY; ~ max RTT */
+
+static void h2_sess_drain_notice(h2_sess *sess, long long now) {
+  sess->drain_usec = now;
+  sess->ctx->drain_cnt++;
+  if (sess->http_ver == H2_HTTP_V2) {
+    h2_sess_drain_notice_v2(sess);
+  }
+  /* HTTP/1.1: "connection: close" on next responses by drain_usec */
+}
+
+static void h2_ctx_drain_timer_cb(h2_ctx *ctx, void *user_data) {
+  (void)user_data;
+
+  long long now = h2_time_usec();
+  long long elapsed = now - ctx->drain_begin_usec;
+  int target = ctx->drain_total;
+  if (elapsed < ctx->drain_spread_usec) {
+    target = (int)(ctx->drain_total * elapsed / ctx->drain_spread_usec) + 1;
+  }
+
+  int remain = 0;
+  h2_sess *sess, *sess_next;
+  for (sess = ctx->sess_list_head.next; sess; sess = sess_next) {
+    sess_next = sess->next;  /* for sess free case */
+    if (!sess->is_server || sess->is_terminated) {
+      continue;
+    }
+    remain++;
+    if (sess->drain_usec == 0) {
+      if (ctx->drain_cnt >= target) {
+        continue;
+      }
+      h2_sess_drain_notice(sess, now);
+    } else if (now - sess->drain_usec >= H2_DRAIN_GRACE_USEC) {
+      if (sess->http_ver == H2_HTTP_V2) {
+        if (sess->is_no_more_req) {
+          continue;  /* final GOAWAY sent; wait for streams closed */
+        }
+        sess->is_no_more_req = 1;  /* final GOAWAY on send idle */
+      } else if (sess->req_cnt == sess->rsp_cnt &&
+                 sess->send_data_remain == 0) {
+        sess->close_reason = CLOSE_BY_HTTP_END;
+        h2_sess_free(sess);
+        continue;
+      } else {
+        continue;  /* wait for response in progress */
+      }
+    } else {
+      continue;
+    }
+    /* flush GOAWAY now; send event is not expected on idle sess */
+    if (h2_sess_send(sess) < 0) {
+      h2_sess_free(sess);
+    }
+  }
+
+  if (remain > 0) {
+    h2_timer_add(ctx, H2_DRAIN_TICK_USEC, h2_ctx_drain_timer_cb, NULL);
+  } else if (ctx->verbose) {
+    warnx("drain completed: %d sessions in %lld msec",
+          ctx->drain_total, elapsed / 1000);
+  }
+}
+
+void h2_ctx_drain(h2_ctx *ctx, long long spread_usec) {
+  if (ctx == NULL || ctx->drain_begin_usec > 0) {
+    return;  /* already draining */
+  }
+
+  /* stop accepting; new connections go to the other listener if shared */
+  while (ctx->svr_list_head.next) {
+    h2_svr_free(ctx->svr_list_head.next);
+  }
+
+  h2_sess *sess;
+  ctx->drain_total = 0;
+  ctx->drain_cnt = 0;
+  for (sess = ctx->sess_list_head.next; sess; sess = sess->next) {
+    if (sess->is_server && !sess->is_terminated) {
+      ctx->drain_total++;
+    }
+  }
+  ctx->drain_begin_usec = h2_time_usec();
+  ctx->drain_spread_usec = (spread_usec > 0)? spread_usec : 1;
+  fprintf(stderr, "drain %d sessions over %lld msec\n",
+          ctx->drain_total, spread_usec / 1000);
+
+  h2_timer_add(ctx, 0, h2_ctx_drain_timer_cb, NULL);
+}
+
+int h2_ctx_is_draining(h2_ctx *ctx) {
+  return (ctx)? (ctx->drain_begin_usec > 0) : 0;
+}
+
+
 /*
  * Context and Service Loop common for client and server --------------------
  */
@@ -802,6 +996,8 @@ void h2_ctx_free(h2_ctx *ctx) {
     h2_peer_free(ctx->peer_list_head.next);
   }
 
+  h2_bal_free(ctx);  /* sessions moved in are freed below */
+
   while (ctx->sess_list_head.next) {
     h2_sess_terminate(ctx->sess_list_head.next, 0);
     h2_sess_free(ctx->sess_list_head.next);
@@ -814,6 +1010,18 @@ void h2_ctx_free(h2_ctx *ctx) {
   }
 #endif
 
+  h2_admit_free(ctx);
+
+  while (ctx->linger_num > 0) {
+    close(ctx->linger[--ctx->linger_num].fd);
+  }
+  free(ctx->linger);
+
+  while (ctx->timer_num > 0) {
+    free(ctx->timer_heap[--ctx->timer_num]);
+  }
+  free(ctx->timer_heap);
+
   free(ctx);
 }
 
@@ -823,6 +1031,12 @@ void h2_ctx_set_http_ver(h2_ctx *ctx, int http_ver) {
   }
 }
 
+void h2_ctx_set_strm_done_cb(h2_ctx *ctx, h2_strm_done_cb strm_done_cb) {
+  if (ctx) {
+    ctx->strm_done_cb = strm_done_cb;
+  }
+}
+
 void h2_ctx_set_verbose(h2_ctx *ctx, int verbose) {
   if (ctx) {
     ctx->verbose = verbose;
@@ -835,6 +1049,260 @@ void h2_ctx_stop(h2_ctx *ctx) {
   }
 }
 
+void h2_ctx_get_stat(h2_ctx *ctx, h2_ctx_stat *stat) {
+  h2_sess *sess;
+
+  memset(stat, 0, sizeof(*stat));
+  stat->sess_num = ctx->sess_num;
+  stat->peer_num = ctx->peer_num;
+  stat->svr_num = ctx->svr_num;
+  stat->timer_num = ctx->timer_num;
+  for (sess = ctx->sess_list_head.next; sess; sess = sess->next) {
+    stat->strm_num += sess->strm_num;
+    stat->send_data_remain += sess->send_data_remain;
+    stat->send_blocked_sess_num += (sess->send_pending ||
+                                    h2_emu_is_send_blocked(sess));
+    stat->emu_sess_num += (sess->emu != NULL);
+  }
+}
+
+
+/*
+ * Abusive Peer Blocking -----------------------------------------------------
+ * peer ip of session closed for abuse rate limits is refused at accept;
+ * block time is doubled on each repeated abuse to stop reconnecting floods
+ */
+
+static void h2_abuse_addr(const struct sockaddr *sa, unsigned char *addr) {
+  memset(addr, 0, 16);
+  if (sa->sa_family == AF_INET6) {
+    memcpy(addr, &((struct sockaddr_in6 *)sa)->sin6_addr, 16);
+  } else if (sa->sa_family == AF_INET) {
+    addr[10] = addr[11] = 0xff;  /* ipv4-mapped ipv6 */
+    memcpy(addr + 12, &((struct sockaddr_in *)sa)->sin_addr, 4);
+  }
+}
+
+void h2_ctx_abuse_block(h2_ctx *ctx, h2_sess *sess) {
+  struct sockaddr_in6 sa;  /* to allow ipv4 and ipv6 */
+  socklen_t sa_len = sizeof(sa);
+  unsigned char addr[16];
+  h2_abuse_ip *e = NULL;
+  int i;
+
+  if (getpeername(sess->fd, (struct sockaddr *)&sa, &sa_len) < 0) {
+    return;
+  }
+  h2_abuse_addr((struct sockaddr *)&sa, addr);
+  for (i = 0; i < H2_ABUSE_IP_MAX; i++) {
+    if (!memcmp(ctx->abuse_ip[i].addr, addr, 16)) {
+      e = &ctx->abuse_ip[i];
+      break;
+    }
+    if (e == NULL ||
+        ctx->abuse_ip[i].block_until_usec < e->block_until_usec) {
+      e = &ctx->abuse_ip[i];  /* oldest to be replaced */
+    }
+  }
+  if (memcmp(e->addr, addr, 16)) {
+    memcpy(e->addr, addr, 16);
+    e->abuse_num = 0;
+  }
+
+  int block_sec = H2_ABUSE_BLOCK_SEC << ((e->abuse_num < 6)? e->abuse_num : 6);
+  if (block_sec > H2_ABUSE_BLOCK_MAX) {
+    block_sec = H2_ABUSE_BLOCK_MAX;
+  }
+  e->abuse_num++;
+  e->block_until_usec = h2_time_usec() + (long long)block_sec * 1000000;
+  warnx("%sBLOCK PEER IP FOR %d SECS: abuse_num=%d",
+        sess->log_prefix, block_sec, e->abuse_num);
+}
+
+/* returns 1 if peer ip is blocked, else 0 */
+static int h2_ctx_abuse_blocked(h2_ctx *ctx, const struct sockaddr *sa) {
+  unsigned char addr[16];
+  int i;
+
+  h2_abuse_addr(sa, addr);
+  for (i = 0; i < H2_ABUSE_IP_MAX; i++) {
+    if (ctx->abuse_ip[i].block_until_usec > 0 &&
+        !memcmp(ctx->abuse_ip[i].addr, addr, 16)) {
+      return (h2_time_usec() < ctx->abuse_ip[i].block_until_usec);
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * Lingering Close -----------------------------------------------------------
+ * full close with unread data makes the kernel send RST, and the peer then
+ * discards responses not yet read; after the final GOAWAY the send side is
+ * shut down first and requests in flight are read out until peer close
+ */
+
+static void h2_ctx_linger_close(h2_ctx *ctx, int idx) {
+  close(ctx->linger[idx].fd);
+  ctx->linger[idx] = ctx->linger[--ctx->linger_num];
+}
+
+static void h2_ctx_linger_timer_cb(h2_ctx *ctx, void *user_data) {
+  char buf[16 * 1024];
+  long long cur_usec = h2_time_usec();
+  int i, r;
+  (void)user_data;
+
+  for (i = 0; i < ctx->linger_num; ) {
+    while ((r = recv(ctx->linger[i].fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0);
+    if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) ||
+        cur_usec >= ctx->linger[i].until_usec) {
+      h2_ctx_linger_close(ctx, i);  /* last one is moved to i */
+    } else {
+      i++;
+    }
+  }
+  if (ctx->linger_num > 0) {
+    h2_timer_add(ctx, H2_LINGER_TICK_USEC, h2_ctx_linger_timer_cb, NULL);
+  }
+}
+
+void h2_ctx_linger(h2_ctx *ctx, int fd) {
+  h2_linger *p;
+
+  if (ctx->linger_num == ctx->linger_alloced) {
+    int n = (ctx->linger_alloced)? ctx->linger_alloced * 2 : 16;
+    if ((p = realloc(ctx->linger, n * sizeof(*p))) == NULL) {
+      shutdown(fd, SHUT_RDWR);
+      close(fd);
+      return;
+    }
+    ctx->linger = p;
+    ctx->linger_alloced = n;
+  }
+  shutdown(fd, SHUT_WR);
+  ctx->linger[ctx->linger_num].fd = fd;
+  ctx->linger[ctx->linger_num].until_usec = h2_time_usec() + H2_LINGER_USEC;
+  if (ctx->linger_num++ == 0) {
+    h2_timer_add(ctx, H2_LINGER_TICK_USEC, h2_ctx_linger_timer_cb, NULL);
+  }
+}
+
+
+/*
+ * Context Timer -------------------------------------------------------------
+ * min heap on expire_usec; checked at every run loop turn
+ */
+
+static void h2_timer_heap_set(h2_ctx *ctx, int idx, h2_timer *timer) {
+  ctx->timer_heap[idx] = timer;
+  timer->heap_idx = idx;
+}
+
+static void h2_timer_heap_up(h2_ctx *ctx, int idx) {
+  h2_timer *timer = ctx->timer_heap[idx];
+  while (idx > 0) {
+    int parent = (idx - 1) / 2;
+    if (ctx->timer_heap[parent]->expire_usec <= timer->expire_usec) {
+      break;
+    }
+    h2_timer_heap_set(ctx, idx, ctx->timer_heap[parent]);
+    idx = parent;
+  }
+  h2_timer_heap_set(ctx, idx, timer);
+}
+
+static void h2_timer_heap_down(h2_ctx *ctx, int idx) {
+  h2_timer *timer = ctx->timer_heap[idx];
+  for (;;) {
+    int child = idx * 2 + 1;
+    if (child >= ctx->timer_num) {
+      break;
+    }
+    if (child + 1 < ctx->timer_num &&
+        ctx->timer_heap[child + 1]->expire_usec <
+        ctx->timer_heap[child]->expire_usec) {
+      child++;
+    }
+    if (timer->expire_usec <= ctx->timer_heap[child]->expire_usec) {
+      break;
+    }
+    h2_timer_heap_set(ctx, idx, ctx->timer_heap[child]);
+    idx = child;
+  }
+  h2_timer_heap_set(ctx, idx, timer);
+}
+
+static void h2_timer_heap_remove(h2_ctx *ctx, int idx) {
+  h2_timer *last = ctx->timer_heap[--ctx->timer_num];
+  if (idx < ctx->timer_num) {
+    h2_timer_heap_set(ctx, idx, last);
+    h2_timer_heap_down(ctx, idx);
+    h2_timer_heap_up(ctx, last->heap_idx);
+  }
+}
+
+h2_timer *h2_timer_add(h2_ctx *ctx, long long delay_usec,
+                       h2_timer_cb timer_cb, void *user_data) {
+  if (ctx == NULL || timer_cb == NULL) {
+    return NULL;
+  }
+  if (ctx->timer_num >= ctx->timer_alloced) {
+    int alloced = (ctx->timer_alloced)? ctx->timer_alloced * 2 : 16;
+    h2_timer **heap = realloc(ctx->timer_heap, sizeof(*heap) * alloced);
+    if (heap == NULL) {
+      warnx("timer heap realloc failed: size=%d", (int)sizeof(*heap) * alloced);
+      return NULL;
+    }
+    ctx->timer_heap = heap;
+    ctx->timer_alloced = alloced;
+  }
+
+  h2_timer *timer = calloc(1, sizeof(h2_timer));
+  timer->expire_usec = h2_time_usec() + ((delay_usec > 0)? delay_usec : 0);
+  timer->timer_cb = timer_cb;
+  timer->user_data = user_data;
+  h2_timer_heap_set(ctx, ctx->timer_num++, timer);
+  h2_timer_heap_up(ctx, timer->heap_idx);
+  return timer;
+}
+
+void h2_timer_del(h2_ctx *ctx, h2_timer *timer) {
+  if (ctx == NULL || timer == NULL) {
+    return;
+  }
+  if (timer->heap_idx < 0 || timer->heap_idx >= ctx->timer_num ||
+      ctx->timer_heap[timer->heap_idx] != timer) {
+    warnx("timer to delete is not pending; ignored");
+    return;
+  }
+  h2_timer_heap_remove(ctx, timer->heap_idx);
+  free(timer);
+}
+
+static void h2_ctx_run_timer(h2_ctx *ctx) {
+  long long now = h2_time_usec();
+  while (ctx->timer_num > 0 && ctx->timer_heap[0]->expire_usec <= now) {
+    h2_timer *timer = ctx->timer_heap[0];
+    h2_timer_heap_remove(ctx, 0);
+    timer->heap_idx = -1;
+    H2_PROF_PHASE(H2_PROF_APP, timer->timer_cb(ctx, timer->user_data));
+    free(timer);
+  }
+}
+
+static int h2_ctx_wait_msec(h2_ctx *ctx) {
+  /* max 100 msec wait for service_flag check */
+  if (ctx->timer_num == 0) {
+    return 100;
+  }
+  long long wait_usec = ctx->timer_heap[0]->expire_usec - h2_time_usec();
+  if (wait_usec <= 0) {
+    return 0;
+  }
+  return (wait_usec >= 100000)? 100 : (int)((wait_usec + 999) / 1000);
+}
+
 #ifdef EPOLL_MODE
 
 void h2_ctx_run(h2_ctx *ctx) {
@@ -845,8 +1313,20 @@ void h2_ctx_run(h2_ctx *ctx) {
   ea = malloc(sizeof(*ea) * ea_alloced); 
 
   while (ctx->service_flag) {
+    /* run expired timers before event check; may free sessions */
+    h2_prof_phase = H2_PROF_TIMER;
+    h2_ctx_run_timer(ctx);
+    h2_prof_phase = H2_PROF_MAIN;
+    if (!ctx->service_flag) {
+      break;  /* stopped by timer callback */
+    }
+
     /* prepare poll fd array */
     ea_max = ctx->sess_num + ctx->svr_num;
+    if (ea_max <= 0 && (ctx->bal == NULL || h2_bal_close(ctx, 0))) {
+      break;  /* no more session to service */
+    }
+    ea_max += (ctx->bal != NULL);  /* balance wake up pipe */
     if (ea_alloced < ea_max) {
       ea_alloced = ((ea_max + 16 + 1023) / 1024) * 1024;
       ea = realloc(ea, sizeof(*ea) * ea_alloced); 
@@ -856,12 +1336,11 @@ void h2_ctx_run(h2_ctx *ctx) {
         break;
       }
     }
-    if (ea_max <= 0) {
-      break;  /* no more session to service */
-    }
 
     /* wait for epoll event */
-    int r = epoll_wait(ctx->epoll_fd, ea, ea_max, 100);
+    h2_prof_phase = H2_PROF_POLL;
+    int r = epoll_wait(ctx->epoll_fd, ea, ea_max, h2_ctx_wait_msec(ctx));
+    h2_prof_phase = H2_PROF_MAIN;
     if (r == 0 || (r < 0 && errno == EINTR)) {
       continue;
     } else if (r < 0) {
@@ -880,35 +1359,55 @@ void h2_ctx_run(h2_ctx *ctx) {
         if ((events & EPOLLIN)) {
           struct sockaddr_in6 sa;  /* to allow ipv4 and ipv6 */
           socklen_t sa_len = sizeof(sa);  /* in/out argument */
+          h2_prof_phase = H2_PROF_ACCEPT;
           int fd = accept(svr->accept_fd, (struct sockaddr *)&sa, &sa_len);
-          if (fd >= 0) {
+          if (fd >= 0 && h2_ctx_abuse_blocked(ctx, (struct sockaddr *)&sa)) {
+            close(fd);  /* refuse abusive peer */
+          } else if (fd >= 0) {
             h2_set_close_exec(fd);
             h2_sess_init_server(ctx, svr, fd, (struct sockaddr *)&sa, sa_len);
-          } else {
+          } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
             warnx("accept() failed on server socket: %s", strerror(errno));
           }
+          h2_prof_phase = H2_PROF_MAIN;
         }
+      } else if (((h2_obj *)e->data.ptr)->cls == &h2_cls_bal) {
+        /* sessions moved in from other thread context */
+        h2_bal_adopt(ctx);
       } else if (((h2_obj *)e->data.ptr)->cls == &h2_cls_sess) {
         /* session rw event */
         h2_sess *sess = (void *)e->data.ptr;
+        long long bal_usec = (ctx->bal)? h2_time_usec() : 0;
         if ((events & EPOLLIN)) {
+          h2_prof_phase = H2_PROF_RECV;
           if (h2_sess_recv(sess) < 0) {
             h2_sess_free(sess);
+            h2_prof_phase = H2_PROF_MAIN;
             continue;
           }
         }
-        if ((events & (EPOLLOUT || EPOLLIN))) {  /* always do send after recv */
-          if (sess->is_terminated && sess->http_ver != H2_HTTP_V2) {
+        h2_prof_phase = H2_PROF_SEND;
+        if ((events & (EPOLLOUT | EPOLLIN))) {  /* always do send after recv */
+          if (sess->is_terminated && sess->http_ver != H2_HTTP_V2 &&
+              h2_emu_queued(sess) == 0) {
             sess->close_reason = CLOSE_BY_HTTP_END;
             h2_sess_free(sess);
+            h2_prof_phase = H2_PROF_MAIN;
+            continue;
           } else {
             if (h2_sess_send(sess) < 0) {
               h2_sess_free(sess);
+              h2_prof_phase = H2_PROF_MAIN;
               continue;
             }
           }
         }
+        h2_prof_phase = H2_PROF_MAIN;
         if ((events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+          /* handle data received before error as GOAWAY followed by RST */
+          if ((events & EPOLLIN)) {
+            while (h2_sess_recv(sess) > 0);
+          }
           sess->close_reason = CLOSE_BY_SOCK_ERR;
           if (!sess->is_terminated) {
             warnx("socket errored: epoll_events=0x%02x sess=%s",
@@ -917,10 +1416,16 @@ void h2_ctx_run(h2_ctx *ctx) {
           h2_sess_free(sess);
           continue;
         }
+        if (bal_usec) {
+          sess->bal_usec += h2_time_usec() - bal_usec;
+        }
       }
     }
   }
 
+  if (ctx->bal) {
+    h2_bal_close(ctx, 1);  /* no more move in; pending ones freed with ctx */
+  }
   free(ea);
 }
 
@@ -936,8 +1441,16 @@ void h2_ctx_run(h2_ctx *ctx) {
   pfd_obj = malloc(sizeof(*pfd_obj) * pfd_alloced); 
 
   while (ctx->service_flag) {
-    /* prepare poll fd array */
-    if (pfd_alloced < ctx->sess_num + ctx->svr_num) {
+    /* run expired timers before event check; may free sessions */
+    h2_prof_phase = H2_PROF_TIMER;
+    h2_ctx_run_timer(ctx);
+    h2_prof_phase = H2_PROF_MAIN;
+    if (!ctx->service_flag) {
+      break;  /* stopped by timer callback */
+    }
+
+    /* prepare poll fd array; +1 for balance wake up pipe */
+    if (pfd_alloced < ctx->sess_num + ctx->svr_num + 1) {
       pfd_alloced = ((ctx->sess_num + ctx->svr_num + 16 + 1023) / 1024) * 1024;
       pfd = realloc(pfd, sizeof(*pfd) * pfd_alloced); 
       pfd_obj = realloc(pfd_obj, sizeof(*pfd_obj) * pfd_alloced); 
@@ -960,12 +1473,17 @@ void h2_ctx_run(h2_ctx *ctx) {
       pfd[n].events = 0;
 #if 1
       /* do not use nghttp2_session info; just follow epoll event status */
-      if (!sess->is_terminated) {
+      if (!sess->is_terminated && !h2_emu_is_read_stalled(sess)) {
         pfd[n].events |= POLLIN;
       }
-      if (sess->send_pending) {
+      if (sess->send_pending && !h2_emu_is_send_blocked(sess)) {
         pfd[n].events |= POLLOUT;
       }
+      if (pfd[n].events == 0 &&
+          (h2_emu_queued(sess) > 0 ||
+           (!sess->is_terminated && h2_emu_is_read_stalled(sess)))) {
+        continue;  /* emulation timer to resume */
+      }
 #else 
       if (sess->http_ver == H2_HTTP_V2) {
         if (nghttp2_session_want_read(sess->ng_sess)) {
@@ -991,12 +1509,21 @@ void h2_ctx_run(h2_ctx *ctx) {
       pfd_obj[n] = &sess->obj;
       n++;
     }
-    if (n == 0) { /* quit service if nothing to do */
+    if (n == 0 && ctx->sess_num == 0 &&  /* quit service if nothing to do */
+        (ctx->bal == NULL || h2_bal_close(ctx, 0))) {
       break;
     }
+    if (ctx->bal) {
+      pfd[n].fd = h2_bal_fd(ctx);
+      pfd[n].events = POLLIN;
+      pfd_obj[n] = (h2_obj *)ctx->bal;
+      n++;
+    }
 
     /* wait for event */
-    int r = poll(pfd, n, 100);
+    h2_prof_phase = H2_PROF_POLL;
+    int r = poll(pfd, n, h2_ctx_wait_msec(ctx));
+    h2_prof_phase = H2_PROF_MAIN;
     if (r == 0 || (r < 0 && errno == EINTR)) {
       continue;
     } else if (r < 0) {
@@ -1018,29 +1545,42 @@ void h2_ctx_run(h2_ctx *ctx) {
         if ((revents & POLLIN)) {
           struct sockaddr_in6 sa;  /* to allow ipv4 and ipv6 */
           socklen_t sa_len = sizeof(sa);  /* in/out argument */
+          h2_prof_phase = H2_PROF_ACCEPT;
           int fd = accept(svr->accept_fd, (struct sockaddr *)&sa, &sa_len);
-          if (fd >= 0) {
+          if (fd >= 0 && h2_ctx_abuse_blocked(ctx, (struct sockaddr *)&sa)) {
+            close(fd);  /* refuse abusive peer */
+          } else if (fd >= 0) {
             h2_set_close_exec(fd);
             h2_sess_init_server(ctx, svr, fd, (struct sockaddr *)&sa, sa_len);
-          } else {
+          } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
             warnx("accept() failed on server socket: %s", strerror(errno));
           }
+          h2_prof_phase = H2_PROF_MAIN;
         }
+      } else if (pfd_obj[i]->cls == &h2_cls_bal) {
+        /* sessions moved in from other thread context */
+        h2_bal_adopt(ctx);
       } else if (pfd_obj[i]->cls == &h2_cls_sess) {
         /* session rw event */
         sess = (void *)pfd_obj[i];
+        long long bal_usec = (ctx->bal)? h2_time_usec() : 0;
         if ((revents & POLLIN)) {
+          h2_prof_phase = H2_PROF_RECV;
           if (h2_sess_recv(sess) < 0) {
             h2_sess_free(sess);
+            h2_prof_phase = H2_PROF_MAIN;
             continue;
           }
         }
-        if ((revents & (POLLOUT || POLLIN))) {  /* always do send after recv */
+        h2_prof_phase = H2_PROF_SEND;
+        if ((revents & (POLLOUT | POLLIN))) {  /* always do send after recv */
           if (h2_sess_send(sess) < 0) {
             h2_sess_free(sess);
+            h2_prof_phase = H2_PROF_MAIN;
             continue;
           }
         }
+        h2_prof_phase = H2_PROF_MAIN;
         if ((revents & POLLRDHUP)) {
           warnx("socket closed by peer");
           sess->close_reason = CLOSE_BY_SOCK_EOF;
@@ -1053,10 +1593,16 @@ void h2_ctx_run(h2_ctx *ctx) {
           h2_sess_free(sess);
           continue;
         }
+        if (bal_usec) {
+          sess->bal_usec += h2_time_usec() - bal_usec;
+        }
       }
     }
   }
 
+  if (ctx->bal) {
+    h2_bal_close(ctx, 1);  /* no more move in; pending ones freed with ctx */
+  }
   free(pfd);
   free(pfd_obj);
 }
@@ -1074,6 +1620,7 @@ static h2_sess *h2_peer_connect_sess(h2_peer *peer, int sess_idx) {
                                   &peer->settings);
   if (sess) {
     peer->sess[sess_idx] = sess;
+    sess->peer_sess_idx = sess_idx;
     if (!peer->act_sess[sess_idx]) {
       /* init peers sess status */
       peer->act_sess[sess_idx] = 1;
@@ -1108,23 +1655,45 @@ void h2_peer_sess_free_hdlr(h2_peer *peer, h2_sess *sess) {
   peer->rsp_rst_cnt += sess->rsp_rst_cnt;
   peer->strm_close_cnt += sess->strm_close_cnt;
   peer->sess_close_cnt++;
+  h2_hpack_stat_add(&peer->hpack_send, &sess->hpack_send.stat);
+  h2_hpack_stat_add(&peer->hpack_recv, &sess->hpack_recv.stat);
 
   peer->sess[i] = NULL; 
+  if (sess->is_ready) {
+    peer->ready_sess_num--;
+  }
   if (peer->act_sess[i]) {
     peer->act_sess[i] = 0;
     peer->act_sess_num--;
   }
+  if (peer->ready_cb) {
+    /* to let app re-check readiness on session loss */
+    H2_PROF_PHASE(H2_PROF_APP,
+                  peer->ready_cb(peer, peer->user_data, peer->ready_sess_num));
+  }
 
-  /* try reconnect is peer or ctx is not termiating */
-  if (peer->ctx->service_flag &&
-      !peer->is_terminated && !peer->is_no_more_req &&
-      (sess->is_req_max_reconn ||
-       peer->reconn_num < peer->settings.reconn_max)) {
-    if (!sess->is_req_max_reconn) {
+  /* try reconnect is peer or ctx is not termiating; or on terminating, */
+  /* for requests to be sent again if the session was not a failed one */
+  if (peer->ctx->service_flag && !peer->is_terminated &&
+      ((!peer->is_no_more_req &&
+        (sess->is_req_max_reconn ||
+         peer->reconn_num < peer->settings.reconn_max)) ||
+       (peer->is_no_more_req && peer->lane_num > 0 && sess->is_ready))) {
+    if (!sess->is_req_max_reconn && !peer->is_no_more_req) {
       peer->reconn_num++;
     }
     h2_peer_connect_sess(peer, i);
   }
+
+  /* requests to be sent again wait for the other or reconnected session */
+  if (peer->lane_num > 0) {
+    for (i = 0; i < peer->settings.sess_num && peer->sess[i] == NULL; i++);
+    if (i < peer->settings.sess_num) {
+      h2_prio_dispatch(peer);
+    } else {
+      h2_prio_flush(peer);  /* no session to send */
+    }
+  }
 }
 
 /* client side context create api to start sessions */
@@ -1156,6 +1725,7 @@ h2_peer *h2_connect(h2_ctx *ctx, SSL_CTX *cli_ssl_ctx,
 
   peer->sess = calloc(peer->settings.sess_num, sizeof(*peer->sess));
   peer->next_sess_idx = 0;
+  peer->rsp_sess_idx = -1;
   peer->act_sess = calloc(peer->settings.sess_num, sizeof(*peer->act_sess));
   peer->act_sess_num = 0;
 
@@ -1183,6 +1753,28 @@ h2_peer *h2_connect(h2_ctx *ctx, SSL_CTX *cli_ssl_ctx,
   return peer;
 }
 
+void h2_peer_set_ready_cb(h2_peer *peer, h2_peer_ready_cb ready_cb) {
+  if (peer) {
+    peer->ready_cb = ready_cb;
+  }
+}
+
+int h2_peer_sess_num(h2_peer *peer) {
+  return (peer)? peer->act_sess_num : 0;
+}
+
+int h2_peer_ready_sess_num(h2_peer *peer) {
+  return (peer)? peer->ready_sess_num : 0;
+}
+
+long long h2_peer_retry_cnt(h2_peer *peer) {
+  return (peer)? peer->req_retry_cnt : 0;
+}
+
+int h2_peer_rsp_sess_idx(h2_peer *peer) {
+  return (peer)? peer->rsp_sess_idx : -1;
+}
+
 void h2_peer_free(h2_peer *peer) {
   int i;
 
@@ -1194,9 +1786,12 @@ void h2_peer_free(h2_peer *peer) {
     }
   }
 
+  /* requests not sent yet in priority lanes */
+  h2_prio_flush(peer);
+
   /* free user data */
   if (peer->peer_free_cb) {
-    peer->peer_free_cb(peer, peer->user_data);
+    H2_PROF_PHASE(H2_PROF_APP, peer->peer_free_cb(peer, peer->user_data));
     peer->peer_free_cb = NULL;
     peer->user_data = NULL;
   }
@@ -1218,11 +1813,14 @@ void h2_peer_free(h2_peer *peer) {
       (peer->tv_end.tv_usec - peer->tv_begin.tv_usec) * 0.000001);
   if (peer->settings.sess_num > 1) {
     fprintf(stderr, "PEER CLOSED %s: %.0f tps (%.3f secs for "
-            "%d reqs %d rsps(%d rsts) %d streams in %d sessions)%s\n",
+            "%lld reqs %lld rsps(%lld rsts, %lld retries) %lld streams "
+            "in %lld sessions)%s\n",
             peer->authority, peer->strm_close_cnt / elapsed,
             elapsed, peer->req_cnt, peer->rsp_cnt, peer->rsp_rst_cnt,
-            peer->strm_close_cnt, peer->sess_close_cnt,
+            peer->req_retry_cnt, peer->strm_close_cnt, peer->sess_close_cnt,
             (peer->req_cnt != peer->rsp_cnt|| peer->rsp_rst_cnt)? " !!!" : "");
+    h2_hpack_stat_print(stderr, "PEER ", "SEND", &peer->hpack_send, -1);
+    h2_hpack_stat_print(stderr, "PEER ", "RECV", &peer->hpack_recv, -1);
   }
 
   free(peer->authority);
@@ -0,0 +1,486 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * JSON Pointer -------------------------------------------------------------
+ * RFC 6901 pointer compiled into reference tokens
+ */
+
+struct h2_json_ptr {
+  char *str;       /* original pointer string */
+  int tok_num;
+  char **tok;      /* unescaped reference tokens */
+  int *tok_len;
+  int *tok_idx;    /* array index value or -1 if not an index */
+};
+
+h2_json_ptr *h2_json_ptr_compile(const char *pointer) {
+  h2_json_ptr *ptr;
+  const char *p;
+  int i, n;
+
+  if (pointer == NULL || (pointer[0] != '\0' && pointer[0] != '/')) {
+    warnx("invalid json pointer; should start with '/': %s",
+          (pointer)? pointer : "(null)");
+    return NULL;
+  }
+  for (n = 0, p = pointer; *p; p++) {
+    n += (*p == '/');
+  }
+  if (n >= H2_JSON_DEPTH_MAX) {
+    warnx("too deep json pointer: depth=%d max=%d", n, H2_JSON_DEPTH_MAX - 1);
+    return NULL;
+  }
+
+  ptr = calloc(1, sizeof(*ptr));
+  ptr->str = strdup(pointer);
+  ptr->tok_num = n;
+  ptr->tok = calloc(n + 1, sizeof(char *));
+  ptr->tok_len = calloc(n + 1, sizeof(int));
+  ptr->tok_idx = calloc(n + 1, sizeof(int));
+  for (i = 0, p = pointer; i < n; i++) {
+    const char *e = strchr(p + 1, '/');
+    int len = (e)? e - (p + 1) : (int)strlen(p + 1);
+    char *t = malloc(len + 1), *q = t;
+    const char *s;
+    for (s = p + 1; s < p + 1 + len; s++) {
+      if (s[0] == '~' && s[1] == '0') {
+        *q++ = '~';
+        s++;
+      } else if (s[0] == '~' && s[1] == '1') {
+        *q++ = '/';
+        s++;
+      } else {
+        *q++ = *s;
+      }
+    }
+    *q = '\0';
+    ptr->tok[i] = t;
+    ptr->tok_len[i] = q - t;
+    ptr->tok_idx[i] = -1;
+    if (q > t && q - t < 10 && strspn(t, "0123456789") == (size_t)(q - t) &&
+        (t[0] != '0' || q - t == 1)) {
+      ptr->tok_idx[i] = atoi(t);
+    }
+    p += 1 + len;
+  }
+  return ptr;
+}
+
+void h2_json_ptr_free(h2_json_ptr *ptr) {
+  int i;
+  if (ptr) {
+    for (i = 0; i < ptr->tok_num; i++) {
+      free(ptr->tok[i]);
+    }
+    free(ptr->tok);
+    free(ptr->tok_len);
+    free(ptr->tok_idx);
+    free(ptr->str);
+    free(ptr);
+  }
+}
+
+const char *h2_json_ptr_str(h2_json_ptr *ptr) {
+  return (ptr)? ptr->str : NULL;
+}
+
+
+/*
+ * Structural Index ---------------------------------------------------------
+ * simdjson style stage 1 on 64 byte blocks: bitmasks of quotes,
+ * backslashes and operators are built by SSE2 (or scalar loop),
+ * escaped quotes are removed by odd backslash sequence check and
+ * in-string mask is taken by prefix xor of the unescaped quotes
+ */
+
+typedef struct {
+  uint64_t prev_escaped;   /* last byte of previous block escapes next */
+  uint64_t prev_in_string; /* all 1s if previous block ended in string */
+} h2_json_scan;
+
+#ifdef __SSE2__
+static inline void h2_json_block_masks(const uint8_t *b, uint64_t *quote,
+                                       uint64_t *bslash, uint64_t *open,
+                                       uint64_t *close, uint64_t *op) {
+  const __m128i quote_v = _mm_set1_epi8('"'), bslash_v = _mm_set1_epi8('\\');
+  const __m128i lower_v = _mm_set1_epi8(0x20);
+  const __m128i open_v = _mm_set1_epi8('{'), close_v = _mm_set1_epi8('}');
+  const __m128i comma_v = _mm_set1_epi8(','), colon_v = _mm_set1_epi8(':');
+  uint64_t q = 0, bs = 0, on = 0, cl = 0, o = 0;
+  int i;
+  for (i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(b + i * 16));
+    __m128i lv = _mm_or_si128(v, lower_v);  /* '[' to '{' and ']' to '}' */
+    __m128i ov = _mm_cmpeq_epi8(lv, open_v);
+    __m128i cv = _mm_cmpeq_epi8(lv, close_v);
+    __m128i sv = _mm_or_si128(_mm_cmpeq_epi8(v, comma_v),
+                              _mm_cmpeq_epi8(v, colon_v));
+    q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote_v))
+           << (i * 16);
+    bs |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, bslash_v))
+            << (i * 16);
+    on |= (uint64_t)(uint16_t)_mm_movemask_epi8(ov) << (i * 16);
+    cl |= (uint64_t)(uint16_t)_mm_movemask_epi8(cv) << (i * 16);
+    o |= (uint64_t)(uint16_t)_mm_movemask_epi8(sv) << (i * 16);
+  }
+  *quote = q;
+  *bslash = bs;
+  *open = on;
+  *close = cl;
+  *op = on | cl | o;
+}
+#else
+static inline void h2_json_block_masks(const uint8_t *b, uint64_t *quote,
+                                       uint64_t *bslash, uint64_t *open,
+                                       uint64_t *close, uint64_t *op) {
+  uint64_t q = 0, bs = 0, on = 0, cl = 0, o = 0;
+  int i;
+  for (i = 0; i < 64; i++) {
+    switch (b[i]) {
+    case '"':  q |= 1ULL << i;  break;
+    case '\\': bs |= 1ULL << i; break;
+    case '[': case '{': on |= 1ULL << i; break;
+    case ']': case '}': cl |= 1ULL << i; break;
+    case ',': case ':': o |= 1ULL << i; break;
+    }
+  }
+  *quote = q;
+  *bslash = bs;
+  *open = on;
+  *close = cl;
+  *op = on | cl | o;
+}
+#endif
+
+static inline uint64_t h2_json_prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/* returns structural mask of the block; quotes and operators out of string */
+/* open and close brackets out of string are set to *open and *close */
+static inline uint64_t h2_json_block_structural(h2_json_scan *scan,
+                                                const uint8_t *b,
+                                                uint64_t *open,
+                                                uint64_t *close) {
+  const uint64_t even_bits = 0x5555555555555555ULL;
+  uint64_t quote, bslash, op, escaped, follows, odd_starts, even_seq;
+  uint64_t in_string;
+
+  h2_json_block_masks(b, &quote, &bslash, open, close, &op);
+
+  /* find escaped characters by odd length backslash sequences */
+  if (bslash == 0 && scan->prev_escaped == 0) {
+    escaped = 0;
+  } else {
+    bslash &= ~scan->prev_escaped;
+    follows = (bslash << 1) | scan->prev_escaped;
+    odd_starts = bslash & ~even_bits & ~follows;
+    scan->prev_escaped = __builtin_add_overflow(odd_starts, bslash, &even_seq);
+    escaped = (even_bits ^ (even_seq << 1)) & follows;
+  }
+  quote &= ~escaped;
+
+  in_string = h2_json_prefix_xor(quote) ^ scan->prev_in_string;
+  scan->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+  *open &= ~in_string;
+  *close &= ~in_string;
+  return (op & ~in_string) | quote;
+}
+
+
+/*
+ * Pointer Extraction -------------------------------------------------------
+ * stage 2 walks the structural characters tracking the container path;
+ * only the keys on alive pointer paths are compared and no DOM is built.
+ * container without alive pointer is skipped by bracket counts per block
+ */
+
+typedef struct {
+  uint64_t alive;     /* pointers matched up to this container */
+  uint64_t rec;       /* pointers whose value is this container */
+  const char *start;  /* container start for rec */
+  int is_arr;
+  int idx;            /* current element index for array */
+  const char *key;    /* current member key for object */
+  int key_len;
+} h2_json_lvl;
+
+#define H2_JSON_EXP_VALUE  0
+#define H2_JSON_EXP_KEY    1
+#define H2_JSON_EXP_COLON  2
+#define H2_JSON_EXP_SEP    3  /* ',' or close after value */
+
+typedef struct {
+  h2_json_ptr **ptrs;
+  h2_json_val *vals;
+  uint64_t found;
+  uint64_t want;
+  uint64_t tok_end[H2_JSON_DEPTH_MAX];  /* pointers of tok_num == depth */
+  h2_json_lvl lvl[H2_JSON_DEPTH_MAX + 1];  /* lvl[0] is for root value */
+  int depth;
+} h2_json_ctx;
+
+/* pointers in the current container matching the current key or index */
+static uint64_t h2_json_match(h2_json_ctx *jc) {
+  h2_json_lvl *l = &jc->lvl[jc->depth];
+  uint64_t m = l->alive, cand = 0;
+  int t = jc->depth - 1;
+
+  if (jc->depth == 0) {
+    return m;
+  }
+  while (m) {
+    int i = __builtin_ctzll(m);
+    h2_json_ptr *ptr = jc->ptrs[i];
+    m &= m - 1;
+    if (l->is_arr) {
+      if (ptr->tok_idx[t] == l->idx) {
+        cand |= 1ULL << i;
+      }
+    } else if (ptr->tok_len[t] == l->key_len &&
+               !memcmp(ptr->tok[t], l->key, l->key_len)) {
+      cand |= 1ULL << i;
+    }
+  }
+  return cand;
+}
+
+static void h2_json_emit(h2_json_ctx *jc, uint64_t m, int type,
+                         const char *str, int len) {
+  m &= ~jc->found;
+  jc->found |= m;
+  while (m) {
+    int i = __builtin_ctzll(m);
+    m &= m - 1;
+    jc->vals[i].type = type;
+    jc->vals[i].str = str;
+    jc->vals[i].len = len;
+  }
+}
+
+static void h2_json_emit_scalar(h2_json_ctx *jc, const char *s,
+                                const char *e) {
+  uint64_t m;
+  while (s < e && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')) {
+    s++;
+  }
+  while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' ||
+                   e[-1] == '\n')) {
+    e--;
+  }
+  if (s < e && (m = h2_json_match(jc) & jc->tok_end[jc->depth])) {
+    h2_json_emit(jc, m, H2_JSON_LITERAL, s, e - s);
+  }
+}
+
+int h2_json_extract(const void *json, int json_len,
+                    h2_json_ptr **ptrs, int ptr_num, h2_json_val *vals) {
+  const uint8_t *buf = json;
+  uint8_t tail[64];
+  h2_json_scan scan = { 0, 0 };
+  h2_json_ctx jc;
+  const char *str_start = NULL, *val_start = (const char *)buf;
+  int exp = H2_JSON_EXP_VALUE, skip = 0, off, i;
+
+  if (ptr_num <= 0 || ptr_num > H2_JSON_PTR_MAX) {
+    return -1;
+  }
+  memset(&jc, 0, sizeof(jc));
+  jc.ptrs = ptrs;
+  jc.vals = vals;
+  jc.want = (ptr_num == 64)? ~0ULL : (1ULL << ptr_num) - 1;
+  for (i = 0; i < ptr_num; i++) {
+    jc.tok_end[ptrs[i]->tok_num] |= 1ULL << i;
+    vals[i].type = H2_JSON_NONE;
+    vals[i].str = NULL;
+    vals[i].len = 0;
+  }
+  jc.lvl[0].alive = jc.want;
+
+  for (off = 0; off < json_len && jc.found != jc.want; off += 64) {
+    const uint8_t *b = buf + off;
+    uint64_t s, open, close;
+
+    if (json_len - off < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, b, json_len - off);
+      b = tail;
+    }
+    s = h2_json_block_structural(&scan, b, &open, &close);
+
+    while (s) {
+      const char *p;
+      h2_json_lvl *l = &jc.lvl[jc.depth];
+      uint64_t m;
+
+      if (skip) {  /* in container of no interest */
+        uint64_t o = open & s, c = close & s;
+        if (__builtin_popcountll(c) < skip) {
+          skip += __builtin_popcountll(o) - __builtin_popcountll(c);
+          break;  /* cannot be closed in this block */
+        }
+        for (m = o | c; m; m &= m - 1) {
+          if ((m & -m & o)) {
+            skip++;
+          } else if (--skip == 0) {
+            break;
+          }
+        }
+        if (skip > 0) {
+          break;  /* opened again before close */
+        }
+        s &= ~(((m & -m) << 1) - 1);  /* drop up to the close */
+        exp = H2_JSON_EXP_SEP;
+        continue;
+      }
+
+      p = (const char *)buf + off + __builtin_ctzll(s);
+      s &= s - 1;
+
+      if (str_start) {  /* closing quote */
+        if (exp == H2_JSON_EXP_KEY) {
+          l->key = str_start + 1;
+          l->key_len = p - (str_start + 1);
+          exp = H2_JSON_EXP_COLON;
+        } else {
+          if ((m = h2_json_match(&jc) & jc.tok_end[jc.depth])) {
+            h2_json_emit(&jc, m, H2_JSON_STRING, str_start + 1,
+                         p - (str_start + 1));
+          }
+          exp = H2_JSON_EXP_SEP;
+        }
+        str_start = NULL;
+        continue;
+      }
+
+      switch (*p) {
+      case '"':
+        if (exp != H2_JSON_EXP_KEY && exp != H2_JSON_EXP_VALUE) {
+          return -2;
+        }
+        str_start = p;
+        break;
+      case '{':
+      case '[':
+        if (exp != H2_JSON_EXP_VALUE || jc.depth >= H2_JSON_DEPTH_MAX) {
+          return -2;
+        }
+        m = h2_json_match(&jc);
+        if ((m & ~jc.found) == 0) {
+          skip = 1;
+          break;
+        }
+        jc.depth++;
+        l = &jc.lvl[jc.depth];
+        l->rec = m & jc.tok_end[jc.depth - 1] & ~jc.found;
+        l->start = p;
+        l->alive = m & ~jc.tok_end[jc.depth - 1];
+        l->is_arr = (*p == '[');
+        l->idx = 0;
+        l->key = NULL;
+        l->key_len = 0;
+        exp = (*p == '[')? H2_JSON_EXP_VALUE : H2_JSON_EXP_KEY;
+        val_start = p + 1;
+        break;
+      case ':':
+        if (exp != H2_JSON_EXP_COLON) {
+          return -2;
+        }
+        exp = H2_JSON_EXP_VALUE;
+        val_start = p + 1;
+        break;
+      case ',':
+      case '}':
+      case ']':
+        if (jc.depth == 0) {
+          return -2;
+        }
+        if (exp == H2_JSON_EXP_VALUE) {
+          h2_json_emit_scalar(&jc, val_start, p);
+        }
+        if (*p == ',') {
+          if (l->is_arr) {
+            l->idx++;
+            exp = H2_JSON_EXP_VALUE;
+            val_start = p + 1;
+          } else {
+            exp = H2_JSON_EXP_KEY;
+          }
+          break;
+        }
+        if (l->is_arr != (*p == ']')) {
+          return -2;
+        }
+        if (l->rec) {
+          h2_json_emit(&jc, l->rec, (l->is_arr)? H2_JSON_ARRAY : H2_JSON_OBJECT,
+                       l->start, p + 1 - l->start);
+        }
+        jc.depth--;
+        exp = H2_JSON_EXP_SEP;
+        break;
+      }
+    }
+  }
+
+  if (jc.found != jc.want && jc.depth == 0 && exp == H2_JSON_EXP_VALUE &&
+      str_start == NULL) {
+    /* scalar root value */
+    h2_json_emit_scalar(&jc, val_start, (const char *)buf + json_len);
+  } else if (jc.found != jc.want && (jc.depth > 0 || str_start || skip)) {
+    return -2;  /* truncated */
+  }
+
+  for (i = 0, off = 0; i < ptr_num; i++) {
+    off += (vals[i].type != H2_JSON_NONE);
+  }
+  return off;
+}
+
+int h2_json_val_eq(const h2_json_val *val, const char *str) {
+  int len = strlen(str);
+  return val->type != H2_JSON_NONE && val->len == len &&
+         !memcmp(val->str, str, len);
+}
@@ -0,0 +1,364 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>      /* for va_start */
+#include <string.h>
+#include <strings.h>     /* for strncasecmp */
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Multipart Boundary -------------------------------------------------------
+ */
+
+int h2_mpart_boundary(const char *content_type, const char **boundary_ret) {
+  const char *p, *b;
+  int len;
+
+  if (content_type == NULL || strncasecmp(content_type, "multipart/", 10)) {
+    return -1;
+  }
+  for (p = strchr(content_type, ';'); p; p = strchr(p, ';')) {
+    p++;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (strncasecmp(p, "boundary=", 9)) {
+      continue;
+    }
+    b = p + 9;
+    if (*b == '"') {
+      b++;
+      len = strcspn(b, "\"");
+      if (b[len] != '"') {
+        return -1;  /* unterminated quoted boundary */
+      }
+    } else {
+      len = strcspn(b, " \t;");
+    }
+    if (len <= 0 || len > 70) {  /* RFC 2046 5.1.1. */
+      return -1;
+    }
+    *boundary_ret = b;
+    return len;
+  }
+  return -1;
+}
+
+
+/*
+ * Multipart Parser ---------------------------------------------------------
+ * parts are described as pointers into the original body without copy
+ */
+
+/* finds next delimiter "CRLF--boundary" from p, or "--boundary" at body */
+/* start; returns end of the previous part and pointer after boundary */
+static int h2_mpart_find_delim(const char *body, const char *p,
+                               const char *e, const char *boundary,
+                               int boundary_len, const char **part_end_ret,
+                               const char **next_ret) {
+  const char *q;
+
+  while (p < e && (q = memmem(p, e - p, boundary, boundary_len))) {
+    if (q - 2 >= body && q[-2] == '-' && q[-1] == '-') {
+      if (q - 2 == body) {
+        *part_end_ret = body;
+        *next_ret = q + boundary_len;
+        return 1;
+      }
+      if (q - 4 >= body && q[-4] == '\r' && q[-3] == '\n') {
+        *part_end_ret = q - 4;
+        *next_ret = q + boundary_len;
+        return 1;
+      }
+    }
+    p = q + 1;
+  }
+  return 0;
+}
+
+static void h2_mpart_parse_hdr(h2_mpart *part, const char *p, const char *e) {
+  const char *name = p, *value;
+  int name_len;
+
+  while (p < e && *p != ':') {
+    p++;
+  }
+  if (p >= e) {
+    return;  /* ignore malformed header line */
+  }
+  name_len = p - name;
+  for (value = p + 1; value < e && (*value == ' ' || *value == '\t'); value++)
+    ;
+  while (e > value && (e[-1] == ' ' || e[-1] == '\t')) {
+    e--;
+  }
+  if (name_len == 12 && !strncasecmp(name, "content-type", 12)) {
+    part->content_type = value;
+    part->content_type_len = e - value;
+  } else if (name_len == 10 && !strncasecmp(name, "content-id", 10)) {
+    part->content_id = value;
+    part->content_id_len = e - value;
+  }
+}
+
+int h2_mpart_parse(const void *body, int body_len,
+                   const char *boundary, int boundary_len,
+                   h2_mpart *parts, int part_max) {
+  const char *b = body, *e = b + body_len, *p, *eol, *part_end;
+  h2_mpart *part;
+  int n = 0;
+
+  /* skip preamble to the first delimiter */
+  if (!h2_mpart_find_delim(b, b, e, boundary, boundary_len, &part_end, &p)) {
+    return -1;
+  }
+  for (;;) {
+    if (e - p >= 2 && p[0] == '-' && p[1] == '-') {
+      return n;  /* close delimiter; epilogue is ignored */
+    }
+    while (p < e && (*p == ' ' || *p == '\t')) {
+      p++;  /* transport padding */
+    }
+    if (e - p < 2 || p[0] != '\r' || p[1] != '\n') {
+      return -1;
+    }
+    p += 2;
+    if (n >= part_max) {
+      return -2;
+    }
+
+    /* part headers until empty line */
+    part = &parts[n];
+    memset(part, 0, sizeof(h2_mpart));
+    for (;;) {
+      if ((eol = memmem(p, e - p, "\r\n", 2)) == NULL) {
+        return -1;
+      }
+      if (eol == p) {
+        p += 2;
+        break;
+      }
+      h2_mpart_parse_hdr(part, p, eol);
+      p = eol + 2;
+    }
+
+    /* part body until next delimiter */
+    if (!h2_mpart_find_delim(b, p, e, boundary, boundary_len,
+                             &part_end, &eol)) {
+      return -1;
+    }
+    part->body = p;
+    part->body_len = part_end - p;
+    n++;
+    p = eol;
+  }
+}
+
+int h2_mpart_find(const h2_mpart *parts, int part_num,
+                  const char *content_type) {
+  int i, len, type_len = strlen(content_type);
+
+  for (i = 0; i < part_num; i++) {
+    if (parts[i].content_type == NULL) {
+      continue;
+    }
+    len = 0;
+    while (len < parts[i].content_type_len &&
+           parts[i].content_type[len] != ';' &&
+           parts[i].content_type[len] != ' ') {
+      len++;
+    }
+    if (len == type_len &&
+        !strncasecmp(parts[i].content_type, content_type, len)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/*
+ * Multipart Builder --------------------------------------------------------
+ * part bodies are referenced in iov; only delimiters and part headers are
+ * written, so the body is sent without concatenation (h2_set_body_iov)
+ */
+
+static int h2_mpart_printf(char **p, char *e, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(*p, e - *p, fmt, ap);
+  va_end(ap);
+  if (n < 0 || n >= e - *p) {
+    return -1;
+  }
+  *p += n;
+  return 0;
+}
+
+static int h2_mpart_buf_short(int hdr_buf_size) {
+  warnx("too small header buffer for multipart: hdr_buf_size=%d",
+        hdr_buf_size);
+  return -1;
+}
+
+int h2_mpart_build(const char *boundary, const h2_mpart *parts, int part_num,
+                   char *hdr_buf, int hdr_buf_size,
+                   struct iovec *iov, int iov_max) {
+  char *p = hdr_buf, *e = hdr_buf + hdr_buf_size, *seg;
+  int i, n = 0;
+
+  if (iov_max < 2 * part_num + 1) {
+    warnx("too small iov for multipart: iov_max=%d part_num=%d",
+          iov_max, part_num);
+    return -1;
+  }
+  for (i = 0; i < part_num; i++) {
+    seg = p;
+    if (h2_mpart_printf(&p, e, "%s--%s\r\n", (i == 0)? "" : "\r\n",
+                        boundary) < 0 ||
+        (parts[i].content_type &&
+         h2_mpart_printf(&p, e, "Content-Type: %.*s\r\n",
+                         parts[i].content_type_len,
+                         parts[i].content_type) < 0) ||
+        (parts[i].content_id &&
+         h2_mpart_printf(&p, e, "Content-Id: %.*s\r\n",
+                         parts[i].content_id_len, parts[i].content_id) < 0) ||
+        h2_mpart_printf(&p, e, "\r\n") < 0) {
+      return h2_mpart_buf_short(hdr_buf_size);
+    }
+    iov[n].iov_base = seg;
+    iov[n].iov_len = p - seg;
+    n++;
+    iov[n].iov_base = (void *)parts[i].body;
+    iov[n].iov_len = parts[i].body_len;
+    n++;
+  }
+  seg = p;
+  if (h2_mpart_printf(&p, e, "\r\n--%s--\r\n", boundary) < 0) {
+    return h2_mpart_buf_short(hdr_buf_size);
+  }
+  iov[n].iov_base = seg;
+  iov[n].iov_len = p - seg;
+  n++;
+  return n;
+}
+
+
+/*
+ * Multipart Message Body ---------------------------------------------------
+ * parts loaded once from command line specs and set as iov body of a msg
+ */
+
+int h2_mpart_load(h2_mpart *part, char *part_str) {
+  char *data = strchr(part_str, '='), *id;
+  void *body;
+  int body_len;
+
+  if (data == NULL || data == part_str) {
+    warnx("invalid multipart part; should be "
+          "content_type[:content_id]=file|0xhex: %s", part_str);
+    return -1;
+  }
+  *data++ = '\0';
+  if ((id = strchr(part_str, ':'))) {
+    *id++ = '\0';
+  }
+  if (!strncasecmp(data, "0x", 2)) {
+    if (h2_body_from_hex_str(data, &body, &body_len) < 0) {
+      return -2;
+    }
+  } else if (h2_body_from_file(data, &body, &body_len) < 0) {
+    return -2;
+  }
+  part->content_type = strdup(part_str);
+  part->content_type_len = strlen(part_str);
+  part->content_id = (id)? strdup(id) : NULL;
+  part->content_id_len = (id)? (int)strlen(id) : 0;
+  part->body = body;
+  part->body_len = body_len;
+  return 0;
+}
+
+void h2_mpart_free(h2_mpart *parts, int part_num) {
+  int i;
+  for (i = 0; i < part_num; i++) {
+    free((void *)parts[i].content_type);
+    free((void *)parts[i].content_id);
+    free((void *)parts[i].body);
+    memset(&parts[i], 0, sizeof(parts[i]));
+  }
+}
+
+int h2_mpart_set_body(h2_msg *msg, const h2_mpart *parts, int part_num,
+                      char **hdr_buf_ret) {
+  struct iovec iov[2 * H2_MPART_MAX + 1];
+  const char *ct, *boundary;
+  char ct_buf[256], boundary_buf[80];
+  char *hdr_buf;
+  int i, n, len;
+
+  *hdr_buf_ret = NULL;
+  if (part_num <= 0) {
+    return 0;
+  }
+
+  /* use boundary of the content-type header if given */
+  ct = h2_hdr_value(msg, "content-type");
+  if ((len = h2_mpart_boundary(ct, &boundary)) > 0) {
+    snprintf(boundary_buf, sizeof(boundary_buf), "%.*s", len, boundary);
+  } else {
+    strcpy(boundary_buf, H2_MPART_BOUNDARY);
+    snprintf(ct_buf, sizeof(ct_buf), "multipart/related; type=\"%.*s\"; "
+             "boundary=%s", parts[0].content_type_len,
+             parts[0].content_type, boundary_buf);
+    h2_set_hdr(msg, "content-type", ct_buf);
+  }
+
+  len = 128 + 4 * 80;
+  for (i = 0; i < part_num; i++) {
+    len += 128 + parts[i].content_type_len + parts[i].content_id_len;
+  }
+  if ((hdr_buf = malloc(len)) == NULL) {
+    warnx("cannot allocate multipart header buffer: size=%d", len);
+    return -1;
+  }
+  n = h2_mpart_build(boundary_buf, parts, part_num, hdr_buf, len,
+                     iov, 2 * H2_MPART_MAX + 1);
+  if (n < 0 || h2_set_body_iov(msg, iov, n) < 0) {
+    free(hdr_buf);
+    return -2;
+  }
+  *hdr_buf_ret = hdr_buf;
+  return 0;
+}
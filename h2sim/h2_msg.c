@@ -38,7 +38,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>    /* for file read */
 #include <fcntl.h>       /* for file read */
-
+#include <zlib.h>        /* for content coding */
 
 #include "h2.h"
 #include "h2_priv.h"
@@ -192,6 +192,7 @@ void h2_msg_free(h2_msg *msg) {
       msg->body = NULL;
       msg->body_len = 0;
     }
+    free(msg->body_iov);
     free(msg);
   }
 }
@@ -219,6 +220,8 @@ void h2_cpy_msg(h2_msg *dst, h2_msg *src) {
       memcpy(dst->body, src->body, src->body_len + 1/* '\0' */);
       dst->body[src->body_len] = '\0';
       dst->body_len = src->body_len;    
+    } else if (src->body_iov) {
+      h2_set_body_iov(dst, src->body_iov, src->body_iov_num);
     }
   }
 }
@@ -367,7 +370,7 @@ const char *h2_hdr_value(h2_msg *msg, const char *name) {
   int n;
   if (msg) {
     h2_hdr *hdr = msg->hdr;
-    for (n = msg->hdr_num; n >= 0; n--, hdr++) {
+    for (n = msg->hdr_num; n > 0; n--, hdr++) {
       if (!strcmp(h2_sbuf_get(&msg->sbuf, hdr->name), name)) {
         return h2_sbuf_get(&msg->sbuf, hdr->value);
       }
@@ -413,24 +416,19 @@ int h2_add_hdr_s(h2_msg *msg, const char *name_value_str) {
 }
 
 int h2_set_hdr(h2_msg *msg, const char *name, const char *value) {
-  int n, value_len = strlen(value);
+  int n;
   h2_hdr *hdr = msg->hdr;
-  for (n = msg->hdr_num; n >= 0; n--, hdr++) {
+  if (value == NULL) {
+    return (h2_del_hdr(msg, name) > 0)? 2 : 0;
+  }
+  for (n = msg->hdr_num; n > 0; n--, hdr++) {
     if (!strcmp(h2_sbuf_get(&msg->sbuf, hdr->name), name)) {
-      if (value == NULL) {
-        /* delete header */
-        for (n--; n > 0; n--, hdr++) {
-          /* NOTE: there is no dealloc in msg->sbuf */
-          *(hdr) = *(hdr + 1);
-        }
-        memset(hdr, 0, sizeof(*hdr));
-        return 2;
-      } else if (!strcmp(h2_sbuf_get(&msg->sbuf, hdr->value), value)) {
+      if (!strcmp(h2_sbuf_get(&msg->sbuf, hdr->value), value)) {
         /* already has same value; no change */ 
         return 0;
       } else {
         /* update value */
-        hdr->value = h2_sbuf_put_n(&msg->sbuf, value, value_len);
+        hdr->value = h2_sbuf_put_n(&msg->sbuf, value, strlen(value));
         return 1;
       }
     }
@@ -447,6 +445,7 @@ int h2_del_hdr(h2_msg *msg, const char *name) {
         *(hdr) = *(hdr + 1); /* NOTE: there is no dealloc in msg->sbuf */
       }
       memset(hdr, 0, sizeof(*hdr));
+      msg->hdr_num--;
       return 1;
     }
   }
@@ -496,10 +495,19 @@ int h2_body_len(h2_msg *msg) {
   return msg->body_len;
 }
 
+static void h2_free_body_iov(h2_msg *msg) {
+  if (msg->body_iov) {
+    free(msg->body_iov);
+    msg->body_iov = NULL;
+    msg->body_iov_num = 0;
+  }
+}
+
 int h2_set_body(h2_msg *msg, void *body, int body_len) {
   if (msg->body) {
     free(msg->body);
   }
+  h2_free_body_iov(msg);
   if (body && body_len > 0) {
     msg->body = body;
     msg->body_len = body_len;
@@ -515,6 +523,7 @@ int h2_cpy_body(h2_msg *msg, void *body, int body_len) {
   if (msg->body) {
     free(msg->body);
   }
+  h2_free_body_iov(msg);
   if (body && body_len > 0) {
     msg->body = malloc(body_len + 1);
     memcpy(msg->body, body, body_len);
@@ -528,6 +537,52 @@ int h2_cpy_body(h2_msg *msg, void *body, int body_len) {
   }
 }
 
+int h2_set_body_iov(h2_msg *msg, const struct iovec *iov, int iov_num) {
+  struct iovec *body_iov = NULL;
+  int i, len = 0;
+
+  for (i = 0; i < iov_num; i++) {
+    len += iov[i].iov_len;
+  }
+  if (len > 0) {
+    if ((body_iov = malloc(sizeof(struct iovec) * iov_num)) == NULL) {
+      warnx("cannot allocate body iov: iov_num=%d", iov_num);
+      return -1;
+    }
+    memcpy(body_iov, iov, sizeof(struct iovec) * iov_num);
+  }
+  h2_set_body(msg, NULL, 0);
+  if (body_iov == NULL) {
+    return 0;
+  }
+  msg->body_iov = body_iov;
+  msg->body_iov_num = iov_num;
+  msg->body_len = len;
+  return 1;
+}
+
+int h2_msg_body_gather(h2_msg *msg, void *buf) {
+  /* PRIVATE */
+  char *p = buf;
+  int i;
+  if (msg->body) {
+    memcpy(p, msg->body, msg->body_len);
+  } else {
+    for (i = 0; i < msg->body_iov_num; i++) {
+      memcpy(p, msg->body_iov[i].iov_base, msg->body_iov[i].iov_len);
+      p += msg->body_iov[i].iov_len;
+    }
+  }
+  return msg->body_len;
+}
+
+const struct iovec *h2_body_iov(h2_msg *msg, int *iov_num_ret) {
+  if (iov_num_ret) {
+    *iov_num_ret = msg->body_iov_num;
+  }
+  return msg->body_iov;
+}
+
 
 /*
  * Body Handling Utilities --------------------------------------------------
@@ -544,8 +599,8 @@ int h2_body_from_hex_str(char *hex_str, void **body_ret, int *body_len_ret) {
   char *s;
   uint8_t *body, *d;
 
-  n = strlen(optarg);
-  s = optarg;
+  n = strlen(hex_str);
+  s = hex_str;
   body = calloc(1, n + 1/* '\0' */);  /* might has n/2 unused */
   d = body;
 
@@ -558,7 +613,7 @@ int h2_body_from_hex_str(char *hex_str, void **body_ret, int *body_len_ret) {
     if (!isxdigit(*s)) {
       warnx("non hexadecial character '%c' 0x%02x at %dth char "
             "of hex body: %s", *s, *s, (int)(s - hex_str), hex_str);
-      free(*body_ret);
+      free(body);
       *body_ret = NULL;
       return -1;
     }
@@ -626,6 +681,162 @@ int h2_body_from_file(char *file, void **body_ret, int *body_len_ret)
 }
 
 
+/*
+ * Content Coding Utilities -------------------------------------------------
+ * gzip and deflate(zlib format) by RFC 9110 8.4.1
+ */
+
+static const char *h2_coding_names[H2_CODING_NUM] = {
+  "identity", "gzip", "deflate"
+};
+
+const char *h2_coding_name(int coding) {
+  return (coding > H2_CODING_IDENTITY && coding < H2_CODING_NUM)?
+         h2_coding_names[coding] : NULL;
+}
+
+int h2_coding_from_name(const char *name) {
+  int i;
+  if (name == NULL) {
+    return H2_CODING_IDENTITY;
+  }
+  for (i = 0; i < H2_CODING_NUM; i++) {
+    if (!strcasecmp(name, h2_coding_names[i])) {
+      return i;
+    }
+  }
+  if (!strcasecmp(name, "x-gzip")) {
+    return H2_CODING_GZIP;
+  }
+  return -1;
+}
+
+int h2_coding_select(const char *accept_encoding, int coding_mask) {
+  double q[H2_CODING_NUM], q_any = -1;
+  const char *p, *e;
+  int i, best;
+
+  for (i = 0; i < H2_CODING_NUM; i++) {
+    q[i] = -1;  /* not listed */
+  }
+  for (p = accept_encoding; p && *p; p = (*e)? e + 1 : e) {
+    char name[32];
+    double qv = 1.0;
+    int n;
+
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    e = p + strcspn(p, ",");
+    n = strcspn(p, ",; \t");
+    if (n == 0 || n >= (int)sizeof(name)) {
+      continue;
+    }
+    memcpy(name, p, n);
+    name[n] = '\0';
+    const char *qp = memchr(p, ';', e - p);
+    if (qp) {
+      qp++;
+      while (*qp == ' ' || *qp == '\t') {
+        qp++;
+      }
+      if ((qp[0] == 'q' || qp[0] == 'Q') && qp[1] == '=') {
+        qv = strtod(qp + 2, NULL);
+      }
+    }
+    if (!strcmp(name, "*")) {
+      q_any = qv;
+    } else if ((i = h2_coding_from_name(name)) >= 0) {
+      q[i] = qv;
+    }
+  }
+
+  /* identity is acceptable unless explicitly refused */
+  if (q[H2_CODING_IDENTITY] < 0) {
+    q[H2_CODING_IDENTITY] = (q_any == 0)? 0 : 1.0;
+  }
+  best = H2_CODING_IDENTITY;
+  for (i = H2_CODING_IDENTITY + 1; i < H2_CODING_NUM; i++) {
+    double qi = (q[i] >= 0)? q[i] : q_any;
+    /* on same q, encoded one and then earlier one is preferred */
+    if ((coding_mask & (1 << i)) && qi > 0 &&
+        ((best == H2_CODING_IDENTITY)? qi >= q[best] : qi > q[best])) {
+      best = i;
+      q[best] = qi;
+    }
+  }
+  return best;
+}
+
+int h2_body_encode(int coding, const void *body, int body_len,
+                   void **enc_ret, int *enc_len_ret) {
+  z_stream zs;
+  uint8_t *buf;
+  int r, buf_size;
+
+  if (coding != H2_CODING_GZIP && coding != H2_CODING_DEFLATE) {
+    warnx("unsupported content coding to encode: %d", coding);
+    return -1;
+  }
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED,
+                   (coding == H2_CODING_GZIP)? 15 + 16 : 15, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    warnx("deflate init failed: %s", (zs.msg)? zs.msg : "");
+    return -2;
+  }
+  buf_size = deflateBound(&zs, body_len);
+  if ((buf = malloc(buf_size + 1/* '\0' */)) == NULL) {
+    warnx("cannot alloc memory for body encode: size=%d", buf_size);
+    deflateEnd(&zs);
+    return -3;
+  }
+  zs.next_in = (Bytef *)body;
+  zs.avail_in = body_len;
+  zs.next_out = buf;
+  zs.avail_out = buf_size;
+  if ((r = deflate(&zs, Z_FINISH)) != Z_STREAM_END) {
+    warnx("deflate failed: ret=%d %s", r, (zs.msg)? zs.msg : "");
+    deflateEnd(&zs);
+    free(buf);
+    return -4;
+  }
+  buf[zs.total_out] = '\0';
+  *enc_ret = buf;
+  *enc_len_ret = zs.total_out;
+  deflateEnd(&zs);
+  return 0;
+}
+
+long long h2_body_decode_len(int coding, const void *body, int body_len) {
+  uint8_t out[16 * 1024];  /* decoded data are discarded */
+  z_stream zs;
+  int r;
+
+  if (coding == H2_CODING_IDENTITY) {
+    return body_len;
+  } else if (coding != H2_CODING_GZIP && coding != H2_CODING_DEFLATE) {
+    return -1;
+  }
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, (coding == H2_CODING_GZIP)? 15 + 16 : 15) != Z_OK) {
+    return -2;
+  }
+  zs.next_in = (Bytef *)body;
+  zs.avail_in = body_len;
+  do {
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+    r = inflate(&zs, Z_NO_FLUSH);
+  } while (r == Z_OK);
+  inflateEnd(&zs);
+  if (r != Z_STREAM_END || zs.avail_in > 0) {
+    return -3;  /* corrupted, truncated or trailing garbage */
+  }
+  return zs.total_out;
+}
+
+
 /*
  * Message Dump Utility -----------------------------------------------------
  */
@@ -665,6 +876,13 @@ void h2_dump_msg(FILE *fp, h2_msg *msg, const char *line_prefix,
   if (msg->body && msg->body_len > 0) {
     fprintf(fp, "%s  __body__[%d]:\n", line_prefix, msg->body_len);
     fprintf(fp, "%s  %s\n", line_prefix, (char *)msg->body);
+  } else if (msg->body_iov) {
+    fprintf(fp, "%s  __body__[%d] in %d iov:\n", line_prefix,
+            msg->body_len, msg->body_iov_num);
+    for (i = 0; i < msg->body_iov_num; i++) {
+      fprintf(fp, "%s  %.*s\n", line_prefix, (int)msg->body_iov[i].iov_len,
+              (char *)msg->body_iov[i].iov_base);
+    }
   }
 }
 
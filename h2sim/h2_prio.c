@@ -0,0 +1,414 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef TLS_MODE
+#include <openssl/ssl.h>
+#endif
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Message Priority ---------------------------------------------------------
+ * 3gpp-sbi-message-priority header value 0~31; lower is more important
+ */
+
+int h2_msg_priority(h2_msg *msg) {
+  const char *v = h2_hdr_value(msg, H2_PRIO_HDR);
+  char *end;
+  long n;
+
+  if (v == NULL) {
+    return H2_PRIO_DEFAULT;
+  }
+  n = strtol(v, &end, 10);
+  if (end == v || *end != '\0' || n < 0 || n > H2_PRIO_MAX) {
+    return H2_PRIO_DEFAULT;
+  }
+  return (int)n;
+}
+
+int h2_set_msg_priority(h2_msg *msg, int priority) {
+  char s[16];
+
+  if (priority > H2_PRIO_MAX) {
+    return -1;
+  }
+  if (priority < 0) {
+    h2_del_hdr(msg, H2_PRIO_HDR);
+    return 0;
+  }
+  sprintf(s, "%d", priority);
+  return (h2_set_hdr(msg, H2_PRIO_HDR, s) < 0)? -1 : 0;
+}
+
+int h2_prio_class(int priority) {
+  if (priority < 0 || priority > H2_PRIO_MAX) {
+    priority = H2_PRIO_DEFAULT;
+  }
+  return priority * H2_PRIO_CLASS_NUM / (H2_PRIO_MAX + 1);
+}
+
+
+/*
+ * Client Request Priority Lanes on Peer ------------------------------------
+ * requests are queued per class when no session has stream room or the
+ * lanes are not empty, and sent on the stream room by strict class order
+ * or by smooth weighted round robin of 8:4:2:1 not to starve lower ones;
+ * requests not processed by server are also queued to be sent again
+ */
+
+struct h2_prio_req {
+  h2_prio_req *next;
+  h2_msg *req;              /* copied */
+  int retry_cnt;            /* > 0 for request not processed by server */
+  h2_response_cb response_cb;
+  void *strm_user_data;
+};
+
+static const int h2_prio_wrr_weight[H2_PRIO_CLASS_NUM] = { 8, 4, 2, 1 };
+
+static void h2_prio_add(h2_peer *peer, h2_prio_req *pr) {
+  int c = h2_prio_class(h2_msg_priority(pr->req));
+
+  if (peer->lane_tail[c]) {
+    peer->lane_tail[c]->next = pr;
+  } else {
+    peer->lane_head[c] = pr;
+  }
+  peer->lane_tail[c] = pr;
+  peer->lane_num++;
+  peer->lane_queue_cnt[c]++;
+}
+
+int h2_prio_enqueue(h2_peer *peer, h2_msg *req,
+                    h2_response_cb response_cb, void *strm_user_data) {
+  h2_prio_req *pr = calloc(1, sizeof(*pr));
+
+  pr->req = h2_msg_init();
+  h2_cpy_msg(pr->req, req);
+  pr->response_cb = response_cb;
+  pr->strm_user_data = strm_user_data;
+  h2_prio_add(peer, pr);
+  return 0;
+}
+
+void h2_prio_requeue(h2_peer *peer, h2_msg *req, int retry_cnt,
+                     h2_response_cb response_cb, void *strm_user_data) {
+  h2_prio_req *pr = calloc(1, sizeof(*pr));
+
+  pr->req = req;
+  pr->retry_cnt = retry_cnt;
+  pr->response_cb = response_cb;
+  pr->strm_user_data = strm_user_data;
+  h2_prio_add(peer, pr);
+  peer->req_retry_cnt++;
+}
+
+static int h2_prio_pick(h2_peer *peer) {
+  int c, pick = -1, total = 0;
+
+  if (peer->settings.prio_sched != H2_PRIO_SCHED_WRR) {
+    for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+      if (peer->lane_head[c]) {
+        return c;
+      }
+    }
+    return -1;
+  }
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    if (peer->lane_head[c]) {
+      peer->lane_wrr[c] += h2_prio_wrr_weight[c];
+      total += h2_prio_wrr_weight[c];
+      if (pick < 0 || peer->lane_wrr[c] > peer->lane_wrr[pick]) {
+        pick = c;
+      }
+    }
+  }
+  if (pick >= 0) {
+    peer->lane_wrr[pick] -= total;
+  }
+  return pick;
+}
+
+static h2_prio_req *h2_prio_pop(h2_peer *peer, int c) {
+  h2_prio_req *pr = peer->lane_head[c];
+
+  peer->lane_head[c] = pr->next;
+  if (peer->lane_head[c] == NULL) {
+    peer->lane_tail[c] = NULL;
+    peer->lane_wrr[c] = 0;
+  }
+  peer->lane_num--;
+  return pr;
+}
+
+void h2_prio_dispatch(h2_peer *peer) {
+  h2_sess *sess;
+  int c, r;
+
+  while (peer->lane_num > 0 && !peer->is_terminated &&
+         (sess = h2_peer_pick_sess(peer)) && h2_sess_strm_room(sess) > 0) {
+    c = h2_prio_pick(peer);
+    h2_prio_req *pr = h2_prio_pop(peer, c);
+    r = h2_sess_send_request(sess, pr->req, pr->retry_cnt,
+                             pr->response_cb, pr->strm_user_data);
+    h2_msg_free(pr->req);
+    if (r < 0 && pr->response_cb) {
+      H2_PROF_PHASE(H2_PROF_APP,
+                    pr->response_cb(peer, NULL, peer->user_data,
+                                    pr->strm_user_data));
+      free(pr);
+      break;  /* not to loop on the request sent again */
+    }
+    free(pr);
+  }
+
+  if (peer->lane_num == 0 && peer->is_term_pending) {
+    h2_peer_terminate_sess(peer, 1/* wait_rsp */);
+  }
+}
+
+void h2_prio_flush(h2_peer *peer) {
+  h2_prio_req *lane[H2_PRIO_CLASS_NUM], *pr;
+  int c;
+
+  /* detach first for requests sent again by the callbacks */
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    lane[c] = peer->lane_head[c];
+    peer->lane_head[c] = peer->lane_tail[c] = NULL;
+    peer->lane_wrr[c] = 0;
+  }
+  peer->lane_num = 0;
+
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    while ((pr = lane[c])) {
+      lane[c] = pr->next;
+      h2_msg_free(pr->req);
+      if (pr->response_cb) {
+        H2_PROF_PHASE(H2_PROF_APP,
+                      pr->response_cb(peer, NULL, peer->user_data,
+                                      pr->strm_user_data));
+      }
+      free(pr);
+    }
+  }
+}
+
+
+/*
+ * Server Request Admission -------------------------------------------------
+ * requests are admitted within token bucket of rate over all sessions;
+ * the others wait in per class lanes and are admitted by class order on
+ * tokens refilled; on queue_max, the newest of the lowest class waiting
+ * is shed by 503 unless the new one is not higher to be shed instead
+ */
+
+#define H2_ADMIT_BURST_USEC  10000  /* token bucket depth in time */
+
+static const char h2_admit_shed_body[] =
+  "{\"status\":503,\"cause\":\"NF_CONGESTION_RISK\"}";
+
+static void h2_admit_refill(h2_admit *adm, long long cur_usec) {
+  adm->tokens += (cur_usec - adm->token_usec) * adm->rate;
+  if (adm->tokens > adm->burst) {
+    adm->tokens = adm->burst;
+  }
+  adm->token_usec = cur_usec;
+}
+
+static void h2_admit_unlink(h2_admit *adm, h2_strm *strm) {
+  int c = strm->prio_class;
+
+  if (strm->admit_prev) {
+    strm->admit_prev->admit_next = strm->admit_next;
+  } else {
+    adm->head[c] = strm->admit_next;
+  }
+  if (strm->admit_next) {
+    strm->admit_next->admit_prev = strm->admit_prev;
+  } else {
+    adm->tail[c] = strm->admit_prev;
+  }
+  strm->admit_prev = strm->admit_next = NULL;
+  strm->is_admit_queued = 0;
+  adm->queued--;
+}
+
+static void h2_admit_shed(h2_admit *adm, h2_sess *sess, h2_strm *strm) {
+  adm->stat[strm->prio_class].shed_cnt++;
+  strm->is_admit_shed = 1;
+  h2_send_response_simple(sess, strm, h2_strm_rmsg(strm), 503,
+                          "application/problem+json",
+                          (void *)h2_admit_shed_body,
+                          sizeof(h2_admit_shed_body) - 1);
+}
+
+static void h2_admit_timer_cb(h2_ctx *ctx, void *user_data);
+
+static void h2_admit_timer_set(h2_ctx *ctx, h2_admit *adm) {
+  long long delay_usec = (long long)((1.0 - adm->tokens) / adm->rate) + 1;
+  adm->timer = h2_timer_add(ctx, delay_usec, h2_admit_timer_cb, adm);
+}
+
+static void h2_admit_timer_cb(h2_ctx *ctx, void *user_data) {
+  h2_admit *adm = user_data;
+  long long cur_usec = h2_time_usec();
+  h2_strm *strm;
+  int c;
+
+  adm->timer = NULL;  /* freed by caller after return */
+  h2_admit_refill(adm, cur_usec);
+  while (adm->queued > 0 && adm->tokens >= 1.0) {
+    for (c = 0; adm->head[c] == NULL; c++)
+      ;
+    strm = adm->head[c];
+    h2_admit_unlink(adm, strm);
+    adm->tokens -= 1.0;
+    adm->stat[c].admit_cnt++;
+    adm->stat[c].queue_cnt++;
+    adm->stat[c].wait_usec_sum += cur_usec - strm->admit_usec;
+    if (cur_usec - strm->admit_usec > adm->stat[c].wait_usec_max) {
+      adm->stat[c].wait_usec_max = cur_usec - strm->admit_usec;
+    }
+    h2_on_request_admit(strm->sess, strm);
+    if (ctx->admit != adm) {
+      return;  /* freed by set admission off in request_cb */
+    }
+  }
+  if (adm->queued > 0) {
+    h2_admit_timer_set(ctx, adm);
+  }
+}
+
+int h2_admit_request(h2_sess *sess, h2_strm *strm) {
+  h2_admit *adm = sess->ctx->admit;
+  int c = strm->prio_class, low;
+
+  h2_admit_refill(adm, h2_time_usec());
+  if (adm->queued == 0 && adm->tokens >= 1.0) {
+    adm->tokens -= 1.0;
+    adm->stat[c].admit_cnt++;
+    return 1;
+  }
+
+  if (adm->queued >= adm->queue_max) {
+    for (low = H2_PRIO_CLASS_NUM - 1; low > c && !adm->tail[low]; low--)
+      ;
+    if (low <= c) {
+      h2_admit_shed(adm, sess, strm);  /* no lower one to be shed */
+      return 0;
+    }
+    h2_strm *victim = adm->tail[low];
+    h2_admit_unlink(adm, victim);
+    h2_admit_shed(adm, victim->sess, victim);
+  }
+
+  strm->admit_prev = adm->tail[c];
+  strm->admit_next = NULL;
+  if (adm->tail[c]) {
+    adm->tail[c]->admit_next = strm;
+  } else {
+    adm->head[c] = strm;
+  }
+  adm->tail[c] = strm;
+  strm->is_admit_queued = 1;
+  strm->admit_usec = adm->token_usec;
+  adm->queued++;
+  if (adm->timer == NULL) {
+    h2_admit_timer_set(sess->ctx, adm);
+  }
+  return 0;
+}
+
+void h2_admit_del(h2_strm *strm) {
+  h2_admit *adm = strm->sess->ctx->admit;
+
+  if (adm) {
+    h2_admit_unlink(adm, strm);
+    adm->stat[strm->prio_class].drop_cnt++;
+  }
+  strm->is_admit_queued = 0;
+}
+
+void h2_admit_free(h2_ctx *ctx) {
+  h2_admit *adm = ctx->admit;
+  h2_strm *strm;
+  int c;
+
+  if (adm == NULL) {
+    return;
+  }
+  ctx->admit = NULL;
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    while ((strm = adm->head[c])) {
+      h2_admit_unlink(adm, strm);
+      h2_on_request_admit(strm->sess, strm);  /* handled without wait */
+    }
+  }
+  if (adm->timer) {
+    h2_timer_del(ctx, adm->timer);
+  }
+  free(adm);
+}
+
+void h2_ctx_set_admission(h2_ctx *ctx, int rate, int queue_max) {
+  h2_admit *adm = ctx->admit;
+
+  if (rate <= 0) {
+    h2_admit_free(ctx);
+    return;
+  }
+  if (adm == NULL) {
+    adm = calloc(1, sizeof(*adm));
+    adm->token_usec = h2_time_usec();
+    ctx->admit = adm;
+  }
+  adm->rate = rate / 1000000.0;
+  adm->queue_max = (queue_max > 0)? queue_max :
+                   (rate / 10 > 0)? rate / 10 : 1;
+  adm->burst = adm->rate * H2_ADMIT_BURST_USEC;
+  if (adm->burst < 1.0) {
+    adm->burst = 1.0;
+  }
+  adm->tokens = adm->burst;
+}
+
+int h2_ctx_get_admit_stat(h2_ctx *ctx, h2_admit_stat *stat_ret) {
+  if (ctx->admit == NULL) {
+    memset(stat_ret, 0, sizeof(h2_admit_stat) * H2_PRIO_CLASS_NUM);
+    return 0;
+  }
+  memcpy(stat_ret, ctx->admit->stat,
+         sizeof(h2_admit_stat) * H2_PRIO_CLASS_NUM);
+  return 1;
+}
@@ -75,6 +75,7 @@ extern h2_cls h2_cls_sess;
 extern h2_cls h2_cls_peer;
 extern h2_cls h2_cls_svr;
 extern h2_cls h2_cls_ctx;
+extern h2_cls h2_cls_bal;
 
 
 /*
@@ -150,7 +151,9 @@ struct h2_msg {
 
   /* body */
   unsigned char *body; /* dynamic alloced */
-  int body_len;
+  int body_len;         /* total length of body_iov if set */
+  struct iovec *body_iov;  /* dynamic alloced array; data are referenced */
+  int body_iov_num;
 
   /* sbuf for header */
   h2_sbuf sbuf;
@@ -161,6 +164,36 @@ struct h2_msg {
 void h2_msg_init_static(h2_msg *msg);
 void h2_msg_clean_static(h2_msg *msg);
 
+/* copy body or gather body_iov into buf of body_len size at least */
+int h2_msg_body_gather(h2_msg *msg, void *buf);
+
+
+/*
+ * Sampling Profiler Phases: defined in "h2_prof.c" ------------------------
+ */
+
+#define H2_PROF_MAIN    0  /* outside of h2_ctx_run() */
+#define H2_PROF_POLL    1  /* epoll_wait() or poll() */
+#define H2_PROF_ACCEPT  2
+#define H2_PROF_RECV    3  /* socket read and frame handling */
+#define H2_PROF_SEND    4  /* frame build and socket write */
+#define H2_PROF_TLS     5  /* ssl handshake */
+#define H2_PROF_TIMER   6  /* context timer handling */
+#define H2_PROF_API     7  /* h2_send_*() from application */
+#define H2_PROF_APP     8  /* application callbacks */
+#define H2_PROF_PHASE_NUM  9
+
+extern __thread int h2_prof_phase;
+
+/* run stmt in phase; nesting restores outer phase */
+#define H2_PROF_PHASE(phase, stmt)  \
+    do {  \
+      int _h2_prof_saved = h2_prof_phase;  \
+      h2_prof_phase = (phase);  \
+      stmt;  \
+      h2_prof_phase = _h2_prof_saved;  \
+    } while (0)
+
 
 /*
  * HTTP Common IO Handlers: defined in "h2_io.c" ---------------------------
@@ -168,21 +201,25 @@ void h2_msg_clean_static(h2_msg *msg);
 
 void h2_sess_mark_send_pending(h2_sess *sess);
 void h2_sess_clear_send_pending(h2_sess *sess);
+void h2_sess_set_events(h2_sess *sess);  /* on send pending or read stall */
 
 void h2_peer_sess_free_hdlr(h2_peer *peer, h2_sess *sess);
 
+/* block abusive peer ip of server session from accept */
+void h2_ctx_abuse_block(h2_ctx *ctx, h2_sess *sess);
+
 
 /*
  * HTTP/2 Handlers: defined in "h2_v2.c" -----------------------------------
  */
 
 /* send message */
-int h2_send_request_v2(h2_sess *sess, h2_msg *req,
+int h2_send_request_v2(h2_sess *sess, h2_msg *req, int retry_cnt,
                        h2_response_cb response_cb, void *strm_user_data);
 int h2_send_response_v2(h2_sess *sess, h2_strm *strm, h2_msg *rsp);
 int h2_send_push_promise_v2(h2_sess *sess, h2_strm *request_strm,
                             h2_msg *prm_req, h2_msg *prm_rsp);
-int h2_send_rst_stream_v2(h2_sess *sess, h2_strm *strm);
+int h2_send_rst_stream_v2(h2_sess *sess, h2_strm *strm, int error_code);
 
 /* io */
 int h2_sess_send_once_v2(h2_sess *sess);
@@ -193,6 +230,9 @@ void h2_sess_init_v2(h2_sess *sess);
 void h2_sess_free_v2(h2_sess *sess);
 void h2_sess_terminate_v2(h2_sess *sess);
 void h2_sess_shutdown_send_v2(h2_sess *sess);
+void h2_sess_drain_notice_v2(h2_sess *sess);
+int h2_sess_remote_max_strm_v2(h2_sess *sess);  /* remote max concurrent */
+void h2_data_sched_del_v2(h2_strm *strm);  /* on strm free with body remains */
 
 
 /*
@@ -200,7 +240,7 @@ void h2_sess_shutdown_send_v2(h2_sess *sess);
  */
 
 /* send message */
-int h2_send_request_v1_1(h2_sess *sess, h2_msg *req,
+int h2_send_request_v1_1(h2_sess *sess, h2_msg *req, int retry_cnt,
                          h2_response_cb response_cb, void *strm_user_data);
 int h2_send_response_v1_1(h2_sess *sess, h2_strm *strm, h2_msg *rsp);
 
@@ -212,6 +252,18 @@ void h2_sess_terminate_v1_1(h2_sess *sess);
 void h2_sess_shutdown_send_v1_1(h2_sess *sess);
 
 
+/*
+ * TLS Handlers: defined in "h2_ssl.c" -------------------------------------
+ */
+
+#ifdef TLS_MODE
+/* apply trust store reloaded in background; called before SSL_new() */
+void h2_ssl_ctx_check_update(SSL_CTX *ssl_ctx);
+/* SSL_connect() or SSL_accept() with handshake time stat */
+int h2_ssl_handshake(SSL *ssl, int is_server, long long *usec_ret);
+#endif
+
+
 /*
  * Stream Utilities --------------------------------------------------------
  */
@@ -223,16 +275,25 @@ typedef struct h2_send_buf {
   int data_used;
   int to_be_freed;
   int msg_type;             /* H2_REQUEST/RESPONSE/PUSH_PROMISE/PUSH_RESPONSE */
+  /* reference body from h2_set_body_iov(); data is NULL and */
+  /* iov data are gathered directly into DATA frames (HTTP/2 only) */
+  struct iovec *iov;        /* dynamic alloced array */
+  int iov_num;
+  int iov_idx;              /* current iov to send */
+  int iov_off;              /* sent offset in current iov */
 } h2_send_buf;
 
 struct h2_strm {
   h2_obj obj;
   h2_strm *prev, *next;
+  h2_sess *sess;            /* for strm list tail update */
   
   int stream_id;
   int send_msg_type;        /* H2_REQUEST/H2_RESPONSE/H2_PUSH_PROMISE */
   int recv_msg_type;
-  h2_msg *rmsg;
+  h2_msg *rmsg;             /* alloced on receive; use h2_strm_rmsg() */
+  int rbody_alloced;        /* HTTP/2: rmsg body buffer size on DATA recv; */
+                            /* -1 for body dropped by alloc failure */
   h2_send_buf send_body_sb; /* for HTTP/2: */
                             /*   server: response body, client: request body */
                             /*   send data buffer for nghttp2_data_provider */
@@ -248,30 +309,182 @@ struct h2_strm {
 
   /* for http/1.1 Connection: close handling */
   int close_sess;           /* close session after handling this session */
+
+  /* HTTP/2 data send scheduling; see h2_settings.data_sched */
+  h2_strm *sched_prev, *sched_next;
+  int is_data_sched;        /* linked in sess sched list while body remains */
+  int is_data_deferred;     /* read callback returned NGHTTP2_ERR_DEFERRED */
+
+  /* server fault injection; see h2_send_response_delayed() and _trunc() */
+  h2_msg *delayed_rsp;      /* response to send on delayed_timer */
+  h2_timer *delayed_timer;
+  int is_body_trunc;        /* body cut at body_trunc_len then */
+  int body_trunc_len;       /* RST_STREAM or session abort */
+
+  /* request priority; see h2_settings.prio_sched and h2_prio.c */
+  int prio_class;           /* h2_prio_class() of the request */
+  h2_strm *admit_prev, *admit_next;  /* in ctx admission lane */
+  int is_admit_queued;
+  long long admit_usec;     /* queued time */
+
+  /* server stream result; see h2_ctx_set_strm_done_cb() */
+  long long recv_usec;      /* request received; 0 if not to be reported */
+  int rsp_status;           /* response sent */
+  long long rsp_body_len;
+  int is_rsp_done;          /* response fully written */
+  int is_admit_shed;
+
+  /* client request kept to be sent again if not processed by server */
+  h2_msg *retry_req;        /* NULL if retry_unprocessed is off */
+  int retry_cnt;            /* times sent again */
+  int is_req_sent;          /* HTTP/2: request HEADERS sent */
 };
 
 /* create strm and append to sess */
 h2_strm *h2_strm_init(h2_sess *sess, int stream_id, int recv_msg_type,
                       h2_response_cb response_cb, void *strm_user_data);
 void h2_strm_free(h2_strm *strm);
+/* get receive message; alloced at first call to save in-flight memory */
+h2_msg *h2_strm_rmsg(h2_strm *strm);
+/* keep request copy if to be sent again; see h2_settings.retry_unprocessed */
+void h2_strm_keep_req(h2_strm *strm, h2_msg *req, int retry_cnt);
 
 /* receive message event handler */
 int h2_on_request_recv(h2_sess *sess, h2_strm *strm);
+int h2_on_request_admit(h2_sess *sess, h2_strm *strm);
+  /* calls request_cb; for the request passed admission */
 int h2_on_response_recv(h2_sess *sess, h2_strm *strm);
+int h2_on_remote_drain(h2_sess *sess);
 
 /* HTTP/2-only receive message event handler */
-int h2_on_rst_stream_recv(h2_sess *sess, h2_strm *strm);
+int h2_on_rst_stream_recv(h2_sess *sess, h2_strm *strm, int error_code);
+int h2_on_goaway_recv(h2_sess *sess, int last_stream_id);
 int h2_on_push_promise_recv(h2_sess *sess, h2_strm *req_strm,
                             h2_strm *prm_strm);
 int h2_on_push_response_recv(h2_sess *sess, h2_strm *prm_strm);
 
 
+/*
+ * Network Emulation: defined in "h2_emu.c" --------------------------------
+ * see h2_settings.emu_*
+ */
+
+typedef struct h2_emu_chunk h2_emu_chunk;
+
+typedef struct h2_emu {
+  long long delay_usec;
+  long long jitter_usec;
+  long long rate;           /* bytes per sec; 0 for unlimited */
+  int loss;                 /* segment loss per mille */
+  long long stall_usec;     /* read stall after recv */
+  long long read_rate;      /* recv bytes per sec; 0 for unlimited */
+
+  /* delay line of sent chunks in order */
+  h2_emu_chunk *head, *tail;
+  int queued;               /* bytes in delay line */
+  int queue_max;            /* writer is blocked over this */
+  long long last_due_usec;  /* to keep order under jitter */
+  int is_blocked;           /* writer blocked by queue_max */
+  int is_sock_blocked;      /* socket would block on last flush */
+
+  /* token bucket for rate */
+  double tokens;
+  double burst;
+  long long token_usec;     /* last token refill time */
+
+  /* token bucket for read_rate; negative on bytes read over it */
+  double read_tokens;
+  double read_burst;
+  long long read_token_usec;
+
+  long long read_resume_usec;  /* 0 if read not stalled */
+
+  h2_timer *timer;          /* for the next due chunk or read resume */
+  long long timer_usec;
+  unsigned int seed;        /* for jitter and loss */
+
+  /* statistics */
+  long long byte_cnt;
+  long long chunk_cnt;
+  long long lost_cnt;
+  long long blocked_cnt;
+  long long stall_cnt;
+} h2_emu;
+
+int h2_emu_is_set(const h2_settings *settings);
+h2_emu *h2_emu_init(h2_sess *sess);  /* NULL if not set */
+void h2_emu_free(h2_sess *sess);
+int h2_emu_write(h2_sess *sess, const void *data, int size);
+  /* queue to delay line; returns queued size or 0 if blocked */
+void h2_emu_stall_read(h2_sess *sess, int recv_len);  /* call after recv */
+int h2_emu_is_read_stalled(h2_sess *sess);
+int h2_emu_is_send_blocked(h2_sess *sess);
+int h2_emu_queued(h2_sess *sess);
+void h2_emu_print_stat(h2_sess *sess);
+
+
+/*
+ * Request Priority Lanes and Admission: defined in "h2_prio.c" ------------
+ * see h2_settings.prio_sched and h2_ctx_set_admission()
+ */
+
+typedef struct h2_prio_req h2_prio_req;  /* client request in peer lane */
+
+typedef struct h2_admit {
+  double rate;              /* requests per usec */
+  int queue_max;
+  double tokens;
+  double burst;
+  long long token_usec;     /* last token refill time */
+
+  /* waiting server streams per class in arrival order */
+  h2_strm *head[H2_PRIO_CLASS_NUM], *tail[H2_PRIO_CLASS_NUM];
+  int queued;
+  h2_timer *timer;          /* for the next token on queued */
+
+  h2_admit_stat stat[H2_PRIO_CLASS_NUM];
+} h2_admit;
+
+/* client peer lanes */
+int h2_prio_enqueue(h2_peer *peer, h2_msg *req,
+                    h2_response_cb response_cb, void *strm_user_data);
+void h2_prio_requeue(h2_peer *peer, h2_msg *req, int retry_cnt,
+                     h2_response_cb response_cb, void *strm_user_data);
+  /* req not processed by server is owned by lane; no copy */
+void h2_prio_dispatch(h2_peer *peer);  /* on stream room of sessions */
+void h2_prio_flush(h2_peer *peer);     /* response_cb with NULL rsp */
+
+/* server admission */
+int h2_admit_request(h2_sess *sess, h2_strm *strm);
+  /* returns 1(to be handled now), 0(queued or shed) */
+void h2_admit_del(h2_strm *strm);     /* on stream free while queued */
+void h2_admit_free(h2_ctx *ctx);
+
+
+/*
+ * Session Rebalancing over Thread Contexts: defined in "h2_bal.c" --------
+ * see h2_ctx_set_balance()
+ */
+
+typedef struct h2_bal h2_bal;  /* per ctx; starts with h2_obj of h2_cls_bal */
+
+int h2_bal_fd(h2_ctx *ctx);       /* readable on sessions moved in */
+void h2_bal_adopt(h2_ctx *ctx);   /* on h2_bal_fd() readable */
+int h2_bal_close(h2_ctx *ctx, int force);
+  /* no more sessions moved in; on run loop end */
+  /* returns 1(closed), 0(sessions moved in are pending and not force) */
+void h2_bal_free(h2_ctx *ctx);
+
+
 /*
  * Session Utilities -------------------------------------------------------
  */
 
 #define H2_RD_BUF_SIZE  (16 * 1024)
 
+/* recv body prealloc limit by content-length; grown by doubling over it */
+#define H2_RBODY_PREALLOC_MAX  (4 * 1024 * 1024)
+
 /* send write pending buffer for nghttp2 mem send handling */
 /* NOTE: nghttp2_sesion_mem_send() retruns per frame */
 /*       so merge men_send return data for io perf; sock is NODELAY mode */
@@ -289,6 +502,73 @@ typedef struct h2_wr_buf {
   int mem_send_size;
 } h2_wr_buf;
 
+/* HPACK statistics per direction; see h2_hpack_scan_feed() */
+typedef struct h2_hpack_stat {
+  long long hdr_num;        /* header fields */
+  long long raw_bytes;      /* name + value bytes before HPACK */
+  long long enc_bytes;      /* header block bytes after HPACK */
+  long long idx_static;     /* indexed field from static table */
+  long long idx_dynamic;    /* indexed field from dynamic table */
+  long long lit_inc;        /* literal with incremental indexing */
+  long long lit_no_idx;     /* literal without indexing */
+  long long lit_never;      /* literal never indexed */
+} h2_hpack_stat;
+
+/* HTTP/2 frame stream scanner to count HPACK representations */
+typedef struct h2_hpack_scan {
+  int is_off;               /* stopped on invalid frame or no memory */
+  int preface_remain;       /* client connection preface bytes to skip */
+  unsigned char fhdr[9];    /* frame header being received */
+  int fhdr_len;
+  int frame_type;
+  int frame_flags;
+  int frame_remain;         /* payload bytes remaining for current frame */
+  int is_frame_copy;        /* header frame payload to be copied to blk */
+  unsigned char *blk;       /* header block being collected; alloced */
+  int blk_size;
+  int blk_len;              /* header block fragments collected */
+  int pay_len;              /* current frame payload copied after blk_len */
+  h2_hpack_stat stat;
+} h2_hpack_scan;
+
+/* defined in h2_v2.c */
+void h2_hpack_scan_feed(h2_hpack_scan *scan, const unsigned char *data,
+                        int size);
+void h2_hpack_stat_add(h2_hpack_stat *dst, const h2_hpack_stat *src);
+void h2_hpack_stat_print(FILE *fp, const char *prefix, const char *dir,
+                         const h2_hpack_stat *stat, int tbl_size);
+  /* tbl_size < 0 for not to show */
+
+/* HTTP/2 frame patterns counted for abuse rate limits */
+#define H2_ABUSE_RST_STREAM   0
+#define H2_ABUSE_PING         1
+#define H2_ABUSE_SETTINGS     2
+#define H2_ABUSE_EMPTY_FRAME  3
+#define H2_ABUSE_NUM          4
+
+/* abusive peer ip blocked at accept; block secs doubled per abuse */
+#define H2_ABUSE_IP_MAX       64
+#define H2_ABUSE_BLOCK_SEC    1
+#define H2_ABUSE_BLOCK_MAX    60
+
+typedef struct h2_abuse_ip {
+  unsigned char addr[16];   /* ipv4 is as ipv4-mapped ipv6 */
+  int abuse_num;
+  long long block_until_usec;
+} h2_abuse_ip;
+
+/* lingering close after the final GOAWAY; see h2_ctx_linger() */
+#define H2_LINGER_USEC        1000000  /* wait for peer close at most */
+#define H2_LINGER_TICK_USEC   10000
+
+typedef struct h2_linger {
+  int fd;
+  long long until_usec;
+} h2_linger;
+
+void h2_ctx_linger(h2_ctx *ctx, int fd);
+  /* half-closes fd and closes it on peer EOF or H2_LINGER_USEC */
+
 /* h2_sess close reason */
 #define CLOSE_BY_SOCK_EOF     (-1)
 #define CLOSE_BY_SOCK_ERR     (-2)
@@ -305,11 +585,17 @@ struct h2_sess {
 
   h2_ctx *ctx;
   h2_peer *peer;            /* for client session */
+  int peer_sess_idx;        /* for client session; index in peer->sess */
   int http_ver;             /* H2_HTTP_V* */
   int is_server;
   h2_settings settings;
 
   h2_strm strm_list_head;
+  h2_strm *strm_list_tail;  /* last strm for append; NULL if empty */
+  int strm_num;             /* number of strms in list */
+
+  /* HTTP/2 streams with body to send in submit order; unless data_sched rr */
+  h2_strm *sched_head, *sched_tail;
 
   SSL *ssl;                 /* non-NULL for tsl sess only */
   int fd;                   /* connected socket fd */
@@ -317,22 +603,41 @@ struct h2_sess {
   char *log_prefix;         /* dynamic alloced */
 
   h2_wr_buf wr_buf;         /* write buffer for nonblocking send */
+  h2_hpack_scan hpack_send; /* HTTP/2: sent header block scanner */
+  h2_hpack_scan hpack_recv; /* HTTP/2: received header block scanner */
   int send_pending;         /* mark when send skipping by would block */
+  h2_emu *emu;              /* network emulation; NULL if off */
   int send_data_remain;     /* sum of h2_send_buf remains to be sent */
 
-  int req_cnt;              /* HTTP/2: client only; HTTP/1.1: both */
-  int rsp_cnt;              /* HTTP/2: client only; HTTP/1.1: both */
-  int rsp_rst_cnt;          /* HTTP/2: client only for rst_stream on req */
+  long long req_cnt;        /* HTTP/2: client only; HTTP/1.1: both */
+  long long rsp_cnt;        /* HTTP/2: client only; HTTP/1.1: both */
+  long long rsp_rst_cnt;    /* HTTP/2: client only for rst_stream on req */
                             /*         NOTE: rsp_cnt is also counted */
-  int strm_close_cnt;
+  long long req_retry_cnt;  /* client only for requests sent again */
+                            /*         NOTE: rsp_cnt is also counted */
+  long long strm_close_cnt;
   struct timeval tv_begin;
   struct timeval tv_end;
 
-  int is_req_max_reconn;    /* mark to be terminated for req_max_per_sess */
+  /* HTTP/2 abuse rate limits; counted in 1 sec window */
+  long long abuse_win_usec; /* window start time */
+  int abuse_cnt[H2_ABUSE_NUM];
+  int abuse_type;           /* H2_ABUSE_* + 1 on GOAWAY sent; 0 for none */
+
+  int is_settings_recv;     /* HTTP/2: remote SETTINGS received */
+  int is_settings_acked;    /* HTTP/2: local SETTINGS ACK received */
+  int is_ready;             /* see h2_sess_is_ready() */
+
+  long long drain_usec;     /* server: drain notice sent time; 0 for none */
+
+  int is_req_max_reconn;    /* reconnect on close without reconn_max count */
   int is_terminated;
+  int is_aborted;           /* h2_sess_abort() called; no more send */
   int is_no_more_req;
   int is_shutdown_send_called;
 
+  long long bal_usec;       /* recv and send time in balance interval */
+
   /* HTTP/2 nghttp2 session context */
   struct nghttp2_session *ng_sess;
 
@@ -349,6 +654,8 @@ struct h2_sess {
   int rmsg_header_done;     /* header is parsed all */
   int rmsg_header_line;     /* header line count parsed */
   int rmsg_content_length;  /* Content-Length header value */
+  char *rmsg_body;          /* body filled across reads; set to rmsg at end */
+  int rmsg_body_len;        /* not to hold large body in rdata as well */
 
   /* HTTP/1.1 send message status */
   h2_strm *strm_sending;    /* maintained for client request send */
@@ -361,11 +668,19 @@ struct h2_sess {
 
 /* sess management */
 void h2_sess_free(h2_sess *sess);
+void h2_sess_mark_ready(h2_sess *sess);
+void h2_sess_print_hpack_stat_v2(h2_sess *sess);  /* in h2_v2.c */
 
 /* mark something to be sent */
 void h2_sess_mark_send_pending(h2_sess *sess);
 int h2_sess_send(h2_sess *sess);
 
+/* client request send on session; retry_cnt is 0 for new request */
+int h2_sess_send_request(h2_sess *sess, h2_msg *req, int retry_cnt,
+                         h2_response_cb response_cb, void *strm_user_data);
+int h2_sess_strm_room(h2_sess *sess);
+  /* request streams to be accepted by the session; <= 0 if full */
+
 
 /*
  * Peer Utilities ----------------------------------------------------------
@@ -383,29 +698,45 @@ struct h2_peer {
   h2_settings settings;
   h2_push_promise_cb push_promise_cb;
   h2_peer_free_cb peer_free_cb;
+  h2_peer_ready_cb ready_cb;
   void *user_data;
 
   /* sessions and load balancing status */
   h2_sess **sess;           /* dynamic sess[sess_num] */
   int next_sess_idx;
+  int rsp_sess_idx;         /* session of response in response_cb; or -1 */
   int *act_sess;            /* dynamic int[sess_num]; mark in act_sess_num */
   int act_sess_num;         /* number of connected sessions */
+  int ready_sess_num;       /* number of ready sessions */
   int reconn_num;           /* number of session reconnect tried */
 
   int is_terminated;
   int is_no_more_req;
+  int is_term_pending;      /* h2_terminate() waits for lanes empty */
+
+  /* request priority lanes; see h2_settings.prio_sched */
+  h2_prio_req *lane_head[H2_PRIO_CLASS_NUM], *lane_tail[H2_PRIO_CLASS_NUM];
+  int lane_num;             /* requests waiting in all lanes */
+  int lane_wrr[H2_PRIO_CLASS_NUM];  /* smooth weighted round robin credit */
+  long long lane_queue_cnt[H2_PRIO_CLASS_NUM];  /* requests waited */
 
   /* performance counts */
-  int req_cnt;              /* HTTP/2: client only; HTTP/1.1: both */
-  int rsp_cnt;              /* HTTP/2: client only; HTTP/1.1: both */
-  int rsp_rst_cnt;          /* HTTP/2: client only for rst_stream on req */
-  int strm_close_cnt;       /* aggregated from sess */
-  int sess_close_cnt;
+  long long req_cnt;        /* HTTP/2: client only; HTTP/1.1: both */
+  long long rsp_cnt;        /* HTTP/2: client only; HTTP/1.1: both */
+  long long rsp_rst_cnt;    /* HTTP/2: client only for rst_stream on req */
+  long long req_retry_cnt;  /* requests sent again on the other session */
+  long long strm_close_cnt; /* aggregated from sess */
+  long long sess_close_cnt;
+  h2_hpack_stat hpack_send; /* aggregated from sess */
+  h2_hpack_stat hpack_recv;
   struct timeval tv_begin;
   struct timeval tv_end;
 };
 
 void h2_peer_free(h2_peer *peer);
+h2_sess *h2_peer_pick_sess(h2_peer *peer);
+  /* active session with the most stream room; NULL if none */
+void h2_peer_terminate_sess(h2_peer *peer, int wait_rsp);
 
 
 /*
@@ -453,10 +784,48 @@ struct h2_ctx {
   /* set at h2_ctx_run() start, cleared by h2_ctx_stop() */
   int service_flag;
 
+  /* abusive server session peers; oldest block is replaced on full */
+  h2_abuse_ip abuse_ip[H2_ABUSE_IP_MAX];
+
+  /* fds half-closed and read until peer close; see h2_ctx_linger() */
+  h2_linger *linger;      /* dynamic alloced h2_linger[linger_alloced] */
+  int linger_num;
+  int linger_alloced;
+
+  /* timer min heap on expire_usec */
+  h2_timer **timer_heap;  /* dynamic alloced h2_timer *[timer_alloced] */
+  int timer_num;
+  int timer_alloced;
+
+  /* graceful drain by h2_ctx_drain(); server sessions only */
+  long long drain_begin_usec;   /* 0 if not draining */
+  long long drain_spread_usec;  /* time to spread drain notices over */
+  int drain_total;              /* server sessions at drain begin */
+  int drain_cnt;                /* server sessions drain noticed */
+
+  /* network emulation session selection by settings.emu_sess_pct */
+  long long emu_sess_seq;
+
+  /* server request admission; NULL if off */
+  h2_admit *admit;
+
+  /* session rebalancing over contexts of threads; NULL if off */
+  h2_bal *bal;
+
+  /* server stream result callback; NULL if off */
+  h2_strm_done_cb strm_done_cb;
+
   int http_ver;   /* HTTP version; H2_HTTP_V* */
   int verbose;    /* verbose flag */
 };
 
+struct h2_timer {
+  long long expire_usec;  /* h2_time_usec() based */
+  int heap_idx;           /* index in ctx->timer_heap */
+  h2_timer_cb timer_cb;
+  void *user_data;
+};
+
 
 #endif  /* __h2_priv_h__ */
 
@@ -0,0 +1,423 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <execinfo.h>  /* for backtrace() */
+#include <dlfcn.h>     /* for dladdr1() */
+#include <link.h>      /* for dl_iterate_phdr() and ElfW() */
+#include <elf.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>  /* for setitimer() */
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Sampling Profiler --------------------------------------------------------
+ * SIGPROF on ITIMER_PROF captures the stack by backtrace() which unwinds
+ * by .eh_frame, so works without frame pointers on optimized build.
+ * samples are aggregated per unique <phase, stack> in lock-free open
+ * addressing table; symbols are resolved only at h2_prof_stop().
+ * NOTE: backtrace() is not async-signal-safe by spec; it is warmed up at
+ *       start not to load libgcc_s in the signal handler
+ */
+
+#define H2_PROF_DEPTH_MAX   64
+#define H2_PROF_SKIP        2       /* signal handler and sigreturn frames */
+#define H2_PROF_SLOT_NUM    16384   /* unique stacks; power of 2 */
+#define H2_PROF_PROBE_MAX   64
+
+typedef struct h2_prof_slot {
+  int state;                /* 0:empty, 1:filling, 2:ready */
+  int phase;                /* H2_PROF_* */
+  int depth;
+  unsigned int hash;
+  long long count;
+  void *pc[H2_PROF_DEPTH_MAX];  /* leaf first */
+} h2_prof_slot;
+
+__thread int h2_prof_phase;  /* H2_PROF_*; set by loop thread */
+
+static const char *h2_prof_phase_name[H2_PROF_PHASE_NUM] = {
+  "main", "poll", "accept", "recv", "send", "tls", "timer", "api", "app"
+};
+
+static h2_prof_slot *h2_prof_slots = NULL;  /* [H2_PROF_SLOT_NUM] */
+static long long h2_prof_sample_num = 0;
+static long long h2_prof_drop_num = 0;
+static long long h2_prof_phase_num[H2_PROF_PHASE_NUM];
+
+static void h2_prof_sighdlr(int signo) {
+  void *pc[H2_PROF_SKIP + H2_PROF_DEPTH_MAX];
+  int saved_errno = errno;
+  int i, n, phase = h2_prof_phase;
+  unsigned int hash = 2166136261u;  /* FNV-1a */
+  (void)signo;
+
+  if (h2_prof_slots == NULL) {
+    return;
+  }
+  n = backtrace(pc, H2_PROF_SKIP + H2_PROF_DEPTH_MAX) - H2_PROF_SKIP;
+  if (n <= 0) {
+    errno = saved_errno;
+    return;
+  }
+  if (phase < 0 || phase >= H2_PROF_PHASE_NUM) {
+    phase = H2_PROF_MAIN;
+  }
+  __atomic_add_fetch(&h2_prof_sample_num, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h2_prof_phase_num[phase], 1, __ATOMIC_RELAXED);
+
+  hash = (hash ^ phase) * 16777619u;
+  for (i = 0; i < n; i++) {
+    hash = (hash ^ (unsigned int)(uintptr_t)pc[H2_PROF_SKIP + i]) * 16777619u;
+  }
+
+  for (i = 0; i < H2_PROF_PROBE_MAX; i++) {
+    h2_prof_slot *slot = &h2_prof_slots[(hash + i) & (H2_PROF_SLOT_NUM - 1)];
+    int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    if (state == 0) {
+      if (__atomic_compare_exchange_n(&slot->state, &state, 1, 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        slot->phase = phase;
+        slot->depth = n;
+        slot->hash = hash;
+        slot->count = 1;
+        memcpy(slot->pc, &pc[H2_PROF_SKIP], sizeof(void *) * n);
+        __atomic_store_n(&slot->state, 2, __ATOMIC_RELEASE);
+        errno = saved_errno;
+        return;
+      }
+      /* else, taken by other thread; state is reloaded */
+    }
+    if (state == 2 && slot->hash == hash && slot->phase == phase &&
+        slot->depth == n &&
+        !memcmp(slot->pc, &pc[H2_PROF_SKIP], sizeof(void *) * n)) {
+      __atomic_add_fetch(&slot->count, 1, __ATOMIC_RELAXED);
+      errno = saved_errno;
+      return;
+    }
+  }
+  __atomic_add_fetch(&h2_prof_drop_num, 1, __ATOMIC_RELAXED);
+  errno = saved_errno;
+}
+
+int h2_prof_start(int hz) {
+  struct sigaction sa;
+  struct itimerval itv;
+  void *warm_up[4];
+
+  if (h2_prof_slots) {
+    warnx("profiler already started");
+    return -1;
+  }
+  if (hz <= 0) {
+    hz = H2_PROF_HZ_DEFAULT;
+  }
+  h2_prof_slots = calloc(H2_PROF_SLOT_NUM, sizeof(h2_prof_slot));
+  if (h2_prof_slots == NULL) {
+    warnx("profiler slot alloc failed");
+    return -1;
+  }
+  h2_prof_sample_num = 0;
+  h2_prof_drop_num = 0;
+  memset(h2_prof_phase_num, 0, sizeof(h2_prof_phase_num));
+  backtrace(warm_up, 4);  /* load unwinder out of signal handler */
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = h2_prof_sighdlr;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) < 0) {
+    warnx("profiler sigaction failed: %s", strerror(errno));
+    free(h2_prof_slots);
+    h2_prof_slots = NULL;
+    return -1;
+  }
+
+  itv.it_interval.tv_sec = 0;
+  itv.it_interval.tv_usec = (hz >= 1000000)? 1 : 1000000 / hz;
+  itv.it_value = itv.it_interval;
+  if (setitimer(ITIMER_PROF, &itv, NULL) < 0) {
+    warnx("profiler setitimer failed: %s", strerror(errno));
+    signal(SIGPROF, SIG_IGN);
+    free(h2_prof_slots);
+    h2_prof_slots = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+
+/*
+ * Symbol Resolve -----------------------------------------------------------
+ * executable's .symtab is read to name static functions which dladdr()
+ * cannot see; shared objects are resolved by dladdr1() with symbol size
+ */
+
+typedef struct {
+  uintptr_t addr;
+  uintptr_t size;
+  const char *name;
+} h2_prof_sym;
+
+static h2_prof_sym *h2_prof_syms = NULL;  /* sorted by addr */
+static int h2_prof_sym_num = 0;
+static char *h2_prof_exe_map = NULL;
+static size_t h2_prof_exe_map_size = 0;
+static uintptr_t h2_prof_exe_base = 0;
+
+static int h2_prof_exe_base_cb(struct dl_phdr_info *info, size_t size,
+                               void *data) {
+  (void)size;
+  *(uintptr_t *)data = info->dlpi_addr;
+  return 1;  /* first entry is the executable */
+}
+
+static int h2_prof_sym_cmp(const void *a, const void *b) {
+  uintptr_t x = ((const h2_prof_sym *)a)->addr;
+  uintptr_t y = ((const h2_prof_sym *)b)->addr;
+  return (x < y)? -1 : (x > y)? 1 : 0;
+}
+
+static void h2_prof_load_exe_syms(void) {
+  struct stat st;
+  int fd, i, j;
+
+  if ((fd = open("/proc/self/exe", O_RDONLY)) < 0) {
+    return;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(ElfW(Ehdr))) {
+    close(fd);
+    return;
+  }
+  h2_prof_exe_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (h2_prof_exe_map == MAP_FAILED) {
+    h2_prof_exe_map = NULL;
+    return;
+  }
+  h2_prof_exe_map_size = st.st_size;
+
+  ElfW(Ehdr) *eh = (void *)h2_prof_exe_map;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+      eh->e_shoff + (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) >
+      h2_prof_exe_map_size) {
+    return;
+  }
+  ElfW(Shdr) *sh = (void *)(h2_prof_exe_map + eh->e_shoff);
+  for (i = 0; i < eh->e_shnum; i++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) {
+      continue;
+    }
+    ElfW(Sym) *sym = (void *)(h2_prof_exe_map + sh[i].sh_offset);
+    const char *str = h2_prof_exe_map + sh[sh[i].sh_link].sh_offset;
+    int n = sh[i].sh_size / sizeof(ElfW(Sym));
+    if ((h2_prof_syms = malloc(sizeof(h2_prof_sym) * n)) == NULL) {
+      warnx("cannot allocate profile symbols: %d; raw addresses used", n);
+      break;  /* resolved by dladdr() or as raw address */
+    }
+    for (j = 0; j < n; j++) {
+      if (ELF64_ST_TYPE(sym[j].st_info) == STT_FUNC && sym[j].st_value &&
+          sym[j].st_size) {
+        h2_prof_sym *s = &h2_prof_syms[h2_prof_sym_num++];
+        s->addr = sym[j].st_value;
+        s->size = sym[j].st_size;
+        s->name = str + sym[j].st_name;
+      }
+    }
+    break;
+  }
+  if (h2_prof_sym_num > 0) {
+    qsort(h2_prof_syms, h2_prof_sym_num, sizeof(h2_prof_sym),
+          h2_prof_sym_cmp);
+  }
+  dl_iterate_phdr(h2_prof_exe_base_cb, &h2_prof_exe_base);
+}
+
+static void h2_prof_free_exe_syms(void) {
+  free(h2_prof_syms);
+  h2_prof_syms = NULL;
+  h2_prof_sym_num = 0;
+  if (h2_prof_exe_map) {
+    munmap(h2_prof_exe_map, h2_prof_exe_map_size);
+    h2_prof_exe_map = NULL;
+  }
+}
+
+/* writes function name of pc into buf */
+static void h2_prof_resolve(void *pc, char *buf, int buf_size) {
+  uintptr_t a = (uintptr_t)pc - h2_prof_exe_base;
+  int lo = 0, hi = h2_prof_sym_num - 1;
+  Dl_info info;
+  ElfW(Sym) *sym = NULL;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (a < h2_prof_syms[mid].addr) {
+      hi = mid - 1;
+    } else if (a >= h2_prof_syms[mid].addr + h2_prof_syms[mid].size) {
+      lo = mid + 1;
+    } else {
+      snprintf(buf, buf_size, "%s", h2_prof_syms[mid].name);
+      return;
+    }
+  }
+
+  if (dladdr1(pc, &info, (void **)&sym, RTLD_DL_SYMENT) && info.dli_fname) {
+    if (sym && info.dli_sname &&
+        (uintptr_t)pc < (uintptr_t)info.dli_saddr + sym->st_size) {
+      snprintf(buf, buf_size, "%s", info.dli_sname);
+    } else if (h2_prof_syms == NULL) {
+      snprintf(buf, buf_size, "%p", pc);  /* no symbol table loaded */
+    } else {
+      const char *p = strrchr(info.dli_fname, '/');
+      snprintf(buf, buf_size, "[%s]", (p)? p + 1 : info.dli_fname);
+    }
+    return;
+  }
+  if (h2_prof_syms == NULL) {
+    snprintf(buf, buf_size, "%p", pc);
+  } else {
+    snprintf(buf, buf_size, "[unknown]");
+  }
+}
+
+
+/*
+ * Folded Stack Output ------------------------------------------------------
+ * "phase;root_func;...;leaf_func count" per line for flamegraph.pl
+ */
+
+typedef struct {
+  char *line;
+  long long count;
+} h2_prof_line;
+
+static int h2_prof_line_cmp(const void *a, const void *b) {
+  return strcmp(((const h2_prof_line *)a)->line,
+                ((const h2_prof_line *)b)->line);
+}
+
+static int h2_prof_write_folded(const char *file) {
+  h2_prof_line *lines;
+  int i, j, line_num = 0, out_num = 0;
+  FILE *fp;
+
+  if ((fp = fopen(file, "w")) == NULL) {
+    warnx("cannot open profile output file: %s: %s", file, strerror(errno));
+    return -1;
+  }
+
+  if ((lines = malloc(sizeof(h2_prof_line) * H2_PROF_SLOT_NUM)) == NULL) {
+    warnx("cannot allocate profile lines: %d", H2_PROF_SLOT_NUM);
+    fclose(fp);
+    return -2;
+  }
+  h2_prof_load_exe_syms();
+  for (i = 0; i < H2_PROF_SLOT_NUM; i++) {
+    h2_prof_slot *slot = &h2_prof_slots[i];
+    char buf[H2_PROF_DEPTH_MAX * 64 + 64], name[256];
+    int n;
+
+    if (slot->state != 2) {
+      continue;
+    }
+    n = snprintf(buf, sizeof(buf), "%s", h2_prof_phase_name[slot->phase]);
+    for (j = slot->depth - 1; j >= 0 && n < (int)sizeof(buf); j--) {
+      /* return address is in the next instruction of call except leaf */
+      h2_prof_resolve((char *)slot->pc[j] - (j > 0), name, sizeof(name));
+      n += snprintf(buf + n, sizeof(buf) - n, ";%s", name);
+    }
+    lines[line_num].line = strdup(buf);
+    lines[line_num].count = slot->count;
+    line_num++;
+  }
+  h2_prof_free_exe_syms();
+
+  /* merge same lines by different pc in the same function */
+  qsort(lines, line_num, sizeof(h2_prof_line), h2_prof_line_cmp);
+  for (i = 0; i < line_num; i = j) {
+    long long count = lines[i].count;
+    for (j = i + 1; j < line_num && !strcmp(lines[i].line, lines[j].line);
+         j++) {
+      count += lines[j].count;
+    }
+    fprintf(fp, "%s %lld\n", lines[i].line, count);
+    out_num++;
+  }
+  for (i = 0; i < line_num; i++) {
+    free(lines[i].line);
+  }
+  free(lines);
+  fclose(fp);
+  return out_num;
+}
+
+int h2_prof_stop(const char *folded_file, FILE *stat_fp) {
+  struct itimerval itv;
+  int i, r = 0;
+
+  if (h2_prof_slots == NULL) {
+    return -1;
+  }
+  memset(&itv, 0, sizeof(itv));
+  setitimer(ITIMER_PROF, &itv, NULL);
+  signal(SIGPROF, SIG_IGN);
+
+  if (folded_file) {
+    r = h2_prof_write_folded(folded_file);
+  }
+  if (stat_fp) {
+    fprintf(stat_fp, "PROFILE: %lld samples (%lld dropped)",
+            h2_prof_sample_num, h2_prof_drop_num);
+    for (i = 0; i < H2_PROF_PHASE_NUM; i++) {
+      if (h2_prof_phase_num[i] > 0) {
+        fprintf(stat_fp, " %s=%.1f%%", h2_prof_phase_name[i],
+                h2_prof_phase_num[i] * 100.0 / h2_prof_sample_num);
+      }
+    }
+    if (folded_file && r >= 0) {
+      fprintf(stat_fp, "; %d stacks to %s", r, folded_file);
+    }
+    fprintf(stat_fp, "\n");
+  }
+
+  free(h2_prof_slots);
+  h2_prof_slots = NULL;
+  return r;
+}
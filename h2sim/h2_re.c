@@ -0,0 +1,683 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Regular Expression Parser ------------------------------------------------
+ * pattern is parsed into a syntax tree of byte sets for DFA construction
+ */
+
+#define H2_RE_NODE_MAX  4096
+#define H2_RE_NFA_MAX   8192
+
+enum {
+  RE_SET,    /* byte set */
+  RE_EMPTY,
+  RE_CAT,    /* left right */
+  RE_ALT,    /* left | right */
+  RE_STAR,   /* left* */
+  RE_PLUS,   /* left+ */
+  RE_QUEST,  /* left? */
+  RE_REPEAT  /* left{min,max}; max < 0 for unbounded */
+};
+
+typedef struct h2_re_node {
+  int type;
+  int left, right;
+  int min, max;
+  uint8_t set[32];  /* RE_SET bitmap */
+} h2_re_node;
+
+typedef struct h2_re_parser {
+  const char *pattern;
+  const char *p;
+  h2_re_node *node;
+  int node_num;
+  int node_alloced;
+  int err;
+} h2_re_parser;
+
+static int h2_re_alt(h2_re_parser *rp);
+
+static int h2_re_new_node(h2_re_parser *rp, int type, int left, int right) {
+  if (rp->node_num >= rp->node_alloced) {
+    if (rp->node_alloced >= H2_RE_NODE_MAX) {
+      rp->err = 1;
+      return 0;
+    }
+    rp->node_alloced = (rp->node_alloced)? rp->node_alloced * 2 : 64;
+    rp->node = realloc(rp->node, sizeof(h2_re_node) * rp->node_alloced);
+  }
+  h2_re_node *n = &rp->node[rp->node_num];
+  memset(n, 0, sizeof(h2_re_node));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  return rp->node_num++;
+}
+
+static inline void h2_re_set_add(uint8_t *set, int c) {
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+static inline int h2_re_set_has(const uint8_t *set, int c) {
+  return set[c >> 3] & (1 << (c & 7));
+}
+
+static void h2_re_set_add_class(uint8_t *set, int (*is_class)(int),
+                                int negate) {
+  int c;
+  for (c = 0; c < 256; c++) {
+    if ((is_class(c) != 0) != negate) {
+      h2_re_set_add(set, c);
+    }
+  }
+}
+
+static int h2_re_is_word(int c) {
+  return isalnum(c) || c == '_';
+}
+
+/* escape after '\'; adds to set and returns 0, or -1 for a single byte */
+static int h2_re_escape(h2_re_parser *rp, uint8_t *set, int *byte_ret) {
+  int c = (unsigned char)*rp->p++;
+  switch (c) {
+  case 'd': h2_re_set_add_class(set, isdigit, 0); return 0;
+  case 'D': h2_re_set_add_class(set, isdigit, 1); return 0;
+  case 'w': h2_re_set_add_class(set, h2_re_is_word, 0); return 0;
+  case 'W': h2_re_set_add_class(set, h2_re_is_word, 1); return 0;
+  case 's': h2_re_set_add_class(set, isspace, 0); return 0;
+  case 'S': h2_re_set_add_class(set, isspace, 1); return 0;
+  case 'n': *byte_ret = '\n'; return -1;
+  case 'r': *byte_ret = '\r'; return -1;
+  case 't': *byte_ret = '\t'; return -1;
+  case '\0': rp->p--; rp->err = 1; return 0;
+  default: *byte_ret = c; return -1;
+  }
+}
+
+static int h2_re_class(h2_re_parser *rp) {
+  int node = h2_re_new_node(rp, RE_SET, -1, -1);
+  uint8_t set[32];
+  int i, negate = 0, c, c2;
+
+  memset(set, 0, sizeof(set));
+  if (*rp->p == '^') {
+    negate = 1;
+    rp->p++;
+  }
+  if (*rp->p == ']') {
+    h2_re_set_add(set, ']');  /* literal at first */
+    rp->p++;
+  }
+  while (*rp->p && *rp->p != ']') {
+    c = (unsigned char)*rp->p++;
+    if (c == '\\' && h2_re_escape(rp, set, &c) == 0) {
+      continue;
+    }
+    if (rp->p[0] == '-' && rp->p[1] && rp->p[1] != ']') {
+      rp->p++;
+      c2 = (unsigned char)*rp->p++;
+      if (c2 == '\\' && h2_re_escape(rp, set, &c2) == 0) {
+        rp->err = 1;  /* class escape as range end */
+        return node;
+      }
+      for ( ; c <= c2; c++) {
+        h2_re_set_add(set, c);
+      }
+    } else {
+      h2_re_set_add(set, c);
+    }
+  }
+  if (*rp->p != ']') {
+    rp->err = 1;
+    return node;
+  }
+  rp->p++;
+  for (i = 0; i < 32; i++) {
+    rp->node[node].set[i] = (negate)? ~set[i] : set[i];
+  }
+  return node;
+}
+
+static int h2_re_atom(h2_re_parser *rp) {
+  int node, c;
+
+  switch (*rp->p) {
+  case '(':
+    rp->p++;
+    if (rp->p[0] == '?' && rp->p[1] == ':') {
+      rp->p += 2;  /* non-capturing group is same as group */
+    }
+    node = h2_re_alt(rp);
+    if (*rp->p != ')') {
+      rp->err = 1;
+      return node;
+    }
+    rp->p++;
+    return node;
+  case '[':
+    rp->p++;
+    return h2_re_class(rp);
+  case '.':
+    rp->p++;
+    node = h2_re_new_node(rp, RE_SET, -1, -1);
+    memset(rp->node[node].set, 0xff, 32);
+    rp->node[node].set['\n' >> 3] &= ~(1 << ('\n' & 7));
+    return node;
+  case '*': case '+': case '?': case '{': case ')': case '|':
+  case '^': case '$':  /* anchors are only at the both ends */
+    rp->err = 1;
+    return 0;
+  }
+  node = h2_re_new_node(rp, RE_SET, -1, -1);
+  c = (unsigned char)*rp->p++;
+  if (c == '\\' && h2_re_escape(rp, rp->node[node].set, &c) == 0) {
+    return node;
+  }
+  h2_re_set_add(rp->node[node].set, c);
+  return node;
+}
+
+static int h2_re_repeat(h2_re_parser *rp) {
+  int node = h2_re_atom(rp), min, max;
+  char *end;
+
+  while (!rp->err) {
+    switch (*rp->p) {
+    case '*':
+      node = h2_re_new_node(rp, RE_STAR, node, -1);
+      break;
+    case '+':
+      node = h2_re_new_node(rp, RE_PLUS, node, -1);
+      break;
+    case '?':
+      node = h2_re_new_node(rp, RE_QUEST, node, -1);
+      break;
+    case '{':
+      min = strtol(rp->p + 1, &end, 10);
+      if (end == rp->p + 1 || min < 0 || min > 255) {
+        rp->err = 1;
+        return node;
+      }
+      max = min;
+      if (*end == ',') {
+        if (end[1] == '}') {
+          max = -1;
+          end++;
+        } else {
+          max = strtol(end + 1, &end, 10);
+        }
+      }
+      if (*end != '}' || (max >= 0 && (max < min || max > 255))) {
+        rp->err = 1;
+        return node;
+      }
+      rp->p = end;
+      node = h2_re_new_node(rp, RE_REPEAT, node, -1);
+      rp->node[node].min = min;
+      rp->node[node].max = max;
+      break;
+    default:
+      return node;
+    }
+    rp->p++;
+  }
+  return node;
+}
+
+static int h2_re_cat(h2_re_parser *rp) {
+  int node = -1, right;
+
+  while (!rp->err && *rp->p && *rp->p != '|' && *rp->p != ')') {
+    if (rp->p[0] == '$' && rp->p[1] == '\0') {
+      break;  /* end anchor */
+    }
+    right = h2_re_repeat(rp);
+    node = (node < 0)? right : h2_re_new_node(rp, RE_CAT, node, right);
+  }
+  return (node < 0)? h2_re_new_node(rp, RE_EMPTY, -1, -1) : node;
+}
+
+static int h2_re_alt(h2_re_parser *rp) {
+  int node = h2_re_cat(rp);
+
+  while (!rp->err && *rp->p == '|') {
+    rp->p++;
+    node = h2_re_new_node(rp, RE_ALT, node, h2_re_cat(rp));
+  }
+  return node;
+}
+
+
+/*
+ * NFA and DFA Construction -------------------------------------------------
+ * Thompson NFA from the syntax tree and subset construction over byte
+ * equivalence classes; the DFA is the only thing kept for matching
+ */
+
+typedef struct h2_re_nfa_state {
+  int set_node;     /* RE_SET node index for byte transition; -1 if epsilon */
+  int out0, out1;   /* -1 for none */
+} h2_re_nfa_state;
+
+typedef struct h2_re_nfa {
+  h2_re_parser *rp;
+  h2_re_nfa_state *st;
+  int st_num;
+  int err;
+} h2_re_nfa;
+
+typedef struct {
+  int start, end;   /* end is epsilon state without out */
+} h2_re_frag;
+
+static int h2_re_nfa_new(h2_re_nfa *nfa, int set_node) {
+  if (nfa->st_num >= H2_RE_NFA_MAX) {
+    nfa->err = 1;
+    return 0;
+  }
+  h2_re_nfa_state *s = &nfa->st[nfa->st_num];
+  s->set_node = set_node;
+  s->out0 = s->out1 = -1;
+  return nfa->st_num++;
+}
+
+static h2_re_frag h2_re_emit(h2_re_nfa *nfa, int node_idx) {
+  h2_re_node *node = &nfa->rp->node[node_idx];
+  h2_re_frag f, a, b;
+  int i;
+
+  if (nfa->err) {
+    f.start = f.end = 0;
+    return f;
+  }
+  switch (node->type) {
+  case RE_SET:
+    f.start = h2_re_nfa_new(nfa, node_idx);
+    f.end = h2_re_nfa_new(nfa, -1);
+    nfa->st[f.start].out0 = f.end;
+    break;
+  case RE_EMPTY:
+  default:
+    f.start = f.end = h2_re_nfa_new(nfa, -1);
+    break;
+  case RE_CAT:
+    a = h2_re_emit(nfa, node->left);
+    b = h2_re_emit(nfa, node->right);
+    nfa->st[a.end].out0 = b.start;
+    f.start = a.start;
+    f.end = b.end;
+    break;
+  case RE_ALT:
+    f.start = h2_re_nfa_new(nfa, -1);
+    f.end = h2_re_nfa_new(nfa, -1);
+    a = h2_re_emit(nfa, node->left);
+    b = h2_re_emit(nfa, node->right);
+    nfa->st[f.start].out0 = a.start;
+    nfa->st[f.start].out1 = b.start;
+    nfa->st[a.end].out0 = f.end;
+    nfa->st[b.end].out0 = f.end;
+    break;
+  case RE_STAR:
+  case RE_QUEST:
+    f.start = h2_re_nfa_new(nfa, -1);
+    f.end = h2_re_nfa_new(nfa, -1);
+    a = h2_re_emit(nfa, node->left);
+    nfa->st[f.start].out0 = a.start;
+    nfa->st[f.start].out1 = f.end;
+    nfa->st[a.end].out0 = (node->type == RE_STAR)? f.start : f.end;
+    break;
+  case RE_PLUS:
+    a = h2_re_emit(nfa, node->left);
+    f.start = a.start;
+    f.end = h2_re_nfa_new(nfa, -1);
+    nfa->st[a.end].out0 = a.start;
+    nfa->st[a.end].out1 = f.end;
+    break;
+  case RE_REPEAT:
+    /* expanded as min copies and (max - min) optional copies */
+    f.start = f.end = h2_re_nfa_new(nfa, -1);
+    for (i = 0; i < node->max || (node->max < 0 && i <= node->min); i++) {
+      if (i < node->min) {
+        a = h2_re_emit(nfa, node->left);
+      } else {
+        a.start = h2_re_nfa_new(nfa, -1);
+        a.end = h2_re_nfa_new(nfa, -1);
+        b = h2_re_emit(nfa, node->left);
+        nfa->st[a.start].out0 = b.start;
+        nfa->st[a.start].out1 = a.end;
+        nfa->st[b.end].out0 = (node->max < 0)? a.start : a.end;
+      }
+      if (nfa->err) {
+        break;
+      }
+      nfa->st[f.end].out0 = a.start;
+      f.end = a.end;
+    }
+    break;
+  }
+  return f;
+}
+
+#define H2_RE_DFA_MAX   4096  /* DFA states including dead state 0 */
+
+struct h2_re {
+  char *str;          /* original pattern */
+  int anchor_end;     /* '$' at the end; else first accept is the match */
+  int cls_num;
+  uint8_t cls[256];   /* byte to equivalence class */
+  int state_num;
+  int start;
+  int16_t *next;      /* [state_num][cls_num]; 0:dead */
+                      /* <0:accept on !anchor_end, -(state) on anchor_end */
+  uint8_t *accept;    /* [state_num] */
+};
+
+typedef struct h2_re_dfa_build {
+  h2_re_nfa *nfa;
+  int words;          /* uint64_t words per NFA state set */
+  uint64_t *sets;     /* [H2_RE_DFA_MAX][words] */
+  int set_num;
+  int *hash_tbl;      /* set index + 1; 0 for empty slot */
+  int hash_size;
+  int *stack;
+} h2_re_dfa_build;
+
+static void h2_re_closure(h2_re_dfa_build *db, uint64_t *set) {
+  h2_re_nfa_state *st = db->nfa->st;
+  uint64_t m;
+  int w, sp = 0, s;
+
+  for (w = 0; w < db->words; w++) {
+    for (m = set[w]; m; m &= m - 1) {
+      db->stack[sp++] = w * 64 + __builtin_ctzll(m);
+    }
+  }
+  while (sp > 0) {
+    s = db->stack[--sp];
+    if (st[s].set_node >= 0) {
+      continue;
+    }
+    if (st[s].out0 >= 0 && !(set[st[s].out0 >> 6] & (1ULL << (st[s].out0 & 63)))) {
+      set[st[s].out0 >> 6] |= 1ULL << (st[s].out0 & 63);
+      db->stack[sp++] = st[s].out0;
+    }
+    if (st[s].out1 >= 0 && !(set[st[s].out1 >> 6] & (1ULL << (st[s].out1 & 63)))) {
+      set[st[s].out1 >> 6] |= 1ULL << (st[s].out1 & 63);
+      db->stack[sp++] = st[s].out1;
+    }
+  }
+}
+
+/* returns DFA state of the NFA state set; new one is added if not found */
+static int h2_re_dfa_state(h2_re_dfa_build *db, const uint64_t *set) {
+  uint64_t h = 14695981039346656037ULL;
+  int i, slot;
+
+  for (i = 0; i < db->words; i++) {
+    h = (h ^ set[i]) * 1099511628211ULL;
+  }
+  for (slot = h & (db->hash_size - 1); db->hash_tbl[slot];
+       slot = (slot + 1) & (db->hash_size - 1)) {
+    i = db->hash_tbl[slot] - 1;
+    if (!memcmp(&db->sets[(size_t)i * db->words], set,
+                sizeof(uint64_t) * db->words)) {
+      return i;
+    }
+  }
+  if (db->set_num >= H2_RE_DFA_MAX) {
+    return -1;
+  }
+  i = db->set_num++;
+  memcpy(&db->sets[(size_t)i * db->words], set, sizeof(uint64_t) * db->words);
+  db->hash_tbl[slot] = i + 1;
+  return i;
+}
+
+/* byte equivalence classes by refining with every byte set in the tree */
+static void h2_re_byte_class(h2_re *re, h2_re_parser *rp) {
+  int split[256][2];
+  int i, c, k, n;
+
+  memset(re->cls, 0, sizeof(re->cls));
+  re->cls_num = 1;
+  for (i = 0; i < rp->node_num; i++) {
+    if (rp->node[i].type != RE_SET) {
+      continue;
+    }
+    memset(split, -1, sizeof(split));
+    n = 0;
+    for (c = 0; c < 256; c++) {
+      k = (h2_re_set_has(rp->node[i].set, c) != 0);
+      if (split[re->cls[c]][k] < 0) {
+        split[re->cls[c]][k] = n++;
+      }
+      re->cls[c] = split[re->cls[c]][k];
+    }
+    re->cls_num = n;
+  }
+}
+
+static int h2_re_build_dfa(h2_re *re, h2_re_nfa *nfa, int accept_st) {
+  h2_re_dfa_build db;
+  int rep[256];  /* representative byte of each class */
+  int i, w, c, s, d, alloced = 64, r = -1;
+  uint64_t *set, m;
+
+  memset(&db, 0, sizeof(db));
+  db.nfa = nfa;
+  db.words = (nfa->st_num + 63) / 64;
+  db.hash_size = H2_RE_DFA_MAX * 2;
+  db.sets = calloc((size_t)H2_RE_DFA_MAX * db.words, sizeof(uint64_t));
+  db.hash_tbl = calloc(db.hash_size, sizeof(int));
+  db.stack = malloc(sizeof(int) * nfa->st_num);
+  set = malloc(sizeof(uint64_t) * db.words);
+  re->next = malloc(sizeof(int16_t) * alloced * re->cls_num);
+  re->accept = malloc(alloced);
+
+  for (c = 255; c >= 0; c--) {
+    rep[re->cls[c]] = c;
+  }
+
+  /* state 0: dead, state 1: start */
+  memset(set, 0, sizeof(uint64_t) * db.words);
+  h2_re_dfa_state(&db, set);
+  set[0] |= 1;  /* NFA start is state 0 */
+  h2_re_closure(&db, set);
+  re->start = h2_re_dfa_state(&db, set);
+
+  for (s = 0; s < db.set_num; s++) {
+    if (s >= alloced) {
+      alloced *= 2;
+      re->next = realloc(re->next, sizeof(int16_t) * alloced * re->cls_num);
+      re->accept = realloc(re->accept, alloced);
+    }
+    const uint64_t *cur = &db.sets[(size_t)s * db.words];
+    re->accept[s] = (cur[accept_st >> 6] >> (accept_st & 63)) & 1;
+    for (c = 0; c < re->cls_num; c++) {
+      memset(set, 0, sizeof(uint64_t) * db.words);
+      for (w = 0; w < db.words; w++) {
+        for (m = cur[w]; m; m &= m - 1) {
+          i = w * 64 + __builtin_ctzll(m);
+          if (nfa->st[i].set_node >= 0 &&
+              h2_re_set_has(nfa->rp->node[nfa->st[i].set_node].set, rep[c])) {
+            set[nfa->st[i].out0 >> 6] |= 1ULL << (nfa->st[i].out0 & 63);
+          }
+        }
+      }
+      h2_re_closure(&db, set);
+      if ((d = h2_re_dfa_state(&db, set)) < 0) {
+        break;
+      }
+      re->next[s * re->cls_num + c] = d;
+    }
+    if (c < re->cls_num) {
+      break;
+    }
+  }
+  re->state_num = db.set_num;
+
+  if (s < db.set_num) {
+    warnx("too many regex dfa states; max=%d: %s", H2_RE_DFA_MAX, re->str);
+  } else {
+    /* mark transitions to accept states to be checked in the match loop */
+    for (s = 0; s < re->state_num; s++) {
+      for (c = 0; c < re->cls_num; c++) {
+        d = re->next[s * re->cls_num + c];
+        if (d > 0 && re->accept[d]) {
+          re->next[s * re->cls_num + c] = (re->anchor_end)? -d : -1;
+        }
+      }
+    }
+    r = 0;
+  }
+
+  free(set);
+  free(db.stack);
+  free(db.hash_tbl);
+  free(db.sets);
+  return r;
+}
+
+
+/*
+ * Regular Expression API ---------------------------------------------------
+ */
+
+h2_re *h2_re_compile(const char *pattern) {
+  h2_re_parser rp;
+  h2_re_nfa nfa;
+  h2_re_frag f;
+  h2_re *re;
+  int root, len;
+
+  if (pattern == NULL) {
+    return NULL;
+  }
+  re = calloc(1, sizeof(h2_re));
+  re->str = strdup(pattern);
+  len = strlen(pattern);
+
+  memset(&rp, 0, sizeof(rp));
+  rp.pattern = pattern;
+  rp.p = pattern;
+  if (*rp.p == '^') {
+    rp.p++;
+    root = h2_re_alt(&rp);
+  } else {
+    /* unanchored start as ".*" prefix; any byte including '\n' */
+    int any = h2_re_new_node(&rp, RE_SET, -1, -1);
+    memset(rp.node[any].set, 0xff, 32);
+    any = h2_re_new_node(&rp, RE_STAR, any, -1);
+    root = h2_re_new_node(&rp, RE_CAT, any, h2_re_alt(&rp));
+  }
+  if (!rp.err && rp.p[0] == '$' && rp.p[1] == '\0' && len >= 1) {
+    re->anchor_end = 1;
+    rp.p++;
+  }
+  if (rp.err || *rp.p != '\0') {
+    warnx("invalid or unsupported regex at %d: %s",
+          (int)(rp.p - pattern), pattern);
+    free(rp.node);
+    h2_re_free(re);
+    return NULL;
+  }
+
+  h2_re_byte_class(re, &rp);
+
+  memset(&nfa, 0, sizeof(nfa));
+  nfa.rp = &rp;
+  nfa.st = malloc(sizeof(h2_re_nfa_state) * H2_RE_NFA_MAX);
+  h2_re_nfa_new(&nfa, -1);  /* NFA start state 0 */
+  f = h2_re_emit(&nfa, root);
+  nfa.st[0].out0 = f.start;
+  if (nfa.err) {
+    warnx("too complex regex; nfa max=%d: %s", H2_RE_NFA_MAX, pattern);
+  }
+  if (nfa.err || h2_re_build_dfa(re, &nfa, f.end) < 0) {
+    free(nfa.st);
+    free(rp.node);
+    h2_re_free(re);
+    return NULL;
+  }
+  free(nfa.st);
+  free(rp.node);
+  return re;
+}
+
+void h2_re_free(h2_re *re) {
+  if (re) {
+    free(re->str);
+    free(re->next);
+    free(re->accept);
+    free(re);
+  }
+}
+
+const char *h2_re_str(h2_re *re) {
+  return re->str;
+}
+
+int h2_re_state_num(h2_re *re) {
+  return re->state_num;
+}
+
+int h2_re_match(const h2_re *re, const char *str, int len) {
+  const uint8_t *p = (const uint8_t *)str, *e;
+  const int16_t *next = re->next;
+  int cls_num = re->cls_num;
+  int s = re->start;
+
+  if (len < 0) {
+    len = strlen(str);
+  }
+  if (re->accept[s] && !re->anchor_end) {
+    return 1;  /* matches empty prefix */
+  }
+  for (e = p + len; p < e; p++) {
+    s = next[s * cls_num + re->cls[*p]];
+    if (s <= 0) {
+      if (s == 0) {
+        return 0;  /* dead */
+      }
+      if (!re->anchor_end) {
+        return 1;  /* first accept */
+      }
+      s = -s;
+    }
+  }
+  return re->accept[s];
+}
@@ -0,0 +1,188 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#include "h2.h"
+
+
+/*
+ * Per Request Result Log ---------------------------------------------------
+ * file is a header followed by fixed size records in host byte order;
+ * records are copied into the buffered writer not to block the event loop
+ */
+
+#define H2_RLOG_MAGIC     "H2RLOG01"
+#define H2_RLOG_BUF_SIZE  (4 * 1024 * 1024)
+#define H2_RLOG_BUF_NUM   8
+
+typedef struct h2_rlog_hdr {
+  char magic[8];
+  int64_t start_time_usec;  /* wall clock time of send_usec 0 */
+  int32_t rec_size;         /* sizeof(h2_rlog_rec) of the writer */
+  int32_t reserved;
+} h2_rlog_hdr;
+
+struct h2_rlog {
+  /* write */
+  h2_bwr *bwr;
+  long long start_usec;
+
+  /* read */
+  char *map;
+  size_t map_size;
+  long long rec_num;
+  long long start_time_usec;
+};
+
+
+h2_rlog *h2_rlog_open(const char *file) {
+  h2_rlog *rlog;
+  h2_rlog_hdr hdr;
+  struct timespec ts;
+
+  if ((rlog = calloc(1, sizeof(*rlog))) == NULL) {
+    warnx("cannot allocate result log");
+    return NULL;
+  }
+  rlog->bwr = h2_bwr_open(file, H2_RLOG_BUF_SIZE, H2_RLOG_BUF_NUM);
+  if (rlog->bwr == NULL) {
+    free(rlog);
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, H2_RLOG_MAGIC, sizeof(hdr.magic));
+  hdr.start_time_usec = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  hdr.rec_size = sizeof(h2_rlog_rec);
+  h2_bwr_write(rlog->bwr, &hdr, sizeof(hdr));
+  rlog->start_usec = h2_time_usec();
+  rlog->start_time_usec = hdr.start_time_usec;
+  return rlog;
+}
+
+long long h2_rlog_start_usec(h2_rlog *rlog) {
+  return rlog->start_usec;
+}
+
+int h2_rlog_write(h2_rlog *rlog, const h2_rlog_rec *rec) {
+  return h2_bwr_write(rlog->bwr, rec, sizeof(*rec));
+}
+
+void h2_rlog_flush(h2_rlog *rlog) {
+  if (rlog->bwr) {
+    h2_bwr_flush(rlog->bwr);
+  }
+}
+
+h2_rlog *h2_rlog_map(const char *file) {
+  h2_rlog *rlog;
+  const h2_rlog_hdr *hdr;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+    warnx("cannot open result log: %s: %s", file, strerror(errno));
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(h2_rlog_hdr)) {
+    warnx("invalid result log: %s", file);
+    close(fd);
+    return NULL;
+  }
+  if ((rlog = calloc(1, sizeof(*rlog))) == NULL) {
+    warnx("cannot allocate result log");
+    close(fd);
+    return NULL;
+  }
+  rlog->map_size = st.st_size;
+  rlog->map = mmap(NULL, rlog->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (rlog->map == MAP_FAILED) {
+    warnx("cannot mmap result log: %s: %s", file, strerror(errno));
+    free(rlog);
+    return NULL;
+  }
+  hdr = (const h2_rlog_hdr *)rlog->map;
+  if (memcmp(hdr->magic, H2_RLOG_MAGIC, 8) ||
+      hdr->rec_size != sizeof(h2_rlog_rec)) {
+    warnx("not a result log of this arch: %s", file);
+    h2_rlog_close(rlog, NULL);
+    return NULL;
+  }
+  rlog->start_time_usec = hdr->start_time_usec;
+  rlog->rec_num = (rlog->map_size - sizeof(*hdr)) / sizeof(h2_rlog_rec);
+  if (sizeof(*hdr) + rlog->rec_num * sizeof(h2_rlog_rec) != rlog->map_size) {
+    warnx("result log truncated: %s; %lld records are used",
+          file, rlog->rec_num);
+  }
+  madvise(rlog->map, rlog->map_size, MADV_SEQUENTIAL);
+  return rlog;
+}
+
+long long h2_rlog_rec_num(h2_rlog *rlog) {
+  return rlog->rec_num;
+}
+
+const h2_rlog_rec *h2_rlog_recs(h2_rlog *rlog) {
+  return (const h2_rlog_rec *)(rlog->map + sizeof(h2_rlog_hdr));
+}
+
+long long h2_rlog_start_time_usec(h2_rlog *rlog) {
+  return rlog->start_time_usec;
+}
+
+void h2_rlog_close(h2_rlog *rlog, FILE *stat_fp) {
+  long long rec_num, drop_rec_num, written_bytes;
+
+  if (rlog == NULL) {
+    return;
+  }
+  if (rlog->bwr) {
+    h2_bwr_stat(rlog->bwr, &rec_num, &drop_rec_num, NULL);
+    written_bytes = h2_bwr_close(rlog->bwr);
+    if (stat_fp) {
+      fprintf(stat_fp, "RESULT LOG: records=%lld dropped=%lld bytes=%lld\n",
+              rec_num - 1/* file header */, drop_rec_num, written_bytes);
+    }
+  }
+  if (rlog->map) {
+    munmap(rlog->map, rlog->map_size);
+  }
+  free(rlog);
+}
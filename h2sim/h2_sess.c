@@ -51,6 +51,7 @@ h2_cls h2_cls_sess = { { &h2_cls_cls }, "h2_cls_sess" };
 h2_cls h2_cls_peer = { { &h2_cls_cls }, "h2_cls_peer" };
 h2_cls h2_cls_svr  = { { &h2_cls_cls }, "h2_cls_svr"  };
 h2_cls h2_cls_ctx  = { { &h2_cls_cls }, "h2_cls_ctx"  };
+h2_cls h2_cls_bal  = { { &h2_cls_cls }, "h2_cls_bal"  };
 
 
 /*
@@ -65,13 +66,14 @@ h2_strm *h2_strm_init(h2_sess *sess, int stream_id, int recv_msg_type,
 
   /* append to session's stream list */
 #if 1
-  h2_strm *st = &sess->strm_list_head;
-  while (st->next) {
-    st = st->next;
-  }
+  h2_strm *st = (sess->strm_list_tail)? sess->strm_list_tail :
+                                        &sess->strm_list_head;
   strm->next = NULL;
   st->next = strm;
   strm->prev = st;
+  sess->strm_list_tail = strm;
+  sess->strm_num++;
+  strm->sess = sess;
 #else
   strm->next = sess->strm_list_head.next;
   sess->strm_list_head.next = strm;
@@ -90,24 +92,73 @@ h2_strm *h2_strm_init(h2_sess *sess, int stream_id, int recv_msg_type,
   case H2_PUSH_RESPONSE: strm->send_msg_type = H2_PUSH_RESPONSE; break;
        /* special handling on PUSH_PROMISE/RESPONSE */
   }
-  strm->rmsg = h2_msg_init();
+  strm->rmsg = NULL;  /* lazy alloc by h2_strm_rmsg() */
 
   strm->response_cb = response_cb;
   strm->user_data = strm_user_data;
   return strm;
 }
 
+static void h2_strm_done(h2_strm *strm) {
+  h2_sess *sess = strm->sess;
+  h2_strm_result result;
+
+  result.status = strm->rsp_status;
+  result.is_done = strm->is_rsp_done;
+  result.is_rejected = strm->is_admit_shed || strm->is_admit_queued;
+  result.req_body_len = (strm->rmsg)? h2_body_len(strm->rmsg) : 0;
+  result.rsp_body_len = strm->rsp_body_len;
+  result.latency_usec = h2_time_usec() - strm->recv_usec;
+  H2_PROF_PHASE(H2_PROF_APP,
+                sess->ctx->strm_done_cb(sess, strm, sess->user_data,
+                                        strm->user_data, &result));
+}
+
 void h2_strm_free(h2_strm *strm) {
 
+  /* report server stream result before its states are cleared */
+  if (strm->recv_usec > 0 && strm->sess->ctx->strm_done_cb) {
+    h2_strm_done(strm);
+  }
+
   /* free user_data */
   strm->response_cb = NULL;
   strm->user_data = NULL;
 
+  /* remove from session's data send scheduling list */
+  if (strm->is_data_sched) {
+    h2_data_sched_del_v2(strm);
+  }
+
+  /* remove from admission lane not handled yet */
+  if (strm->is_admit_queued) {
+    h2_admit_del(strm);
+  }
+
+  /* drop delayed response not sent yet */
+  if (strm->delayed_timer) {
+    h2_timer_del(strm->sess->ctx, strm->delayed_timer);
+    strm->delayed_timer = NULL;
+  }
+  if (strm->delayed_rsp) {
+    h2_msg_free(strm->delayed_rsp);
+    strm->delayed_rsp = NULL;
+  }
+
   /* remove from session's stream list */
   strm->prev->next = strm->next;
   if (strm->next) {
     strm->next->prev = strm->prev;
   }
+  if (strm->sess) {
+    if (strm->sess->strm_list_tail == strm) {
+      h2_sess *sess = strm->sess;
+      sess->strm_list_tail = (strm->prev == &sess->strm_list_head)?
+                             NULL : strm->prev;
+    }
+    strm->sess->strm_num--;
+    strm->sess = NULL;
+  }
 
   /* clean and dealloc stream data */
   if (strm->rmsg) {
@@ -117,6 +168,11 @@ void h2_strm_free(h2_strm *strm) {
   if (strm->send_body_sb.to_be_freed) {
     free(strm->send_body_sb.data);
   }
+  free(strm->send_body_sb.iov);
+  if (strm->retry_req) {
+    h2_msg_free(strm->retry_req);
+    strm->retry_req = NULL;
+  }
   strm->stream_id = 0;  /* to check invalidattion */
 
   // HERE: TOOD: here goes the application logic: deallocate user_data
@@ -124,13 +180,70 @@ void h2_strm_free(h2_strm *strm) {
   free(strm);
 }
 
+void h2_strm_set_user_data(h2_strm *strm, void *strm_user_data) {
+  if (strm && !strm->is_req) {
+    strm->user_data = strm_user_data;
+  }
+}
+
+h2_msg *h2_strm_rmsg(h2_strm *strm) {
+  if (strm->rmsg == NULL) {
+    strm->rmsg = h2_msg_init();
+  }
+  return strm->rmsg;
+}
+
+void h2_strm_keep_req(h2_strm *strm, h2_msg *req, int retry_cnt) {
+  h2_sess *sess = strm->sess;
+  if (sess->peer && retry_cnt < sess->settings.retry_unprocessed) {
+    strm->retry_req = h2_msg_init();
+    h2_cpy_msg(strm->retry_req, req);
+    strm->retry_cnt = retry_cnt;
+  }
+}
+
+/* hand over request not processed by server to peer lanes to be sent */
+/* again on the other session; returns 1 if handed over, else 0 */
+static int h2_strm_retry(h2_sess *sess, h2_strm *strm) {
+  h2_peer *peer = sess->peer;
+  if (!strm->is_req || strm->is_rsp_set || strm->retry_req == NULL ||
+      peer == NULL || peer->is_terminated) {
+    return 0;
+  }
+  if (peer->is_no_more_req) {
+    peer->is_term_pending = 1;  /* h2_terminate() after sent again */
+  }
+  if (sess->ctx->verbose) {
+    warnx("%s[%d] REQUEST NOT PROCESSED; SEND AGAIN(%d)",
+          sess->log_prefix, strm->stream_id, strm->retry_cnt + 1);
+  }
+  if (strm->send_body_sb.data &&
+      strm->send_body_sb.data == strm->retry_req->body) {
+    /* body still referenced by send buf till stream closed */
+    h2_msg *req = h2_msg_init();
+    h2_cpy_msg(req, strm->retry_req);
+    h2_prio_requeue(peer, req, strm->retry_cnt + 1,
+                    strm->response_cb, strm->user_data);
+  } else {
+    h2_prio_requeue(peer, strm->retry_req, strm->retry_cnt + 1,
+                    strm->response_cb, strm->user_data);
+    strm->retry_req = NULL;
+  }
+  strm->response_cb = NULL;
+  strm->user_data = NULL;
+  strm->is_rsp_set = 1;  /* response is for the new stream */
+  sess->req_retry_cnt++;
+  sess->rsp_cnt++;  /* for req-rsp count matching */
+  return 1;
+}
+
 
 /*
  * Client Messaging APIs ---------------------------------------------------
  */
 
 /* Send HTTP request to the remote peer */
-static int h2_sess_send_request(h2_sess *sess, h2_msg *req,
+int h2_sess_send_request(h2_sess *sess, h2_msg *req, int retry_cnt,
                          h2_response_cb response_cb, void *strm_user_data) {
   if (sess->is_server) {
     warnx("%scannot send request for sess is not client sess\n",
@@ -143,24 +256,29 @@ static int h2_sess_send_request(h2_sess *sess, h2_msg *req,
   }
 
   if (sess->http_ver == H2_HTTP_V2) {
-    return h2_send_request_v2(sess, req, response_cb, strm_user_data);
+    return h2_send_request_v2(sess, req, retry_cnt,
+                              response_cb, strm_user_data);
   } else {
-    return h2_send_request_v1_1(sess, req, response_cb, strm_user_data);
+    return h2_send_request_v1_1(sess, req, retry_cnt,
+                                response_cb, strm_user_data);
   }
 }
 
-/* h2 client application api for request on peer with sess load balancing */
-int h2_send_request(h2_peer *peer, h2_msg *req,
-                    h2_response_cb response_cb, void *strm_user_data) {
-  h2_sess *sess = NULL;
-  int i, r, n = peer->settings.sess_num, nsi = peer->next_sess_idx;
+/* request streams to be accepted by the session; <= 0 if full */
+int h2_sess_strm_room(h2_sess *sess) {
+  int max_strm = (sess->http_ver == H2_HTTP_V2)?
+                 h2_sess_remote_max_strm_v2(sess) : 1/* no pipelining */;
+  return max_strm - (int)(sess->req_cnt - sess->rsp_cnt);
+}
 
-  if (peer->is_terminated || peer->is_no_more_req) {
-    warnx("cannot send request for peer is terminated: %s\n", peer->authority);
-    return -1;
-  }
+/* active session with the most stream room for load balancing */
+h2_sess *h2_peer_pick_sess(h2_peer *peer) {
+  h2_sess *sess = NULL, *room_sess = NULL;
+  int i, n = peer->settings.sess_num, nsi = peer->next_sess_idx;
+  int room, room_max = 0, room_si = nsi;
 
-  /* find active session with round-robin load balancing */
+  /* find active session with the most room for remote max concurrent */
+  /* streams; round-robin among the same room sessions */
   for (i = 0; i < n; i++) {
     int si = (nsi + i) % n;
     if ((sess = peer->sess[si]) && peer->act_sess[si])  {
@@ -177,19 +295,57 @@ int h2_send_request(h2_peer *peer, h2_msg *req,
         h2_sess_terminate(sess, 1/* wait_rsp */);
         sess = NULL;  /* try other sess */
       } else {
-        /* use this session */
-        break;
+        room = h2_sess_strm_room(sess);
+        if (room_sess == NULL || room > room_max) {
+          room_sess = sess;
+          room_max = room;
+          room_si = si;
+        }
+        sess = NULL;
       }
     }
   }
-  peer->next_sess_idx = (nsi + i + 1) % n;  /* advances even no valid sess */
+  peer->next_sess_idx = (room_si + 1) % n;  /* advances even no valid sess */
+  return room_sess;
+}
+
+/* h2 client application api for request on peer with sess load balancing */
+static int h2_send_request_on_peer(h2_peer *peer, h2_msg *req,
+                                   h2_response_cb response_cb,
+                                   void *strm_user_data) {
+  h2_sess *sess;
+  int r;
+
+  if (peer->is_terminated || peer->is_no_more_req) {
+    warnx("cannot send request for peer is terminated: %s\n", peer->authority);
+    return -1;
+  }
+
+  sess = h2_peer_pick_sess(peer);
+
+  /* wait in priority lane behind the others or for stream room; */
+  /* lanes may have requests to be sent again even prio_sched is off */
+  if (sess && (peer->lane_num > 0 ||
+               (peer->settings.prio_sched != H2_PRIO_SCHED_OFF &&
+                h2_sess_strm_room(sess) <= 0))) {
+    return h2_prio_enqueue(peer, req, response_cb, strm_user_data);
+  }
 
   if (sess == NULL) {
     /* TODO: try to connect server */
   }
 
+  /* wait in lane while sessions are draining or reconnecting */
+  if (sess == NULL && peer->settings.retry_unprocessed > 0) {
+    int i;
+    for (i = 0; i < peer->settings.sess_num && peer->sess[i] == NULL; i++);
+    if (i < peer->settings.sess_num) {
+      return h2_prio_enqueue(peer, req, response_cb, strm_user_data);
+    }
+  }
+
   if (sess) {
-    r = h2_sess_send_request(sess, req, response_cb, strm_user_data);
+    r = h2_sess_send_request(sess, req, 0, response_cb, strm_user_data);
   } else {
     warnx("no session available to peer: %s", peer->authority);
     r = -1;
@@ -203,10 +359,17 @@ int h2_send_request(h2_peer *peer, h2_msg *req,
   return r;
 }
 
+int h2_send_request(h2_peer *peer, h2_msg *req,
+                    h2_response_cb response_cb, void *strm_user_data) {
+  int r;
+  H2_PROF_PHASE(H2_PROF_API,
+                r = h2_send_request_on_peer(peer, req, response_cb,
+                                            strm_user_data));
+  return r;
+}
+
 /* terminalte all sessions on the peer */
 int h2_terminate(h2_peer *peer, int wait_rsp) {
-  int i;
-
   if (peer == NULL || peer->is_terminated) {
     return 1;
   }
@@ -216,8 +379,22 @@ int h2_terminate(h2_peer *peer, int wait_rsp) {
       return 1;
     }
     peer->is_no_more_req = 1;
+    if (peer->lane_num > 0) {
+      peer->is_term_pending = 1;  /* see h2_prio_dispatch() */
+      return 0;
+    }
+  } else {
+    h2_prio_flush(peer);
   }
 
+  h2_peer_terminate_sess(peer, wait_rsp);
+  return 0;
+}
+
+void h2_peer_terminate_sess(h2_peer *peer, int wait_rsp) {
+  int i;
+
+  peer->is_term_pending = 0;
   for (i = 0; i < peer->settings.sess_num; i++) {
     if (peer->act_sess[i]) {
       peer->act_sess[i] = 0;
@@ -225,7 +402,6 @@ int h2_terminate(h2_peer *peer, int wait_rsp) {
     }
     h2_sess_terminate(peer->sess[i], wait_rsp);  /* go ahread even on error */
   }
-  return 0;
 }
 
 
@@ -235,7 +411,8 @@ int h2_terminate(h2_peer *peer, int wait_rsp) {
 
 /* Send HTTP request to the remote peer */
 
-int h2_send_response(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
+static int h2_send_response_on_sess(h2_sess *sess, h2_strm *strm,
+                                    h2_msg *rsp) {
   if (!sess->is_server) {
     warnx("%scannot send response for sess is not server sess\n",
           sess->log_prefix);
@@ -246,11 +423,20 @@ int h2_send_response(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
     return -1;
   }
 
-  if (sess->http_ver == H2_HTTP_V2) {
-    return h2_send_response_v2(sess, strm, rsp);
-  } else {
-    return h2_send_response_v1_1(sess, strm, rsp);
+  int r = (sess->http_ver == H2_HTTP_V2)?
+          h2_send_response_v2(sess, strm, rsp) :
+          h2_send_response_v1_1(sess, strm, rsp);
+  if (r >= 0 && strm->recv_usec > 0) {
+    strm->rsp_status = rsp->status;
+    strm->rsp_body_len = h2_body_len(rsp);
   }
+  return r;
+}
+
+int h2_send_response(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
+  int r;
+  H2_PROF_PHASE(H2_PROF_API, r = h2_send_response_on_sess(sess, strm, rsp));
+  return r;
 }
 
 int h2_send_response_simple(h2_sess *sess, h2_strm *strm, h2_msg *ref_req,
@@ -265,7 +451,7 @@ int h2_send_response_simple(h2_sess *sess, h2_strm *strm, h2_msg *ref_req,
   }
   rsp.status = status;
   rsp.body = body;
-  rsp.body_len = body_len;
+  rsp.body_len = (body)? body_len : 0;
 
   if (h2_send_response(sess, strm, &rsp) < 0) {
     return -1;
@@ -277,8 +463,8 @@ int h2_send_response_simple(h2_sess *sess, h2_strm *strm, h2_msg *ref_req,
   return 0;
 }
 
-int h2_send_push_promise(h2_sess *sess, h2_strm *request_strm,
-                         h2_msg *prm_req, h2_msg *prm_rsp) {
+static int h2_send_push_promise_on_sess(h2_sess *sess, h2_strm *request_strm,
+                                        h2_msg *prm_req, h2_msg *prm_rsp) {
   if (!sess->is_server) {
     warnx("%scannot send request for sess is not server sess\n",
           sess->log_prefix);
@@ -299,26 +485,147 @@ int h2_send_push_promise(h2_sess *sess, h2_strm *request_strm,
   }
 }
 
+int h2_send_push_promise(h2_sess *sess, h2_strm *request_strm,
+                         h2_msg *prm_req, h2_msg *prm_rsp) {
+  int r;
+  H2_PROF_PHASE(H2_PROF_API,
+                r = h2_send_push_promise_on_sess(sess, request_strm,
+                                                 prm_req, prm_rsp));
+  return r;
+}
+
+
+/*
+ * Server Fault Injection APIs ----------------------------------------------
+ */
+
+static const char *h2_err_code_name[] = {
+  "NO_ERROR", "PROTOCOL_ERROR", "INTERNAL_ERROR", "FLOW_CONTROL_ERROR",
+  "SETTINGS_TIMEOUT", "STREAM_CLOSED", "FRAME_SIZE_ERROR", "REFUSED_STREAM",
+  "CANCEL", "COMPRESSION_ERROR", "CONNECT_ERROR", "ENHANCE_YOUR_CALM",
+  "INADEQUATE_SECURITY", "HTTP_1_1_REQUIRED"
+};
+
+int h2_err_code_from_name(const char *name) {
+  int i;
+  if (name == NULL || *name == '\0') {
+    return -1;
+  }
+  if (isdigit(*name)) {
+    char *end;
+    long code = strtol(name, &end, 0);
+    return (*end == '\0' && code <= 0x7fffffff)? (int)code : -1;
+  }
+  for (i = 0; i < (int)(sizeof(h2_err_code_name) / sizeof(char *)); i++) {
+    if (!strcasecmp(name, h2_err_code_name[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int h2_check_rsp_strm(h2_sess *sess, h2_strm *strm) {
+  if (!sess->is_server || sess->is_terminated) {
+    warnx("%scannot send response for sess is not server sess "
+          "or terminated", sess->log_prefix);
+    return -1;
+  }
+  if (strm->is_rsp_set || strm->delayed_rsp) {
+    warnx("%s[%d] response already sent", sess->log_prefix, strm->stream_id);
+    return -1;
+  }
+  return 0;
+}
+
+int h2_reset_stream(h2_sess *sess, h2_strm *strm, int error_code) {
+  if (h2_check_rsp_strm(sess, strm) < 0) {
+    return -1;
+  }
+  if (sess->http_ver == H2_HTTP_V2) {
+    strm->is_rsp_set = 1;  /* no push promise nor response after this */
+    return h2_send_rst_stream_v2(sess, strm, error_code);
+  } else {
+    return h2_sess_abort(sess);
+  }
+}
+
+static void h2_send_response_delayed_cb(h2_ctx *ctx, void *user_data) {
+  h2_strm *strm = user_data;
+  h2_msg *rsp = strm->delayed_rsp;
+  (void)ctx;
+
+  strm->delayed_timer = NULL;  /* freed by caller after return */
+  strm->delayed_rsp = NULL;
+  h2_send_response(strm->sess, strm, rsp);  /* warned on error */
+  h2_msg_free(rsp);
+}
+
+int h2_send_response_delayed(h2_sess *sess, h2_strm *strm, h2_msg *rsp,
+                             long long delay_usec) {
+  if (delay_usec <= 0) {
+    return h2_send_response(sess, strm, rsp);
+  }
+  if (h2_check_rsp_strm(sess, strm) < 0) {
+    return -1;
+  }
+  strm->delayed_rsp = h2_msg_init();
+  h2_cpy_msg(strm->delayed_rsp, rsp);
+  strm->delayed_timer = h2_timer_add(sess->ctx, delay_usec,
+                                     h2_send_response_delayed_cb, strm);
+  return 0;
+}
+
+int h2_send_response_trunc(h2_sess *sess, h2_strm *strm, h2_msg *rsp,
+                           int body_len_sent) {
+  if (body_len_sent < 0 || body_len_sent >= h2_body_len(rsp)) {
+    return h2_send_response(sess, strm, rsp);  /* nothing to cut */
+  }
+  strm->is_body_trunc = 1;
+  strm->body_trunc_len = body_len_sent;
+  return h2_send_response(sess, strm, rsp);
+}
+
 
 /*
  * Receive Message Event Handlers -----------------------------------------
  */
 
 int h2_on_request_recv(h2_sess *sess, h2_strm *strm) {
+  if (sess->is_aborted) {
+    return 0;  /* the rest of received data are dropped */
+  }
+  if (sess->ctx->strm_done_cb) {
+    strm->recv_usec = h2_time_usec();
+  }
+
   /* check request headers */
-  if (!strm->rmsg->method || !strm->rmsg->authority || !strm->rmsg->path) {
+  h2_msg *rmsg = h2_strm_rmsg(strm);
+  if (!rmsg->method || !rmsg->authority || !rmsg->path) {
     warnx("%s[%d] request psuedo header missing; send 400 response",
           sess->log_prefix, strm->stream_id);
-    if (h2_send_response_simple(sess, strm, strm->rmsg, 400,
+    if (h2_send_response_simple(sess, strm, rmsg, 400,
                                 NULL, NULL, 0) != 0) {
       return -1;
     }
     return 0;
   }
 
+  /* may wait in admission lane or be shed; see h2_ctx_set_admission() */
+  if (sess->ctx->admit || sess->settings.prio_sched != H2_PRIO_SCHED_OFF) {
+    strm->prio_class = h2_prio_class(h2_msg_priority(rmsg));
+  }
+  if (sess->ctx->admit && !h2_admit_request(sess, strm)) {
+    return 0;
+  }
+  return h2_on_request_admit(sess, strm);
+}
+
+int h2_on_request_admit(h2_sess *sess, h2_strm *strm) {
+  h2_msg *rmsg = h2_strm_rmsg(strm);
   int rs = 404;
   if (sess->request_cb) {
-    rs = sess->request_cb(sess, strm, strm->rmsg, sess->user_data);
+    H2_PROF_PHASE(H2_PROF_APP,
+                  rs = sess->request_cb(sess, strm, rmsg, sess->user_data));
   }
 
   if (rs < 0) {
@@ -329,7 +636,7 @@ int h2_on_request_recv(h2_sess *sess, h2_strm *strm) {
   }
 
   if (rs > 0) {
-    if (h2_send_response_simple(sess, strm, strm->rmsg, rs,
+    if (h2_send_response_simple(sess, strm, rmsg, rs,
                                 NULL, NULL, 0) != 0) {
       return -1;
     }
@@ -346,8 +653,12 @@ int h2_on_response_recv(h2_sess *sess, h2_strm *strm) {
     }
     if (strm->response_cb) {
       h2_peer *peer = sess->peer;
-      int r = strm->response_cb(peer, strm->rmsg,
-                                peer->user_data, strm->user_data);
+      int r;
+      peer->rsp_sess_idx = sess->peer_sess_idx;
+      H2_PROF_PHASE(H2_PROF_APP,
+                    r = strm->response_cb(peer, h2_strm_rmsg(strm),
+                                          peer->user_data, strm->user_data));
+      peer->rsp_sess_idx = -1;
       if (r < 0) {
         warnx("%s[%d] response_cb failed; go ahead: ret=%d",
               sess->log_prefix, strm->stream_id, r);
@@ -358,6 +669,34 @@ int h2_on_response_recv(h2_sess *sess, h2_strm *strm) {
     if (sess->is_no_more_req && sess->req_cnt == sess->rsp_cnt) {
       h2_sess_terminate(sess, 0);
     }
+    if (sess->peer && sess->peer->lane_num > 0) {
+      h2_prio_dispatch(sess->peer);  /* for the stream room */
+    }
+  }
+  return 0;
+}
+
+int h2_on_remote_drain(h2_sess *sess) {
+  /* HTTP/2 GOAWAY or HTTP/1.1 "connection: close" received */
+  if (sess->is_server || sess->is_no_more_req) {
+    return 0;
+  }
+  /* remote is draining; move new requests to the other sessions and */
+  /* reconnect on close regardless of reconn_max */
+  h2_peer *peer = sess->peer;
+  if (peer) {
+    int i;
+    for (i = 0; i < peer->settings.sess_num; i++) {
+      if (peer->sess[i] == sess && peer->act_sess[i]) {
+        peer->act_sess[i] = 0;
+        peer->act_sess_num--;
+      }
+    }
+    sess->is_req_max_reconn = 1;
+  }
+  h2_sess_terminate(sess, 1/* wait_rsp */);
+  if (sess->req_cnt == sess->rsp_cnt) {
+    h2_sess_terminate(sess, 0);  /* nothing to wait */
   }
   return 0;
 }
@@ -367,18 +706,52 @@ int h2_on_response_recv(h2_sess *sess, h2_strm *strm) {
  * HTTP/2-Only Receive Message Event Handlers -----------------------------
  */
 
-int h2_on_rst_stream_recv(h2_sess *sess, h2_strm *strm) {
+int h2_on_goaway_recv(h2_sess *sess, int last_stream_id) {
+  h2_strm *strm;
+  int n = 0;
+
+  /* requests over last_stream_id are not processed (RFC 7540 6.8) */
+  if (!sess->is_server) {
+    for (strm = sess->strm_list_head.next; strm; strm = strm->next) {
+      if (strm->stream_id > last_stream_id) {
+        n += h2_strm_retry(sess, strm);
+      }
+    }
+  }
+  h2_on_remote_drain(sess);  /* not to send again on this session */
+  if (n > 0) {
+    if (sess->is_no_more_req && sess->req_cnt == sess->rsp_cnt) {
+      h2_sess_terminate(sess, 0);  /* for GOAWAY after drain notice */
+    }
+    h2_prio_dispatch(sess->peer);
+  }
+  return 0;
+}
+
+int h2_on_rst_stream_recv(h2_sess *sess, h2_strm *strm, int error_code) {
   /* NOTE: HTTP_V2 ONLY */
   if (strm->is_req && strm->is_rsp_set) {
     warnx("%s[%d] response already handled before this RST_STREAM; ignore",
           sess->log_prefix, strm->stream_id);
     return -1;
   }
+  /* REFUSED_STREAM means no application processing (RFC 7540 8.1.4) */
+  if (error_code == H2_ERR_REFUSED_STREAM && h2_strm_retry(sess, strm)) {
+    if (sess->is_no_more_req && sess->req_cnt == sess->rsp_cnt) {
+      h2_sess_terminate(sess, 0);
+    }
+    h2_prio_dispatch(sess->peer);
+    return 0;
+  }
   /* NOTE: response_cb might be called for push_response stream */
   if (strm->response_cb && !strm->is_rsp_set) {
     h2_peer *peer = sess->peer;
-    int r = strm->response_cb(peer, NULL,
-                              peer->user_data, strm->user_data);
+    int r;
+    peer->rsp_sess_idx = sess->peer_sess_idx;
+    H2_PROF_PHASE(H2_PROF_APP,
+                  r = strm->response_cb(peer, NULL,
+                                        peer->user_data, strm->user_data));
+    peer->rsp_sess_idx = -1;
     if (r < 0) {
       warnx("%s[%d] response_cb for RST_STREAM failed; go ahead: ret=%d",
             sess->log_prefix, strm->stream_id, r);
@@ -392,6 +765,9 @@ int h2_on_rst_stream_recv(h2_sess *sess, h2_strm *strm) {
     if (sess->is_no_more_req && sess->req_cnt == sess->rsp_cnt) {
       h2_sess_terminate(sess, 0);
     }
+    if (sess->peer && sess->peer->lane_num > 0) {
+      h2_prio_dispatch(sess->peer);
+    }
   }
   return 0;
 }
@@ -406,9 +782,13 @@ int h2_on_push_promise_recv(h2_sess *sess, h2_strm *req_strm,
     h2_peer *peer = sess->peer;
     h2_response_cb push_response_cb = NULL;
     void *push_strm_user_data = NULL;
-    int r = peer->push_promise_cb(peer, prm_strm->rmsg,
-                                  peer->user_data, req_strm->user_data,
-                                  &push_response_cb, &push_strm_user_data);
+    int r;
+    H2_PROF_PHASE(H2_PROF_APP,
+                  r = peer->push_promise_cb(peer, h2_strm_rmsg(prm_strm),
+                                            peer->user_data,
+                                            req_strm->user_data,
+                                            &push_response_cb,
+                                            &push_strm_user_data));
     if (r < 0) {
       warnx("%s[%d] push_promise_callback failed; reset: ret=%d",
             sess->log_prefix, req_strm->stream_id, r);
@@ -422,7 +802,7 @@ int h2_on_push_promise_recv(h2_sess *sess, h2_strm *req_strm,
   /* else, RST promise stream */
   prm_strm->response_cb = NULL;
   prm_strm->user_data = NULL;  /* invaliadate stream user_data */
-  h2_send_rst_stream_v2(sess, prm_strm);
+  h2_send_rst_stream_v2(sess, prm_strm, H2_ERR_REFUSED_STREAM);
   return 0;
 }
 
@@ -431,8 +811,13 @@ int h2_on_push_response_recv(h2_sess *sess, h2_strm *prm_strm) {
   /* TODO: check response header */
   if (sess->peer && prm_strm->response_cb) {
     h2_peer *peer = sess->peer;
-    int ret = prm_strm->response_cb(peer, prm_strm->rmsg,
-                                    peer->user_data, prm_strm->user_data);
+    int ret;
+    peer->rsp_sess_idx = sess->peer_sess_idx;
+    H2_PROF_PHASE(H2_PROF_APP,
+                  ret = prm_strm->response_cb(peer, h2_strm_rmsg(prm_strm),
+                                              peer->user_data,
+                                              prm_strm->user_data));
+    peer->rsp_sess_idx = -1;
     if (ret < 0) {
       warnx("%s[%d] on_push_promise_callback failed; go ahead: ret=%d",
             sess->log_prefix, prm_strm->stream_id, ret);
@@ -447,6 +832,12 @@ int h2_on_push_response_recv(h2_sess *sess, h2_strm *prm_strm) {
  */
 
 inline char *h2_sess_close_reason_str(h2_sess *sess) {
+  if (sess->abuse_type) {
+     return "abuse";
+  }
+  if (sess->is_aborted) {
+     return "abort";
+  }
   if (sess->close_reason == CLOSE_BY_NGHTTP2_END && sess->is_terminated) {
      return "sess term";
   }
@@ -468,22 +859,25 @@ void h2_sess_free(h2_sess *sess) {
       (sess->tv_end.tv_usec - sess->tv_begin.tv_usec) * 0.000001);
 
   if (sess->is_server) {
-    fprintf(stderr, "%sDISCONNECTED%s%s: %.0f tps (%.3f secs for %d streams)\n",
+    fprintf(stderr, "%sDISCONNECTED%s%s: %.0f tps (%.3f secs for %lld streams)\n",
             sess->log_prefix,
             (sess->close_reason)? " by " : "",
             (sess->close_reason)? h2_sess_close_reason_str(sess) : "",
             sess->strm_close_cnt / elapsed, elapsed, sess->strm_close_cnt);
   } else {
     fprintf(stderr, "%sDISCONNECTED%s%s: %.0f tps (%.3f secs for "
-            "%d reqs %d rsps %d rsts %d streams)%s\n",
+            "%lld reqs %lld rsps %lld rsts %lld retries %lld streams)%s\n",
             sess->log_prefix,
             (sess->close_reason)? " by " : "",
             (sess->close_reason)? h2_sess_close_reason_str(sess) : "",
             sess->strm_close_cnt / elapsed, elapsed,
             sess->req_cnt, sess->rsp_cnt, sess->rsp_rst_cnt,
-            sess->strm_close_cnt,
+            sess->req_retry_cnt, sess->strm_close_cnt,
             (sess->req_cnt != sess->rsp_cnt)? " !!!" : "");
   }
+  h2_sess_print_hpack_stat_v2(sess);
+  h2_emu_print_stat(sess);
+  h2_emu_free(sess);  /* queued data are dropped */
 
   if (sess->fd >= 0) {
 #ifdef EPOLL_MODE
@@ -495,9 +889,25 @@ void h2_sess_free(h2_sess *sess) {
       epoll_ctl(sess->ctx->epoll_fd, EPOLL_CTL_DEL, sess->fd, &e);
     }
 #endif
-    /* NOTE: close() SHOULD be called event when shutdown() is called */
-    shutdown(sess->fd, SHUT_RDWR);
-    close(sess->fd);
+    if (sess->is_server && sess->close_reason == CLOSE_BY_NGHTTP2_END &&
+        !sess->is_aborted && !sess->abuse_type) {
+      /* after the final GOAWAY; requests in flight are read out not to */
+      /* reset the connection before the client reads the responses */
+#ifdef TLS_MODE
+      if (sess->ssl) {
+        SSL_shutdown(sess->ssl);  /* close_notify before half-close */
+        SSL_free(sess->ssl);
+        sess->ssl = NULL;
+      }
+#endif
+      h2_ctx_linger(sess->ctx, sess->fd);
+    } else {
+      /* NOTE: close() SHOULD be called event when shutdown() is called */
+      if (!sess->is_aborted) {
+        shutdown(sess->fd, SHUT_RDWR);  /* aborted one is closed by RST */
+      }
+      close(sess->fd);
+    }
     sess->fd = -1;
   }
 
@@ -532,10 +942,29 @@ void h2_sess_free(h2_sess *sess) {
       sess->send_data_remain -=
         (strm->send_body_sb.data_size - strm->send_body_sb.data_used);
     }
+    if (sess->http_ver != H2_HTTP_V2) {
+      /* HTTP/1.1 reference body iov is not in data_size; see h2_v1_1.c */
+      h2_send_buf *sb = &strm->send_body_sb;
+      int i;
+      for (i = sb->iov_idx; i < sb->iov_num; i++) {
+        sess->send_data_remain -= sb->iov[i].iov_len;
+      }
+    }
+    /* request not sent at all is not processed; sent again after */
+    /* h2_peer_sess_free_hdlr() */
+    if (strm->is_req && !strm->is_rsp_set &&
+        ((sess->http_ver == H2_HTTP_V2)? !strm->is_req_sent :
+                                         strm->send_body_sb.data_used == 0)) {
+      h2_strm_retry(sess, strm);
+    }
     if (sess->peer && !strm->is_rsp_set && strm->response_cb) {
       /* NOTE: call response callback with rsp=NULL */
       h2_peer *peer = sess->peer;
-      strm->response_cb(peer, NULL, peer->user_data, strm->user_data);
+      peer->rsp_sess_idx = sess->peer_sess_idx;
+      H2_PROF_PHASE(H2_PROF_APP,
+                    strm->response_cb(peer, NULL, peer->user_data,
+                                      strm->user_data));
+      peer->rsp_sess_idx = -1;
     }
     h2_strm_free(strm);
     strm = next;
@@ -543,7 +972,7 @@ void h2_sess_free(h2_sess *sess) {
 
   /* free user_data for server session */
   if (sess->sess_free_cb) {
-    sess->sess_free_cb(sess, sess->user_data);
+    H2_PROF_PHASE(H2_PROF_APP, sess->sess_free_cb(sess, sess->user_data));
     sess->sess_free_cb = NULL;
     sess->user_data = NULL;
   }
@@ -566,6 +995,8 @@ void h2_sess_free(h2_sess *sess) {
     sess->rdata_size = 0;
     sess->rdata_used = 0;
   }
+  free(sess->rmsg_body);
+  sess->rmsg_body = NULL;
   sess->strm_recving = NULL;
   sess->strm_sending = NULL;
 
@@ -589,6 +1020,33 @@ h2_ctx *h2_sess_ctx(h2_sess *sess) {
   return (sess)? sess->ctx : NULL;
 }
 
+void h2_sess_mark_ready(h2_sess *sess) {
+  if (sess->is_ready) {
+    return;
+  }
+  sess->is_ready = 1;
+  if (sess->ctx->verbose) {
+    warnx("%sSESSION READY", sess->log_prefix);
+  }
+
+  if (sess->peer) {
+    h2_peer *peer = sess->peer;
+    peer->ready_sess_num++;
+    if (peer->ready_cb) {
+      H2_PROF_PHASE(H2_PROF_APP,
+                    peer->ready_cb(peer, peer->user_data,
+                                   peer->ready_sess_num));
+    }
+    if (peer->lane_num > 0) {
+      h2_prio_dispatch(peer);  /* on reconnected */
+    }
+  }
+}
+
+int h2_sess_is_ready(h2_sess *sess) {
+  return (sess)? sess->is_ready : 0;
+}
+
 
 /*
  * Session Settings --------------------------------------------------------
@@ -599,6 +1057,7 @@ void h2_settings_init(h2_settings *settings) {
   settings->sess_num = 1;
   settings->reconn_max = 0;        /* no reconn */
   settings->req_max_per_sess = 0;  /* no max check */
+  settings->retry_unprocessed = 2;
   /* HTTP/2 */
   settings->header_table_size = -1;
   settings->enable_push = -1;
@@ -607,8 +1066,26 @@ void h2_settings_init(h2_settings *settings) {
   settings->max_frame_size = -1;
   settings->max_header_list_size = -1;
   settings->enable_connect_protocol = -1;
+  settings->conn_window_size = -1;
   /* HTTP/1.1 */
   settings->single_req = 0;
+  /* HTTP/2 Data Send Scheduling */
+  settings->data_sched = H2_DATA_SCHED_RR;
+  /* Request Priority Lanes */
+  settings->prio_sched = H2_PRIO_SCHED_OFF;
+  /* HTTP/2 Abuse Rate Limits */
+  settings->rst_stream_rate = 0;
+  settings->ping_rate = 0;
+  settings->settings_rate = 0;
+  settings->empty_frame_rate = 0;
+  /* Network Emulation */
+  settings->emu_delay = 0;
+  settings->emu_jitter = 0;
+  settings->emu_rate = 0;
+  settings->emu_loss = 0;
+  settings->emu_read_stall = 0;
+  settings->emu_read_rate = 0;
+  settings->emu_sess_pct = 0;
 }
 
 int h2_set_settings(h2_settings *settings, char *id_value_str)
@@ -633,6 +1110,36 @@ int h2_set_settings(h2_settings *settings, char *id_value_str)
   }
   *p = '\0';  /* make id a string */
   p++;  /* skip '=' from value */
+  if (!strcasecmp(id, "data_sched")) {  /* symbolic value */
+    if (!strcasecmp(p, "rr")) {
+      settings->data_sched = H2_DATA_SCHED_RR;
+    } else if (!strcasecmp(p, "fifo")) {
+      settings->data_sched = H2_DATA_SCHED_FIFO;
+    } else if (!strcasecmp(p, "srpt")) {
+      settings->data_sched = H2_DATA_SCHED_SRPT;
+    } else {
+      warnx("set settings: data_sched should be rr|fifo|srpt: %s", p);
+      free(str);
+      return -1;
+    }
+    free(str);
+    return 0;
+  }
+  if (!strcasecmp(id, "prio_sched")) {  /* symbolic value */
+    if (!strcasecmp(p, "off")) {
+      settings->prio_sched = H2_PRIO_SCHED_OFF;
+    } else if (!strcasecmp(p, "strict")) {
+      settings->prio_sched = H2_PRIO_SCHED_STRICT;
+    } else if (!strcasecmp(p, "wrr")) {
+      settings->prio_sched = H2_PRIO_SCHED_WRR;
+    } else {
+      warnx("set settings: prio_sched should be off|strict|wrr: %s", p);
+      free(str);
+      return -1;
+    }
+    free(str);
+    return 0;
+  }
   if (sscanf(p, "%i", &val) != 1 || val < 0) {
     warnx("set settings: value should be natural number: %s", p);
     free(str);
@@ -646,6 +1153,8 @@ int h2_set_settings(h2_settings *settings, char *id_value_str)
     settings->reconn_max = val;
   } else if (!strcasecmp(id, "req_max_per_sess")) {
     settings->req_max_per_sess = val;
+  } else if (!strcasecmp(id, "retry_unprocessed")) {
+    settings->retry_unprocessed = val;
   /* HTTP/2 Settings */
   } else if (!strcasecmp(id, "header_table_size")) {
     settings->header_table_size = val;
@@ -661,9 +1170,35 @@ int h2_set_settings(h2_settings *settings, char *id_value_str)
     settings->max_header_list_size = val;
   } else if (!strcasecmp(id, "enable_connect_protocol")) {
     settings->enable_connect_protocol = val;
+  } else if (!strcasecmp(id, "conn_window_size")) {
+    settings->conn_window_size = val;
   /* HTTP/1.1 Settings */ 
   } else if (!strcasecmp(id, "single_request")) {
     settings->single_req = val;
+  /* HTTP/2 Abuse Rate Limits */
+  } else if (!strcasecmp(id, "rst_stream_rate")) {
+    settings->rst_stream_rate = val;
+  } else if (!strcasecmp(id, "ping_rate")) {
+    settings->ping_rate = val;
+  } else if (!strcasecmp(id, "settings_rate")) {
+    settings->settings_rate = val;
+  } else if (!strcasecmp(id, "empty_frame_rate")) {
+    settings->empty_frame_rate = val;
+  /* Network Emulation */
+  } else if (!strcasecmp(id, "emu_delay")) {
+    settings->emu_delay = val;
+  } else if (!strcasecmp(id, "emu_jitter")) {
+    settings->emu_jitter = val;
+  } else if (!strcasecmp(id, "emu_rate")) {
+    settings->emu_rate = val;
+  } else if (!strcasecmp(id, "emu_loss")) {
+    settings->emu_loss = val;
+  } else if (!strcasecmp(id, "emu_read_stall")) {
+    settings->emu_read_stall = val;
+  } else if (!strcasecmp(id, "emu_read_rate")) {
+    settings->emu_read_rate = val;
+  } else if (!strcasecmp(id, "emu_sess_pct")) {
+    settings->emu_sess_pct = val;
   } else {
     warnx("set settings: unknown setting identifier: %s", id);
     free(str);
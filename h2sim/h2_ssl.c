@@ -33,7 +33,10 @@
 #include <errno.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include "h2.h"
 #include "h2_priv.h"
@@ -46,6 +49,7 @@
 #include <openssl/conf.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <openssl/pem.h>
 
 #if OPENSSL_VERSION_NUMBER < 0x10002000L
 #error "openssl version SHOULD be >= 1.0.2"
@@ -164,6 +168,526 @@ SSL_CTX *h2_ssl_ctx_init(int is_server/* else client */,
 }
 
 
+/*
+ * TLS Context Extension Data ---------------------------------------------
+ * trust store preload and background reload, verify result cache and stat;
+ * kept as SSL_CTX ex_data and freed on SSL_CTX_free()
+ */
+
+#define H2_SSL_CACHE_WAYS         4     /* set associative ways */
+#define H2_SSL_CACHE_SIZE_DEFAULT 1024
+#define H2_SSL_CACHE_TTL_DEFAULT  60    /* secs */
+#define H2_SSL_RELOAD_DEFAULT     5     /* secs; 0 for no reload */
+
+typedef struct {
+  unsigned char md[SHA256_DIGEST_LENGTH];  /* peer chain and params key */
+  int gen;                   /* trust store generation; 0 for empty slot */
+  long long expire_usec;
+  int ret;                   /* X509_verify_cert() return value */
+  int err;                   /* X509_STORE_CTX_get_error() value */
+} h2_ssl_cache_ent;
+
+typedef struct {
+  /* trust store sources */
+  char *trust_file;
+  char *trust_dir;
+  int store_gen;             /* increased on store reload */
+  int purpose;               /* X509_PURPOSE_* set by ctx; 0 for none */
+
+  /* background reloader */
+  int reload_sec;
+  pthread_t reload_thread;
+  int is_reload_thread;
+  int is_reload_stop;
+  pthread_mutex_t reload_lock;
+  pthread_cond_t reload_cond;
+  X509_STORE *reload_store;  /* prepared store to be applied; locked */
+
+  /* verify result cache */
+  h2_ssl_cache_ent *cache;   /* alloced as [cache_set_num][H2_SSL_CACHE_WAYS] */
+  int cache_set_num;         /* power of 2 */
+  long long cache_ttl_usec;
+
+  /* stat */
+  long long verify_hit_cnt, verify_hit_usec;
+  long long verify_miss_cnt, verify_miss_usec;
+  long long hs_cnt[3], hs_usec[3];  /* per H2_SSL_HS_* */
+} h2_ssl_data;
+
+/* handshake stat kind */
+#define H2_SSL_HS_NO_VERIFY   0
+#define H2_SSL_HS_CACHE_HIT   1
+#define H2_SSL_HS_CACHE_MISS  2
+
+static int h2_ssl_data_idx = -1;
+static pthread_once_t h2_ssl_data_idx_once = PTHREAD_ONCE_INIT;
+
+static void h2_ssl_reload_stop(h2_ssl_data *data);
+
+static void h2_ssl_data_free_cb(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                                int idx, long argl, void *argp) {
+  h2_ssl_data *data = ptr;
+  (void)parent;
+  (void)ad;
+  (void)idx;
+  (void)argl;
+  (void)argp;
+
+  if (data == NULL) {
+    return;
+  }
+  h2_ssl_reload_stop(data);
+  pthread_mutex_destroy(&data->reload_lock);
+  pthread_cond_destroy(&data->reload_cond);
+  free(data->trust_file);
+  free(data->trust_dir);
+  free(data->cache);
+  free(data);
+}
+
+static void h2_ssl_data_idx_init(void) {
+  h2_ssl_data_idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
+                                             h2_ssl_data_free_cb);
+}
+
+static h2_ssl_data *h2_ssl_data_get(SSL_CTX *ssl_ctx, int create) {
+  h2_ssl_data *data;
+
+  pthread_once(&h2_ssl_data_idx_once, h2_ssl_data_idx_init);
+  if (h2_ssl_data_idx < 0) {
+    return NULL;
+  }
+  data = SSL_CTX_get_ex_data(ssl_ctx, h2_ssl_data_idx);
+  if (data == NULL && create) {
+    data = calloc(1, sizeof(*data));
+    pthread_mutex_init(&data->reload_lock, NULL);
+    pthread_cond_init(&data->reload_cond, NULL);
+    data->store_gen = 1;
+    data->reload_sec = H2_SSL_RELOAD_DEFAULT;
+    if (SSL_CTX_set_ex_data(ssl_ctx, h2_ssl_data_idx, data) != 1) {
+      h2_ssl_data_free_cb(NULL, data, NULL, 0, 0, NULL);
+      return NULL;
+    }
+  }
+  return data;
+}
+
+
+/*
+ * Trust Store Preload and Reload -----------------------------------------
+ * all CA certificates and CRLs are loaded into the store on init,
+ * instead of hashed dir lookup and CRL file loads on handshakes
+ */
+
+static int h2_ssl_store_load_file(X509_STORE *store, const char *file,
+                                  int *cert_num, int *crl_num) {
+  STACK_OF(X509_INFO) *infos;
+  BIO *bio;
+  int i;
+
+  if ((bio = BIO_new_file(file, "r")) == NULL) {
+    return -1;
+  }
+  infos = PEM_X509_INFO_read_bio(bio, NULL, NULL, NULL);
+  BIO_free(bio);
+  if (infos == NULL) {
+    ERR_clear_error();
+    return -1;
+  }
+  for (i = 0; i < sk_X509_INFO_num(infos); i++) {
+    X509_INFO *info = sk_X509_INFO_value(infos, i);
+    if (info->x509 && X509_STORE_add_cert(store, info->x509) == 1) {
+      (*cert_num)++;
+    }
+    if (info->crl && X509_STORE_add_crl(store, info->crl) == 1) {
+      (*crl_num)++;
+    }
+  }
+  sk_X509_INFO_pop_free(infos, X509_INFO_free);
+  ERR_clear_error();  /* ignore already in store errors */
+  return 0;
+}
+
+/* calls func for each regular file in dir; returns file count */
+static int h2_ssl_dir_scan(const char *dir,
+                           void (*func)(const char *path, struct stat *st,
+                                        void *arg), void *arg) {
+  char path[1024];
+  struct dirent *de;
+  struct stat st;
+  DIR *dp;
+  int n = 0;
+
+  if ((dp = opendir(dir)) == NULL) {
+    return -1;
+  }
+  while ((de = readdir(dp))) {
+    if (de->d_name[0] == '.') {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+      func(path, &st, arg);
+      n++;
+    }
+  }
+  closedir(dp);
+  return n;
+}
+
+typedef struct {
+  X509_STORE *store;
+  int cert_num;
+  int crl_num;
+} h2_ssl_store_load_arg;
+
+static void h2_ssl_store_load_dir_func(const char *path, struct stat *st,
+                                       void *arg) {
+  h2_ssl_store_load_arg *la = arg;
+  (void)st;
+  h2_ssl_store_load_file(la->store, path, &la->cert_num, &la->crl_num);
+}
+
+static X509_STORE *h2_ssl_store_load(const char *trust_file,
+                                     const char *trust_dir) {
+  h2_ssl_store_load_arg la = { X509_STORE_new(), 0, 0 };
+
+  if (la.store == NULL) {
+    return NULL;
+  }
+  if (trust_file &&
+      h2_ssl_store_load_file(la.store, trust_file,
+                             &la.cert_num, &la.crl_num) < 0) {
+    warnx("cannot load trust file: %s", trust_file);
+    X509_STORE_free(la.store);
+    return NULL;
+  }
+  if (trust_dir &&
+      h2_ssl_dir_scan(trust_dir, h2_ssl_store_load_dir_func, &la) < 0) {
+    warnx("cannot load trust dir: %s", trust_dir);
+    X509_STORE_free(la.store);
+    return NULL;
+  }
+  warnx("trust store loaded: certs=%d crls=%d", la.cert_num, la.crl_num);
+  return la.store;
+}
+
+/* file change signature as sum of mtime, size and count */
+static void h2_ssl_sig_dir_func(const char *path, struct stat *st, void *arg) {
+  long long *sig = arg;
+  (void)path;
+  *sig = *sig * 31 + (long long)st->st_mtime * 1000003 + st->st_size + 1;
+}
+
+static long long h2_ssl_trust_sig(h2_ssl_data *data) {
+  long long sig = 0;
+  struct stat st;
+
+  if (data->trust_file && stat(data->trust_file, &st) == 0) {
+    h2_ssl_sig_dir_func(data->trust_file, &st, &sig);
+  }
+  if (data->trust_dir) {
+    h2_ssl_dir_scan(data->trust_dir, h2_ssl_sig_dir_func, &sig);
+  }
+  return sig;
+}
+
+static void *h2_ssl_reload_thread_main(void *arg) {
+  h2_ssl_data *data = arg;
+  long long sig = h2_ssl_trust_sig(data);
+
+  pthread_mutex_lock(&data->reload_lock);
+  while (!data->is_reload_stop) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += data->reload_sec;
+    pthread_cond_timedwait(&data->reload_cond, &data->reload_lock, &ts);
+    if (data->is_reload_stop) {
+      break;
+    }
+    pthread_mutex_unlock(&data->reload_lock);
+
+    /* load new store without lock; it takes time */
+    long long new_sig = h2_ssl_trust_sig(data);
+    X509_STORE *store = NULL;
+    if (new_sig != sig) {
+      sig = new_sig;
+      store = h2_ssl_store_load(data->trust_file, data->trust_dir);
+    }
+
+    pthread_mutex_lock(&data->reload_lock);
+    if (store) {
+      if (data->reload_store) {
+        X509_STORE_free(data->reload_store);  /* not applied yet */
+      }
+      data->reload_store = store;
+    }
+  }
+  pthread_mutex_unlock(&data->reload_lock);
+  return NULL;
+}
+
+static int h2_ssl_reload_start(h2_ssl_data *data) {
+  if (data->is_reload_thread || data->reload_sec <= 0 ||
+      (data->trust_file == NULL && data->trust_dir == NULL)) {
+    return 0;
+  }
+  data->is_reload_stop = 0;
+  if (pthread_create(&data->reload_thread, NULL,
+                     h2_ssl_reload_thread_main, data) != 0) {
+    warnx("cannot create trust store reload thread: %s", strerror(errno));
+    return -1;
+  }
+  data->is_reload_thread = 1;
+  return 0;
+}
+
+static void h2_ssl_reload_stop(h2_ssl_data *data) {
+  if (data->is_reload_thread) {
+    pthread_mutex_lock(&data->reload_lock);
+    data->is_reload_stop = 1;
+    pthread_cond_signal(&data->reload_cond);
+    pthread_mutex_unlock(&data->reload_lock);
+    pthread_join(data->reload_thread, NULL);
+    data->is_reload_thread = 0;
+  }
+  if (data->reload_store) {
+    X509_STORE_free(data->reload_store);
+    data->reload_store = NULL;
+  }
+}
+
+void h2_ssl_ctx_check_update(SSL_CTX *ssl_ctx) {
+  h2_ssl_data *data = h2_ssl_data_get(ssl_ctx, 0);
+  X509_STORE *store;
+
+  if (data == NULL || !data->is_reload_thread ||
+      __atomic_load_n(&data->reload_store, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&data->reload_lock);
+  store = data->reload_store;
+  data->reload_store = NULL;
+  pthread_mutex_unlock(&data->reload_lock);
+
+  if (store) {
+    SSL_CTX_set_cert_store(ssl_ctx, store);  /* old one is freed */
+    data->store_gen++;  /* invalidates cached verify results */
+    warnx("trust store reloaded: gen=%d", data->store_gen);
+  }
+}
+
+
+/*
+ * Peer Certificate Verify Result Cache -----------------------------------
+ * keyed by sha256 over the presented chain and the verify params which
+ * change the result: store, role, purpose, flags, depth and peer identity
+ * (hosts, email, ip); the result is reused within ttl and the same trust
+ * store generation
+ */
+
+static int h2_ssl_cert_verify_cache_key(X509_STORE_CTX *x509_ctx,
+                                        h2_ssl_data *data, unsigned char *md) {
+  X509_VERIFY_PARAM *param = X509_STORE_CTX_get0_param(x509_ctx);
+  STACK_OF(X509) *chain = X509_STORE_CTX_get0_untrusted(x509_ctx);
+  X509 *cert = X509_STORE_CTX_get0_cert(x509_ctx);
+  SSL *ssl = X509_STORE_CTX_get_ex_data(x509_ctx,
+                                        SSL_get_ex_data_X509_STORE_CTX_idx());
+  unsigned char cert_md[SHA256_DIGEST_LENGTH];
+  unsigned int md_len;
+  EVP_MD_CTX *mctx;
+  char *s;
+  int i, ok;
+
+  if (cert == NULL || param == NULL || ssl == NULL ||
+      (mctx = EVP_MD_CTX_new()) == NULL) {
+    return -1;
+  }
+  struct {
+    X509_STORE *store;
+    int is_server, purpose, depth, auth_level;
+    unsigned long flags;
+    unsigned int hostflags;
+  } p;
+  memset(&p, 0, sizeof(p));  /* no garbage in padding */
+  p.store = X509_STORE_CTX_get0_store(x509_ctx);
+  p.is_server = SSL_is_server(ssl);
+  p.purpose = data->purpose;
+  p.depth = X509_VERIFY_PARAM_get_depth(param);
+  p.auth_level = X509_VERIFY_PARAM_get_auth_level(param);
+  p.flags = X509_VERIFY_PARAM_get_flags(param);
+  p.hostflags = X509_VERIFY_PARAM_get_hostflags(param);
+
+  ok = EVP_DigestInit_ex(mctx, EVP_sha256(), NULL) &&
+       EVP_DigestUpdate(mctx, &p, sizeof(p)) &&
+       X509_digest(cert, EVP_sha256(), cert_md, &md_len) &&
+       EVP_DigestUpdate(mctx, cert_md, md_len);
+  for (i = 0; ok && chain && i < sk_X509_num(chain); i++) {
+    ok = X509_digest(sk_X509_value(chain, i), EVP_sha256(), cert_md,
+                     &md_len) &&
+         EVP_DigestUpdate(mctx, cert_md, md_len);
+  }
+  /* NUL terminated strings, with an empty one as the end of hosts */
+  for (i = 0; ok && (s = X509_VERIFY_PARAM_get0_host(param, i)); i++) {
+    ok = EVP_DigestUpdate(mctx, s, strlen(s) + 1);
+  }
+  s = X509_VERIFY_PARAM_get0_email(param);
+  ok = ok && EVP_DigestUpdate(mctx, "", 1) &&
+       EVP_DigestUpdate(mctx, (s)? s : "", (s)? strlen(s) + 1 : 1);
+  if (ok && (s = X509_VERIFY_PARAM_get1_ip_asc(param))) {
+    ok = EVP_DigestUpdate(mctx, s, strlen(s) + 1);
+    OPENSSL_free(s);
+  }
+  ok = ok && EVP_DigestFinal_ex(mctx, md, &md_len);
+  EVP_MD_CTX_free(mctx);
+  return (ok)? 0 : -1;
+}
+
+static int h2_ssl_cert_verify_cache_cb(X509_STORE_CTX *x509_ctx, void *arg) {
+  h2_ssl_data *data = arg;
+  h2_ssl_cache_ent *set = NULL, *ent = NULL;
+  unsigned char md[SHA256_DIGEST_LENGTH];
+  long long begin_usec = h2_time_usec();
+  int i, r;
+
+  if (data->cache && h2_ssl_cert_verify_cache_key(x509_ctx, data, md) == 0) {
+    unsigned int h;
+    memcpy(&h, md, sizeof(h));
+    set = &data->cache[(h & (data->cache_set_num - 1)) * H2_SSL_CACHE_WAYS];
+    for (i = 0; i < H2_SSL_CACHE_WAYS; i++) {
+      if (set[i].gen == data->store_gen && !memcmp(set[i].md, md, sizeof(md)) &&
+          set[i].expire_usec > begin_usec) {
+        ent = &set[i];
+        break;
+      }
+    }
+  }
+
+  if (ent) {
+    X509_STORE_CTX_set_error(x509_ctx, ent->err);
+    data->verify_hit_cnt++;
+    data->verify_hit_usec += h2_time_usec() - begin_usec;
+    return ent->ret;
+  }
+
+  r = X509_verify_cert(x509_ctx);
+
+  if (set) {
+    /* replace invalid or the earliest expiring entry */
+    ent = &set[0];
+    for (i = 0; i < H2_SSL_CACHE_WAYS; i++) {
+      if (set[i].gen != data->store_gen) {
+        ent = &set[i];
+        break;
+      }
+      if (set[i].expire_usec < ent->expire_usec) {
+        ent = &set[i];
+      }
+    }
+    memcpy(ent->md, md, sizeof(md));
+    ent->gen = data->store_gen;
+    ent->expire_usec = begin_usec + data->cache_ttl_usec;
+    ent->ret = r;
+    ent->err = X509_STORE_CTX_get_error(x509_ctx);
+  }
+  data->verify_miss_cnt++;
+  data->verify_miss_usec += h2_time_usec() - begin_usec;
+  return r;
+}
+
+int h2_ssl_ctx_set_verify_cache(SSL_CTX *ssl_ctx, int cache_size,
+                                int cache_ttl_sec) {
+  h2_ssl_data *data;
+  int set_num;
+
+  if (ssl_ctx == NULL || (data = h2_ssl_data_get(ssl_ctx, 1)) == NULL) {
+    warnx("invalid arugment: ssl_ctx should not be NULL");
+    return -1;
+  }
+
+  free(data->cache);
+  data->cache = NULL;
+  data->cache_set_num = 0;
+  if (cache_size > 0) {
+    for (set_num = 1; set_num * H2_SSL_CACHE_WAYS < cache_size; set_num <<= 1);
+    data->cache = calloc(set_num * H2_SSL_CACHE_WAYS, sizeof(*data->cache));
+    data->cache_set_num = set_num;
+  }
+  data->cache_ttl_usec = (long long)cache_ttl_sec * 1000000;
+  return 0;
+}
+
+int h2_ssl_ctx_set_verify_reload(SSL_CTX *ssl_ctx, int reload_sec) {
+  h2_ssl_data *data;
+
+  if (ssl_ctx == NULL || (data = h2_ssl_data_get(ssl_ctx, 1)) == NULL) {
+    warnx("invalid arugment: ssl_ctx should not be NULL");
+    return -1;
+  }
+  h2_ssl_reload_stop(data);
+  data->reload_sec = reload_sec;
+  return h2_ssl_reload_start(data);
+}
+
+
+/*
+ * Handshake and Stat -----------------------------------------------------
+ */
+
+int h2_ssl_handshake(SSL *ssl, int is_server, long long *usec_ret) {
+  h2_ssl_data *data = h2_ssl_data_get(SSL_get_SSL_CTX(ssl), 1);
+  long long begin_usec = h2_time_usec();
+  long long hit_cnt = 0, miss_cnt = 0;
+  long long usec;
+  int r, kind;
+
+  if (data) {
+    hit_cnt = data->verify_hit_cnt;
+    miss_cnt = data->verify_miss_cnt;
+  }
+  r = (is_server)? SSL_accept(ssl) : SSL_connect(ssl);
+  usec = h2_time_usec() - begin_usec;
+
+  if (data && r == 1) {
+    kind = (data->verify_hit_cnt != hit_cnt)? H2_SSL_HS_CACHE_HIT :
+           (data->verify_miss_cnt != miss_cnt)? H2_SSL_HS_CACHE_MISS :
+           H2_SSL_HS_NO_VERIFY;
+    data->hs_cnt[kind]++;
+    data->hs_usec[kind] += usec;
+  }
+  if (usec_ret) {
+    *usec_ret = usec;
+  }
+  return r;
+}
+
+void h2_ssl_ctx_print_stat(FILE *fp, SSL_CTX *ssl_ctx, const char *title) {
+  static const char *hs_kind_str[3] = { "no_verify", "cache_hit", "verify" };
+  h2_ssl_data *data;
+  int i;
+
+  if (ssl_ctx == NULL || (data = h2_ssl_data_get(ssl_ctx, 0)) == NULL) {
+    return;
+  }
+  for (i = 0; i < 3; i++) {
+    if (data->hs_cnt[i] > 0) {
+      fprintf(fp, "%s TLS HANDSHAKE(%s): %lld handshakes avg %lld usec\n",
+              title, hs_kind_str[i], data->hs_cnt[i],
+              data->hs_usec[i] / data->hs_cnt[i]);
+    }
+  }
+  if (data->verify_hit_cnt + data->verify_miss_cnt > 0) {
+    fprintf(fp, "%s TLS VERIFY: %lld cache hits avg %lld usec, "
+            "%lld verifies avg %lld usec\n", title,
+            data->verify_hit_cnt, (data->verify_hit_cnt > 0)?
+              data->verify_hit_usec / data->verify_hit_cnt : 0,
+            data->verify_miss_cnt, (data->verify_miss_cnt > 0)?
+              data->verify_miss_usec / data->verify_miss_cnt : 0);
+  }
+}
+
+
 /*
  * Peer Certificate Verify Config Utilities -------------------------------
  */
@@ -254,10 +778,22 @@ int h2_ssl_ctx_set_verify(SSL_CTX *ssl_ctx, int is_server, int ssl_verify_flag,
     return 0;
   }
 
-  int r = SSL_CTX_load_verify_locations(ssl_ctx, trust_file, trust_dir);
-  if (r < 0) {
-    warnx("SSL_CTX_load_verify_locations() failed; ret=%d "
-          "trust_file=%s trust_dir=%s", r, trust_file, trust_dir);
+  /* preload trust store instead of SSL_CTX_load_verify_locations() */
+  h2_ssl_data *data = h2_ssl_data_get(ssl_ctx, 1);
+  X509_STORE *store = h2_ssl_store_load(trust_file, trust_dir);
+  if (data == NULL || store == NULL) {
+    warnx("trust store load failed; trust_file=%s trust_dir=%s",
+          trust_file, trust_dir);
+    return -2;
+  }
+  SSL_CTX_set_cert_store(ssl_ctx, store);
+  h2_ssl_reload_stop(data);
+  free(data->trust_file);
+  free(data->trust_dir);
+  data->trust_file = (trust_file)? strdup(trust_file) : NULL;
+  data->trust_dir = (trust_dir)? strdup(trust_dir) : NULL;
+  data->store_gen++;
+  if (h2_ssl_reload_start(data) < 0) {
     return -2;
   }
 
@@ -273,8 +809,9 @@ int h2_ssl_ctx_set_verify(SSL_CTX *ssl_ctx, int is_server, int ssl_verify_flag,
     X509_VERIFY_PARAM_set_flags(param, X509_V_FLAG_CRL_CHECK_ALL);
   }
   if ((ssl_verify_flag & H2_SSL_VERIFY_PURPOSE)) {
-    X509_VERIFY_PARAM_set_purpose(param,
-        (is_server)? X509_PURPOSE_SSL_CLIENT : X509_PURPOSE_SSL_SERVER);
+    data->purpose = (is_server)? X509_PURPOSE_SSL_CLIENT :
+                                 X509_PURPOSE_SSL_SERVER;
+    X509_VERIFY_PARAM_set_purpose(param, data->purpose);
   }
 
   int mode = SSL_VERIFY_PEER;
@@ -287,6 +824,8 @@ int h2_ssl_ctx_set_verify(SSL_CTX *ssl_ctx, int is_server, int ssl_verify_flag,
   } else {
     SSL_CTX_set_verify(ssl_ctx, mode, h2_cert_verify_cb);
   }
+  /* to measure verify cost and use cache if set */
+  SSL_CTX_set_cert_verify_callback(ssl_ctx, h2_ssl_cert_verify_cache_cb, data);
 
   return 0;
 }
@@ -307,6 +846,8 @@ int h2_ssl_ctx_set_verify_from_str(SSL_CTX *ssl_ctx, int is_server,
   char *tk, *last_p = NULL;
   int ssl_verify_flag = 0/* H2_SSL_VERIFY_NONE */;
   char *trust_file = NULL, *trust_dir = NULL;
+  int cache_size = 0, cache_ttl = H2_SSL_CACHE_TTL_DEFAULT;
+  int reload = H2_SSL_RELOAD_DEFAULT;
 
   tk = strtok_r(str, ",", &last_p);
   do {
@@ -326,14 +867,29 @@ int h2_ssl_ctx_set_verify_from_str(SSL_CTX *ssl_ctx, int is_server,
       ssl_verify_flag |= H2_SSL_VERIFY_CRL_ALL;
     } else if (!strcasecmp(tk, "purpose")) {
       ssl_verify_flag |= H2_SSL_VERIFY_PURPOSE;
+    } else if (!strcasecmp(tk, "cache")) {
+      cache_size = H2_SSL_CACHE_SIZE_DEFAULT;
+    } else if (!strncasecmp(tk, "cache_size=", 11)) {
+      cache_size = atoi(tk + 11);
+    } else if (!strncasecmp(tk, "cache_ttl=", 10)) {
+      cache_ttl = atoi(tk + 10);
+    } else if (!strncasecmp(tk, "reload=", 7)) {
+      reload = atoi(tk + 7);
     } else {
       warnx("unknown verify string token: %s", tk);
       return -1;
     }
   } while ((tk = strtok_r(NULL, ",", &last_p)));
 
-  int r = h2_ssl_ctx_set_verify(ssl_ctx, is_server, ssl_verify_flag,
-                                trust_file, trust_dir);
+  /* reload and cache are set before to be applied at set verify */
+  int r = h2_ssl_ctx_set_verify_reload(ssl_ctx, reload);
+  if (r >= 0) {
+    r = h2_ssl_ctx_set_verify_cache(ssl_ctx, cache_size, cache_ttl);
+  }
+  if (r >= 0) {
+    r = h2_ssl_ctx_set_verify(ssl_ctx, is_server, ssl_verify_flag,
+                              trust_file, trust_dir);
+  }
   free(str);
   return r; 
 }
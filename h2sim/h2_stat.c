@@ -0,0 +1,219 @@
+/*
+ * h2sim - HTTP2 Simple Application Framework using nghttp2
+ *
+ * Copyright 2019 Lee Yongjae, Telcoware Co.,LTD.
+ *
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "h2.h"
+#include "h2_priv.h"
+
+
+/*
+ * Time Utilities -----------------------------------------------------------
+ */
+
+long long h2_time_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+long long h2_cpu_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+long long h2_proc_cpu_usec(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+         ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+long long h2_peak_rss_kb(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;  /* kbytes on linux */
+}
+
+double h2_cpu_mhz(void) {
+  char line[256];
+  double mhz = 0;
+  FILE *fp = fopen("/proc/cpuinfo", "r");
+  if (fp) {
+    while (fgets(line, sizeof(line), fp)) {
+      if (sscanf(line, "cpu MHz : %lf", &mhz) == 1) {
+        break;
+      }
+    }
+    fclose(fp);
+  }
+  return mhz;
+}
+
+
+/*
+ * Log-Linear Histogram -----------------------------------------------------
+ * bucket is (msb position, next H2_HIST_SUB_BITS bits) of the value
+ * ie. values are kept within 1/(1 << H2_HIST_SUB_BITS) relative error
+ */
+
+#define H2_HIST_SUB_NUM  (1 << H2_HIST_SUB_BITS)
+
+static inline int h2_hist_bucket_idx(long long value) {
+  unsigned long long v = (value > 0)? (unsigned long long)value : 0;
+  if (v < H2_HIST_SUB_NUM) {
+    return (int)v;
+  }
+  int shift = (63 - __builtin_clzll(v)) - H2_HIST_SUB_BITS;
+  return ((shift + 1) << H2_HIST_SUB_BITS) +
+         (int)((v >> shift) & (H2_HIST_SUB_NUM - 1));
+}
+
+static inline long long h2_hist_bucket_value(int idx) {
+  /* returns middle value of the bucket */
+  if (idx < H2_HIST_SUB_NUM) {
+    return idx;
+  }
+  int shift = (idx >> H2_HIST_SUB_BITS) - 1;
+  long long low = (long long)(H2_HIST_SUB_NUM + (idx & (H2_HIST_SUB_NUM - 1)))
+                  << shift;
+  return low + (((long long)1 << shift) >> 1);
+}
+
+void h2_hist_init(h2_hist *hist) {
+  memset(hist, 0, sizeof(*hist));
+}
+
+void h2_hist_add(h2_hist *hist, long long value) {
+  if (hist->cnt == 0 || value < hist->min) {
+    hist->min = value;
+  }
+  if (hist->cnt == 0 || value > hist->max) {
+    hist->max = value;
+  }
+  hist->cnt++;
+  hist->sum += value;
+  hist->bucket[h2_hist_bucket_idx(value)]++;
+}
+
+void h2_hist_merge(h2_hist *dst, const h2_hist *src) {
+  int i;
+
+  if (src->cnt == 0) {
+    return;
+  }
+  if (dst->cnt == 0 || src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (dst->cnt == 0 || src->max > dst->max) {
+    dst->max = src->max;
+  }
+  dst->cnt += src->cnt;
+  dst->sum += src->sum;
+  for (i = 0; i < H2_HIST_BUCKET_NUM; i++) {
+    dst->bucket[i] += src->bucket[i];
+  }
+}
+
+long long h2_hist_percentile(const h2_hist *hist, double percent) {
+  long long rank, n = 0;
+  int i;
+
+  if (hist->cnt == 0) {
+    return 0;
+  }
+  rank = (long long)(hist->cnt * percent / 100.0 + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  for (i = 0; i < H2_HIST_BUCKET_NUM; i++) {
+    n += hist->bucket[i];
+    if (n >= rank) {
+      long long v = h2_hist_bucket_value(i);
+      return (v < hist->min)? hist->min : (v > hist->max)? hist->max : v;
+    }
+  }
+  return hist->max;
+}
+
+void h2_hist_print(FILE *fp, const h2_hist *hist, const char *title) {
+  fprintf(fp, "%s: cnt=%lld avg=%lld min=%lld p50=%lld p90=%lld p99=%lld "
+          "p99.9=%lld max=%lld\n",
+          title, hist->cnt, (hist->cnt)? hist->sum / hist->cnt : 0, hist->min,
+          h2_hist_percentile(hist, 50.0), h2_hist_percentile(hist, 90.0),
+          h2_hist_percentile(hist, 99.0), h2_hist_percentile(hist, 99.9),
+          hist->max);
+}
+
+
+/*
+ * Trend of Sampled Series --------------------------------------------------
+ * least squares slope for the amount of drift and Kendall tau for the
+ * monotonicity of it; a leak shows both steady slope and tau near +1
+ */
+
+void h2_trend_calc(const double *v, int n, h2_trend *trend) {
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  long long concord = 0, pair = 0;
+  int i, j;
+
+  memset(trend, 0, sizeof(*trend));
+  if (n < 2) {
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    sx += i;
+    sy += v[i];
+    sxx += (double)i * i;
+    sxy += i * v[i];
+  }
+  trend->slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+
+  double first = (sy - trend->slope * sx) / n;  /* fitted value at 0 */
+  double last = first + trend->slope * (n - 1);
+  if (first != 0) {
+    trend->change = (last - first) / ((first > 0)? first : -first);
+  }
+
+  for (i = 0; i < n - 1; i++) {
+    for (j = i + 1; j < n; j++) {
+      if (v[j] > v[i]) {
+        concord++;
+      } else if (v[j] < v[i]) {
+        concord--;
+      }
+      pair++;
+    }
+  }
+  trend->tau = (double)concord / pair;
+}
@@ -44,6 +44,9 @@
 #include "h2_priv.h"
 
 
+/* pseudo stream id of HTTP/1.1 message as in HTTP/2; wraps in positive int */
+#define H2_V1_1_STRM_ID(req_cnt)  ((int)((2 * (req_cnt) + 1) & 0x7fffffff))
+
 /* HTTP/1.1 reason values per status */
 static char *http_status_reason[5][20] = {
   { /*100*/"Continue",
@@ -111,24 +114,59 @@ static void h2_set_send_data(h2_strm *strm, void *data, int size) {
   send_buf->msg_type = strm->send_msg_type;
 }
 
-int h2_send_request_v1_1(h2_sess *sess, h2_msg *req,
+/* reference body of h2_set_body_iov() is sent after the header data */
+/* without gathering into the message buffer; only iov array is copied */
+static void h2_set_send_iov(h2_strm *strm, h2_msg *msg) {
+  h2_send_buf *send_buf = &strm->send_body_sb;
+  send_buf->iov = malloc(sizeof(struct iovec) * msg->body_iov_num);
+  memcpy(send_buf->iov, msg->body_iov,
+         sizeof(struct iovec) * msg->body_iov_num);
+  send_buf->iov_num = msg->body_iov_num;
+  send_buf->iov_idx = 0;
+  send_buf->iov_off = 0;
+}
+
+static int h2_send_buf_is_done(h2_send_buf *sb) {
+  return (sb->data_used >= sb->data_size && sb->iov_idx >= sb->iov_num);
+}
+
+/* returns the next data to send and marks it used */
+static int h2_send_buf_next(h2_send_buf *sb, const uint8_t **data_ret) {
+  int size;
+  if (sb->data_used < sb->data_size) {
+    *data_ret = sb->data + sb->data_used;
+    size = sb->data_size - sb->data_used;
+    sb->data_used = sb->data_size;
+    return size;
+  }
+  while (sb->iov_idx < sb->iov_num) {
+    struct iovec *v = &sb->iov[sb->iov_idx++];
+    if (v->iov_len > 0) {
+      *data_ret = v->iov_base;
+      return (int)v->iov_len;
+    }
+  }
+  return 0;
+}
+
+int h2_send_request_v1_1(h2_sess *sess, h2_msg *req, int retry_cnt,
                          h2_response_cb response_cb, void *strm_user_data) {
   char *p, *buf;
   int i, buf_len;
 
   /* NOTE: buf should contain extra headers */
   buf_len = 64 + h2_sbuf_used(&req->sbuf) + h2_hdr_num(req) * 4 + 
-            req->body_len + 1;
+            ((req->body_iov)? 0 : req->body_len) + 1;
   buf = malloc(buf_len);
 
   /* set header */
   p = buf;
   p += sprintf(p, "%s %s HTTP/1.1\r\n", h2_method(req), h2_path(req));
   p += sprintf(p, "host: %s\r\n", h2_authority(req));
-  if (req->body && req->body_len > 0) {
+  if (req->body_len > 0) {
     p += sprintf(p, "content-length: %d\r\n", req->body_len);
   }
-  if (sess->settings.single_req) {
+  if (sess->settings.single_req || sess->drain_usec > 0) {
     /* HERE: TODO: reimplement single_req */
     p += sprintf(p, "connection: close\r\n");
   }
@@ -139,17 +177,17 @@ int h2_send_request_v1_1(h2_sess *sess, h2_msg *req,
   p += sprintf(p, "\r\n");
 
   /* set body */
-  if (req->body && req->body_len > 0) {
-    memcpy(p, req->body, req->body_len);
-    p += req->body_len;
+  if (req->body_len > 0 && !req->body_iov) {
+    p += h2_msg_body_gather(req, p);
   }
   *p = '\0';  /* mark NULL at the end of message */
 
   /* ASSUME: success */ /* TODO: handled error case */
-  h2_strm *strm = h2_strm_init(sess, 2 * sess->req_cnt + 1, H2_RESPONSE,
-                               response_cb, strm_user_data);
+  h2_strm *strm = h2_strm_init(sess, H2_V1_1_STRM_ID(sess->req_cnt),
+                               H2_RESPONSE, response_cb, strm_user_data);
   sess->req_cnt++;
   strm->is_req = 1;
+  h2_strm_keep_req(strm, req, retry_cnt);
 
   /* HERE: TODO: reimplement single_req */
   if (sess->settings.single_req) {
@@ -159,6 +197,10 @@ int h2_send_request_v1_1(h2_sess *sess, h2_msg *req,
   /* set send message as read data buf */
   h2_set_send_data(strm, buf, p - buf);
   sess->send_data_remain += strm->send_body_sb.data_size;
+  if (req->body_iov) {
+    h2_set_send_iov(strm, req);
+    sess->send_data_remain += req->body_len;
+  }
 
   return h2_sess_send(sess);
 }
@@ -177,16 +219,20 @@ int h2_send_response_v1_1(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
     reason = "Unknown";
   }
 
-  buf_len = 64 + h2_sbuf_used(&rsp->sbuf) + h2_hdr_num(rsp) * 4 + rsp->body_len;
+  /* truncated body is gathered to be cut */
+  int is_body_ref = (rsp->body_iov && !strm->is_body_trunc);
+  buf_len = 64 + h2_sbuf_used(&rsp->sbuf) + h2_hdr_num(rsp) * 4 +
+            ((is_body_ref)? 0 : rsp->body_len);
   buf = malloc(buf_len);
 
   /* set header */
   p = buf;
   p += sprintf(p, "%d %s\r\n", s, reason);
-  if (rsp->body && rsp->body_len > 0) {
+  if (rsp->body_len > 0) {
     p += sprintf(p, "content-length: %d\r\n", rsp->body_len);
   }
-  if (sess->settings.single_req) {
+  if (sess->settings.single_req || sess->drain_usec > 0 ||
+      sess->is_no_more_req) {
     /* HERE: TODO: reimplement single_req */
     p += sprintf(p, "connection: close\r\n");
     strm->close_sess = 1;
@@ -198,13 +244,19 @@ int h2_send_response_v1_1(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
   p += sprintf(p, "\r\n");
 
   /* set body */
-  if (rsp->body && rsp->body_len > 0) {
-    memcpy(p, rsp->body, rsp->body_len);
-    p += rsp->body_len;
+  if (rsp->body_len > 0 && !is_body_ref) {
+    p += h2_msg_body_gather(rsp, p);
+    if (strm->is_body_trunc) {
+      p -= rsp->body_len - strm->body_trunc_len;  /* aborted after sent */
+    }
   }
 
   /* set send message as read data buf */
   h2_set_send_data(strm, buf, p - buf);
+  if (is_body_ref) {
+    h2_set_send_iov(strm, rsp);
+    sess->send_data_remain += rsp->body_len;
+  }
 
   /* mark response to send */
   strm->is_rsp_set = 1;
@@ -226,11 +278,11 @@ static int h2_sess_recv_hdl_once_v1_1(h2_sess *sess) {
   /* returns 1(message parse completed), 0(parse not completed), <0(error) */
   h2_msg *rmsg;
   if (sess->strm_recving) {
-    rmsg = sess->strm_recving->rmsg;
+    rmsg = h2_strm_rmsg(sess->strm_recving);
   } else {
     /* check for starting new strm and rmsg */
     if (sess->is_server) {
-      sess->strm_recving = h2_strm_init(sess, sess->req_cnt * 2 + 1,
+      sess->strm_recving = h2_strm_init(sess, H2_V1_1_STRM_ID(sess->req_cnt),
                                         H2_REQUEST, NULL, NULL);
     } else {  /* client */
       if (sess->strm_list_head.next == NULL) {
@@ -245,7 +297,7 @@ static int h2_sess_recv_hdl_once_v1_1(h2_sess *sess) {
     sess->rmsg_header_done = 0;
     sess->rmsg_header_line = 0;
     sess->rmsg_content_length = 0;
-    rmsg = sess->strm_recving->rmsg;
+    rmsg = h2_strm_rmsg(sess->strm_recving);
   }
 
   /* check and parse http header */
@@ -337,7 +389,7 @@ static int h2_sess_recv_hdl_once_v1_1(h2_sess *sess) {
             /* TODO: NEED MORE STRICT CHECKING */
             sess->rmsg_content_length = atoi(value); 
           } else if (nlen == 10 && !strncasecmp(name, "connection", 10)) {
-            if (!strcasecmp(value, "close")) {
+            if (end - value == 5 && !strncasecmp(value, "close", 5)) {
                sess->strm_recving->close_sess = 1;
             }
             /* TODO: ELSE MAY NEED TO HANDLE <header fields> to remove */
@@ -365,10 +417,32 @@ static int h2_sess_recv_hdl_once_v1_1(h2_sess *sess) {
     if (sess->rmsg_content_length && h2_body_len(rmsg) == 0) {
       /* check for data avaiable for content_length */
       /* TODO: NEED TO HANDLE Chunked Body case */
-      if (sess->rdata_size - sess->rdata_used >= sess->rmsg_content_length) {
+      int avail = sess->rdata_size - sess->rdata_used;
+      if (sess->rmsg_body == NULL && avail >= sess->rmsg_content_length) {
         h2_cpy_body(rmsg, sess->rdata + sess->rdata_used,
                     sess->rmsg_content_length);
         sess->rdata_used += sess->rmsg_content_length; 
+      } else {
+        /* partial body; move to body buffer to keep rdata small */
+        int n = sess->rmsg_content_length - sess->rmsg_body_len;
+        if (sess->rmsg_body == NULL) {
+          sess->rmsg_body = malloc(sess->rmsg_content_length + 1);
+          sess->rmsg_body_len = 0;
+          n = sess->rmsg_content_length;
+        }
+        if (n > avail) {
+          n = avail;
+        }
+        memcpy(sess->rmsg_body + sess->rmsg_body_len,
+               sess->rdata + sess->rdata_used, n);
+        sess->rmsg_body_len += n;
+        sess->rdata_used += n;
+        if (sess->rmsg_body_len == sess->rmsg_content_length) {
+          sess->rmsg_body[sess->rmsg_body_len] = '\0';
+          h2_set_body(rmsg, sess->rmsg_body, sess->rmsg_body_len);
+          sess->rmsg_body = NULL;
+          sess->rmsg_body_len = 0;
+        }
       }
     }
     if (sess->rmsg_content_length == h2_body_len(rmsg)) {
@@ -380,6 +454,9 @@ static int h2_sess_recv_hdl_once_v1_1(h2_sess *sess) {
         sess->strm_recving = NULL;
         /* NOTE: on sess.singe_req, sess is closed after send reponse */
       } else {  /* client */
+        if (sess->strm_recving->close_sess) {
+          h2_on_remote_drain(sess);  /* last response on this sess */
+        }
         r = h2_on_response_recv(sess, sess->strm_recving);
         h2_strm_free(sess->strm_recving);
         sess->strm_close_cnt++;
@@ -478,20 +555,25 @@ int h2_sess_send_once_v1_1(h2_sess *sess) {
            strm = strm_next) {
         strm_next = strm->next;
         sb = &strm->send_body_sb;
-        if (sb->data_used >= sb->data_size) {
+        if (h2_send_buf_is_done(sb) && strm->is_body_trunc) {
+          if (wb->merge_size > 0 || wb->mem_send_size > 0) {
+            break;  /* abort after the cut body is flushed */
+          }
+          h2_sess_abort(sess);
+          return -1;
+        } else if (h2_send_buf_is_done(sb)) {
+          strm->is_rsp_done = 1;
           h2_strm_free(strm);  /* strm.data are all sent; free stream */
           sess->strm_close_cnt++;
           //{
           //  static int n = 0;
-          //  printf("DEBUG[%d]: req_cnt=%d rsp_cnt=%d strm_close_cnt=%d\n",
+          //  printf("DEBUG[%d]: req_cnt=%lld rsp_cnt=%lld strm_close_cnt=%lld\n",
           //         n, sess->req_cnt, sess->rsp_cnt, sess->strm_close_cnt);
           //}
           continue;
 
         } else {  /* found data to send */
-          strm_send_data = sb->data + sb->data_used;
-          strm_send_size = sb->data_size - sb->data_used;
-          sb->data_used = sb->data_size;
+          strm_send_size = h2_send_buf_next(sb, &strm_send_data);
           break;
         }
       }
@@ -501,12 +583,10 @@ int h2_sess_send_once_v1_1(h2_sess *sess) {
       } 
       while ((strm = sess->strm_sending)) {
         sb = &strm->send_body_sb;
-        if (sb->data_used >= sb->data_size) {
+        if (h2_send_buf_is_done(sb)) {
           sess->strm_sending = strm->next;
         } else {
-          strm_send_data = sb->data + sb->data_used;
-          strm_send_size = sb->data_size - sb->data_used;
-          sb->data_used = sb->data_size;
+          strm_send_size = h2_send_buf_next(sb, &strm_send_data);
           break;
         }
       }
@@ -536,6 +616,13 @@ int h2_sess_send_once_v1_1(h2_sess *sess) {
 
   /* try to send merge_data once */
   if (wb->merge_size > 0) {
+    if (sess->emu) {
+      /* delayed by emulation timer; never fails */
+      if ((sent = h2_emu_write(sess, wb->merge_data, wb->merge_size)) == 0) {
+        h2_sess_mark_send_pending(sess);
+        return total_sent;  /* resumed by emulation timer */
+      }
+    } else
 #ifdef TLS_MODE
     if (ssl) {
       r = SSL_write(ssl, wb->merge_data, wb->merge_size);
@@ -591,6 +678,13 @@ int h2_sess_send_once_v1_1(h2_sess *sess) {
 
   /* try to send mem_send_data once */
   if (wb->mem_send_size) {
+    if (sess->emu) {
+      /* delayed by emulation timer; never fails */
+      if ((sent = h2_emu_write(sess, wb->mem_send_data, wb->mem_send_size)) == 0) {
+        h2_sess_mark_send_pending(sess);
+        return total_sent;  /* resumed by emulation timer */
+      }
+    } else
 #ifdef TLS_MODE
     if (ssl) {
       r = SSL_write(ssl, wb->mem_send_data, wb->mem_send_size);
@@ -652,7 +746,8 @@ int h2_sess_send_once_v1_1(h2_sess *sess) {
   if (total_sent == 0) {
     h2_sess_clear_send_pending(sess);
     /* close session on singgle_req mode */ 
-    if (sess->is_no_more_req && !sess->is_shutdown_send_called) {
+    if (sess->is_no_more_req && !sess->is_shutdown_send_called &&
+        h2_emu_queued(sess) == 0) {
       h2_sess_shutdown_send_v1_1(sess);
       sess->is_shutdown_send_called = 1;
     }
@@ -26,11 +26,13 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
 #include <ctype.h>
+#include <limits.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/time.h>    /* for gettimeofday */
@@ -87,25 +89,144 @@ static void ng_print_headers(FILE *f, nghttp2_nv *nva, size_t nvlen,
 }
 
 
+/*
+ * HTTP/2 Data Send Scheduling ----------------------------------------------
+ * nghttp2 interleaves DATA of all streams by weight (rr); for fifo and srpt,
+ * only the stream picked by policy may send and the others are deferred
+ * from the body read callback, then resumed when they are picked later.
+ * streams blocked by the stream flow control window are not picked
+ * to keep the connection busy. with prio_sched, the weight is set by
+ * priority class for rr, and higher class is picked first for fifo and srpt.
+ */
+
+static void h2_data_sched_add_v2(h2_sess *sess, h2_strm *strm) {
+  strm->sched_prev = sess->sched_tail;
+  strm->sched_next = NULL;
+  if (sess->sched_tail) {
+    sess->sched_tail->sched_next = strm;
+  } else {
+    sess->sched_head = strm;
+  }
+  sess->sched_tail = strm;
+  strm->is_data_sched = 1;
+  strm->is_data_deferred = 0;
+}
+
+void h2_data_sched_del_v2(h2_strm *strm) {
+  h2_sess *sess = strm->sess;
+
+  if (strm->sched_prev) {
+    strm->sched_prev->sched_next = strm->sched_next;
+  } else {
+    sess->sched_head = strm->sched_next;
+  }
+  if (strm->sched_next) {
+    strm->sched_next->sched_prev = strm->sched_prev;
+  } else {
+    sess->sched_tail = strm->sched_prev;
+  }
+  strm->sched_prev = strm->sched_next = NULL;
+  strm->is_data_sched = 0;
+  strm->is_data_deferred = 0;
+}
+
+static h2_strm *h2_data_sched_pick_v2(h2_sess *sess) {
+  h2_strm *strm, *pick = NULL;
+  int remain, pick_remain = 0, is_better;
+  int is_prio = (sess->settings.prio_sched != H2_PRIO_SCHED_OFF);
+
+  for (strm = sess->sched_head; strm; strm = strm->sched_next) {
+    if (nghttp2_session_get_stream_remote_window_size(sess->ng_sess,
+                                                      strm->stream_id) <= 0) {
+      continue;
+    }
+    if (sess->settings.data_sched == H2_DATA_SCHED_FIFO && !is_prio) {
+      return strm;
+    }
+    /* higher priority class first, then by data_sched; earlier one on tie */
+    remain = strm->send_body_sb.data_size - strm->send_body_sb.data_used;
+    if (pick == NULL) {
+      is_better = 1;
+    } else if (is_prio && strm->prio_class != pick->prio_class) {
+      is_better = (strm->prio_class < pick->prio_class);
+    } else {
+      is_better = (sess->settings.data_sched == H2_DATA_SCHED_SRPT &&
+                   remain < pick_remain);
+    }
+    if (is_better) {
+      pick = strm;
+      pick_remain = remain;
+    }
+  }
+  return pick;
+}
+
+/* HTTP/2 stream weight by priority class; 256, 64, 16, 4 */
+#define H2_PRIO_WEIGHT(prio_class)  (NGHTTP2_MAX_WEIGHT >> (2 * (prio_class)))
+
+/* returns 1 if the stream picked is resumed to send, else 0 */
+static int h2_data_sched_resume_v2(h2_sess *sess) {
+  if (sess->sched_head == NULL) {
+    return 0;
+  }
+  h2_strm *strm = h2_data_sched_pick_v2(sess);
+  if (strm == NULL || !strm->is_data_deferred) {
+    return 0;
+  }
+  strm->is_data_deferred = 0;
+  return (nghttp2_session_resume_data(sess->ng_sess, strm->stream_id) == 0);
+}
+
+
 /*
  * HTTP/2 Message Send -----------------------------------------------------
  */
 
+/* copy from reference body iov into DATA frame buf */
+static void h2_send_buf_gather(h2_send_buf *sb, uint8_t *buf, int n) {
+  struct iovec *v;
+  int m;
+
+  while (n > 0) {
+    v = &sb->iov[sb->iov_idx];
+    m = (int)v->iov_len - sb->iov_off;
+    if (m > n) {
+      m = n;
+    }
+    memcpy(buf, (char *)v->iov_base + sb->iov_off, m);
+    buf += m;
+    n -= m;
+    sb->iov_off += m;
+    if (sb->iov_off >= (int)v->iov_len) {
+      sb->iov_idx++;
+      sb->iov_off = 0;
+    }
+  }
+}
+
 static ssize_t ng_send_msg_body_cb(nghttp2_session *ng_sess,
                     int32_t stream_id, uint8_t *buf, size_t length,
                     uint32_t *data_flags, nghttp2_data_source *source,
                     void *user_data) {
   h2_send_buf *sb = source->ptr;
   h2_sess *sess = user_data;
-  (void)ng_sess;
-  (void)stream_id;
+  h2_strm *strm = (void *)((char *)sb - offsetof(h2_strm, send_body_sb));
+
+  if (strm->is_data_sched && h2_data_sched_pick_v2(sess) != strm) {
+    strm->is_data_deferred = 1;
+    return NGHTTP2_ERR_DEFERRED;
+  }
 
   int n = sb->data_size - sb->data_used;
   if (n > (int)length) {
     n = (int)length;
   }
   if (n > 0) {
-    memcpy(buf, &sb->data[sb->data_used], n);
+    if (sb->iov) {
+      h2_send_buf_gather(sb, buf, n);
+    } else {
+      memcpy(buf, &sb->data[sb->data_used], n);
+    }
   }
 
   /* dump out response body */
@@ -127,6 +248,15 @@ static ssize_t ng_send_msg_body_cb(nghttp2_session *ng_sess,
   sb->data_used += n;
   if (sb->data_used >= sb->data_size) {
     *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    if (strm->is_body_trunc) {
+      /* fault injection: body cut without END_STREAM then reset */
+      *data_flags |= NGHTTP2_DATA_FLAG_NO_END_STREAM;
+      nghttp2_submit_rst_stream(ng_sess, NGHTTP2_FLAG_NONE,
+                                stream_id, NGHTTP2_INTERNAL_ERROR);
+    }
+    if (strm->is_data_sched) {
+      h2_data_sched_del_v2(strm);
+    }
   } else {
     //fprintf(stderr, "DEBUG: %s[%d] REMAINS DATA: %d sess.send_data_remain=%d\n",
     //        sess->log_prefix, stream_id, sb->data_size - sb->data_used,
@@ -138,15 +268,32 @@ static ssize_t ng_send_msg_body_cb(nghttp2_session *ng_sess,
 }
 
 static void h2_cpy_send_data_prd(nghttp2_data_provider *data_prd, 
-                                 h2_strm *strm, void *data, int size) {
-  /* ASSUME: data!=null, size>0 */
+                                 h2_strm *strm, h2_msg *msg, int is_ref) {
+  /* is_ref: msg body outlives strm; not copied */
+  /* ASSUME: msg->body_len>0 */
   h2_send_buf *send_buf = &strm->send_body_sb;
-  send_buf->data = malloc(size + 1);
-  memcpy(send_buf->data, data, size);
-  send_buf->data[size] = '\0';
+  int size = msg->body_len;
+  if (msg->body_iov) {
+    /* reference body; only iov array is copied */
+    send_buf->iov = malloc(sizeof(struct iovec) * msg->body_iov_num);
+    memcpy(send_buf->iov, msg->body_iov,
+           sizeof(struct iovec) * msg->body_iov_num);
+    send_buf->iov_num = msg->body_iov_num;
+    send_buf->iov_idx = 0;
+    send_buf->iov_off = 0;
+    send_buf->data = NULL;
+    send_buf->to_be_freed = 0;
+  } else if (is_ref) {
+    send_buf->data = msg->body;
+    send_buf->to_be_freed = 0;
+  } else {
+    send_buf->data = malloc(size + 1);
+    memcpy(send_buf->data, msg->body, size);
+    send_buf->data[size] = '\0';
+    send_buf->to_be_freed = 1;
+  }
   send_buf->data_size = size;
   send_buf->data_used = 0;
-  send_buf->to_be_freed = 1;
   send_buf->msg_type = strm->send_msg_type;
   if (data_prd) {
     data_prd->source.ptr = send_buf;
@@ -154,7 +301,7 @@ static void h2_cpy_send_data_prd(nghttp2_data_provider *data_prd,
   }
 }
 
-int h2_send_request_v2(h2_sess *sess, h2_msg *req,
+int h2_send_request_v2(h2_sess *sess, h2_msg *req, int retry_cnt,
                        h2_response_cb response_cb, void *strm_user_data) {
 #define REQ_HDR_MAX  (5 + H2_MSG_HDR_MAX)
   nghttp2_nv ng_hdr[REQ_HDR_MAX];
@@ -169,7 +316,7 @@ int h2_send_request_v2(h2_sess *sess, h2_msg *req,
   ng_hdr_append(ng_hdr, &ng_hdr_num, REQ_HDR_MAX, ":path", h2_path(req));
   /* TODO: content-length MUST NOT be sent if  transfer-encoding is set. */
   /*       (rfc7230 3.3.2. Content-Length) */
-  if (req->body && req->body_len > 0) {
+  if (req->body_len > 0) {
     sprintf(s[0], "%d", req->body_len);
     ng_hdr_append(ng_hdr, &ng_hdr_num, REQ_HDR_MAX, "content-length", s[0]);
   }
@@ -181,20 +328,34 @@ int h2_send_request_v2(h2_sess *sess, h2_msg *req,
   /* ASSUME: success */ /* TODO: handled error case */
   h2_strm *strm = h2_strm_init(sess, 0, H2_RESPONSE,
                                response_cb, strm_user_data);
+  h2_strm_keep_req(strm, req, retry_cnt);
 
-  /* set send message body read handler */
+  /* set send message body read handler; from kept one if any */
   nghttp2_data_provider data_prd_buf, *data_prd = NULL;
-  if (req->body && req->body_len > 0) {
-    h2_cpy_send_data_prd(&data_prd_buf, strm, req->body, req->body_len);
+  if (req->body_len > 0) {
+    if (strm->retry_req) {
+      h2_cpy_send_data_prd(&data_prd_buf, strm, strm->retry_req, 1);
+    } else {
+      h2_cpy_send_data_prd(&data_prd_buf, strm, req, 0);
+    }
     data_prd = &data_prd_buf;
   }
 
+  /* weighted by priority class for DATA interleaving */
+  nghttp2_priority_spec pri_spec_buf, *pri_spec = NULL;
+  if (sess->settings.prio_sched != H2_PRIO_SCHED_OFF) {
+    strm->prio_class = h2_prio_class(h2_msg_priority(req));
+    nghttp2_priority_spec_init(&pri_spec_buf, 0,
+                               H2_PRIO_WEIGHT(strm->prio_class), 0);
+    pri_spec = &pri_spec_buf;
+  }
+
   if (sess->ng_sess == NULL) {
     warnx("%send request failed for invalid session", sess->log_prefix);
     return -1;
   }
 
-  stream_id = nghttp2_submit_request(sess->ng_sess, NULL,
+  stream_id = nghttp2_submit_request(sess->ng_sess, pri_spec,
                                      ng_hdr, ng_hdr_num, data_prd, strm);
   if (stream_id < 0) {
     warnx("%sCannot not submit HTTP request: %s",
@@ -206,6 +367,9 @@ int h2_send_request_v2(h2_sess *sess, h2_msg *req,
   strm->stream_id = stream_id;
   sess->send_data_remain += strm->send_body_sb.data_size;
   sess->req_cnt++;
+  if (data_prd && sess->settings.data_sched != H2_DATA_SCHED_RR) {
+    h2_data_sched_add_v2(sess, strm);
+  }
 
   if (sess->ctx->verbose) {
     fprintf(stderr, "%s[%d] REQUEST HEADER:\n",
@@ -227,7 +391,7 @@ int h2_send_response_v2(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
 
   sprintf(s[0], "%d", rsp->status);
   ng_hdr_append(ng_hdr, &ng_hdr_num, RSP_HDR_MAX, ":status", s[0]);
-  if (rsp->body && rsp->body_len > 0) {
+  if (rsp->body_len > 0) {
     sprintf(s[1], "%d", rsp->body_len);
     ng_hdr_append(ng_hdr, &ng_hdr_num, RSP_HDR_MAX, "content-length", s[1]);
   }
@@ -238,9 +402,12 @@ int h2_send_response_v2(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
 
   /* set response body read handler */
   nghttp2_data_provider data_prd_buf, *data_prd = NULL;
-  if (rsp->body && rsp->body_len > 0) {
-    h2_cpy_send_data_prd(&data_prd_buf, strm, rsp->body, rsp->body_len);
+  if (rsp->body_len > 0) {
+    h2_cpy_send_data_prd(&data_prd_buf, strm, rsp, 0);
     data_prd = &data_prd_buf;
+    if (strm->is_body_trunc) {
+      strm->send_body_sb.data_size = strm->body_trunc_len;
+    }
   }
 
   /* mark response sent to prevent further push_promise */
@@ -259,6 +426,17 @@ int h2_send_response_v2(h2_sess *sess, h2_strm *strm, h2_msg *rsp) {
           sess->log_prefix, strm->stream_id, r, nghttp2_strerror(r));
     return -1;
   }
+  if (data_prd && sess->settings.prio_sched != H2_PRIO_SCHED_OFF) {
+    /* response DATA weighted by request priority class; best effort */
+    nghttp2_priority_spec pri_spec;
+    nghttp2_priority_spec_init(&pri_spec, 0,
+                               H2_PRIO_WEIGHT(strm->prio_class), 0);
+    nghttp2_session_change_stream_priority(sess->ng_sess, strm->stream_id,
+                                           &pri_spec);
+  }
+  if (data_prd && sess->settings.data_sched != H2_DATA_SCHED_RR) {
+    h2_data_sched_add_v2(sess, strm);
+  }
 
   if (sess->ctx->verbose) {
     fprintf(stderr, "%s[%d] %s HEADER:\n",
@@ -327,17 +505,99 @@ int h2_send_push_promise_v2(h2_sess *sess, h2_strm *request_strm,
  * HTTP/2 Special Message Event Handlers ------------------------------------
  */
 
-int h2_send_rst_stream_v2(h2_sess *sess, h2_strm *strm) {
+int h2_send_rst_stream_v2(h2_sess *sess, h2_strm *strm, int error_code) {
   if (sess->ng_sess == NULL) {
     warnx("%send rst stream failed for invalid session", sess->log_prefix);
     return -1;
   }
   nghttp2_submit_rst_stream(sess->ng_sess, NGHTTP2_FLAG_NONE,
-                            strm->stream_id, NGHTTP2_REFUSED_STREAM);  
+                            strm->stream_id, error_code);  
+  h2_sess_mark_send_pending(sess);
   return 0;
 }
 
 
+/*
+ * HTTP/2 Abuse Rate Limits -------------------------------------------------
+ * cheap frames which cost the peer nothing but the loop thread much are
+ * counted per 1 sec window; on limit exceeded, GOAWAY(ENHANCE_YOUR_CALM)
+ * is sent and further received data are dropped till the session closes
+ */
+
+static const char *h2_abuse_name[H2_ABUSE_NUM] = {
+  "RST_STREAM", "PING", "SETTINGS", "empty frame"
+};
+
+static int h2_abuse_rate_max(h2_sess *sess, int type) {
+  switch (type) {
+  case H2_ABUSE_RST_STREAM:  return sess->settings.rst_stream_rate;
+  case H2_ABUSE_PING:        return sess->settings.ping_rate;
+  case H2_ABUSE_SETTINGS:    return sess->settings.settings_rate;
+  case H2_ABUSE_EMPTY_FRAME: return sess->settings.empty_frame_rate;
+  }
+  return 0;
+}
+
+/* returns 1 if the session is marked as abused, else 0 */
+static int h2_abuse_check_v2(h2_sess *sess, const nghttp2_frame *frame) {
+  int type, rate_max;
+
+  if (sess->abuse_type) {
+    return 1;
+  }
+  if (!sess->is_server) {
+    return 0;  /* server side protection; client follows the server */
+  }
+  switch (frame->hd.type) {
+  case NGHTTP2_RST_STREAM:
+    type = H2_ABUSE_RST_STREAM;
+    break;
+  case NGHTTP2_PING:
+    if ((frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+      return 0;
+    }
+    type = H2_ABUSE_PING;
+    break;
+  case NGHTTP2_SETTINGS:
+    if ((frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+      return 0;
+    }
+    type = H2_ABUSE_SETTINGS;
+    break;
+  case NGHTTP2_DATA:
+    if (frame->hd.length > 0 || (frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+      return 0;
+    }
+    type = H2_ABUSE_EMPTY_FRAME;
+    break;
+  default:
+    return 0;
+  }
+  if ((rate_max = h2_abuse_rate_max(sess, type)) <= 0) {
+    return 0;
+  }
+
+  long long cur_usec = h2_time_usec();
+  if (cur_usec - sess->abuse_win_usec >= 1000000) {
+    memset(sess->abuse_cnt, 0, sizeof(sess->abuse_cnt));
+    sess->abuse_win_usec = cur_usec;
+  }
+  if (++sess->abuse_cnt[type] <= rate_max) {
+    return 0;
+  }
+
+  /* escalate: GOAWAY and stop processing this session */
+  warnx("%sGOAWAY(ENHANCE_YOUR_CALM) for %s flood: over %d/sec",
+        sess->log_prefix, h2_abuse_name[type], rate_max);
+  sess->abuse_type = type + 1;
+  sess->is_terminated = 1;
+  h2_ctx_abuse_block(sess->ctx, sess);
+  nghttp2_session_terminate_session(sess->ng_sess, NGHTTP2_ENHANCE_YOUR_CALM);
+  h2_sess_mark_send_pending(sess);
+  return 1;
+}
+
+
 /*
  * NGHTTP2 Session Callbacks h2_sess ----------------------------------------
  */
@@ -375,7 +635,7 @@ static int ng_header_cb(nghttp2_session *ng_sess,
     return 0;
   }
 
-  h2_msg *msg = strm->rmsg;
+  h2_msg *msg = h2_strm_rmsg(strm);
   if (name[0] == ':') {  /* psuedo heaers */
     if (is_request) {
       if (name_len == 7 && !memcmp(":method", name, name_len)) {
@@ -417,6 +677,8 @@ static int ng_header_cb(nghttp2_session *ng_sess,
     /* TODO: NEED TO HANDLE content-lenght header for body buffer pre-alloc */
   }
 
+  sess->hpack_recv.stat.raw_bytes += name_len + value_len;
+
   if (sess->ctx->verbose) {
     ng_print_header(stderr, (char *)name, name_len, value, value_len,
                     sess->log_prefix, frame->hd.stream_id);
@@ -447,7 +709,7 @@ static int ng_begin_hdr_cb(nghttp2_session *ng_sess,
       /* reinit for push_response */
       h2_msg_free(strm->rmsg);
       strm->recv_msg_type = H2_PUSH_RESPONSE;
-      strm->rmsg = h2_msg_init();
+      strm->rmsg = NULL;  /* lazy alloc */
     } else {
       warnx("%s[%d] UNKNOWN BEGIN HEADER; ignore: "
             "frame.hd.type=%d frame.headers.cat=%d",
@@ -495,6 +757,10 @@ static int ng_frame_recv_cb(nghttp2_session *ng_sess,
   h2_strm *request_strm, *promised_strm;
   int r;
 
+  if (h2_abuse_check_v2(sess, frame)) {
+    return 0;  /* ignore frames from abusive peer */
+  }
+
   switch (frame->hd.type) {
   case NGHTTP2_DATA:     /* called after on_data_chunk_recevied */
   case NGHTTP2_HEADERS:
@@ -526,15 +792,38 @@ static int ng_frame_recv_cb(nghttp2_session *ng_sess,
     }
     break;
 
+  case NGHTTP2_SETTINGS:
+    /* ready at remote SETTINGS received and local SETTINGS ACKed */
+    if ((frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+      sess->is_settings_acked = 1;
+    } else {
+      sess->is_settings_recv = 1;
+    }
+    if (sess->is_settings_recv && sess->is_settings_acked) {
+      h2_sess_mark_ready(sess);
+    }
+    break;
+
   case NGHTTP2_RST_STREAM:
-    warnx("%s[%d] RST_STREAM RECEIVED", sess->log_prefix, frame->hd.stream_id);
+    if (sess->ctx->verbose) {  /* not to be flooded in log */
+      warnx("%s[%d] RST_STREAM RECEIVED",
+            sess->log_prefix, frame->hd.stream_id);
+    }
     if ((strm ||
          (strm = nghttp2_session_get_stream_user_data(ng_sess,
                                                       frame->hd.stream_id))) &&
         strm->stream_id == frame->hd.stream_id) {
-      h2_on_rst_stream_recv(sess, strm);
+      h2_on_rst_stream_recv(sess, strm, frame->rst_stream.error_code);
     }
     break;
+
+  case NGHTTP2_GOAWAY:
+    if (sess->ctx->verbose) {
+      warnx("%sGOAWAY RECEIVED: last_stream_id=%d error=%u", sess->log_prefix,
+            frame->goaway.last_stream_id, frame->goaway.error_code);
+    }
+    h2_on_goaway_recv(sess, frame->goaway.last_stream_id);
+    break;
   }
 
   return 0;
@@ -552,14 +841,45 @@ static int ng_data_cb(nghttp2_session *ng_sess, uint8_t flags,
     return 0;
   }
 
-  /* TODO: pre-alloc body buffer if content-length header detected */
-  /*       add h2_msg.body_alloced_size */
-
-  h2_msg *msg = strm->rmsg;
-  if (msg->body) {
-    msg->body = (uint8_t *)realloc(msg->body, msg->body_len + len + 1);
-  } else {
-    msg->body = (uint8_t *)malloc(len + 1);
+  /* body buffer is pre-alloced by content-length if given, */
+  /* else grown by doubling not to realloc on every DATA frame */
+  h2_msg *msg = h2_strm_rmsg(strm);
+  long long need = (long long)msg->body_len + len + 1;
+  if (strm->rbody_alloced < 0) {
+    return 0;  /* body dropped and stream reset; see below */
+  }
+  if (msg->body == NULL) {
+    strm->rbody_alloced = 0;
+  }
+  if (need > strm->rbody_alloced) {
+    long long size = 2LL * strm->rbody_alloced;
+    uint8_t *body;
+    if (msg->body == NULL) {
+      const char *cl = h2_hdr_value(msg, "content-length");
+      size = (cl)? atoll(cl) + 1 : 0;
+      if (size > H2_RBODY_PREALLOC_MAX) {
+        size = H2_RBODY_PREALLOC_MAX;  /* not to trust peer's length */
+      }
+    }
+    if (size < need) {
+      size = need;
+    } else if (size > INT_MAX) {
+      size = INT_MAX;
+    }
+    if (need > INT_MAX ||
+        (body = (uint8_t *)realloc(msg->body, size)) == NULL) {
+      warnx("%s[%d] cannot allocate recv body: size=%lld; stream reset",
+            sess->log_prefix, stream_id, need);
+      free(msg->body);
+      msg->body = NULL;
+      msg->body_len = 0;
+      strm->rbody_alloced = -1;
+      nghttp2_submit_rst_stream(ng_sess, NGHTTP2_FLAG_NONE,
+                                stream_id, NGHTTP2_INTERNAL_ERROR);
+      return 0;
+    }
+    msg->body = body;
+    strm->rbody_alloced = (int)size;
   }
   if (len > 0) {
     memcpy(&msg->body[msg->body_len], data, len);
@@ -592,7 +912,7 @@ static int ng_strm_close_cb(nghttp2_session *ng_sess, int32_t stream_id,
 
 #if 0
   fprintf(stderr, "DEBUG: %s[%d] END OF STREAM: "
-          "strm_close_cnt=%d req_cnt=%d rsp_cnt=%d rsp_rst_cnt=%d "
+          "strm_close_cnt=%lld req_cnt=%lld rsp_cnt=%lld rsp_rst_cnt=%lld "
           "err=%u, send_data_remain=%d\n",
           sess->log_prefix, stream_id,
           sess->strm_close_cnt+1, 
@@ -618,6 +938,7 @@ static int ng_strm_close_cb(nghttp2_session *ng_sess, int32_t stream_id,
   sess->strm_close_cnt++;
   sess->send_data_remain -=
     (strm->send_body_sb.data_size - strm->send_body_sb.data_used);
+  strm->is_rsp_done = (error_code == 0 && strm->rsp_status > 0);
   h2_strm_free(strm);
   nghttp2_session_set_stream_user_data(ng_sess, stream_id, NULL);
 
@@ -677,6 +998,9 @@ int h2_sess_send_once_v2(h2_sess *sess) {
     mem_send_size = nghttp2_session_mem_send(sess->ng_sess, &mem_send_data);
     /* DEBUG: to check mem_send size */
     /* fprintf(stderr, "%d ", (int)mem_send_size); */
+    if (mem_send_size > 0) {
+      h2_hpack_scan_feed(&sess->hpack_send, mem_send_data, mem_send_size);
+    }
 
     if (mem_send_size < 0) {
       /* probablly NGHTTP2_ERR_NOMEM; abort immediately */
@@ -685,6 +1009,9 @@ int h2_sess_send_once_v2(h2_sess *sess) {
       sess->close_reason = CLOSE_BY_NGHTTP2_ERR;
       return -1;
     } else if (mem_send_size == 0) {
+      if (h2_data_sched_resume_v2(sess)) {
+        continue;  /* all others are deferred; retry with the resumed */
+      }
       /* no more data to send */
 #ifdef EPOLL_MODE
       mem_send_zero = 1; 
@@ -707,6 +1034,13 @@ int h2_sess_send_once_v2(h2_sess *sess) {
 
   /* try to send merge_data once */
   if (wb->merge_size > 0) {
+    if (sess->emu) {
+      /* delayed by emulation timer; never fails */
+      if ((sent = h2_emu_write(sess, wb->merge_data, wb->merge_size)) == 0) {
+        h2_sess_mark_send_pending(sess);
+        return total_sent;  /* resumed by emulation timer */
+      }
+    } else
 #ifdef TLS_MODE
     if (ssl) {
       r = SSL_write(ssl, wb->merge_data, wb->merge_size);
@@ -769,6 +1103,13 @@ int h2_sess_send_once_v2(h2_sess *sess) {
 
   /* try to send mem_send_data once */
   if (wb->mem_send_size) {
+    if (sess->emu) {
+      /* delayed by emulation timer; never fails */
+      if ((sent = h2_emu_write(sess, wb->mem_send_data, wb->mem_send_size)) == 0) {
+        h2_sess_mark_send_pending(sess);
+        return total_sent;  /* resumed by emulation timer */
+      }
+    } else
 #ifdef TLS_MODE
     if (ssl) {
       r = SSL_write(ssl, wb->mem_send_data, wb->mem_send_size);
@@ -831,7 +1172,10 @@ int h2_sess_send_once_v2(h2_sess *sess) {
 
   if (total_sent == 0) {
     h2_sess_clear_send_pending(sess);
-    if (sess->is_no_more_req && !sess->is_shutdown_send_called) {
+    /* client GOAWAY waits for the requests queued over remote max */
+    /* concurrent streams not to let server close on no active stream */
+    if (sess->is_no_more_req && !sess->is_shutdown_send_called &&
+        (sess->is_server || sess->req_cnt == sess->rsp_cnt)) {
       h2_sess_shutdown_send_v2(sess);
       sess->is_shutdown_send_called = 1;
     }
@@ -844,7 +1188,8 @@ int h2_sess_send_once_v2(h2_sess *sess) {
   }
 
 #ifdef EPOLL_MODE
-  if (mem_send_zero && !nghttp2_session_want_read(sess->ng_sess)) {
+  if (mem_send_zero && !nghttp2_session_want_read(sess->ng_sess) &&
+      h2_emu_queued(sess) == 0) {
     sess->close_reason = CLOSE_BY_NGHTTP2_END;
     return -6;
   }
@@ -853,6 +1198,263 @@ int h2_sess_send_once_v2(h2_sess *sess) {
   return total_sent;
 }
 
+/*
+ * HPACK Statistics --------------------------------------------------------
+ * sent and received byte streams are scanned for header block fragments;
+ * other frames are skipped by frame length without copy
+ */
+
+#define H2_HPACK_BLK_MAX      (1024 * 1024)  /* stop scan if larger */
+#define H2_HPACK_STATIC_NUM   61             /* rfc7541 static table size */
+#define H2_CLIENT_PREFACE_LEN 24
+
+/* returns 0 on decoded, -1 on invalid or short data */
+static int hpack_int(const unsigned char **pp, const unsigned char *end,
+                     int prefix_bits, unsigned int *value) {
+  const unsigned char *p = *pp;
+  unsigned int mask = (1 << prefix_bits) - 1;
+  unsigned int v;
+  int shift = 0;
+
+  if (p >= end) {
+    return -1;
+  }
+  v = *p++ & mask;
+  if (v == mask) {
+    do {
+      if (p >= end || shift > 28) {
+        return -1;
+      }
+      v += (unsigned int)(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p++ & 0x80);
+  }
+  *pp = p;
+  *value = v;
+  return 0;
+}
+
+static int hpack_skip_str(const unsigned char **pp, const unsigned char *end) {
+  unsigned int len;
+  if (hpack_int(pp, end, 7, &len) < 0 || len > (unsigned int)(end - *pp)) {
+    return -1;
+  }
+  *pp += len;
+  return 0;
+}
+
+static void hpack_scan_block(h2_hpack_scan *scan) {
+  const unsigned char *p = scan->blk, *end = scan->blk + scan->blk_len;
+  h2_hpack_stat *stat = &scan->stat;
+  unsigned int idx;
+
+  stat->enc_bytes += scan->blk_len;
+  while (p < end) {
+    if ((*p & 0x80)) {  /* indexed header field */
+      if (hpack_int(&p, end, 7, &idx) < 0) {
+        break;
+      }
+      if (idx <= H2_HPACK_STATIC_NUM) {
+        stat->idx_static++;
+      } else {
+        stat->idx_dynamic++;
+      }
+    } else if ((*p & 0x40)) {  /* literal with incremental indexing */
+      if (hpack_int(&p, end, 6, &idx) < 0 ||
+          (idx == 0 && hpack_skip_str(&p, end) < 0) ||
+          hpack_skip_str(&p, end) < 0) {
+        break;
+      }
+      stat->lit_inc++;
+    } else if ((*p & 0x20)) {  /* dynamic table size update */
+      if (hpack_int(&p, end, 5, &idx) < 0) {
+        break;
+      }
+      continue;  /* not a header field */
+    } else {  /* literal without indexing or never indexed */
+      int is_never = (*p & 0x10);
+      if (hpack_int(&p, end, 4, &idx) < 0 ||
+          (idx == 0 && hpack_skip_str(&p, end) < 0) ||
+          hpack_skip_str(&p, end) < 0) {
+        break;
+      }
+      if (is_never) {
+        stat->lit_never++;
+      } else {
+        stat->lit_no_idx++;
+      }
+    }
+    stat->hdr_num++;
+  }
+}
+
+/* header block fragment from copied payload at blk[blk_len] */
+static void hpack_scan_frame_end(h2_hpack_scan *scan) {
+  unsigned char *pay = scan->blk + scan->blk_len;
+  int off = 0, len = scan->pay_len;
+
+  if (scan->frame_type != NGHTTP2_CONTINUATION &&
+      (scan->frame_flags & NGHTTP2_FLAG_PADDED)) {
+    if (len < 1 || pay[0] + 1 > len) {
+      scan->is_off = 1;
+      return;
+    }
+    len -= pay[0];
+    off = 1;
+  }
+  if (scan->frame_type == NGHTTP2_HEADERS &&
+      (scan->frame_flags & NGHTTP2_FLAG_PRIORITY)) {
+    off += 5;
+  } else if (scan->frame_type == NGHTTP2_PUSH_PROMISE) {
+    off += 4;  /* promised stream id */
+  }
+  if (off > len) {
+    scan->is_off = 1;
+    return;
+  }
+  memmove(pay, pay + off, len - off);
+  scan->blk_len += len - off;
+  scan->pay_len = 0;
+
+  if ((scan->frame_flags & NGHTTP2_FLAG_END_HEADERS)) {
+    hpack_scan_block(scan);
+    scan->blk_len = 0;
+  }
+}
+
+void h2_hpack_scan_feed(h2_hpack_scan *scan, const unsigned char *data,
+                        int size) {
+  const unsigned char *p = data, *end = data + size;
+  int n;
+
+  while (p < end && !scan->is_off) {
+    if (scan->preface_remain > 0) {
+      n = (end - p < scan->preface_remain)? end - p : scan->preface_remain;
+      scan->preface_remain -= n;
+      p += n;
+    } else if (scan->frame_remain > 0) {
+      n = (end - p < scan->frame_remain)? end - p : scan->frame_remain;
+      if (scan->is_frame_copy) {
+        memcpy(scan->blk + scan->blk_len + scan->pay_len, p, n);
+        scan->pay_len += n;
+      }
+      scan->frame_remain -= n;
+      p += n;
+      if (scan->frame_remain == 0 && scan->is_frame_copy) {
+        hpack_scan_frame_end(scan);
+      }
+    } else {
+      /* frame header */
+      n = 9 - scan->fhdr_len;
+      n = (end - p < n)? end - p : n;
+      memcpy(scan->fhdr + scan->fhdr_len, p, n);
+      scan->fhdr_len += n;
+      p += n;
+      if (scan->fhdr_len < 9) {
+        break;
+      }
+      scan->fhdr_len = 0;
+      scan->frame_remain = ((int)scan->fhdr[0] << 16) |
+                           ((int)scan->fhdr[1] << 8) | scan->fhdr[2];
+      scan->frame_type = scan->fhdr[3];
+      scan->frame_flags = scan->fhdr[4];
+      scan->is_frame_copy = (scan->frame_type == NGHTTP2_HEADERS ||
+                             scan->frame_type == NGHTTP2_PUSH_PROMISE ||
+                             scan->frame_type == NGHTTP2_CONTINUATION);
+      if (scan->is_frame_copy) {
+        int need = scan->blk_len + scan->frame_remain;
+        if (need > H2_HPACK_BLK_MAX) {
+          scan->is_off = 1;
+          break;
+        }
+        if (need > scan->blk_size) {
+          int size = (need > 4096)? need : 4096;
+          unsigned char *blk;
+          if ((blk = realloc(scan->blk, size)) == NULL) {
+            warnx("cannot allocate hpack scan block: size=%d", size);
+            scan->is_off = 1;
+            break;
+          }
+          scan->blk = blk;
+          scan->blk_size = size;
+        }
+        scan->pay_len = 0;
+        if (scan->frame_remain == 0) {
+          hpack_scan_frame_end(scan);
+        }
+      }
+    }
+  }
+}
+
+void h2_hpack_stat_add(h2_hpack_stat *dst, const h2_hpack_stat *src) {
+  dst->hdr_num += src->hdr_num;
+  dst->raw_bytes += src->raw_bytes;
+  dst->enc_bytes += src->enc_bytes;
+  dst->idx_static += src->idx_static;
+  dst->idx_dynamic += src->idx_dynamic;
+  dst->lit_inc += src->lit_inc;
+  dst->lit_no_idx += src->lit_no_idx;
+  dst->lit_never += src->lit_never;
+}
+
+void h2_hpack_stat_print(FILE *fp, const char *prefix, const char *dir,
+                         const h2_hpack_stat *stat, int tbl_size) {
+  char tbl_str[32] = "";
+
+  if (stat->hdr_num <= 0) {
+    return;
+  }
+  if (tbl_size >= 0) {
+    snprintf(tbl_str, sizeof(tbl_str), " table=%d", tbl_size);
+  }
+  fprintf(fp, "%sHPACK %s: %lld hdrs %lld -> %lld bytes (%.1f%%) "
+          "indexed static=%lld dynamic=%lld (%.1f%% hit) "
+          "literal inc=%lld no_idx=%lld never=%lld%s\n",
+          prefix, dir, stat->hdr_num, stat->raw_bytes, stat->enc_bytes,
+          (stat->raw_bytes > 0)? stat->enc_bytes * 100.0 / stat->raw_bytes : 0,
+          stat->idx_static, stat->idx_dynamic,
+          stat->idx_dynamic * 100.0 / stat->hdr_num,
+          stat->lit_inc, stat->lit_no_idx, stat->lit_never, tbl_str);
+}
+
+void h2_sess_print_hpack_stat_v2(h2_sess *sess) {
+  if (sess->ng_sess == NULL) {
+    return;
+  }
+  h2_hpack_stat_print(stderr, sess->log_prefix, "SEND", &sess->hpack_send.stat,
+      (int)nghttp2_session_get_hd_deflate_dynamic_table_size(sess->ng_sess));
+  h2_hpack_stat_print(stderr, sess->log_prefix, "RECV", &sess->hpack_recv.stat,
+      (int)nghttp2_session_get_hd_inflate_dynamic_table_size(sess->ng_sess));
+}
+
+static int ng_frame_send_cb(nghttp2_session *ng_sess,
+                            const nghttp2_frame *frame, void *user_data) {
+  h2_sess *sess = (h2_sess *)user_data;
+  const nghttp2_nv *nva = NULL;
+  size_t i, nvlen = 0;
+  h2_strm *strm;
+
+  if (frame->hd.type == NGHTTP2_HEADERS) {
+    nva = frame->headers.nva;
+    nvlen = frame->headers.nvlen;
+    /* request on wire; may be processed by server from now */
+    if (frame->headers.cat == NGHTTP2_HCAT_REQUEST &&
+        (strm = nghttp2_session_get_stream_user_data(ng_sess,
+                                                     frame->hd.stream_id))) {
+      strm->is_req_sent = 1;
+    }
+  } else if (frame->hd.type == NGHTTP2_PUSH_PROMISE) {
+    nva = frame->push_promise.nva;
+    nvlen = frame->push_promise.nvlen;
+  }
+  for (i = 0; i < nvlen; i++) {
+    sess->hpack_send.stat.raw_bytes += nva[i].namelen + nva[i].valuelen;
+  }
+  return 0;
+}
+
+
 /*
  * Http2 Settings Handling -------------------------------------------------
  */
@@ -884,10 +1486,23 @@ int h2_sess_send_settings_v2(h2_sess *sess) {
     warnx("submit setting failed: %s", nghttp2_strerror(r));
     return -1;
   }
+  if (sess->settings.conn_window_size >= 0) {
+    /* not a SETTINGS parameter; WINDOW_UPDATE on stream 0 up to the size */
+    r = nghttp2_session_set_local_window_size(sess->ng_sess,
+            NGHTTP2_FLAG_NONE, 0, sess->settings.conn_window_size);
+    if (r != 0) {
+      warnx("set connection window size failed: %s", nghttp2_strerror(r));
+      return -1;
+    }
+  }
   return h2_sess_send(sess);
 }
 
 int h2_sess_recv_v2(h2_sess *sess, const void *data, int size) {
+  if (sess->abuse_type) {
+    return size;  /* drop all till GOAWAY sent and closed */
+  }
+  h2_hpack_scan_feed(&sess->hpack_recv, data, size);
   int r = nghttp2_session_mem_recv(sess->ng_sess, data, size);
   if (r < 0) {
      warnx("HTTP2 read error; nghttp2_session_mem_recv failed: %s",
@@ -906,9 +1521,12 @@ void h2_sess_init_v2(h2_sess *sess) {
   nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, ng_frame_recv_cb);
   nghttp2_session_callbacks_set_on_stream_close_callback(cbs, ng_strm_close_cb);
   nghttp2_session_callbacks_set_error_callback2(cbs, ng_error2_cb);
+  nghttp2_session_callbacks_set_on_frame_send_callback(cbs, ng_frame_send_cb);
   if (sess->is_server) {
+    sess->hpack_recv.preface_remain = H2_CLIENT_PREFACE_LEN;
     nghttp2_session_server_new(&sess->ng_sess, cbs, sess);
   } else {
+    sess->hpack_send.preface_remain = H2_CLIENT_PREFACE_LEN;
     nghttp2_session_client_new(&sess->ng_sess, cbs, sess);
   }
   nghttp2_session_callbacks_del(cbs);
@@ -919,6 +1537,10 @@ void h2_sess_free_v2(h2_sess *sess) {
     nghttp2_session_del(sess->ng_sess);
     sess->ng_sess = NULL;
   }
+  free(sess->hpack_send.blk);
+  sess->hpack_send.blk = NULL;
+  free(sess->hpack_recv.blk);
+  sess->hpack_recv.blk = NULL;
 }
 
 void h2_sess_terminate_v2(h2_sess *sess) {
@@ -929,8 +1551,21 @@ void h2_sess_terminate_v2(h2_sess *sess) {
   }
 }
 
+int h2_sess_remote_max_strm_v2(h2_sess *sess) {
+  uint32_t n;
+  if (sess->ng_sess == NULL) {
+    return 0;
+  }
+  n = nghttp2_session_get_remote_settings(sess->ng_sess,
+                             NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+  return (n > 0x3fffffff)? 0x3fffffff : (int)n;  /* initially unlimited */
+}
+
 void h2_sess_shutdown_send_v2(h2_sess *sess) {
-  int n = nghttp2_session_get_next_stream_id(sess->ng_sess) - 1;
+  /* server: last request stream accepted; client: last pushed stream */
+  int n = (sess->is_server)?
+          nghttp2_session_get_last_proc_stream_id(sess->ng_sess) :
+          (int)nghttp2_session_get_next_stream_id(sess->ng_sess) - 1;
   int r = nghttp2_submit_goaway(sess->ng_sess, NGHTTP2_FLAG_NONE,
                                 n, NGHTTP2_NO_ERROR, NULL, 0);
   if (r < 0) {
@@ -942,6 +1577,16 @@ void h2_sess_shutdown_send_v2(h2_sess *sess) {
 }
 
 
+void h2_sess_drain_notice_v2(h2_sess *sess) {
+  /* GOAWAY with max last_stream_id; streams in flight are not refused */
+  int r = nghttp2_submit_shutdown_notice(sess->ng_sess);
+  if (r < 0) {
+    warnx("%snghttp2_submit_shutdown_notice() failed; ignored: %s",
+          sess->log_prefix, nghttp2_strerror(r));
+  }
+}
+
+
 /*
  * HTTP/1.1 to HTTP/2 Upgrade Handlers -------------------------------------
  */
@@ -33,12 +33,14 @@
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>    /* for hot restart handoff socket */
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/time.h>  /* for gettimeofday() */
 #include <sys/stat.h>  /* for file read */
 #include <fcntl.h>     /* for file read */
+#include <pthread.h>   /* for -N service threads */
 
 #ifdef TLS_MODE
 #include <openssl/ssl.h>
@@ -52,6 +54,7 @@
 
 
 int verbose = 1;
+int rsp_encode = 0;  /* precompress response bodies for accept-encoding */
 
 h2_settings h2svr_settings;
 
@@ -61,19 +64,80 @@ h2_settings h2svr_settings;
 #define RSP_CASE_MAX  100
 #define PUSH_PRM_MAX  100
 
+#define ENC_BODY_MIN  256  /* smaller bodies are not worth to compress */
+#define BULK_BODY_MIN  (64 * 1024)  /* larger -e bodies are sent by reference */
+
+#define RSP_CASE_JSON_MAX  4   /* json body conditions per rsp case */
+#define RSP_CASE_PRED_MAX  8   /* header, query and path predicates per case */
+
+
+/* response case fault types; see -F option */
+#define FAULT_RST    0  /* RST_STREAM instead of response */
+#define FAULT_CLOSE  1  /* abrupt close of the session */
+#define FAULT_STALL  2  /* response delayed */
+#define FAULT_TRUNC  3  /* response body cut then reset */
+#define FAULT_NUM    4
+
+#define FAULT_SESS_GOAWAY  (FAULT_NUM + 0)  /* stat index for -E goaway */
+#define FAULT_SESS_CLOSE   (FAULT_NUM + 1)  /* stat index for -E close */
+#define FAULT_STAT_NUM     (FAULT_NUM + 2)
+
 
 /* application context */
 
+/* request predicate compiled at load time; see -w option */
+#define PRED_HDR        0  /* header value of name */
+#define PRED_QUERY      1  /* query parameter value of name in path */
+#define PRED_PATH       2  /* path without query */
+#define PRED_AUTHORITY  3
+#define PRED_METHOD     4
+
+#define PRED_EXISTS     0
+#define PRED_EQ         1
+#define PRED_RE         2
+
+typedef struct req_pred {
+  int target;   /* PRED_HDR, PRED_QUERY, ... */
+  int op;       /* PRED_EXISTS, PRED_EQ or PRED_RE */
+  int negate;   /* '!' prefixed */
+  char *name;   /* header or query name; lower cased for header */
+  int name_len; /* header name is compared by first char, then the rest */
+  char *value;  /* for PRED_EQ */
+  int value_len;
+  h2_re *re;    /* for PRED_RE */
+} req_pred;
+
 typedef struct http2_rsp_case {
   /* request pattern */
   char *req_method;       /* static string; may be NULL */
   char *req_authority;    /* static string; may be NULL */
   char *req_path_prefix;  /* static string; may be NULL */
   int req_path_prefix_len;
+  struct {
+    int ptr_idx;            /* app_context.json_ptr index */
+    char *value;            /* static string; NULL for existence check */
+  } req_json[RSP_CASE_JSON_MAX];  /* request json body field conditions */
+  int req_json_num;
+  req_pred req_pred[RSP_CASE_PRED_MAX];  /* all should be true */
+  int req_pred_num;
 
   /* corresponding response */
   h2_msg *rsp;
 
+  /* multipart/related rsp body parts; sent as iov without concatenation */
+  h2_mpart mpart[H2_MPART_MAX];  /* content_type, content_id and body */
+  int mpart_num;                 /* are dynamic alloced */
+  char *mpart_hdr_buf;           /* delimiters and part headers */
+
+  /* -e body over BULK_BODY_MIN; referenced as iov not to copy per rsp */
+  /* NOTE: not compressed by -z */
+  void *bulk_body;
+
+  /* precompressed rsp body variants by content coding */
+  void *enc_body[H2_CODING_NUM];
+  int enc_body_len[H2_CODING_NUM];
+  int enc_mask;  /* bit-OR of (1 << H2_CODING_*) available */
+
 #ifdef GET_FILE
   /* GET path returns file contents of rsp_base_dir as root dir */
   char *rsp_base_dir;     /* static string; may be NULL */
@@ -83,15 +147,1053 @@ typedef struct http2_rsp_case {
   int push_prm_idx;      /* start of push promises for this req */
   int push_prm_num;      /* number of push promises for this req */
 
-} http2_rsp_case;
+  /* fault injection; picked by one random draw per request */
+  double fault_pct[FAULT_NUM];     /* rate in percent by FAULT_* */
+  uint32_t fault_thr[FAULT_NUM];   /* cumulative rate in 2^32 scale */
+  int fault_rst_code;              /* H2_ERR_* for RST_STREAM */
+  int fault_stall_msec;
+  int fault_trunc_len;             /* body bytes sent; <0 for half */
+
+} http2_rsp_case;
+
+typedef struct app_context {
+  http2_rsp_case rsp_case[RSP_CASE_MAX];
+  int rsp_case_num;
+
+  http2_rsp_case push_prm[PUSH_PRM_MAX];
+  int push_prm_num;
+
+  /* json pointers of all rsp cases; extracted at once per request */
+  h2_json_ptr *json_ptr[H2_JSON_PTR_MAX];
+  int json_ptr_num;
+} app_context;
+
+/* accepted session context */
+typedef struct sess_context {
+  app_context *app_ctx;
+  long long strm_cnt;   /* requests received; for session faults */
+} sess_context;
+
+/* response case metrics of a thread; indexed by case id */
+typedef struct case_stat {
+  long long req_num;   /* requests ended */
+  long long done_num;  /* of them, response fully written */
+  long long rx_bytes;  /* request body bytes */
+  long long tx_bytes;  /* response body bytes fully written */
+  h2_hist lat;         /* request received to response fully written */
+} case_stat;
+
+
+/*
+ * Service Threads ----------------------------------------------------------
+ * each thread runs its own h2_ctx on the shared listen sockets; run time
+ * stats are counted by the thread without locks and summed at report;
+ * sessions are moved between threads by h2_ctx_set_balance()
+ */
+
+#define THREAD_MAX  64
+
+typedef struct thread_context {
+  h2_ctx *ctx;
+  pthread_t pthread;
+  int idx;
+  int drain_req;  /* hot restart drain requested by thread 0; atomic */
+
+  long long req_num;
+  long long rx_bytes;  /* request body bytes */
+  long long tx_bytes;  /* response body bytes */
+  long long enc_rsp_num[H2_CODING_NUM];  /* responses sent per coding */
+  long long enc_saved_bytes;  /* identity body bytes - sent body bytes */
+  uint32_t fault_seed;
+  long long fault_cnt[FAULT_STAT_NUM];
+  case_stat *case_stat;  /* [case_stat_num] */
+} __attribute__((aligned(64))) thread_context;  /* no false sharing */
+
+static thread_context thr_ctx[THREAD_MAX];
+static int thread_num = 1;  /* see -N option */
+static __thread thread_context *thr = &thr_ctx[0];
+
+int bal_imbalance_pct = 20;  /* see -B option */
+int bal_interval_msec = 0;
+
+#define LISTEN_MAX  16  /* -S options to be listened by the threads */
+
+struct {
+  const char *authority;
+  h2_svr *svr;             /* of thread 0 */
+  const char *key_file;    /* NULL for http */
+  const char *cert_file;
+  const char *ssl_verify_str;
+} listen_spec[LISTEN_MAX];
+int listen_spec_num = 0;
+
+
+/*
+ * Response Body Content Coding ---------------------------------------------
+ * bodies are compressed once at load time and the variant is selected
+ * by request's accept-encoding
+ */
+
+static struct {
+  long long enc_cpu_usec;  /* load time compression cpu */
+  long long enc_in_bytes;
+  long long enc_out_bytes;
+} enc_stat;  /* responses sent are in thread_context */
+
+static void encode_body_variants(h2_msg *rsp, void *body, int body_len,
+                                 void **enc_body, int *enc_body_len,
+                                 int *enc_mask) {
+  long long cpu_usec;
+  int i;
+
+  *enc_mask = 0;
+  if (!rsp_encode || body == NULL || body_len < ENC_BODY_MIN ||
+      (rsp && h2_hdr_value(rsp, "content-encoding"))) {
+    return;  /* not to compress or already encoded by -x */
+  }
+  cpu_usec = h2_cpu_usec();
+  for (i = H2_CODING_IDENTITY + 1; i < H2_CODING_NUM; i++) {
+    if (h2_body_encode(i, body, body_len,
+                       &enc_body[i], &enc_body_len[i]) < 0) {
+      continue;
+    }
+    if (enc_body_len[i] >= body_len) {
+      free(enc_body[i]);  /* no gain */
+      enc_body[i] = NULL;
+      continue;
+    }
+    *enc_mask |= (1 << i);
+    enc_stat.enc_in_bytes += body_len;
+    enc_stat.enc_out_bytes += enc_body_len[i];
+  }
+  enc_stat.enc_cpu_usec += h2_cpu_usec() - cpu_usec;
+}
+
+static void encode_rsp_case(http2_rsp_case *rc) {
+  const struct iovec *iov;
+  char *body = NULL;
+  int i, iov_num, len = 0;
+
+  if (h2_body(rc->rsp) || !(iov = h2_body_iov(rc->rsp, &iov_num))) {
+    encode_body_variants(rc->rsp, h2_body(rc->rsp), h2_body_len(rc->rsp),
+                         rc->enc_body, rc->enc_body_len, &rc->enc_mask);
+    return;
+  }
+  /* large -e body is referenced by iov; flattened to compress once */
+  if (rsp_encode && (body = malloc(h2_body_len(rc->rsp))) == NULL) {
+    fprintf(stderr, "cannot allocate body to encode: len=%d\n",
+            h2_body_len(rc->rsp));
+    return;
+  }
+  for (i = 0; body && i < iov_num; i++) {
+    memcpy(body + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  encode_body_variants(rc->rsp, body, len,
+                       rc->enc_body, rc->enc_body_len, &rc->enc_mask);
+  free(body);
+}
+
+static void free_rsp_case_enc(http2_rsp_case *rc) {
+  int i;
+  for (i = 0; i < H2_CODING_NUM; i++) {
+    free(rc->enc_body[i]);
+    rc->enc_body[i] = NULL;
+  }
+  rc->enc_mask = 0;
+}
+
+/* replace rsp body with encoded variant for req's accept-encoding */
+static void set_rsp_body_coding(h2_msg *rsp, h2_msg *req, int body_len,
+                                void **enc_body, int *enc_body_len,
+                                int enc_mask) {
+  int coding = H2_CODING_IDENTITY;
+
+  if (enc_mask) {
+    coding = h2_coding_select(h2_hdr_value(req, "accept-encoding"), enc_mask);
+    h2_set_hdr(rsp, "vary", "accept-encoding");
+  }
+  if (coding != H2_CODING_IDENTITY) {
+    h2_cpy_body(rsp, enc_body[coding], enc_body_len[coding]);
+    h2_set_hdr(rsp, "content-encoding", h2_coding_name(coding));
+    thr->enc_saved_bytes += body_len - enc_body_len[coding];
+  }
+  thr->enc_rsp_num[coding]++;
+}
+
+static void print_enc_stat(void) {
+  long long rsp_num[H2_CODING_NUM] = { 0 }, saved_bytes = 0;
+  int i, c;
+  if (!rsp_encode) {
+    return;
+  }
+  for (i = 0; i < thread_num; i++) {
+    for (c = 0; c < H2_CODING_NUM; c++) {
+      rsp_num[c] += thr_ctx[i].enc_rsp_num[c];
+    }
+    saved_bytes += thr_ctx[i].enc_saved_bytes;
+  }
+  long long enc_rsp_num = rsp_num[H2_CODING_GZIP] +
+                          rsp_num[H2_CODING_DEFLATE];
+  fprintf(stderr, "CONTENT CODING: load compress %lld -> %lld bytes "
+          "in %lld cpu usec; rsps identity=%lld gzip=%lld deflate=%lld; "
+          "%lld bytes saved (%.1f bytes per compress cpu usec)\n",
+          enc_stat.enc_in_bytes, enc_stat.enc_out_bytes,
+          enc_stat.enc_cpu_usec, rsp_num[H2_CODING_IDENTITY],
+          rsp_num[H2_CODING_GZIP], rsp_num[H2_CODING_DEFLATE], saved_bytes,
+          (enc_rsp_num > 0 && enc_stat.enc_cpu_usec > 0)?
+          (double)saved_bytes / enc_stat.enc_cpu_usec : 0);
+}
+
+
+#ifdef GET_FILE
+/*
+ * Response File Cache ------------------------------------------------------
+ * file is loaded and compressed on first request and reloaded on change;
+ * shared by threads under file_cache_lock
+ */
+
+#define FILE_CACHE_MAX       1024
+#define FILE_CACHE_SLOT_NUM  (FILE_CACHE_MAX * 2)  /* power of 2 */
+#define FILE_CACHE_BODY_MAX  (16 * 1024 * 1024)
+
+typedef struct file_cache {
+  char *path;
+  time_t mtime;
+  off_t size;
+  void *body;
+  int body_len;
+  void *enc_body[H2_CODING_NUM];
+  int enc_body_len[H2_CODING_NUM];
+  int enc_mask;
+} file_cache;
+
+static file_cache file_cache_slot[FILE_CACHE_SLOT_NUM];
+static int file_cache_num = 0;
+static pthread_mutex_t file_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void file_cache_clear(file_cache *fc) {
+  int i;
+  free(fc->body);
+  fc->body = NULL;
+  for (i = 0; i < H2_CODING_NUM; i++) {
+    free(fc->enc_body[i]);
+    fc->enc_body[i] = NULL;
+  }
+  fc->enc_mask = 0;
+}
+
+/* returns cached file or NULL if not cacheable; file_cache_lock held */
+static file_cache *file_cache_get(const char *path) {
+  struct stat st;
+  unsigned int h = 5381;
+  const char *p;
+  file_cache *fc = NULL;
+  int i;
+
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) ||
+      st.st_size > FILE_CACHE_BODY_MAX) {
+    return NULL;
+  }
+  for (p = path; *p; p++) {
+    h = h * 33 + (unsigned char)*p;
+  }
+  for (i = 0; i < FILE_CACHE_SLOT_NUM; i++) {
+    fc = &file_cache_slot[(h + i) & (FILE_CACHE_SLOT_NUM - 1)];
+    if (fc->path == NULL || !strcmp(fc->path, path)) {
+      break;
+    }
+  }
+  if (fc->path == NULL) {
+    if (file_cache_num >= FILE_CACHE_MAX) {
+      return NULL;  /* cache full */
+    }
+    fc->path = strdup(path);
+    file_cache_num++;
+  } else if (fc->body && fc->mtime == st.st_mtime && fc->size == st.st_size) {
+    return fc;  /* cache hit */
+  }
+
+  file_cache_clear(fc);
+  if (h2_body_from_file((char *)path, &fc->body, &fc->body_len) < 0) {
+    return NULL;
+  }
+  fc->mtime = st.st_mtime;
+  fc->size = st.st_size;
+  encode_body_variants(NULL, fc->body, fc->body_len,
+                       fc->enc_body, fc->enc_body_len, &fc->enc_mask);
+  return fc;
+}
+
+static void file_cache_free(void) {
+  int i;
+  for (i = 0; i < FILE_CACHE_SLOT_NUM; i++) {
+    file_cache_clear(&file_cache_slot[i]);
+    free(file_cache_slot[i].path);
+    file_cache_slot[i].path = NULL;
+  }
+  file_cache_num = 0;
+}
+#endif
+
+
+/*
+ * Request JSON Body Conditions ---------------------------------------------
+ */
+
+/* add -j /json_pointer[=value] condition to the rsp case */
+static int add_req_json_cond(app_context *app_ctx, http2_rsp_case *rc,
+                             char *ptr_value_str) {
+  char *value = strchr(ptr_value_str, '=');
+  int i;
+
+  if (rc->req_json_num >= RSP_CASE_JSON_MAX) {
+    fprintf(stderr, "too many json conditions per case; max=%d: %s\n",
+            RSP_CASE_JSON_MAX, ptr_value_str);
+    return -1;
+  }
+  if (value) {
+    *value++ = '\0';
+  }
+  for (i = 0; i < app_ctx->json_ptr_num; i++) {
+    if (!strcmp(h2_json_ptr_str(app_ctx->json_ptr[i]), ptr_value_str)) {
+      break;  /* shared with other case */
+    }
+  }
+  if (i == app_ctx->json_ptr_num) {
+    if (app_ctx->json_ptr_num >= H2_JSON_PTR_MAX) {
+      fprintf(stderr, "too many json pointers; max=%d: %s\n",
+              H2_JSON_PTR_MAX, ptr_value_str);
+      return -2;
+    }
+    if ((app_ctx->json_ptr[i] = h2_json_ptr_compile(ptr_value_str)) == NULL) {
+      return -3;
+    }
+    app_ctx->json_ptr_num++;
+  }
+  rc->req_json[rc->req_json_num].ptr_idx = i;
+  rc->req_json[rc->req_json_num].value = value;
+  rc->req_json_num++;
+  return 0;
+}
+
+static void extract_req_json(app_context *app_ctx, h2_msg *req,
+                             h2_json_val *json_val) {
+  const void *json = h2_body(req);
+  int json_len = h2_body_len(req);
+  const char *boundary;
+  int i, boundary_len;
+
+  /* use the json part of multipart/related body; ex) N1N2MessageTransfer */
+  boundary_len = h2_mpart_boundary(h2_hdr_value(req, "content-type"),
+                                   &boundary);
+  if (boundary_len > 0) {
+    h2_mpart parts[H2_MPART_MAX];
+    int n = h2_mpart_parse(json, json_len, boundary, boundary_len,
+                           parts, H2_MPART_MAX);
+    if ((i = h2_mpart_find(parts, n, "application/json")) >= 0) {
+      json = parts[i].body;
+      json_len = parts[i].body_len;
+    } else {
+      json_len = 0;
+    }
+  }
+
+  if (json_len <= 0 ||
+      h2_json_extract(json, json_len, app_ctx->json_ptr,
+                      app_ctx->json_ptr_num, json_val) < 0) {
+    for (i = 0; i < app_ctx->json_ptr_num; i++) {
+      json_val[i].type = H2_JSON_NONE;  /* no body or malformed */
+    }
+  }
+}
+
+
+/*
+ * Request Predicates -------------------------------------------------------
+ * compiled once at load; evaluated on the received message's header array
+ * and path without allocation
+ */
+
+/* add -w [!]name[=value|~regex] predicate to the rsp case */
+static int add_req_pred(http2_rsp_case *rc, char *pred_str) {
+  req_pred *pd;
+  char *name = pred_str, *op;
+  int i;
+
+  if (rc->req_pred_num >= RSP_CASE_PRED_MAX) {
+    fprintf(stderr, "too many predicates per case; max=%d: %s\n",
+            RSP_CASE_PRED_MAX, pred_str);
+    return -1;
+  }
+  pd = &rc->req_pred[rc->req_pred_num];
+  memset(pd, 0, sizeof(req_pred));
+  if (*name == '!') {
+    pd->negate = 1;
+    name++;
+  }
+  op = name + strcspn(name, "=~");
+  pd->op = (*op == '=')? PRED_EQ : (*op == '~')? PRED_RE : PRED_EXISTS;
+  if (op == name) {
+    fprintf(stderr, "predicate name missing: %s\n", pred_str);
+    return -2;
+  }
+
+  if (op - name == 5 && !strncmp(name, ":path", 5)) {
+    pd->target = PRED_PATH;
+  } else if (op - name == 10 && !strncmp(name, ":authority", 10)) {
+    pd->target = PRED_AUTHORITY;
+  } else if (op - name == 7 && !strncmp(name, ":method", 7)) {
+    pd->target = PRED_METHOD;
+  } else if (*name == ':') {
+    fprintf(stderr, "unknown pseudo header for predicate: %s\n", pred_str);
+    return -2;
+  } else if (*name == '?') {
+    pd->target = PRED_QUERY;
+    pd->name = strndup(name + 1, op - name - 1);
+  } else {
+    pd->target = PRED_HDR;
+    pd->name = strndup(name, op - name);
+    for (i = 0; pd->name[i]; i++) {
+      pd->name[i] = tolower(pd->name[i]);
+    }
+  }
+  pd->name_len = (pd->name)? (int)strlen(pd->name) : 0;
+
+  if (pd->op == PRED_EQ) {
+    pd->value = strdup(op + 1);
+    pd->value_len = strlen(pd->value);
+  } else if (pd->op == PRED_RE &&
+             (pd->re = h2_re_compile(op + 1)) == NULL) {
+    free(pd->name);  /* slot is not counted; leave it clean for reuse */
+    memset(pd, 0, sizeof(req_pred));
+    return -3;
+  }
+  rc->req_pred_num++;
+  return 0;
+}
+
+static void free_req_pred(http2_rsp_case *rc) {
+  int i;
+  for (i = 0; i < rc->req_pred_num; i++) {
+    free(rc->req_pred[i].name);
+    free(rc->req_pred[i].value);
+    h2_re_free(rc->req_pred[i].re);
+  }
+  rc->req_pred_num = 0;
+}
+
+/* returns target value of the predicate in req; NULL if not exists */
+static const char *req_pred_value(req_pred *pd, h2_msg *req, int *len_ret) {
+  const char *v = NULL, *p, *e, *name;
+  int i, n;
+
+  switch (pd->target) {
+  case PRED_HDR:
+    /* HTTP/1.1 names are not lower cased; first char rejects most */
+    n = h2_hdr_num(req);
+    for (i = 0; i < n; i++) {
+      name = h2_hdr_idx_name(req, i);
+      if (tolower((unsigned char)name[0]) == pd->name[0] &&
+          !strncasecmp(name + 1, pd->name + 1, pd->name_len - 1) &&
+          name[pd->name_len] == '\0') {
+        v = h2_hdr_idx_value(req, i);
+        *len_ret = strlen(v);
+        break;
+      }
+    }
+    break;
+  case PRED_PATH:
+    if ((v = h2_path(req))) {  /* NULL for HTTP/1.1 with no target */
+      *len_ret = strcspn(v, "?");
+    }
+    break;
+  case PRED_QUERY:
+    if ((p = h2_path(req)) == NULL || (p = strchr(p, '?')) == NULL) {
+      break;
+    }
+    for (p++; *p; p = e + (*e == '&')) {
+      e = p + strcspn(p, "&");
+      n = strcspn(p, "=&");
+      if (n == pd->name_len && !memcmp(p, pd->name, n)) {
+        v = (p[n] == '=')? p + n + 1 : p + n;
+        *len_ret = e - v;
+        break;
+      }
+    }
+    break;
+  case PRED_AUTHORITY:
+    v = h2_authority(req);
+    *len_ret = (v)? (int)strlen(v) : 0;
+    break;
+  case PRED_METHOD:
+    v = h2_method(req);
+    *len_ret = (v)? (int)strlen(v) : 0;
+    break;
+  }
+  return v;
+}
+
+/* returns 1 if all predicates of the rsp case are true */
+static int match_req_pred(http2_rsp_case *rc, h2_msg *req) {
+  req_pred *pd = rc->req_pred;
+  const char *v;
+  int n, r, len = 0;
+
+  for (n = rc->req_pred_num; n > 0; n--, pd++) {
+    v = req_pred_value(pd, req, &len);
+    if (v == NULL) {
+      r = 0;
+    } else if (pd->op == PRED_EQ) {
+      r = (len == pd->value_len && !memcmp(v, pd->value, len));
+    } else if (pd->op == PRED_RE) {
+      r = h2_re_match(pd->re, v, len);
+    } else {
+      r = 1;
+    }
+    if (r == pd->negate) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+ * Multipart Response Body --------------------------------------------------
+ * parts are loaded once and the rsp body refers them by iov, so that
+ * multipart responses are sent without per response concatenation
+ */
+
+/* add -y content_type[:content_id]=file|0xhex part to the rsp case */
+static int add_rsp_mpart(http2_rsp_case *rc, char *part_str) {
+  if (rc->mpart_num >= H2_MPART_MAX) {
+    fprintf(stderr, "too many multipart parts per case; max=%d: %s\n",
+            H2_MPART_MAX, part_str);
+    return -1;
+  }
+  if (h2_mpart_load(&rc->mpart[rc->mpart_num], part_str) < 0) {
+    return -2;
+  }
+  rc->mpart_num++;
+  return 0;
+}
+
+/* set rsp body of the case as iov of the parts */
+static int build_rsp_mpart(http2_rsp_case *rc) {
+  if (rc->mpart_num == 0) {
+    return 0;
+  }
+  if (h2_body_len(rc->rsp) > 0) {
+    fprintf(stderr, "multipart parts cannot be used with rsp body: %s\n",
+            (rc->req_path_prefix)? rc->req_path_prefix : rc->req_method);
+    return -1;
+  }
+  if (h2_mpart_set_body(rc->rsp, rc->mpart, rc->mpart_num,
+                        &rc->mpart_hdr_buf) < 0) {
+    return -2;
+  }
+  return 0;
+}
+
+static void free_rsp_mpart(http2_rsp_case *rc) {
+  h2_mpart_free(rc->mpart, rc->mpart_num);
+  rc->mpart_num = 0;
+  free(rc->mpart_hdr_buf);
+  rc->mpart_hdr_buf = NULL;
+}
+
+
+/*
+ * Fault Injection ----------------------------------------------------------
+ * response case faults are picked by one xorshift draw per request against
+ * cumulative thresholds computed at load time; session faults are by
+ * stream count of the session; cheap enough to be on at full tps
+ */
+
+static const char *fault_name[FAULT_STAT_NUM] = {
+  "rst", "close", "stall", "trunc", "sess_goaway", "sess_close"
+};
+
+static struct {
+  long long goaway_after;  /* GOAWAY after the streams of each session */
+  long long close_after;   /* abort at the streams of each session */
+} sess_fault;
+
+static int fault_on = 0;  /* seed and counts are in thread_context */
+
+static inline uint32_t fault_rand(void) {
+  uint32_t x = thr->fault_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return (thr->fault_seed = x);
+}
+
+static int add_rsp_fault(http2_rsp_case *rc, char *fault_str) {
+  /* fault_str: type=percent[:arg] */
+  char *eq = strchr(fault_str, '='), *arg;
+  int f, i;
+
+  for (f = 0; f < FAULT_NUM; f++) {
+    if (eq && eq - fault_str == (int)strlen(fault_name[f]) &&
+        !strncmp(fault_str, fault_name[f], eq - fault_str)) {
+      break;
+    }
+  }
+  if (f >= FAULT_NUM) {
+    fprintf(stderr, "unknown fault type: %s\n", fault_str);
+    return -1;
+  }
+  double pct = strtod(eq + 1, &arg);
+  if (arg == eq + 1 || pct < 0 || pct > 100 || (*arg && *arg != ':')) {
+    fprintf(stderr, "invalid fault rate percent: %s\n", fault_str);
+    return -1;
+  }
+  arg = (*arg == ':')? arg + 1 : NULL;
+
+  switch (f) {
+  case FAULT_RST:
+    rc->fault_rst_code = (arg)? h2_err_code_from_name(arg) :
+                                H2_ERR_INTERNAL_ERROR;
+    if (rc->fault_rst_code < 0) {
+      fprintf(stderr, "unknown rst error code: %s\n", arg);
+      return -1;
+    }
+    break;
+  case FAULT_STALL:
+    rc->fault_stall_msec = (arg)? atoi(arg) : 1000;
+    break;
+  case FAULT_TRUNC:
+    rc->fault_trunc_len = (arg)? atoi(arg) : -1;
+    break;
+  }
+
+  double sum = 0;
+  rc->fault_pct[f] = pct;
+  for (i = 0; i < FAULT_NUM; i++) {
+    sum += rc->fault_pct[i];
+    if (sum > 100) {
+      fprintf(stderr, "fault rates of the case over 100 percent: %s\n",
+              fault_str);
+      return -1;
+    }
+    rc->fault_thr[i] = (uint32_t)(sum / 100 * 4294967295.0);
+  }
+  fault_on = 1;
+  return 0;
+}
+
+static int add_sess_fault(char *fault_str) {
+  /* fault_str: goaway=streams | close=streams */
+  long long n;
+  if (sscanf(fault_str, "goaway=%lld", &n) == 1 && n > 0) {
+    sess_fault.goaway_after = n;
+  } else if (sscanf(fault_str, "close=%lld", &n) == 1 && n > 0) {
+    sess_fault.close_after = n;
+  } else {
+    fprintf(stderr, "invalid session fault: %s\n", fault_str);
+    return -1;
+  }
+  fault_on = 1;
+  return 0;
+}
+
+/* returns fault picked for the request or FAULT_NUM for none */
+static int pick_rsp_fault(http2_rsp_case *rc) {
+  int f = FAULT_NUM;
+  if (rc->fault_thr[FAULT_NUM - 1] > 0) {
+    uint32_t r = fault_rand();
+    for (f = 0; f < FAULT_NUM && r >= rc->fault_thr[f]; f++) {
+    }
+    if (f < FAULT_NUM) {
+      thr->fault_cnt[f]++;
+    }
+  }
+  return f;
+}
+
+/* returns 1 if the session is aborted, else 0 */
+static int inject_sess_fault(h2_sess *sess, sess_context *sc) {
+  sc->strm_cnt++;
+  if (sess_fault.close_after > 0 && sc->strm_cnt >= sess_fault.close_after) {
+    thr->fault_cnt[FAULT_SESS_CLOSE]++;
+    h2_sess_abort(sess);
+    return 1;
+  }
+  if (sess_fault.goaway_after > 0 &&
+      sc->strm_cnt == sess_fault.goaway_after) {
+    thr->fault_cnt[FAULT_SESS_GOAWAY]++;
+    h2_sess_terminate(sess, 1/* GOAWAY after responses in progress */);
+  }
+  return 0;
+}
+
+static void print_fault_stat(void) {
+  long long cnt;
+  int f, i;
+  if (!fault_on) {
+    return;
+  }
+  fprintf(stderr, "FAULT INJECTED:");
+  for (f = 0; f < FAULT_STAT_NUM; f++) {
+    for (cnt = 0, i = 0; i < thread_num; i++) {
+      cnt += thr_ctx[i].fault_cnt[f];
+    }
+    fprintf(stderr, " %s=%lld", fault_name[f], cnt);
+  }
+  fprintf(stderr, "\n");
+}
+
+
+/*
+ * Traffic Capture ----------------------------------------------------------
+ * requests are recorded for h2cli -L replay; file write is on a thread
+ */
+
+#define CAPTURE_FLUSH_USEC  1000000  /* partial buffer write on idle */
+
+h2_cap *capture = NULL;  /* see -C option */
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;  /* -N threads */
+
+static int capture_open(const char *arg) {
+  int body_mode = H2_CAP_BODY;
+  if (!strncmp(arg, "hash:", 5)) {
+    body_mode = H2_CAP_BODY_HASH;
+    arg += 5;
+  }
+  if (capture) {
+    fprintf(stderr, "-C capture file is already given: %s\n", arg);
+    return -1;
+  }
+  if ((capture = h2_cap_open(arg, body_mode)) == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+static void capture_timer_cb(h2_ctx *ctx, void *user_data) {
+  pthread_mutex_lock(&capture_lock);
+  h2_cap_flush(capture);
+  pthread_mutex_unlock(&capture_lock);
+  h2_timer_add(ctx, CAPTURE_FLUSH_USEC, capture_timer_cb, user_data);
+}
+
+
+/*
+ * Request Admission --------------------------------------------------------
+ * server capacity emulation by 3gpp-sbi-message-priority class lanes;
+ * lower priority requests are shed by 503 first under overload; with -N
+ * threads, the rate and queue are divided to the threads
+ */
+
+h2_admit_stat admit_stat[H2_PRIO_CLASS_NUM];
+int admit_rate = 0;  /* see -A option */
+int admit_queue_max = 0;
+
+static int set_admission(const char *arg) {
+  int rate = 0, queue_max = 0;
+  if (sscanf(arg, "%d:%d", &rate, &queue_max) < 1 ||
+      rate <= 0 || queue_max < 0) {
+    fprintf(stderr, "invalid -A rate[:queue_max] option value: %s\n", arg);
+    return -1;
+  }
+  admit_rate = rate;
+  admit_queue_max = queue_max;
+  return 0;
+}
+
+static void apply_admission(h2_ctx *ctx) {
+  int rate = admit_rate / thread_num;
+  int queue_max = admit_queue_max / thread_num;
+  h2_ctx_set_admission(ctx, (rate > 0)? rate : 1,
+                       (admit_queue_max > 0 && queue_max <= 0)? 1 : queue_max);
+}
+
+static void add_admit_stat(h2_ctx *ctx) {
+  h2_admit_stat ast[H2_PRIO_CLASS_NUM];
+  int c;
+  if (!h2_ctx_get_admit_stat(ctx, ast)) {
+    return;
+  }
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    admit_stat[c].admit_cnt += ast[c].admit_cnt;
+    admit_stat[c].queue_cnt += ast[c].queue_cnt;
+    admit_stat[c].wait_usec_sum += ast[c].wait_usec_sum;
+    if (admit_stat[c].wait_usec_max < ast[c].wait_usec_max) {
+      admit_stat[c].wait_usec_max = ast[c].wait_usec_max;
+    }
+    admit_stat[c].shed_cnt += ast[c].shed_cnt;
+    admit_stat[c].drop_cnt += ast[c].drop_cnt;
+  }
+}
+
+static void print_admit_stat(void) {
+  int c;
+  if (admit_rate <= 0) {
+    return;
+  }
+  for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+    h2_admit_stat *st = &admit_stat[c];
+    if (st->admit_cnt + st->shed_cnt + st->drop_cnt == 0) {
+      continue;
+    }
+    fprintf(stderr, "ADMISSION[%d] prio %d~%d: admitted=%lld (queued=%lld "
+            "wait avg=%lld max=%lld usec) shed=%lld dropped=%lld\n", c,
+            c * (H2_PRIO_MAX + 1) / H2_PRIO_CLASS_NUM,
+            (c + 1) * (H2_PRIO_MAX + 1) / H2_PRIO_CLASS_NUM - 1,
+            st->admit_cnt, st->queue_cnt,
+            (st->queue_cnt > 0)? st->wait_usec_sum / st->queue_cnt : 0,
+            st->wait_usec_max, st->shed_cnt, st->drop_cnt);
+  }
+}
+
+
+/*
+ * Response Case Metrics ----------------------------------------------------
+ * counted at stream end into the slot of the case id set on the stream by
+ * request_cb; ids after rsp cases are for 404 and admission rejects
+ */
+
+#define CASE_ID_404(app_ctx)    ((app_ctx)->rsp_case_num)
+#define CASE_ID_ADMIT(app_ctx)  ((app_ctx)->rsp_case_num + 1)
+#define CASE_STAT_NUM(app_ctx)  ((app_ctx)->rsp_case_num + 2)
+
+/* strm_user_data of case id; NULL for not counted */
+#define CASE_ID_DATA(id)  ((void *)(intptr_t)((id) + 1))
+
+int report_interval_sec = 0;  /* see -I option */
+
+static void case_stat_done_cb(h2_sess *sess, h2_strm *strm,
+                              void *sess_user_data, void *strm_user_data,
+                              const h2_strm_result *result) {
+  sess_context *sc = sess_user_data;
+  int id = (int)(intptr_t)strm_user_data - 1;
+  (void)sess;
+  (void)strm;
+
+  if (id < 0) {
+    if (!result->is_rejected || sc == NULL) {
+      return;  /* eg. stat endpoint or bad request */
+    }
+    id = CASE_ID_ADMIT(sc->app_ctx);
+  }
+  case_stat *cs = &thr->case_stat[id];
+  cs->req_num++;
+  cs->rx_bytes += result->req_body_len;
+  if (result->is_done) {
+    cs->done_num++;
+    cs->tx_bytes += result->rsp_body_len;
+    h2_hist_add(&cs->lat, result->latency_usec);
+  }
+}
+
+static const char *case_stat_name(app_context *app_ctx, int id,
+                                  char *buf, int buf_size) {
+  http2_rsp_case *rc = &app_ctx->rsp_case[id];
+  if (id == CASE_ID_404(app_ctx)) {
+    return "404";
+  } else if (id == CASE_ID_ADMIT(app_ctx)) {
+    return "admission";
+  }
+  snprintf(buf, buf_size, "%s %s", rc->req_method,
+           (rc->req_path_prefix)? rc->req_path_prefix : "*");
+  return buf;
+}
+
+/* sum of the threads; other threads' are read while running */
+static void case_stat_sum(int id, case_stat *sum) {
+  int i;
+  memset(sum, 0, sizeof(*sum));
+  for (i = 0; i < thread_num; i++) {
+    case_stat *cs = &thr_ctx[i].case_stat[id];
+    sum->req_num += cs->req_num;
+    sum->done_num += cs->done_num;
+    sum->rx_bytes += cs->rx_bytes;
+    sum->tx_bytes += cs->tx_bytes;
+    h2_hist_merge(&sum->lat, &cs->lat);
+  }
+}
+
+static case_stat *case_stat_last = NULL;  /* for interval report */
+
+static void case_stat_timer_cb(h2_ctx *ctx, void *user_data) {
+  app_context *app_ctx = user_data;
+  case_stat cs, *last;
+  h2_hist lat;
+  char name[256];
+  int id, b;
+
+  for (id = 0; id < CASE_STAT_NUM(app_ctx); id++) {
+    case_stat_sum(id, &cs);
+    last = &case_stat_last[id];
+    if (cs.req_num == last->req_num) {
+      continue;
+    }
+    /* latency of the interval; min and max are not known */
+    lat.cnt = cs.lat.cnt - last->lat.cnt;
+    lat.sum = cs.lat.sum - last->lat.sum;
+    lat.min = 0;
+    lat.max = LLONG_MAX;
+    for (b = 0; b < H2_HIST_BUCKET_NUM; b++) {
+      lat.bucket[b] = cs.lat.bucket[b] - last->lat.bucket[b];
+    }
+    fprintf(stderr, "CASE[%d] %s: %.1f tps; %lld reqs %lld failed; "
+            "rx=%lld tx=%lld body bytes; latency(usec) avg=%lld p50=%lld "
+            "p99=%lld\n", id, case_stat_name(app_ctx, id, name, sizeof(name)),
+            (double)(cs.req_num - last->req_num) / report_interval_sec,
+            cs.req_num - last->req_num,
+            (cs.req_num - cs.done_num) - (last->req_num - last->done_num),
+            cs.rx_bytes - last->rx_bytes, cs.tx_bytes - last->tx_bytes,
+            (lat.cnt > 0)? lat.sum / lat.cnt : 0,
+            h2_hist_percentile(&lat, 50.0), h2_hist_percentile(&lat, 99.0));
+    *last = cs;
+  }
+  h2_timer_add(ctx, report_interval_sec * 1000000LL, case_stat_timer_cb,
+               user_data);
+}
+
+static void print_case_stat(app_context *app_ctx) {
+  case_stat cs;
+  char name[256], title[300];
+  int id;
+
+  for (id = 0; id < CASE_STAT_NUM(app_ctx); id++) {
+    case_stat_sum(id, &cs);
+    if (cs.req_num == 0) {
+      continue;
+    }
+    fprintf(stderr, "CASE[%d] %s: %lld reqs (%lld failed); "
+            "rx=%lld tx=%lld body bytes\n", id,
+            case_stat_name(app_ctx, id, name, sizeof(name)), cs.req_num,
+            cs.req_num - cs.done_num, cs.rx_bytes, cs.tx_bytes);
+    snprintf(title, sizeof(title), "CASE[%d] LATENCY(usec)", id);
+    h2_hist_print(stderr, &cs.lat, title);
+  }
+}
+
+
+/*
+ * Stats Endpoint -----------------------------------------------------------
+ * run time resource usage as json on GET of -T path; for backpressure tests
+ * by slow clients to watch server memory and blocked sessions during a run
+ */
+
+char *stat_path = NULL;  /* see -T option */
+int stat_path_len = 0;
+
+static int is_stat_req(h2_msg *req) {
+  const char *path = h2_path(req);
+  return (stat_path && path && !strncmp(path, stat_path, stat_path_len) &&
+          (path[stat_path_len] == '\0' || path[stat_path_len] == '?'));
+}
+
+static long long stat_rss_kb(void) {
+  long long size, rss = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    if (fscanf(fp, "%lld %lld", &size, &rss) != 2) {
+      rss = 0;
+    }
+    fclose(fp);
+  }
+  return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void print_resource_stat(void) {
+  long long cpu_usec = h2_proc_cpu_usec();
+  long long req_num = 0, rx_bytes = 0, tx_bytes = 0, bytes;
+  int i;
+
+  /* body bytes for cpu per byte */
+  for (i = 0; i < thread_num; i++) {
+    req_num += thr_ctx[i].req_num;
+    rx_bytes += thr_ctx[i].rx_bytes;
+    tx_bytes += thr_ctx[i].tx_bytes;
+  }
+  bytes = rx_bytes + tx_bytes;
+  fprintf(stderr, "RESOURCE: %lld reqs; rx=%lld tx=%lld body bytes; "
+          "cpu=%lld usec %.2f cycles/byte at %.0f MHz; peak rss=%lld kB\n",
+          req_num, rx_bytes, tx_bytes, cpu_usec,
+          (bytes > 0)? cpu_usec * h2_cpu_mhz() / bytes : 0, h2_cpu_mhz(),
+          h2_peak_rss_kb());
+}
+
+static int send_stat_rsp(h2_sess *sess, h2_strm *strm, h2_msg *req,
+                         app_context *app_ctx) {
+  h2_ctx_stat stat;
+  h2_admit_stat ast[H2_PRIO_CLASS_NUM];
+  h2_bal_stat bst;
+  case_stat cs;
+  char name[256];
+  int body_size = 1536 + CASE_STAT_NUM(app_ctx) * 512;
+  char *body = malloc(body_size);
+  int body_len, rs, c, id;
 
-typedef struct app_context {
-  http2_rsp_case rsp_case[RSP_CASE_MAX];
-  int rsp_case_num;
+  h2_ctx_get_stat(h2_sess_ctx(sess), &stat);
+  body_len = snprintf(body, body_size,
+                      "{\"sess_num\":%d,\"strm_num\":%lld,"
+                      "\"send_data_remain\":%lld,"
+                      "\"send_blocked_sess_num\":%d,\"emu_sess_num\":%d,"
+                      "\"timer_num\":%d,\"rss_kb\":%lld",
+                      stat.sess_num, stat.strm_num, stat.send_data_remain,
+                      stat.send_blocked_sess_num, stat.emu_sess_num,
+                      stat.timer_num, stat_rss_kb());
+  if (thread_num > 1) {  /* stats above are of the serving thread */
+    body_len += snprintf(body + body_len, body_size - body_len,
+                         ",\"thread\":%d,\"thread_num\":%d",
+                         thr->idx, thread_num);
+  }
+  if (h2_ctx_get_bal_stat(h2_sess_ctx(sess), &bst)) {
+    body_len += snprintf(body + body_len, body_size - body_len,
+                         ",\"busy_pct\":%d,\"sess_moved_out\":%lld,"
+                         "\"sess_moved_in\":%lld", bst.busy_pct,
+                         bst.move_out_cnt, bst.move_in_cnt);
+  }
+  if (h2_ctx_get_admit_stat(h2_sess_ctx(sess), ast)) {
+    body_len += snprintf(body + body_len, body_size - body_len,
+                         ",\"admission\":[");
+    for (c = 0; c < H2_PRIO_CLASS_NUM; c++) {
+      body_len += snprintf(body + body_len, body_size - body_len,
+                           "%s{\"admitted\":%lld,\"queued\":%lld,"
+                           "\"wait_max_usec\":%lld,\"shed\":%lld,"
+                           "\"dropped\":%lld}", (c > 0)? "," : "",
+                           ast[c].admit_cnt, ast[c].queue_cnt,
+                           ast[c].wait_usec_max, ast[c].shed_cnt,
+                           ast[c].drop_cnt);
+    }
+    body_len += snprintf(body + body_len, body_size - body_len, "]");
+  }
+  body_len += snprintf(body + body_len, body_size - body_len, ",\"cases\":[");
+  for (id = 0; id < CASE_STAT_NUM(app_ctx); id++) {
+    case_stat_sum(id, &cs);
+    body_len += snprintf(body + body_len, body_size - body_len,
+                         "%s{\"id\":%d,\"name\":\"%.200s\",\"reqs\":%lld,"
+                         "\"failed\":%lld,\"rx_bytes\":%lld,"
+                         "\"tx_bytes\":%lld,\"latency_usec\":{\"avg\":%lld,"
+                         "\"p50\":%lld,\"p99\":%lld,\"max\":%lld}}",
+                         (id > 0)? "," : "", id,
+                         case_stat_name(app_ctx, id, name, sizeof(name)),
+                         cs.req_num, cs.req_num - cs.done_num, cs.rx_bytes,
+                         cs.tx_bytes,
+                         (cs.lat.cnt > 0)? cs.lat.sum / cs.lat.cnt : 0,
+                         h2_hist_percentile(&cs.lat, 50.0),
+                         h2_hist_percentile(&cs.lat, 99.0), cs.lat.max);
+  }
+  body_len += snprintf(body + body_len, body_size - body_len, "]}\n");
 
-  http2_rsp_case push_prm[PUSH_PRM_MAX];
-  int push_prm_num;
-} app_context;
+  h2_msg *rsp = h2_msg_init();
+  h2_set_status(rsp, 200);
+  h2_add_hdr(rsp, "content-type", "application/json");
+  h2_set_body(rsp, body, body_len);
+  h2_prepare_rsp(rsp, req);
+  if (verbose) {
+    h2_dump_msg(stdout, rsp, "", "RESPONSE");
+  }
+  rs = h2_send_response(sess, strm, rsp);
+  h2_msg_free(rsp);
+  return (rs < 0)? -1 : 0;
+}
 
 
 /*
@@ -100,23 +1202,34 @@ typedef struct app_context {
 
 int request_cb(h2_sess *sess, h2_strm *strm,
                h2_msg *req, void *sess_user_data) {
-  /* TEST CASE FOR RST_STREAM */
-  /*
-  static int cnt = 0;
-  cnt++;
-  if (cnt % 100 == 0)
-    return -1;  // the caller should handle this as RST_STREAM case
-  */
-
   /* returns: 0(msg handled), >0(status code to be retured), 0<(error) */
-  app_context *app_ctx = sess_user_data;
+  sess_context *sc = sess_user_data;
+  app_context *app_ctx = sc->app_ctx;
 
   if (verbose) {
     h2_dump_msg(stdout, req, "", "REQUEST");
   }
 
+  if (is_stat_req(req)) {
+    return send_stat_rsp(sess, strm, req, app_ctx);
+  }
+  thr->req_num++;
+  thr->rx_bytes += h2_body_len(req);
+
+  if (capture) {
+    pthread_mutex_lock(&capture_lock);
+    h2_cap_write(capture, req);
+    pthread_mutex_unlock(&capture_lock);
+  }
+
+  if (fault_on && inject_sess_fault(sess, sc)) {
+    return 0;
+  }
+
   /* find rsp_case for the request */
   http2_rsp_case *rc = app_ctx->rsp_case;
+  h2_json_val json_val[H2_JSON_PTR_MAX];
+  int json_extracted = 0;
   int n = app_ctx->rsp_case_num;
   for ( ; n > 0; n--, rc++) {
     if ((rc->req_method == NULL ||
@@ -125,13 +1238,41 @@ int request_cb(h2_sess *sess, h2_strm *strm,
          !strcmp(h2_authority(req), rc->req_authority)) &&
         (rc->req_path_prefix == NULL ||
          !strncmp(h2_path(req), rc->req_path_prefix,
-                  rc->req_path_prefix_len))) {
+                  rc->req_path_prefix_len)) &&
+        (rc->req_pred_num == 0 || match_req_pred(rc, req))) {
+      if (rc->req_json_num > 0) {
+        int i;
+        if (!json_extracted) {
+          extract_req_json(app_ctx, req, json_val);
+          json_extracted = 1;
+        }
+        for (i = 0; i < rc->req_json_num; i++) {
+          h2_json_val *v = &json_val[rc->req_json[i].ptr_idx];
+          if ((rc->req_json[i].value == NULL)? v->type == H2_JSON_NONE :
+              !h2_json_val_eq(v, rc->req_json[i].value)) {
+            break;
+          }
+        }
+        if (i < rc->req_json_num) {
+          continue;  /* json condition not matched */
+        }
+      }
       break;  /* rc is matched */
     }
   }
   if (n <= 0) {
+    h2_strm_set_user_data(strm, CASE_ID_DATA(CASE_ID_404(app_ctx)));
     return 404;
   }
+  h2_strm_set_user_data(strm, CASE_ID_DATA(rc - app_ctx->rsp_case));
+
+  int fault = pick_rsp_fault(rc);
+  if (fault == FAULT_RST) {
+    return (h2_reset_stream(sess, strm, rc->fault_rst_code) < 0)? -1 : 0;
+  } else if (fault == FAULT_CLOSE) {
+    h2_sess_abort(sess);
+    return 0;
+  }
   
   /* set response body from rc->rsp */
   h2_msg *rsp = h2_msg_init();
@@ -149,13 +1290,29 @@ int request_cb(h2_sess *sess, h2_strm *strm,
     }
     sprintf(path, "%s%s", rc->rsp_base_dir, rel_path);
     /* TODO: need to check resulting path; might be security hole */
-    if (h2_body_from_file(path, (void **)&body, &body_len) < 0) {
-      h2_msg_free(rsp);
-      return 404;
+    pthread_mutex_lock(&file_cache_lock);
+    file_cache *fc = file_cache_get(path);
+    if (fc) {
+      h2_cpy_body(rsp, fc->body, fc->body_len);
+      set_rsp_body_coding(rsp, req, fc->body_len,
+                          fc->enc_body, fc->enc_body_len, fc->enc_mask);
     }
-    h2_set_body(rsp, body, body_len);
-  }
+    pthread_mutex_unlock(&file_cache_lock);
+    if (fc == NULL) {
+      if (h2_body_from_file(path, (void **)&body, &body_len) < 0) {
+        h2_msg_free(rsp);
+        h2_strm_set_user_data(strm, CASE_ID_DATA(CASE_ID_404(app_ctx)));
+        return 404;
+      }
+      h2_set_body(rsp, body, body_len);
+      thr->enc_rsp_num[H2_CODING_IDENTITY]++;
+    }
+  } else
 #endif
+  {
+    set_rsp_body_coding(rsp, req, h2_body_len(rc->rsp),
+                        rc->enc_body, rc->enc_body_len, rc->enc_mask);
+  }
 
   /* send optional push promise */
   http2_rsp_case *prm = &app_ctx->push_prm[rc->push_prm_idx];
@@ -168,6 +1325,8 @@ int request_cb(h2_sess *sess, h2_strm *strm,
     h2_msg *prm_rsp = h2_msg_init();
     h2_cpy_msg(prm_rsp, prm->rsp);
     h2_prepare_rsp(prm_rsp, req);
+    set_rsp_body_coding(prm_rsp, req, h2_body_len(prm->rsp),
+                        prm->enc_body, prm->enc_body_len, prm->enc_mask);
 
     h2_send_push_promise(sess, strm, prm_req, prm_rsp);
 
@@ -179,12 +1338,28 @@ int request_cb(h2_sess *sess, h2_strm *strm,
   if (verbose) {
     h2_dump_msg(stdout, rsp, "", "RESPONSE");
   }
-  int rs = h2_send_response(sess, strm, rsp);
+  int rs;
+  thr->tx_bytes += h2_body_len(rsp);
+  if (fault == FAULT_STALL) {
+    rs = h2_send_response_delayed(sess, strm, rsp,
+                                  rc->fault_stall_msec * 1000LL);
+  } else if (fault == FAULT_TRUNC) {
+    rs = h2_send_response_trunc(sess, strm, rsp,
+                                (rc->fault_trunc_len < 0)?
+                                h2_body_len(rsp) / 2 : rc->fault_trunc_len);
+  } else {
+    rs = h2_send_response(sess, strm, rsp);
+  }
   h2_msg_free(rsp);
 
   return (rs < 0)? -1 : 0;
 }
 
+void sess_free_cb(h2_sess *sess, void *sess_user_data) {
+  (void)sess;
+  free(sess_user_data);
+}
+
 int accept_cb(h2_svr *svr, void *server_user_data,
               const char *peer_ip, unsigned short peer_port,
               SSL_CTX **ssl_ctx_ret, h2_settings *settings_ret,
@@ -195,17 +1370,22 @@ int accept_cb(h2_svr *svr, void *server_user_data,
   (void)peer_port;
 
   /* set accepted session paramters */
+  sess_context *sc = calloc(1, sizeof(sess_context));
+  sc->app_ctx = server_user_data;
   *ssl_ctx_ret = NULL/* use svr_ssl_ctx */;
   *settings_ret = h2svr_settings;
   *request_cb_ret = request_cb;
-  *sess_free_cb_ret = NULL/* static user data */;
-  *sess_user_data_ret = server_user_data/* app_ctx * */; 
+  *sess_free_cb_ret = sess_free_cb;
+  *sess_user_data_ret = sc; 
   return 0;
 }
 
 void svr_free_cb(h2_svr *svr, void *svr_user_data) {
   (void)svr_user_data; 
   if (h2_svr_ssl_ctx(svr)) {
+#ifdef TLS_MODE
+    h2_ssl_ctx_print_stat(stderr, h2_svr_ssl_ctx(svr), h2_svr_authority(svr));
+#endif
     SSL_CTX_free(h2_svr_ssl_ctx(svr));
   }
 }
@@ -219,6 +1399,362 @@ int cli_cert_verify_pass_cb(int preverify_ok, X509_STORE_CTX *ctx) {
 #endif
 
 
+/*
+ * Hot Restart Listen Socket Handoff ----------------------------------------
+ * new process connects to the unix socket of the old one and receives
+ * listen socket fds with authorities by SCM_RIGHTS; on ready byte from
+ * the new process, the old one closes listeners and drains its sessions
+ */
+
+#define HANDOFF_FD_MAX     16      /* listen sockets to hand off */
+#define HANDOFF_MSG_MAX    4096    /* authority list message size */
+#define HANDOFF_POLL_USEC  100000  /* old process handoff socket check */
+#define HANDOFF_WAIT_SEC   5       /* new process wait for fds */
+#define HANDOFF_READY      'R'     /* new process ready to accept */
+
+char *handoff_path = NULL;              /* unix socket path; see -R option */
+long long drain_spread_usec = 2000000;  /* see -D option */
+int handoff_sock = -1;  /* listening unix socket; owner of handoff_path */
+int handoff_conn = -1;  /* connection between old and new processes */
+
+h2_svr *listen_svr[HANDOFF_FD_MAX];  /* listen sockets to hand off */
+int listen_svr_num = 0;
+
+struct {
+  char *authority;  /* points in inherit_msg */
+  int fd;           /* -1 if adopted or closed */
+} inherit[HANDOFF_FD_MAX];  /* listen sockets taken from the old process */
+int inherit_num = 0;
+char inherit_msg[HANDOFF_MSG_MAX + 1];
+
+static int handoff_addr(const char *path, struct sockaddr_un *sa) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(sa->sun_path)) {
+    fprintf(stderr, "handoff socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(sa->sun_path, path);
+  return 0;
+}
+
+/* new process: take listen sockets from the old one; 0 if no old one */
+static int handoff_take(const char *path) {
+  struct sockaddr_un sa;
+  if (handoff_addr(path, &sa) < 0) {
+    return -1;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    fprintf(stderr, "handoff socket() failed: %s\n", strerror(errno));
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    /* ENOENT or ECONNREFUSED for cold start; not an error */
+    close(sock);
+    return 0;
+  }
+  struct timeval tv = { HANDOFF_WAIT_SEC, 0 };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * HANDOFF_FD_MAX)];
+  } cbuf;
+  struct iovec iov = { inherit_msg, HANDOFF_MSG_MAX };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf.buf;
+  msg.msg_controllen = sizeof(cbuf.buf);
+  ssize_t n = recvmsg(sock, &msg, 0);
+  if (n <= 0) {
+    fprintf(stderr, "no listen sockets from old process at %s: %s\n",
+            path, (n < 0)? strerror(errno) : "closed");
+    close(sock);
+    return -1;
+  }
+  inherit_msg[n] = '\0';
+
+  int fd_num = 0;
+  int *fds = NULL;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS) {
+    fd_num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    fds = (int *)CMSG_DATA(cmsg);
+  }
+
+  /* message is authority lines in fd order */
+  char *p = inherit_msg, *e;
+  while (inherit_num < fd_num && (e = strchr(p, '\n'))) {
+    *e = '\0';
+    inherit[inherit_num].authority = p;
+    memcpy(&inherit[inherit_num].fd, &fds[inherit_num], sizeof(int));
+    inherit_num++;
+    p = e + 1;
+  }
+  while (inherit_num < fd_num) {  /* malformed message; should not happen */
+    int fd;
+    memcpy(&fd, &fds[inherit_num++], sizeof(int));
+    close(fd);
+  }
+
+  fprintf(stderr, "hot restart: %d listen sockets taken from %s\n",
+          inherit_num, path);
+  handoff_conn = sock;  /* to send ready after all set */
+  return inherit_num;
+}
+
+/* new process: listen on inherited socket of authority if any */
+static h2_svr *listen_inherited(h2_ctx *ctx, const char *authority,
+                                SSL_CTX *ssl_ctx, void *svr_user_data) {
+  int i;
+  for (i = 0; i < inherit_num; i++) {
+    if (inherit[i].fd >= 0 && !strcmp(inherit[i].authority, authority)) {
+      int fd = inherit[i].fd;
+      inherit[i].fd = -1;
+      return h2_listen_fd(ctx, authority, fd, ssl_ctx, accept_cb,
+                          svr_free_cb, svr_user_data);
+    }
+  }
+  return h2_listen(ctx, authority, ssl_ctx, accept_cb,
+                   svr_free_cb, svr_user_data);
+}
+
+/* old process: send listen socket fds and authorities */
+static int handoff_send(int conn) {
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * HANDOFF_FD_MAX)];
+  } cbuf;
+  char text[HANDOFF_MSG_MAX];
+  int i, len = 0;
+
+  memset(&cbuf, 0, sizeof(cbuf));
+  int *fds = (int *)CMSG_DATA(&cbuf.hdr);
+  for (i = 0; i < listen_svr_num; i++) {
+    int fd = h2_svr_fd(listen_svr[i]);
+    const char *authority = h2_svr_authority(listen_svr[i]);
+    int n = snprintf(text + len, sizeof(text) - len, "%s\n", authority);
+    if (n < 0 || n >= (int)sizeof(text) - len) {
+      fprintf(stderr, "handoff message overflow: %s\n", authority);
+      return -1;
+    }
+    memcpy(&fds[i], &fd, sizeof(int));
+    len += n;
+  }
+
+  struct iovec iov = { text, len };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf.buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * listen_svr_num);
+  cbuf.hdr.cmsg_level = SOL_SOCKET;
+  cbuf.hdr.cmsg_type = SCM_RIGHTS;
+  cbuf.hdr.cmsg_len = CMSG_LEN(sizeof(int) * listen_svr_num);
+  if (sendmsg(conn, &msg, 0) != len) {
+    fprintf(stderr, "handoff sendmsg() failed: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* old process: serve handoff request and wait for new process ready */
+static void handoff_timer_cb(h2_ctx *ctx, void *user_data) {
+  (void)user_data;
+
+  if (handoff_conn < 0) {
+    handoff_conn = accept(handoff_sock, NULL, NULL);
+    if (handoff_conn >= 0) {
+      if (handoff_send(handoff_conn) < 0) {
+        close(handoff_conn);
+        handoff_conn = -1;
+      } else {
+        fprintf(stderr, "hot restart: %d listen sockets handed off; "
+                "wait for new process ready\n", listen_svr_num);
+      }
+    }
+  } else {
+    char c = 0;
+    ssize_t n = recv(handoff_conn, &c, 1, MSG_DONTWAIT);
+    if (n == 1 && c == HANDOFF_READY) {
+      /* new process owns handoff_path and accepts on the listen sockets */
+      close(handoff_conn);
+      close(handoff_sock);
+      handoff_conn = -1;
+      handoff_sock = -1;
+      fprintf(stderr, "hot restart: new process ready; drain sessions\n");
+      h2_ctx_drain(ctx, drain_spread_usec);
+      int i;
+      for (i = 1; i < thread_num; i++) {
+        __atomic_store_n(&thr_ctx[i].drain_req, 1, __ATOMIC_RELEASE);
+      }
+      return;  /* no more handoff */
+    }
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      fprintf(stderr, "hot restart: new process failed; keep serving\n");
+      close(handoff_conn);
+      handoff_conn = -1;
+    }
+  }
+
+  h2_timer_add(ctx, HANDOFF_POLL_USEC, handoff_timer_cb, NULL);
+}
+
+/* new or cold started process: ready old process and own handoff_path */
+static int handoff_start(h2_ctx *ctx, const char *path) {
+  int i;
+  for (i = 0; i < inherit_num; i++) {
+    if (inherit[i].fd >= 0) {
+      fprintf(stderr, "hot restart: close listen socket not in -S: %s\n",
+              inherit[i].authority);
+      close(inherit[i].fd);
+      inherit[i].fd = -1;
+    }
+  }
+
+  if (handoff_conn >= 0) {
+    char c = HANDOFF_READY;
+    if (send(handoff_conn, &c, 1, 0) != 1) {
+      fprintf(stderr, "hot restart: cannot notify old process: %s\n",
+              strerror(errno));
+    }
+    close(handoff_conn);
+    handoff_conn = -1;
+  }
+
+  /* NOTE: old process keeps its unix socket open till ready received */
+  struct sockaddr_un sa;
+  if (handoff_addr(path, &sa) < 0) {
+    return -1;
+  }
+  unlink(path);
+  handoff_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (handoff_sock < 0 ||
+      bind(handoff_sock, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      listen(handoff_sock, 1) < 0) {
+    fprintf(stderr, "cannot listen on handoff socket %s: %s\n",
+            path, strerror(errno));
+    return -1;
+  }
+  fcntl(handoff_sock, F_SETFL, fcntl(handoff_sock, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(handoff_sock, F_SETFD, FD_CLOEXEC);
+
+  h2_timer_add(ctx, HANDOFF_POLL_USEC, handoff_timer_cb, NULL);
+  return 0;
+}
+
+/* thread other than 0: drain on the request by handoff_timer_cb() */
+static void handoff_drain_timer_cb(h2_ctx *ctx, void *user_data) {
+  (void)user_data;
+  if (__atomic_load_n(&thr->drain_req, __ATOMIC_ACQUIRE)) {
+    h2_ctx_drain(ctx, drain_spread_usec);
+    return;
+  }
+  h2_timer_add(ctx, HANDOFF_POLL_USEC, handoff_drain_timer_cb, NULL);
+}
+
+static void handoff_free(const char *path) {
+  if (handoff_conn >= 0) {
+    close(handoff_conn);
+    handoff_conn = -1;
+  }
+  if (handoff_sock >= 0) {
+    close(handoff_sock);
+    handoff_sock = -1;
+    unlink(path);  /* still owner; not handed off */
+  }
+}
+
+
+/*
+ * Service Thread Run -------------------------------------------------------
+ */
+
+#ifdef TLS_MODE
+static SSL_CTX *svr_ssl_ctx_init(const char *key_file, const char *cert_file,
+                                 const char *ssl_verify_str) {
+  SSL_CTX *ssl_ctx = h2_ssl_ctx_init(1/*server*/, (char *)key_file,
+                                     (char *)cert_file);
+  if (ssl_ctx == NULL) {
+    fprintf(stderr, "cannot initialize ssl_ctx: key_file=%s cert_file=%s\n",
+            key_file, cert_file);
+    return NULL;
+  }
+  if (h2_ssl_ctx_set_verify_from_str(ssl_ctx, 1,
+                                     (char *)ssl_verify_str) < 0) {
+    fprintf(stderr, "cannot set client certificate verify option: %s\n",
+            ssl_verify_str);
+    SSL_CTX_free(ssl_ctx);
+    return NULL;
+  }
+  return ssl_ctx;
+}
+#endif
+
+/* other than thread 0; listen on the sockets of thread 0 */
+static int thread_init(thread_context *t, int http_ver, int verbose_h2,
+                       void *svr_user_data) {
+  SSL_CTX *ssl_ctx;
+  int i, fd;
+
+  t->ctx = h2_ctx_init(http_ver, verbose_h2);
+  h2_ctx_set_strm_done_cb(t->ctx, case_stat_done_cb);
+  for (i = 0; i < listen_spec_num; i++) {
+    ssl_ctx = NULL;  /* own SSL_CTX; its stat and cache are not locked */
+#ifdef TLS_MODE
+    if (listen_spec[i].key_file &&
+        !(ssl_ctx = svr_ssl_ctx_init(listen_spec[i].key_file,
+                                     listen_spec[i].cert_file,
+                                     listen_spec[i].ssl_verify_str))) {
+      return -1;
+    }
+#endif
+    if ((fd = dup(h2_svr_fd(listen_spec[i].svr))) < 0 ||
+        !h2_listen_fd(t->ctx, listen_spec[i].authority, fd, ssl_ctx,
+                      accept_cb, svr_free_cb, svr_user_data)) {
+      fprintf(stderr, "thread %d listen failed: %s\n", t->idx,
+              listen_spec[i].authority);
+      return -1;
+    }
+  }
+  if (admit_rate > 0) {
+    apply_admission(t->ctx);
+  }
+  if (handoff_path) {
+    h2_timer_add(t->ctx, HANDOFF_POLL_USEC, handoff_drain_timer_cb, NULL);
+  }
+  return 0;
+}
+
+static void *thread_main(void *arg) {
+  thr = arg;
+  h2_ctx_run(thr->ctx);
+  return NULL;
+}
+
+static void print_thread_stat(void) {
+  h2_bal_stat bst;
+  int i;
+  if (thread_num <= 1) {
+    return;
+  }
+  for (i = 0; i < thread_num; i++) {
+    if (h2_ctx_get_bal_stat(thr_ctx[i].ctx, &bst)) {
+      fprintf(stderr, "THREAD[%d]: %lld reqs; last busy %d%%; "
+              "sessions moved out=%lld in=%lld\n", i, thr_ctx[i].req_num,
+              bst.busy_pct, bst.move_out_cnt, bst.move_in_cnt);
+    } else {
+      fprintf(stderr, "THREAD[%d]: %lld reqs\n", i, thr_ctx[i].req_num);
+    }
+  }
+}
+
+
 /*
  * Application main and runtime argument parsers ----------------------------
  */
@@ -239,15 +1775,53 @@ static void help(char *prog) {
   fprintf(stderr, "     # <settings_id> := header_table_size | enable_push |\n");
   fprintf(stderr, "     #   max_concurrent_streams, initial_window_size | max_frame_size\n");
   fprintf(stderr, "     #   max_header_list_size, enable_connect_protocol\n");
+  fprintf(stderr, "     #   conn_window_size: connection receive window\n");
+  fprintf(stderr, "     # data_sched=rr|fifo|srpt: response DATA scheduling\n");
+  fprintf(stderr, "     #   rr:interleaved(default), fifo:earliest first,\n");
+  fprintf(stderr, "     #   srpt:shortest remaining body first\n");
+  fprintf(stderr, "     # prio_sched=off|strict|wrr: fifo|srpt picks and rr weights\n");
+  fprintf(stderr, "     #   by 3gpp-sbi-message-priority class of the request\n");
+  fprintf(stderr, "     # abuse rate limits per sec; 0 for off (default):\n");
+  fprintf(stderr, "     #   rst_stream_rate, ping_rate, settings_rate,\n");
+  fprintf(stderr, "     #   empty_frame_rate; e.g. 1000, 100, 100, 1000\n");
+  fprintf(stderr, "     # network emulation on sent bytes; 0 for off:\n");
+  fprintf(stderr, "     #   emu_delay(msec), emu_jitter(msec), emu_rate(kbit/s),\n");
+  fprintf(stderr, "     #   emu_loss(per mille), emu_read_stall(msec after each read),\n");
+  fprintf(stderr, "     #   emu_read_rate(kbit/s), emu_sess_pct(percent of sessions)\n");
   fprintf(stderr, "  -1                         # use HTTP/1.1 instead of HTTP/2\n");
   fprintf(stderr, "  -Q                         # h2sim io quiet mode\n");
   fprintf(stderr, "  -q                         # all quiet mode\n");
+  fprintf(stderr, "  -G folded_file             # cpu profile as folded stacks at exit\n");
+  fprintf(stderr, "  -z                         # gzip/deflate rsp bodies by accept-encoding\n");
+  fprintf(stderr, "  -R handoff_unix_socket     # hot restart; should precede -S\n");
+  fprintf(stderr, "     # take listen sockets from the old process on the socket\n");
+  fprintf(stderr, "     # if any, then serve the socket for the next restart\n");
+  fprintf(stderr, "  -D drain_spread_sec        # drain GOAWAY spread on restart; default:2\n");
+  fprintf(stderr, "  -E goaway=N|close=N        # session fault at N-th stream of each session\n");
+  fprintf(stderr, "     # goaway: graceful GOAWAY, close: abrupt close by tcp RST\n");
+  fprintf(stderr, "  -C [hash:]capture_file     # record requests for h2cli -L replay\n");
+  fprintf(stderr, "     # hash: body length and hash only instead of whole body\n");
+  fprintf(stderr, "  -T stat_path               # run time stats as json on the path\n");
+  fprintf(stderr, "  -A rate[:queue_max]        # admission capacity of rate reqs/sec; over it,\n");
+  fprintf(stderr, "     # reqs wait by 3gpp-sbi-message-priority class up to queue_max\n");
+  fprintf(stderr, "     # (default: rate/10) and the lowest priority are shed by 503 first\n");
+  fprintf(stderr, "  -I report_interval_sec     # per response case stats every interval\n");
+  fprintf(stderr, "     # reqs, failed, body bytes and latency; 404 and admission included\n");
+  fprintf(stderr, "  -N thread_num              # service threads on the listen sockets;\n");
+  fprintf(stderr, "     # default:1, max:%d\n", THREAD_MAX);
+  fprintf(stderr, "  -B imbalance_pct[:interval_msec] # move a session from the busiest\n");
+  fprintf(stderr, "     # thread on cpu busy gap over imbalance_pct for 3 intervals;\n");
+  fprintf(stderr, "     # default:20:1000, 0 for off\n");
   fprintf(stderr, "rsp_case_options:\n");
   fprintf(stderr, "  # -m starts each case\n");
-  fprintf(stderr, "  # -a and -p are optional matching condition\n");
+  fprintf(stderr, "  # -a, -p, -w and -j are optional matching condition\n");
   fprintf(stderr, "  -m req_method              # GET|POST|PUT|PATCH|DELETE\n");
   fprintf(stderr, "  -a req_authority\n");
   fprintf(stderr, "  -p req_path_prefix\n");
+  fprintf(stderr, "  -w [!]name[=value|~regex] # req predicate; exists if no value\n");
+  fprintf(stderr, "     # name := header_name | ?query_name | :path | :authority | :method\n");
+  fprintf(stderr, "     # :path is without query; ! for negation; regex is unanchored\n");
+  fprintf(stderr, "  -j /json_pointer[=value] # req json body field; exists if no value\n");
   fprintf(stderr, "  # -o starts push promose req and response on the case\n");
   fprintf(stderr, "  -o push_prmise_req_path    # assume GET method\n");
   fprintf(stderr, "  -s rsp_status              # default:200\n");
@@ -255,7 +1829,16 @@ static void help(char *prog) {
   fprintf(stderr, "  -t rsp_body_text\n");
   fprintf(stderr, "  -b rsp_body_hex_binary\n");
   fprintf(stderr, "  -f rsp_body_file\n");
-  fprintf(stderr, "  -e rsp_body_size           # dummy zero value body of given size\n");
+  fprintf(stderr, "  -e rsp_body_size           # dummy zero value body of given size;\n");
+  fprintf(stderr, "     # k, m or g suffix for 1024 based units\n");
+  fprintf(stderr, "  -y content_type[:content_id]=file|0xhex\n");
+  fprintf(stderr, "                             # multipart/related rsp body part\n");
+  fprintf(stderr, "  -F fault=percent[:arg]     # response fault rate of the case\n");
+  fprintf(stderr, "     # rst[:error_code]: RST_STREAM; default:INTERNAL_ERROR\n");
+  fprintf(stderr, "     # close: abrupt close of the session\n");
+  fprintf(stderr, "     # stall[:msec]: response delayed; default:1000\n");
+  fprintf(stderr, "     # trunc[:bytes]: body cut then reset; default:half\n");
+  fprintf(stderr, "     # HTTP/1.1 session is aborted for rst and trunc\n");
 #ifdef GET_FILE
   fprintf(stderr, "  -d rsp_file_base_directory # req path is / mapped to this directory\n");
 #endif
@@ -266,11 +1849,14 @@ static void help(char *prog) {
 #endif
 }
 
-h2_ctx *ctx = NULL;
+h2_ctx *ctx = NULL;  /* of thread 0; main thread */
 
 void sighdlr_mark_stop(int signo) {
+  int i;
   (void)signo;
-  h2_ctx_stop(ctx); 
+  for (i = 0; i < thread_num; i++) {
+    h2_ctx_stop(thr_ctx[i].ctx);
+  }
 }
 
 int main(int argc, char **argv) {
@@ -290,6 +1876,7 @@ int main(int argc, char **argv) {
   void *body;
   int body_len;
   int http_ver = H2_HTTP_V2;
+  char *prof_file = NULL;
 
   h2_settings_init(&h2svr_settings);
 
@@ -306,11 +1893,13 @@ int main(int argc, char **argv) {
 #endif
 
   ctx = h2_ctx_init(http_ver, verbose_h2); 
+  thr_ctx[0].ctx = ctx;
 
-  int c;
+  int c, n;
   int listen_num = 0;
   char scale;
-  while ((c = getopt(argc, argv, "k:c:V:S:H:1Qqm:a:p:o:s:x:t:b:f:e:d:h")) >=  0) {
+  long long body_size;
+  while ((c = getopt(argc, argv, "k:c:V:S:H:1QqG:zR:D:E:C:T:A:I:N:B:m:a:p:w:j:o:s:x:t:b:f:e:y:F:d:h")) >=  0) {
     switch (c) {
 #ifdef TLS_MODE
     case 'k':
@@ -327,14 +1916,8 @@ int main(int argc, char **argv) {
 #ifdef TLS_MODE
       if (!strncasecmp(optarg, "https://", 8)) {
         authority = optarg + 8;
-        if (!(ssl_ctx = h2_ssl_ctx_init(1/*server*/, key_file, cert_file))) {
-          fprintf(stderr, "cannot initialize ssl_ctx: "
-                  "key_file=%s cert_file=%s\n", key_file, cert_file);
-          return EXIT_FAILURE;
-        }
-        if (h2_ssl_ctx_set_verify_from_str(ssl_ctx, 1, ssl_verify_str) < 0) {
-          fprintf(stderr, "cannot set client certificate verify option: %s\n",
-                  ssl_verify_str);
+        if (!(ssl_ctx = svr_ssl_ctx_init(key_file, cert_file,
+                                         ssl_verify_str))) {
           return EXIT_FAILURE;
         }
       } else
@@ -346,11 +1929,31 @@ int main(int argc, char **argv) {
         fprintf(stderr, "unknown server binding format: %s\n", optarg);
         return EXIT_FAILURE;
       }
-      if (!h2_listen(ctx, authority, ssl_ctx, accept_cb,
-                     svr_free_cb, &app_ctx)) {
+      if (handoff_path && listen_svr_num >= HANDOFF_FD_MAX) {
+        fprintf(stderr, "too many listen sockets for hot restart: max=%d\n",
+                HANDOFF_FD_MAX);
+        return EXIT_FAILURE;
+      }
+      h2_svr *svr = listen_inherited(ctx, authority, ssl_ctx, &app_ctx);
+      if (!svr) {
         fprintf(stderr, "server binding failed; quit: %s\n", authority);
         return EXIT_FAILURE;
       }
+      if (handoff_path) {
+        listen_svr[listen_svr_num++] = svr;
+      }
+      if (listen_spec_num < LISTEN_MAX) {  /* overflow checked after -N */
+        listen_spec[listen_spec_num].authority = authority;
+        listen_spec[listen_spec_num].svr = svr;
+#ifdef TLS_MODE
+        if (ssl_ctx) {
+          listen_spec[listen_spec_num].key_file = key_file;
+          listen_spec[listen_spec_num].cert_file = cert_file;
+          listen_spec[listen_spec_num].ssl_verify_str = ssl_verify_str;
+        }
+#endif
+        listen_spec_num++;
+      }
       listen_num++;
       break;
     case 'H':
@@ -373,6 +1976,73 @@ int main(int argc, char **argv) {
       verbose_h2 = 0;
       h2_ctx_set_verbose(ctx, verbose_h2);
       break;
+    case 'G':
+      prof_file = optarg;
+      break;
+    case 'z':
+      rsp_encode = 1;
+      break;
+    case 'R':
+      if (listen_num > 0) {
+        fprintf(stderr, "-R option should precede -S options\n");
+        return EXIT_FAILURE;
+      }
+      handoff_path = optarg;
+      if (handoff_take(handoff_path) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'D':
+      drain_spread_usec = (long long)(atof(optarg) * 1000000);
+      if (drain_spread_usec < 0) {
+        fprintf(stderr, "invalid -D drain_spread_sec: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'E':
+      if (add_sess_fault(optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'C':
+      if (capture_open(optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'T':
+      stat_path = optarg;
+      stat_path_len = strlen(optarg);
+      break;
+    case 'A':
+      if (set_admission(optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'I':
+      report_interval_sec = atoi(optarg);
+      if (report_interval_sec <= 0) {
+        fprintf(stderr, "invalid -I report_interval_sec: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'N':
+      thread_num = atoi(optarg);
+      if (thread_num < 1 || thread_num > THREAD_MAX) {
+        fprintf(stderr, "invalid -N thread_num: %s; max=%d\n", optarg,
+                THREAD_MAX);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'B':
+      bal_interval_msec = 0;
+      if (sscanf(optarg, "%d:%d", &bal_imbalance_pct,
+                 &bal_interval_msec) < 1 ||
+          bal_imbalance_pct < 0 || bal_interval_msec < 0) {
+        fprintf(stderr, "invalid -B imbalance_pct[:interval_msec]: %s\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      break;
 
     /* reponse case request matching parameters */
     case 'm':  /* http request method to match; ALSO start of reponse case */
@@ -400,6 +2070,25 @@ int main(int argc, char **argv) {
       rc->req_path_prefix = optarg;
       rc->req_path_prefix_len = strlen(optarg);
       break;
+    case 'w':  /* http request predicate to match */
+      if (rc_is_push_prm) {
+        fprintf(stderr, "predicate is not for push promise: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      if (add_req_pred(rc, optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'j':  /* http request json body field to match */
+      if (rc_is_push_prm) {
+        fprintf(stderr, "json condition is not for push promise: %s\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      if (add_req_json_cond(&app_ctx, rc, optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
     case 'o':
       if (app_ctx.push_prm_num >= PUSH_PRM_MAX) {
         fprintf(stderr, "too many push promise cases: %d\n",
@@ -449,14 +2138,44 @@ int main(int argc, char **argv) {
       h2_set_body(rc->rsp, body, body_len);
       break;
     case 'e':
-      if (sscanf(optarg, "%d%c", &body_len, &scale) == 2 &&
-          (scale == 'k' || scale == 'K')) {
-        body_len *= 1024;
-      } else if (sscanf(optarg, "%d%c", &body_len, &scale) != 1) {
-        fprintf(stderr, "invalid -e req_body_size option value: %s\n", optarg);
+      n = sscanf(optarg, "%lld%c", &body_size, &scale);
+      if (n == 2 && strchr("kKmMgG", scale) && scale) {
+        body_size <<= (tolower(scale) == 'g')? 30 :
+                      (tolower(scale) == 'm')? 20 : 10;
+      } else if (n != 1) {
+        fprintf(stderr, "invalid -e rsp_body_size option value: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      if (body_size < 0 || body_size >= INT_MAX) {
+        fprintf(stderr, "-e rsp_body_size should be less than 2g: %s\n",
+                optarg);
+        return EXIT_FAILURE;
+      }
+      body_len = (int)body_size;
+      free(rc->bulk_body);
+      rc->bulk_body = NULL;
+      if (body_len >= BULK_BODY_MIN) {
+        struct iovec iov;
+        rc->bulk_body = iov.iov_base = calloc(1, body_len);
+        iov.iov_len = body_len;
+        h2_set_body_iov(rc->rsp, &iov, 1);
+      } else {
+        h2_set_body(rc->rsp, calloc(1, body_len + 1), body_len);
+      }
+      break;
+    case 'y':  /* http response multipart body part */
+      if (add_rsp_mpart(rc, optarg) < 0) {
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'F':  /* http response fault injection rate */
+      if (rc_is_push_prm) {
+        fprintf(stderr, "fault is not for push promise: %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+      if (add_rsp_fault(rc, optarg) < 0) {
         return EXIT_FAILURE;
       }
-      h2_set_body(rc->rsp, calloc(1, body_len + 1), body_len);
       break;
 #ifdef GET_FILE
     case 'd':  /* http response file base directory */
@@ -484,6 +2203,12 @@ int main(int argc, char **argv) {
       help(argv[0]);
       return EXIT_FAILURE;
   }
+  if (thread_num > 1 && listen_spec_num < listen_num) {
+    /* threads 1.. would listen only on the -S options in listen_spec */
+    fprintf(stderr, "too many listen sockets for -N threads: max=%d\n",
+            LISTEN_MAX);
+    return EXIT_FAILURE;
+  }
 
   /* default rsp_case */
   if (app_ctx.rsp_case_num == 0) {
@@ -496,20 +2221,134 @@ int main(int argc, char **argv) {
     app_ctx.rsp_case_num = 1;
   }
 
+  /* build multipart and precompress response bodies */
+  int i;
+  for (i = 0; i < app_ctx.rsp_case_num; i++) {
+    if (build_rsp_mpart(&app_ctx.rsp_case[i]) < 0) {
+      return EXIT_FAILURE;
+    }
+    encode_rsp_case(&app_ctx.rsp_case[i]);
+  }
+  for (i = 0; i < app_ctx.push_prm_num; i++) {
+    if (build_rsp_mpart(&app_ctx.push_prm[i]) < 0) {
+      return EXIT_FAILURE;
+    }
+    encode_rsp_case(&app_ctx.push_prm[i]);
+  }
+
+  uint32_t seed = (uint32_t)(h2_time_usec() ^ getpid());
+  for (i = 0; i < thread_num; i++) {
+    thr_ctx[i].idx = i;
+    thr_ctx[i].fault_seed = (seed + i * 0x9e3779b9u) | 1;
+    thr_ctx[i].case_stat = calloc(CASE_STAT_NUM(&app_ctx), sizeof(case_stat));
+  }
+  h2_ctx_set_strm_done_cb(ctx, case_stat_done_cb);
+  if (admit_rate > 0) {
+    apply_admission(ctx);
+  }
+  for (i = 1; i < thread_num; i++) {
+    if (thread_init(&thr_ctx[i], http_ver, verbose_h2, &app_ctx) < 0) {
+      return EXIT_FAILURE;
+    }
+  }
+  if (thread_num > 1 && bal_imbalance_pct > 0) {
+    h2_ctx *ctx_arr[THREAD_MAX];
+    for (i = 0; i < thread_num; i++) {
+      ctx_arr[i] = thr_ctx[i].ctx;
+    }
+    if (h2_ctx_set_balance(ctx_arr, thread_num, bal_imbalance_pct,
+                           bal_interval_msec) < 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
   signal(SIGPIPE, SIG_IGN);
   signal(SIGINT, sighdlr_mark_stop);
 
-  h2_ctx_run(ctx);
+  if (prof_file && h2_prof_start(0) < 0) {
+    return EXIT_FAILURE;
+  }
 
-  h2_ctx_free(ctx);
+  if (handoff_path && handoff_start(ctx, handoff_path) < 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (capture) {
+    h2_timer_add(ctx, CAPTURE_FLUSH_USEC, capture_timer_cb, NULL);
+  }
+
+  if (report_interval_sec > 0) {
+    case_stat_last = calloc(CASE_STAT_NUM(&app_ctx), sizeof(case_stat));
+    h2_timer_add(ctx, report_interval_sec * 1000000LL, case_stat_timer_cb,
+                 &app_ctx);
+  }
+
+  int thr_started;
+  for (thr_started = 1; thr_started < thread_num; thr_started++) {
+    thread_context *t = &thr_ctx[thr_started];
+    int r = pthread_create(&t->pthread, NULL, thread_main, t);
+    if (r != 0) {
+      fprintf(stderr, "cannot create service thread: %s\n", strerror(r));
+      sighdlr_mark_stop(0);
+      break;
+    }
+  }
+  if (thr_started == thread_num) {
+    h2_ctx_run(ctx);
+  }
+  for (i = 1; i < thr_started; i++) {
+    pthread_join(thr_ctx[i].pthread, NULL);
+  }
+
+  print_thread_stat();
+  for (i = 0; i < thread_num; i++) {
+    add_admit_stat(thr_ctx[i].ctx);
+  }
+  for (i = thread_num - 1; i >= 0; i--) {
+    h2_ctx_free(thr_ctx[i].ctx);
+  }
+
+  if (capture) {
+    h2_cap_close(capture, stderr);
+  }
+
+  if (handoff_path) {
+    handoff_free(handoff_path);
+  }
+
+  if (prof_file) {
+    h2_prof_stop(prof_file, stderr);
+  }
+
+  print_case_stat(&app_ctx);
+  print_enc_stat();
+  print_fault_stat();
+  print_admit_stat();
+  print_resource_stat();
 
-  int i;
   for (i = 0; i <= app_ctx.rsp_case_num && i < RSP_CASE_MAX; i++) {
     h2_msg_free(app_ctx.rsp_case[i].rsp);
+    free_rsp_case_enc(&app_ctx.rsp_case[i]);
+    free_rsp_mpart(&app_ctx.rsp_case[i]);
+    free_req_pred(&app_ctx.rsp_case[i]);
+    free(app_ctx.rsp_case[i].bulk_body);
   }
   for (i = 0; i <= app_ctx.push_prm_num && i < PUSH_PRM_MAX; i++) {
     h2_msg_free(app_ctx.push_prm[i].rsp);
+    free_rsp_case_enc(&app_ctx.push_prm[i]);
+    free_rsp_mpart(&app_ctx.push_prm[i]);
+    free(app_ctx.push_prm[i].bulk_body);
   } 
+#ifdef GET_FILE
+  file_cache_free();
+#endif
+  for (i = 0; i < thread_num; i++) {
+    free(thr_ctx[i].case_stat);
+  }
+  free(case_stat_last);
+  for (i = 0; i < app_ctx.json_ptr_num; i++) {
+    h2_json_ptr_free(app_ctx.json_ptr[i]);
+  }
 
 #ifdef TLS_MODE
   ERR_free_strings();